@@ -66,13 +66,27 @@ namespace Fluggo.CodeGeneration.IL {
 		///   and disable source code generation.</param>
 		/// <returns>An <see cref="AssemblyGeneratorContext"/> for the new assembly.</returns>
 		public static AssemblyGeneratorContext CreateAssembly( string name, string filename, bool debugMode ) {
+			return CreateAssembly( name, null, filename, debugMode );
+		}
+
+		/// <summary>
+		/// Creates a new dynamic assembly that can be saved to the given directory.
+		/// </summary>
+		/// <param name="name">Name of the new assembly.</param>
+		/// <param name="directory">Optional directory in which the assembly will be saved. If this is <see langword='null'/>,
+		///   the assembly is saved to the current directory.</param>
+		/// <param name="filename">Optional filename for the new assembly. This filename is used if you call the <see cref="Save"/> method.</param>
+		/// <param name="debugMode">Specify true to disable optimizations and emit source code for the new assembly, or false to enable optimizations
+		///   and disable source code generation.</param>
+		/// <returns>An <see cref="AssemblyGeneratorContext"/> for the new assembly.</returns>
+		public static AssemblyGeneratorContext CreateAssembly( string name, string directory, string filename, bool debugMode ) {
 			AssemblyName aname = new AssemblyName();
 			aname.Name = name;
 
 			PermissionSet deniedPerms = new PermissionSet( null );
 			deniedPerms.AddPermission( new SecurityPermission( SecurityPermissionFlag.SkipVerification ) );
 
-            AssemblyBuilder assembly = AppDomain.CurrentDomain.DefineDynamicAssembly( aname, AssemblyBuilderAccess.RunAndSave, (string) null,
+            AssemblyBuilder assembly = AppDomain.CurrentDomain.DefineDynamicAssembly( aname, AssemblyBuilderAccess.RunAndSave, directory,
 				new PermissionSet( null ), new PermissionSet( null ), deniedPerms );
 				
 			if( debugMode ) {
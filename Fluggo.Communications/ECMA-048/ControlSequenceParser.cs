@@ -26,18 +26,24 @@ namespace Fluggo.Communications.Terminals {
 	/// <summary>
 	/// Interprets control codes in a stream of bytes.
 	/// </summary>
+	/// <remarks>Text is found a block at a time: a lookup table maps each byte to its character, or to a stop value for C0,
+	///     C1 and ESC, so a run of text is scanned and translated in one pass and delivered in a single
+	///     <see cref="ITerminalControlWriter.WriteText(char[],int,int)"/> call. Inside an escape or control sequence, each
+	///     byte is classified once and the next step is read from a transition table.</remarks>
 	public class ControlSequenceParseStream : Stream
 	{
+		const char __stop = '\uFFFF';
+		const int __maxTextBufferLength = 65536;
+
 		bool _7bit = true;
 		State _currentState = State.Text;
 		int _param1, _param2;
 		byte _intermediate;
 		ITerminalControlWriter _control;
-		Queue<char> _escapeSequenceLog;
+		StringBuilder _escapeSequenceLog;
 		bool _debug = true;
 		byte[] _dumbByteBuffer = new byte[1];
-		char[] _dumbCharBuffer = new char[1];
-//		Decoder _decoder;
+		char[] _textMap, _textBuffer = new char[256];
 
 		/// <summary>
 		/// Creates a new instance of the <see cref='ControlSequenceParseStream'/> class.
@@ -53,255 +59,260 @@ namespace Fluggo.Communications.Terminals {
 			_control = stream;
 			_7bit = is7bit;
 			_debug = debug;
-//			_decoder = _7bit ? Encoding.UTF8.GetDecoder() : Encoding.ASCII.GetDecoder();
+			_textMap = is7bit ? __textMap7 : __textMap8;
+
+			if( debug )
+				_escapeSequenceLog = new StringBuilder();
 		}
 
 		enum State
 		{
 			Text,
-			Escape,
 			EscapeStart,
 			Parameter1,
 			Parameter2,
 			Intermediate,
 		}
 
-		bool IsIntermediateCode( byte data ) {
-			return (data & 0xF0) == 0x20;
+		/// <summary>
+		/// Class of a byte inside an escape or control sequence.
+		/// </summary>
+		enum ByteClass : byte
+		{
+			C0,					// 00-1F
+			Intermediate,		// 20-2F
+			Digit,				// 30-39
+			Separator,			// 3A
+			StringSeparator,	// 3B
+			ParameterOther,		// 3C-3F
+			Bracket,			// 5B, CSI after ESC, otherwise a final
+			UpperFinal,			// 40-5F, C1 after ESC
+			LowerFinal,			// 60-7F, independent control function after ESC
+			High,				// 80-FF in 7-bit mode, 80-9F in 8-bit mode
+
+			Count
 		}
 
-		bool IsC0Code( byte data ) {
-			return (data & 0xE0) == 0x00;
+		/// <summary>
+		/// Step to take for a byte inside a sequence.
+		/// </summary>
+		enum Action : byte
+		{
+			/// <summary>Send the sequence so far as text and drop the byte.</summary>
+			Abort,
+			/// <summary>Send the sequence so far as text and handle the byte as if no sequence had started.</summary>
+			AbortReprocess,
+			/// <summary>ESC was not the start of a sequence; send a caret and handle the byte as text.</summary>
+			Caret,
+			BeginControlSequence,
+			C1Code,
+			IndependentControlFunction,
+			Parameter1Digit,
+			Parameter2Digit,
+			StartParameter2,
+			Intermediate,
+			Final
 		}
 
-		bool IsC1Code( byte data ) {
-			if( _7bit )
-				return (data & 0xE0) == 0x40;
-			else
-				return (data & 0xE0) == 0x80;
-		}
+		static readonly char[] __textMap7 = new char[256], __textMap8 = new char[256];
+		static readonly ByteClass[] __byteClass = new ByteClass[256];
+		static readonly Action[] __transitions = new Action[(int) State.Intermediate * (int) ByteClass.Count + (int) ByteClass.Count];
+
+		static ControlSequenceParseStream() {
+			for( int i = 0; i < 256; i++ ) {
+				// Text: C0 stops a run in both modes, C1 only in 8-bit mode. ASCII decoding turns high bytes into '?'
+				// in 7-bit mode, and 8-bit mode folds A0-FF down onto 20-7F.
+				if( i < 0x20 ) {
+					__textMap7[i] = __stop;
+					__textMap8[i] = __stop;
+				}
+				else if( i < 0x80 ) {
+					__textMap7[i] = (char) i;
+					__textMap8[i] = (char) i;
+				}
+				else {
+					__textMap7[i] = '?';
+					__textMap8[i] = (i < 0xA0) ? __stop : (char)(i - 0x80);
+				}
 
-		bool IsIndependentControlFunction( byte data ) {
-			return (data & 0xE0) == 0x60;
-		}
+				// Sequences
+				if( i < 0x20 )
+					__byteClass[i] = ByteClass.C0;
+				else if( i < 0x30 )
+					__byteClass[i] = ByteClass.Intermediate;
+				else if( i < 0x3A )
+					__byteClass[i] = ByteClass.Digit;
+				else if( i == 0x3A )
+					__byteClass[i] = ByteClass.Separator;
+				else if( i == 0x3B )
+					__byteClass[i] = ByteClass.StringSeparator;
+				else if( i < 0x40 )
+					__byteClass[i] = ByteClass.ParameterOther;
+				else if( i == 0x5B )
+					__byteClass[i] = ByteClass.Bracket;
+				else if( i < 0x60 )
+					__byteClass[i] = ByteClass.UpperFinal;
+				else if( i < 0x80 )
+					__byteClass[i] = ByteClass.LowerFinal;
+				else
+					__byteClass[i] = ByteClass.High;
+			}
 
-		bool IsFinalCode( byte data ) {
-			return (data & 0xC0) == 0x40;
-		}
+			for( ByteClass c = ByteClass.C0; c < ByteClass.Count; c++ ) {
+				// After ESC
+				Action action;
 
-		bool IsParameterCode( byte data ) {
-			return ((data & 0xF8) == 0x30) || ((data & 0xFC) == 0x38);
-		}
+				switch( c ) {
+					case ByteClass.Bracket:
+						action = Action.BeginControlSequence;
+						break;
 
-		bool IsParameterStringSeparator( byte data ) {
-			return data == 0x3B;
-		}
+					case ByteClass.UpperFinal:
+						action = Action.C1Code;
+						break;
+
+					case ByteClass.LowerFinal:
+						action = Action.IndependentControlFunction;
+						break;
+
+					default:
+						action = Action.Caret;
+						break;
+				}
+
+				SetTransition( State.EscapeStart, c, action );
+
+				// Inside a control sequence
+				switch( c ) {
+					case ByteClass.C0:
+					case ByteClass.High:
+						// Don't swallow line breaks and the like with a broken sequence
+						action = Action.AbortReprocess;
+						break;
+
+					case ByteClass.Intermediate:
+						action = Action.Intermediate;
+						break;
 
-		bool IsParameterSeparator( byte data ) {
-			return data == 0x3A;
+					case ByteClass.Bracket:
+					case ByteClass.UpperFinal:
+					case ByteClass.LowerFinal:
+						action = Action.Final;
+						break;
+
+					default:
+						action = Action.Abort;
+						break;
+				}
+
+				SetTransition( State.Parameter1, c, action );
+				SetTransition( State.Parameter2, c, action );
+
+				// We support only one intermediate, so the next byte had better be a final
+				SetTransition( State.Intermediate, c, (action == Action.Intermediate) ? Action.Abort : action );
+			}
+
+			SetTransition( State.Parameter1, ByteClass.Digit, Action.Parameter1Digit );
+			SetTransition( State.Parameter1, ByteClass.StringSeparator, Action.StartParameter2 );
+			SetTransition( State.Parameter2, ByteClass.Digit, Action.Parameter2Digit );
 		}
 
-		bool IsParameterData( byte data ) {
-			return IsParameterCode( data ) && (data < 0x3A);
+		static void SetTransition( State state, ByteClass byteClass, Action action ) {
+			__transitions[(int) state * (int) ByteClass.Count + (int) byteClass] = action;
 		}
 
 		public override void Write( byte[] data, int offset, int length ) {
 			new ArraySegment<byte>( data, offset, length );
 
-			for( int i = offset; i < (offset + length); i++ )
-				WriteByte( data[i] );
-		}
+			int i = offset, end = offset + length;
 
-		void ProcessFinalCode( byte data ) {
-			if( _intermediate == 0x00 ) {
-				// Process without an intermediate
-				_control.WriteControlSequence( _param1, _param2, (ControlFinalCode) data );
-			}
-			else if( _intermediate == 0x20 ) {
-				// Single 0x20 intermediate
-				_control.WriteControlSequence( _param1, _param2, (ControlExtendedFinalCode) data );
-			}
-			else if( _escapeSequenceLog != null ) {
-				// Send the control sequence as text for debug purposes
-				while( _escapeSequenceLog.Count != 0 )
-					_control.WriteText( _escapeSequenceLog.Dequeue() );
-			}
+			while( i < end ) {
+				if( _currentState == State.Text ) {
+					i = WriteTextRun( data, i, end );
 
-			_currentState = State.Text;
-			_escapeSequenceLog = null;
-		}
+					if( i == end )
+						return;
 
-		public override void WriteByte( byte data ) {
-			if( !_7bit && (data >= 0xA0) ) {
-				// Translate down so that we can understand
-				data -= 0x80;
-			}
-			
-			for( ; ; ) {
-				if( _escapeSequenceLog != null ) {
-					_dumbByteBuffer[0] = data;
-					_escapeSequenceLog.Enqueue( Encoding.ASCII.GetChars( _dumbByteBuffer, 0, 1 )[0] );
+					// Only C0, C1 and ESC stop a run
+					byte code = data[i++];
+
+					if( code == (byte) C0.Escape )
+						_currentState = State.EscapeStart;
+					else if( code == (byte) C1.ControlSequenceIntroducer )
+						BeginControlSequence();
+					else if( code < 0x20 )
+						_control.WriteControlCode( (C0) code );
+					else
+						_control.WriteControlCode( (C1) code );
+
+					continue;
+				}
+
+				byte b = data[i];
+
+				if( !_7bit && (b >= 0xA0) ) {
+					// Translate down so that we can understand
+					b -= 0x80;
 				}
 
-				switch( _currentState ) {
-					case State.Text:
-						if( !_7bit && IsC1Code( data ) ) {
-							if( data == (byte) C1.ControlSequenceIntroducer ) {
-								_currentState = State.Escape;
-								return;
-							}
-							else {
-								_control.WriteControlCode( (C1) data );
-								return;
-							}
-						}
-						if( IsC0Code( data ) ) {
-							if( data == (byte) C0.Escape ) {
-								_currentState = State.EscapeStart;
-								return;
-							}
-							else {
-								_control.WriteControlCode( (C0) data );
-								return;
-							}
-						}
-						else {
-							_dumbByteBuffer[0] = data;
-							//_decoder.GetChars( _dumbByteBuffer, 0, 1, _dumbCharBuffer, 0, false );
-							
-							_control.WriteText( Encoding.ASCII.GetChars( _dumbByteBuffer, 0, 1 ), 0, 1 );
-							return;
-						}
-
-					case State.Escape:
-						_intermediate = 0x00;
-						_param1 = -1;
-						_param2 = -1;
-
-						if( _debug ) {
-							_escapeSequenceLog = new Queue<char>();
-							_escapeSequenceLog.Enqueue( '^' );
-						}
-
-						if( IsParameterCode( data ) ) {
-							_currentState = State.Parameter1;
-							// Repeat processing
-						}
-						else if( IsIntermediateCode( data ) ) {
-							_intermediate = data;
-							_currentState = State.Intermediate;
-							return;
-						}
-						else if( IsFinalCode( data ) ) {
-							_currentState = State.Text;
-							ProcessFinalCode( data );
-							return;
-						}
+				Action action = __transitions[(int) _currentState * (int) ByteClass.Count + (int) __byteClass[b]];
 
+				if( action == Action.AbortReprocess || action == Action.Caret ) {
+					if( action == Action.Caret )
+						_control.WriteText( '^' );
+					else
+						AbortSequence();
+
+					// Handle the byte again as text
+					_currentState = State.Text;
+					continue;
+				}
+
+				i++;
+
+				if( _currentState != State.EscapeStart && _debug )
+					_escapeSequenceLog.Append( (b < 0x80) ? (char) b : '?' );
+
+				switch( action ) {
+					case Action.Abort:
+						AbortSequence();
 						break;
 
-					case State.EscapeStart:
-						if( data == 0x5B ) {
-							_currentState = State.Escape;
-							return;
-						}
-						if( _7bit && IsC1Code( data ) ) {
-							// Translate up to 8-bit depth
-							_currentState = State.Text;
-							_control.WriteControlCode( (C1) ((data & 0x1F) | 0x80) );
-							return;
-						}
-						if( IsIndependentControlFunction( data ) ) {
-							_currentState = State.Text;
-							_control.WriteIndependentControlFunction( (IndependentControlFunction) data );
-							return;
-						}
-						else {
-							_currentState = State.Text;
-							_control.WriteText( '^' );
-							// Repeat processing
-						}
+					case Action.BeginControlSequence:
+						BeginControlSequence();
+						break;
 
+					case Action.C1Code:
+						// Translate up to 8-bit depth
+						_currentState = State.Text;
+						_control.WriteControlCode( (C1) ((b & 0x1F) | 0x80) );
 						break;
 
-					case State.Parameter1:
-						if( !IsParameterCode( data ) ) {
-							if( IsIntermediateCode( data ) ) {
-								_intermediate = data;
-								_currentState = State.Intermediate;
-								return;
-							}
-							else if( IsFinalCode( data ) ) {
-								_currentState = State.Text;
-								ProcessFinalCode( data );
-								return;
-							}
-						}
-						else if( IsParameterStringSeparator( data ) ) {
-							_currentState = State.Parameter2;
-							return;
-						}
-						else if( !IsParameterData( data ) ) {
-							// Don't exactly know what to do with this yet...
-							while( _escapeSequenceLog.Count != 0 )
-								_control.WriteText( _escapeSequenceLog.Dequeue() );
-
-							_escapeSequenceLog = null;
-							_currentState = State.Text;
-							return;
-						}
-
-						if( _param1 == -1 )
-							_param1 = 0;
-
-						_param1 *= 10;
-						_param1 |= (0x0F & data);
-						return;
+					case Action.IndependentControlFunction:
+						_currentState = State.Text;
+						_control.WriteIndependentControlFunction( (IndependentControlFunction) b );
+						break;
 
-					case State.Parameter2:
-						if( !IsParameterCode( data ) ) {
-							if( IsIntermediateCode( data ) ) {
-								_intermediate = data;
-								_currentState = State.Intermediate;
-								return;
-							}
-							else if( IsFinalCode( data ) ) {
-								_currentState = State.Text;
-								ProcessFinalCode( data );
-								return;
-							}
-						}
-						else if( IsParameterStringSeparator( data ) || IsParameterSeparator( data ) ) {
-							// Don't exactly know what to do with this yet...
-							while( _escapeSequenceLog.Count != 0 )
-								_control.WriteText( _escapeSequenceLog.Dequeue() );
-
-							_escapeSequenceLog = null;
-							_currentState = State.Text;
-							return;
-						}
-
-						if( _param2 == -1 )
-							_param2 = 0;
-
-						_param2 *= 10;
-						_param2 |= (0x0F & data);
-						return;
+					case Action.Parameter1Digit:
+						_param1 = AddDigit( _param1, b );
+						break;
+
+					case Action.Parameter2Digit:
+						_param2 = AddDigit( _param2, b );
+						break;
 
-					case State.Intermediate:
-						// At this point, we have support for only one intermediate, so the next one had better be a final
-						if( !IsFinalCode( data ) ) {
-							// Don't exactly know what to do with this yet...
-							while( _escapeSequenceLog.Count != 0 )
-								_control.WriteText( _escapeSequenceLog.Dequeue() );
+					case Action.StartParameter2:
+						_currentState = State.Parameter2;
+						break;
 
-							_escapeSequenceLog = null;
-							_currentState = State.Text;
-							return;
-						}
+					case Action.Intermediate:
+						_intermediate = b;
+						_currentState = State.Intermediate;
+						break;
 
-						ProcessFinalCode( data );
-						return;
+					case Action.Final:
+						ProcessFinalCode( b );
+						break;
 
 					default:
 						throw new UnexpectedException();
@@ -309,6 +320,92 @@ namespace Fluggo.Communications.Terminals {
 			}
 		}
 
+		/// <summary>
+		/// Sends the text starting at the given position to the terminal.
+		/// </summary>
+		/// <returns>The position of the first byte that isn't text, or <paramref name="end"/> if the rest of the block is text.</returns>
+		int WriteTextRun( byte[] data, int start, int end ) {
+			char[] map = _textMap;
+			int i = start;
+
+			// Find the end of the run first so that it can be delivered in one call
+			while( i < end && map[data[i]] != __stop )
+				i++;
+
+			int length = i - start;
+
+			if( length == 0 )
+				return i;
+
+			if( length > _textBuffer.Length && _textBuffer.Length < __maxTextBufferLength )
+				_textBuffer = new char[Math.Min( Math.Max( length, _textBuffer.Length * 2 ), __maxTextBufferLength )];
+
+			char[] buffer = _textBuffer;
+
+			for( int runStart = start; runStart < i; runStart += buffer.Length ) {
+				int count = Math.Min( buffer.Length, i - runStart );
+
+				for( int j = 0; j < count; j++ )
+					buffer[j] = map[data[runStart + j]];
+
+				_control.WriteText( buffer, 0, count );
+			}
+
+			return i;
+		}
+
+		static int AddDigit( int param, byte data ) {
+			if( param == -1 )
+				param = 0;
+
+			// Saturate rather than wrap on absurdly long parameters
+			if( param > (int.MaxValue - 9) / 10 )
+				return int.MaxValue;
+
+			return param * 10 + (0x0F & data);
+		}
+
+		void BeginControlSequence() {
+			_intermediate = 0x00;
+			_param1 = -1;
+			_param2 = -1;
+			_currentState = State.Parameter1;
+
+			if( _debug ) {
+				_escapeSequenceLog.Length = 0;
+				_escapeSequenceLog.Append( "^[" );
+			}
+		}
+
+		void AbortSequence() {
+			// Send the control sequence as text for debug purposes
+			if( _debug && _currentState != State.EscapeStart )
+				_control.WriteText( _escapeSequenceLog.ToString() );
+
+			_currentState = State.Text;
+		}
+
+		void ProcessFinalCode( byte data ) {
+			if( _intermediate == 0x00 ) {
+				// Process without an intermediate
+				_control.WriteControlSequence( _param1, _param2, (ControlFinalCode) data );
+			}
+			else if( _intermediate == 0x20 ) {
+				// Single 0x20 intermediate
+				_control.WriteControlSequence( _param1, _param2, (ControlExtendedFinalCode) data );
+			}
+			else if( _debug ) {
+				_control.WriteText( _escapeSequenceLog.ToString() );
+			}
+
+			_currentState = State.Text;
+		}
+
+		public override void WriteByte( byte data ) {
+			_dumbByteBuffer[0] = data;
+			Write( _dumbByteBuffer, 0, 1 );
+		}
+
 		#region Stream support
 		public override bool CanRead {
 			get { return false; }
@@ -322,7 +419,12 @@ namespace Fluggo.Communications.Terminals {
 			get { return true; }
 		}
 
+		/// <summary>
+		/// Flushes the <see cref="ITerminalControlWriter"/> the interpreted sequences go to.
+		/// </summary>
+		/// <remarks>A sequence that hasn't been completed yet stays in the parser.</remarks>
 		public override void Flush() {
+			_control.Flush();
 		}
 
 		public override long Length {
@@ -0,0 +1,819 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Collections.Generic;
+
+namespace Fluggo.Communications.Terminals {
+	/// <summary>
+	/// Describes one of the eight standard terminal colors.
+	/// </summary>
+	/// <remarks>The values match the last digit of the <see cref="SetGraphicRenditionParam"/> that selects the color.</remarks>
+	public enum TerminalColor : byte {
+		Black = 0,
+		Red = 1,
+		Green = 2,
+		Yellow = 3,
+		Blue = 4,
+		Magenta = 5,
+		Cyan = 6,
+		White = 7,
+
+		/// <summary>
+		/// The terminal's default color for the foreground or background.
+		/// </summary>
+		Default = 9
+	}
+
+	/// <summary>
+	/// Describes the graphic rendition of a cell on a <see cref="TerminalScreen"/>, apart from its colors.
+	/// </summary>
+	[Flags]
+	public enum TerminalCellAttributes : byte {
+		None = 0,
+		Bold = 0x01,
+		Faint = 0x02,
+		Italic = 0x04,
+		Underline = 0x08,
+		Blink = 0x10,
+		NegativeImage = 0x20,
+		Concealed = 0x40,
+		StrikeOut = 0x80
+	}
+
+	/// <summary>
+	/// Describes a rectangle of cells on a <see cref="TerminalScreen"/>.
+	/// </summary>
+	public struct TerminalRegion {
+		int _column, _row, _width, _height;
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='TerminalRegion'/> structure.
+		/// </summary>
+		/// <param name="column">Zero-based column of the left edge of the region.</param>
+		/// <param name="row">Zero-based row of the top edge of the region.</param>
+		/// <param name="width">Number of columns in the region.</param>
+		/// <param name="height">Number of rows in the region.</param>
+		public TerminalRegion( int column, int row, int width, int height ) {
+			_column = column;
+			_row = row;
+			_width = width;
+			_height = height;
+		}
+
+		/// <summary>
+		/// Gets the column of the left edge of the region.
+		/// </summary>
+		/// <value>The zero-based column of the left edge of the region.</value>
+		public int Column {
+			get { return _column; }
+		}
+
+		/// <summary>
+		/// Gets the row of the top edge of the region.
+		/// </summary>
+		/// <value>The zero-based row of the top edge of the region.</value>
+		public int Row {
+			get { return _row; }
+		}
+
+		/// <summary>
+		/// Gets the width of the region.
+		/// </summary>
+		/// <value>The number of columns in the region.</value>
+		public int Width {
+			get { return _width; }
+		}
+
+		/// <summary>
+		/// Gets the height of the region.
+		/// </summary>
+		/// <value>The number of rows in the region.</value>
+		public int Height {
+			get { return _height; }
+		}
+
+		public override string ToString() {
+			return string.Format( "({0},{1}) {2}x{3}", _column, _row, _width, _height );
+		}
+	}
+
+	/// <summary>
+	/// Keeps the contents of a character-cell terminal screen up to date from a stream of control functions.
+	/// </summary>
+	/// <remarks>Connect a <see cref="ControlSequenceParseStream"/> to the screen and write the terminal's output to it. The
+	///     screen handles text, cursor movement, erasing, inserting and deleting, scrolling within a scroll region, and the
+	///     color and attribute parts of <see cref="ControlFinalCode.SetGraphicRendition"/>. Anything else is ignored.
+	///   <para>Cells are stored as separate arrays of characters, colors and attributes, one element per cell in row-major
+	///     order, which keeps the grid compact and makes scrolling a handful of block copies.</para>
+	///   <para>Every change marks the cells it touches as damaged. A viewer can call <see cref="GetDamage"/> to learn which
+	///     rectangles changed since the last <see cref="ClearDamage"/>, and send only those cells instead of replaying the
+	///     whole byte stream.</para>
+	///   <para>Scroll regions are set with DECSTBM (CSI <i>top</i> ; <i>bottom</i> r), which ECMA-48 leaves to private use but
+	///     which every common terminal understands.</para></remarks>
+	public class TerminalScreen : ITerminalControlWriter {
+		const ControlFinalCode __setTopAndBottomMargins = (ControlFinalCode) 0x72;
+		const int __tabWidth = 8;
+
+		int _columns, _rows;
+		char[] _chars;
+		byte[] _foreground, _background, _attributes;
+		int[] _dirtyLeft, _dirtyRight;
+		bool _damaged;
+
+		int _cursorColumn, _cursorRow, _scrollTop, _scrollBottom;
+		bool _wrapPending;
+		TerminalColor _currentForeground, _currentBackground;
+		TerminalCellAttributes _currentAttributes;
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='TerminalScreen'/> class.
+		/// </summary>
+		/// <param name="columns">Number of columns on the screen.</param>
+		/// <param name="rows">Number of rows on the screen.</param>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="columns"/> or <paramref name="rows"/> is less than one.</exception>
+		public TerminalScreen( int columns, int rows ) {
+			if( columns < 1 )
+				throw new ArgumentOutOfRangeException( "columns" );
+
+			if( rows < 1 )
+				throw new ArgumentOutOfRangeException( "rows" );
+
+			_columns = columns;
+			_rows = rows;
+
+			int cellCount = checked(columns * rows);
+			_chars = new char[cellCount];
+			_foreground = new byte[cellCount];
+			_background = new byte[cellCount];
+			_attributes = new byte[cellCount];
+			_dirtyLeft = new int[rows];
+			_dirtyRight = new int[rows];
+
+			ClearDamage();
+			Reset();
+		}
+
+	#region Public members
+		/// <summary>
+		/// Gets the width of the screen.
+		/// </summary>
+		/// <value>The number of columns on the screen.</value>
+		public int Columns {
+			get { return _columns; }
+		}
+
+		/// <summary>
+		/// Gets the height of the screen.
+		/// </summary>
+		/// <value>The number of rows on the screen.</value>
+		public int Rows {
+			get { return _rows; }
+		}
+
+		/// <summary>
+		/// Gets the column of the cursor.
+		/// </summary>
+		/// <value>The zero-based column of the active position.</value>
+		public int CursorColumn {
+			get { return _cursorColumn; }
+		}
+
+		/// <summary>
+		/// Gets the row of the cursor.
+		/// </summary>
+		/// <value>The zero-based row of the active position.</value>
+		public int CursorRow {
+			get { return _cursorRow; }
+		}
+
+		/// <summary>
+		/// Gets the character in a cell.
+		/// </summary>
+		/// <param name="column">Zero-based column of the cell.</param>
+		/// <param name="row">Zero-based row of the cell.</param>
+		/// <returns>The character in the cell. Erased cells contain a space.</returns>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="column"/> or <paramref name="row"/> is outside the screen.</exception>
+		public char GetCharacter( int column, int row ) {
+			return _chars[GetIndex( column, row )];
+		}
+
+		/// <summary>
+		/// Gets the foreground color of a cell.
+		/// </summary>
+		/// <param name="column">Zero-based column of the cell.</param>
+		/// <param name="row">Zero-based row of the cell.</param>
+		/// <returns>The foreground color of the cell.</returns>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="column"/> or <paramref name="row"/> is outside the screen.</exception>
+		public TerminalColor GetForeground( int column, int row ) {
+			return (TerminalColor) _foreground[GetIndex( column, row )];
+		}
+
+		/// <summary>
+		/// Gets the background color of a cell.
+		/// </summary>
+		/// <param name="column">Zero-based column of the cell.</param>
+		/// <param name="row">Zero-based row of the cell.</param>
+		/// <returns>The background color of the cell.</returns>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="column"/> or <paramref name="row"/> is outside the screen.</exception>
+		public TerminalColor GetBackground( int column, int row ) {
+			return (TerminalColor) _background[GetIndex( column, row )];
+		}
+
+		/// <summary>
+		/// Gets the attributes of a cell.
+		/// </summary>
+		/// <param name="column">Zero-based column of the cell.</param>
+		/// <param name="row">Zero-based row of the cell.</param>
+		/// <returns>The attributes of the cell.</returns>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="column"/> or <paramref name="row"/> is outside the screen.</exception>
+		public TerminalCellAttributes GetAttributes( int column, int row ) {
+			return (TerminalCellAttributes) _attributes[GetIndex( column, row )];
+		}
+
+		/// <summary>
+		/// Gets a value that represents whether any part of the screen has changed since the last <see cref="ClearDamage"/>.
+		/// </summary>
+		/// <value>True if any cell has changed, false otherwise.</value>
+		public bool HasDamage {
+			get { return _damaged; }
+		}
+
+		/// <summary>
+		/// Gets the parts of the screen that have changed since the last <see cref="ClearDamage"/>.
+		/// </summary>
+		/// <returns>An array of rectangles, from top to bottom, that together cover every changed cell. The array is empty
+		///   if nothing has changed.</returns>
+		/// <remarks>Damage is kept as a span of columns for each row. Neighboring rows with the same span are reported as one
+		///   rectangle, so a scroll or a full redraw comes back as a single region.</remarks>
+		public TerminalRegion[] GetDamage() {
+			List<TerminalRegion> regions = new List<TerminalRegion>();
+			int start = -1;
+
+			for( int row = 0; row <= _rows; row++ ) {
+				if( start != -1 ) {
+					if( row < _rows && _dirtyLeft[row] == _dirtyLeft[start] && _dirtyRight[row] == _dirtyRight[start] )
+						continue;
+
+					regions.Add( new TerminalRegion( _dirtyLeft[start], start, _dirtyRight[start] - _dirtyLeft[start], row - start ) );
+					start = -1;
+				}
+
+				if( row < _rows && _dirtyRight[row] > _dirtyLeft[row] )
+					start = row;
+			}
+
+			return regions.ToArray();
+		}
+
+		/// <summary>
+		/// Marks the whole screen as unchanged.
+		/// </summary>
+		/// <remarks>Call this once the changes returned by <see cref="GetDamage"/> have been sent.</remarks>
+		public void ClearDamage() {
+			for( int row = 0; row < _rows; row++ ) {
+				_dirtyLeft[row] = int.MaxValue;
+				_dirtyRight[row] = 0;
+			}
+
+			_damaged = false;
+		}
+
+		/// <summary>
+		/// Returns the screen to its initial state.
+		/// </summary>
+		/// <remarks>The screen is erased, the cursor moves to the top-left corner, the scroll region covers the whole
+		///   screen and the default rendition is selected. The whole screen is marked as damaged.</remarks>
+		public void Reset() {
+			_cursorColumn = 0;
+			_cursorRow = 0;
+			_wrapPending = false;
+			_scrollTop = 0;
+			_scrollBottom = _rows - 1;
+			_currentForeground = TerminalColor.Default;
+			_currentBackground = TerminalColor.Default;
+			_currentAttributes = TerminalCellAttributes.None;
+
+			for( int row = 0; row < _rows; row++ )
+				EraseCells( row, 0, _columns );
+		}
+	#endregion
+
+	#region Text
+		public void WriteText( char data ) {
+			PutChar( data );
+		}
+
+		public void WriteText( string data ) {
+			if( data == null )
+				throw new ArgumentNullException( "data" );
+
+			for( int i = 0; i < data.Length; i++ )
+				PutChar( data[i] );
+		}
+
+		public void WriteText( char[] data, int offset, int count ) {
+			new ArraySegment<char>( data, offset, count );
+
+			for( int i = offset; i < offset + count; i++ )
+				PutChar( data[i] );
+		}
+
+		private void PutChar( char data ) {
+			if( _wrapPending ) {
+				// The last character filled the line; this one starts the next
+				_wrapPending = false;
+				_cursorColumn = 0;
+				LineFeed();
+			}
+
+			int index = _cursorRow * _columns + _cursorColumn;
+			_chars[index] = data;
+			_foreground[index] = (byte) _currentForeground;
+			_background[index] = (byte) _currentBackground;
+			_attributes[index] = (byte) _currentAttributes;
+			MarkDirty( _cursorRow, _cursorColumn, _cursorColumn + 1 );
+
+			if( _cursorColumn == _columns - 1 )
+				_wrapPending = true;
+			else
+				_cursorColumn++;
+		}
+	#endregion
+
+	#region Control functions
+		public void WriteControlCode( C0 code ) {
+			switch( code ) {
+				case C0.Backspace:
+					MoveCursorTo( _cursorColumn - 1, _cursorRow );
+					break;
+
+				case C0.CharacterTab:
+					MoveCursorTo( Math.Min( (_cursorColumn / __tabWidth + 1) * __tabWidth, _columns - 1 ), _cursorRow );
+					break;
+
+				case C0.LineFeed:
+				case C0.LineTab:
+				case C0.FormFeed:
+					_wrapPending = false;
+					LineFeed();
+					break;
+
+				case C0.CarriageReturn:
+					MoveCursorTo( 0, _cursorRow );
+					break;
+			}
+		}
+
+		public void WriteControlCode( C1 code ) {
+			switch( code ) {
+				case C1.NextLine:
+					_wrapPending = false;
+					_cursorColumn = 0;
+					LineFeed();
+					break;
+
+				case C1.ReverseLineFeed:
+					_wrapPending = false;
+					ReverseLineFeed();
+					break;
+			}
+		}
+
+		public void WriteControlSequence( int p1, int p2, ControlFinalCode final ) {
+			switch( final ) {
+				case ControlFinalCode.CursorUp:
+					MoveCursorVertically( -Count( p1 ) );
+					break;
+
+				case ControlFinalCode.CursorDown:
+				case ControlFinalCode.LinePositionForward:
+					MoveCursorVertically( Count( p1 ) );
+					break;
+
+				case ControlFinalCode.CursorRight:
+				case ControlFinalCode.CharacterPositionForward:
+					MoveCursorTo( _cursorColumn + Count( p1 ), _cursorRow );
+					break;
+
+				case ControlFinalCode.CursorLeft:
+				case ControlFinalCode.CharacterPositionBackward:
+					MoveCursorTo( _cursorColumn - Count( p1 ), _cursorRow );
+					break;
+
+				case ControlFinalCode.CursorNextLine:
+					MoveCursorVertically( Count( p1 ) );
+					MoveCursorTo( 0, _cursorRow );
+					break;
+
+				case ControlFinalCode.CurporPreviousLine:
+					MoveCursorVertically( -Count( p1 ) );
+					MoveCursorTo( 0, _cursorRow );
+					break;
+
+				case ControlFinalCode.CursorCharAbsolute:
+				case ControlFinalCode.CharacterPositionAbsolute:
+					MoveCursorTo( Count( p1 ) - 1, _cursorRow );
+					break;
+
+				case ControlFinalCode.LinePositionAbsolute:
+					MoveCursorTo( _cursorColumn, Count( p1 ) - 1 );
+					break;
+
+				case ControlFinalCode.CursorPosition:
+				case ControlFinalCode.CharacterAndLinePosition:
+					MoveCursorTo( Count( p2 ) - 1, Count( p1 ) - 1 );
+					break;
+
+				case ControlFinalCode.CursorForwardTab:
+					for( int i = Math.Min( Count( p1 ), _columns ); i != 0; i-- )
+						WriteControlCode( C0.CharacterTab );
+					break;
+
+				case ControlFinalCode.ErasePage:
+					ErasePage( p1 );
+					break;
+
+				case ControlFinalCode.EraseLine:
+					EraseLine( p1 );
+					break;
+
+				case ControlFinalCode.EraseCharacter:
+					EraseCells( _cursorRow, _cursorColumn, (int) Math.Min( (long) _cursorColumn + Count( p1 ), _columns ) );
+					break;
+
+				case ControlFinalCode.InsertCharacter:
+					InsertCharacters( Count( p1 ) );
+					break;
+
+				case ControlFinalCode.DeleteCharacter:
+					DeleteCharacters( Count( p1 ) );
+					break;
+
+				case ControlFinalCode.InsertLine:
+					if( _cursorRow >= _scrollTop && _cursorRow <= _scrollBottom ) {
+						ScrollDown( _cursorRow, _scrollBottom, Count( p1 ) );
+						MoveCursorTo( 0, _cursorRow );
+					}
+					break;
+
+				case ControlFinalCode.DeleteLine:
+					if( _cursorRow >= _scrollTop && _cursorRow <= _scrollBottom ) {
+						ScrollUp( _cursorRow, _scrollBottom, Count( p1 ) );
+						MoveCursorTo( 0, _cursorRow );
+					}
+					break;
+
+				case ControlFinalCode.ScrollUp:
+					ScrollUp( _scrollTop, _scrollBottom, Count( p1 ) );
+					break;
+
+				case ControlFinalCode.ScrollDown:
+					ScrollDown( _scrollTop, _scrollBottom, Count( p1 ) );
+					break;
+
+				case ControlFinalCode.SetGraphicRendition:
+					if( p1 < 0 && p2 < 0 )
+						p1 = (int) SetGraphicRenditionParam.Default;
+
+					if( p1 >= 0 )
+						SetGraphicRendition( p1 );
+
+					if( p2 >= 0 )
+						SetGraphicRendition( p2 );
+					break;
+
+				case __setTopAndBottomMargins:
+					SetScrollRegion( p1, p2 );
+					break;
+			}
+		}
+
+		public void WriteControlSequence( int p1, int p2, ControlExtendedFinalCode final ) {
+		}
+
+		public void WriteIndependentControlFunction( IndependentControlFunction function ) {
+			if( function == IndependentControlFunction.Ris )
+				Reset();
+		}
+
+		/// <summary>
+		/// Does nothing; changes take effect on the screen as they are written.
+		/// </summary>
+		public void Flush() {
+		}
+	#endregion
+
+	#region Cursor movement
+		/// <summary>
+		/// Gets the repeat count from a parameter, where a missing or zero parameter means one.
+		/// </summary>
+		private static int Count( int param ) {
+			return (param < 1) ? 1 : param;
+		}
+
+		private void MoveCursorTo( int column, int row ) {
+			_wrapPending = false;
+			_cursorColumn = Math.Max( 0, Math.Min( column, _columns - 1 ) );
+			_cursorRow = Math.Max( 0, Math.Min( row, _rows - 1 ) );
+		}
+
+		/// <summary>
+		/// Moves the cursor up or down without scrolling, stopping at the edge of the scroll region if it starts inside it.
+		/// </summary>
+		private void MoveCursorVertically( int count ) {
+			int top = 0, bottom = _rows - 1;
+
+			if( _cursorRow >= _scrollTop && _cursorRow <= _scrollBottom ) {
+				top = _scrollTop;
+				bottom = _scrollBottom;
+			}
+
+			long row = (long) _cursorRow + count;
+			MoveCursorTo( _cursorColumn, (int) Math.Max( top, Math.Min( row, bottom ) ) );
+		}
+
+		private void LineFeed() {
+			if( _cursorRow == _scrollBottom )
+				ScrollUp( _scrollTop, _scrollBottom, 1 );
+			else if( _cursorRow < _rows - 1 )
+				_cursorRow++;
+		}
+
+		private void ReverseLineFeed() {
+			if( _cursorRow == _scrollTop )
+				ScrollDown( _scrollTop, _scrollBottom, 1 );
+			else if( _cursorRow > 0 )
+				_cursorRow--;
+		}
+
+		private void SetScrollRegion( int top, int bottom ) {
+			top = Count( top ) - 1;
+			bottom = (bottom < 1) ? _rows - 1 : Math.Min( bottom - 1, _rows - 1 );
+
+			if( top >= bottom )
+				return;
+
+			_scrollTop = top;
+			_scrollBottom = bottom;
+			MoveCursorTo( 0, 0 );
+		}
+	#endregion
+
+	#region Editing
+		private void ErasePage( int mode ) {
+			switch( mode ) {
+				case -1:
+				case 0:
+					// Active position to the end of the screen
+					EraseCells( _cursorRow, _cursorColumn, _columns );
+
+					for( int row = _cursorRow + 1; row < _rows; row++ )
+						EraseCells( row, 0, _columns );
+					break;
+
+				case 1:
+					// Start of the screen to the active position
+					for( int row = 0; row < _cursorRow; row++ )
+						EraseCells( row, 0, _columns );
+
+					EraseCells( _cursorRow, 0, _cursorColumn + 1 );
+					break;
+
+				case 2:
+					for( int row = 0; row < _rows; row++ )
+						EraseCells( row, 0, _columns );
+					break;
+			}
+		}
+
+		private void EraseLine( int mode ) {
+			switch( mode ) {
+				case -1:
+				case 0:
+					EraseCells( _cursorRow, _cursorColumn, _columns );
+					break;
+
+				case 1:
+					EraseCells( _cursorRow, 0, _cursorColumn + 1 );
+					break;
+
+				case 2:
+					EraseCells( _cursorRow, 0, _columns );
+					break;
+			}
+		}
+
+		private void InsertCharacters( int count ) {
+			_wrapPending = false;
+			count = Math.Min( count, _columns - _cursorColumn );
+
+			int start = _cursorRow * _columns + _cursorColumn;
+			CopyCells( start, start + count, _columns - _cursorColumn - count );
+			EraseCells( _cursorRow, _cursorColumn, _cursorColumn + count );
+			MarkDirty( _cursorRow, _cursorColumn, _columns );
+		}
+
+		private void DeleteCharacters( int count ) {
+			_wrapPending = false;
+			count = Math.Min( count, _columns - _cursorColumn );
+
+			int start = _cursorRow * _columns + _cursorColumn;
+			CopyCells( start + count, start, _columns - _cursorColumn - count );
+			EraseCells( _cursorRow, _columns - count, _columns );
+			MarkDirty( _cursorRow, _cursorColumn, _columns );
+		}
+
+		/// <summary>
+		/// Moves the rows from <paramref name="top"/> to <paramref name="bottom"/> up, erasing the rows that open up at the bottom.
+		/// </summary>
+		private void ScrollUp( int top, int bottom, int count ) {
+			count = Math.Min( count, bottom - top + 1 );
+
+			CopyCells( (top + count) * _columns, top * _columns, (bottom - top + 1 - count) * _columns );
+
+			for( int row = bottom - count + 1; row <= bottom; row++ )
+				EraseCells( row, 0, _columns );
+
+			for( int row = top; row <= bottom; row++ )
+				MarkDirty( row, 0, _columns );
+		}
+
+		/// <summary>
+		/// Moves the rows from <paramref name="top"/> to <paramref name="bottom"/> down, erasing the rows that open up at the top.
+		/// </summary>
+		private void ScrollDown( int top, int bottom, int count ) {
+			count = Math.Min( count, bottom - top + 1 );
+
+			CopyCells( top * _columns, (top + count) * _columns, (bottom - top + 1 - count) * _columns );
+
+			for( int row = top; row < top + count; row++ )
+				EraseCells( row, 0, _columns );
+
+			for( int row = top; row <= bottom; row++ )
+				MarkDirty( row, 0, _columns );
+		}
+
+		private void CopyCells( int source, int destination, int count ) {
+			if( count <= 0 )
+				return;
+
+			Array.Copy( _chars, source, _chars, destination, count );
+			Array.Copy( _foreground, source, _foreground, destination, count );
+			Array.Copy( _background, source, _background, destination, count );
+			Array.Copy( _attributes, source, _attributes, destination, count );
+		}
+
+		/// <summary>
+		/// Erases cells in a row to spaces in the current background color.
+		/// </summary>
+		/// <param name="row">Row to erase.</param>
+		/// <param name="left">First column to erase.</param>
+		/// <param name="right">Column after the last one to erase.</param>
+		private void EraseCells( int row, int left, int right ) {
+			if( left >= right )
+				return;
+
+			int start = row * _columns + left, end = row * _columns + right;
+
+			for( int i = start; i < end; i++ ) {
+				_chars[i] = ' ';
+				_foreground[i] = (byte) TerminalColor.Default;
+				_background[i] = (byte) _currentBackground;
+				_attributes[i] = (byte) TerminalCellAttributes.None;
+			}
+
+			MarkDirty( row, left, right );
+		}
+	#endregion
+
+	#region Graphic rendition
+		private void SetGraphicRendition( int param ) {
+			switch( param ) {
+				case (int) SetGraphicRenditionParam.Default:
+					_currentForeground = TerminalColor.Default;
+					_currentBackground = TerminalColor.Default;
+					_currentAttributes = TerminalCellAttributes.None;
+					return;
+
+				case (int) SetGraphicRenditionParam.Bold:
+					SetAttributes( TerminalCellAttributes.Bold | TerminalCellAttributes.Faint, TerminalCellAttributes.Bold );
+					return;
+
+				case (int) SetGraphicRenditionParam.Faint:
+					SetAttributes( TerminalCellAttributes.Bold | TerminalCellAttributes.Faint, TerminalCellAttributes.Faint );
+					return;
+
+				case (int) SetGraphicRenditionParam.NormalIntensity:
+					SetAttributes( TerminalCellAttributes.Bold | TerminalCellAttributes.Faint, TerminalCellAttributes.None );
+					return;
+
+				case (int) SetGraphicRenditionParam.Italic:
+					SetAttributes( TerminalCellAttributes.Italic, TerminalCellAttributes.Italic );
+					return;
+
+				case (int) SetGraphicRenditionParam.NoItalics:
+					SetAttributes( TerminalCellAttributes.Italic, TerminalCellAttributes.None );
+					return;
+
+				case (int) SetGraphicRenditionParam.Underline:
+				case (int) SetGraphicRenditionParam.DoubleUnderline:
+					SetAttributes( TerminalCellAttributes.Underline, TerminalCellAttributes.Underline );
+					return;
+
+				case (int) SetGraphicRenditionParam.NoUnderline:
+					SetAttributes( TerminalCellAttributes.Underline, TerminalCellAttributes.None );
+					return;
+
+				case (int) SetGraphicRenditionParam.SlowBlink:
+				case (int) SetGraphicRenditionParam.FastBlink:
+					SetAttributes( TerminalCellAttributes.Blink, TerminalCellAttributes.Blink );
+					return;
+
+				case (int) SetGraphicRenditionParam.Steady:
+					SetAttributes( TerminalCellAttributes.Blink, TerminalCellAttributes.None );
+					return;
+
+				case (int) SetGraphicRenditionParam.NegativeImage:
+					SetAttributes( TerminalCellAttributes.NegativeImage, TerminalCellAttributes.NegativeImage );
+					return;
+
+				case (int) SetGraphicRenditionParam.PositiveImage:
+					SetAttributes( TerminalCellAttributes.NegativeImage, TerminalCellAttributes.None );
+					return;
+
+				case (int) SetGraphicRenditionParam.ConcealedCharacters:
+					SetAttributes( TerminalCellAttributes.Concealed, TerminalCellAttributes.Concealed );
+					return;
+
+				case (int) SetGraphicRenditionParam.RevealedCharacters:
+					SetAttributes( TerminalCellAttributes.Concealed, TerminalCellAttributes.None );
+					return;
+
+				case (int) SetGraphicRenditionParam.StrikeOut:
+					SetAttributes( TerminalCellAttributes.StrikeOut, TerminalCellAttributes.StrikeOut );
+					return;
+
+				case (int) SetGraphicRenditionParam.NoStrikeOut:
+					SetAttributes( TerminalCellAttributes.StrikeOut, TerminalCellAttributes.None );
+					return;
+
+				case (int) SetGraphicRenditionParam.DefaultColor:
+					_currentForeground = TerminalColor.Default;
+					return;
+
+				case (int) SetGraphicRenditionParam.DefaultBackgroundColor:
+					_currentBackground = TerminalColor.Default;
+					return;
+			}
+
+			if( param >= (int) SetGraphicRenditionParam.Black && param <= (int) SetGraphicRenditionParam.White )
+				_currentForeground = (TerminalColor)(param - (int) SetGraphicRenditionParam.Black);
+			else if( param >= (int) SetGraphicRenditionParam.BlackBackground && param <= (int) SetGraphicRenditionParam.WhiteBackground )
+				_currentBackground = (TerminalColor)(param - (int) SetGraphicRenditionParam.BlackBackground);
+		}
+
+		private void SetAttributes( TerminalCellAttributes mask, TerminalCellAttributes value ) {
+			_currentAttributes = (_currentAttributes & ~mask) | value;
+		}
+	#endregion
+
+	#region Damage tracking
+		private void MarkDirty( int row, int left, int right ) {
+			if( left < _dirtyLeft[row] )
+				_dirtyLeft[row] = left;
+
+			if( right > _dirtyRight[row] )
+				_dirtyRight[row] = right;
+
+			_damaged = true;
+		}
+
+		private int GetIndex( int column, int row ) {
+			if( column < 0 || column >= _columns )
+				throw new ArgumentOutOfRangeException( "column" );
+
+			if( row < 0 || row >= _rows )
+				throw new ArgumentOutOfRangeException( "row" );
+
+			return row * _columns + column;
+		}
+	#endregion
+	}
+}
@@ -0,0 +1,436 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.Text;
+
+namespace Fluggo.Communications.Terminals {
+	/// <summary>
+	/// Replays a colorized log through a <see cref="TerminalControlStreamWriter"/> and through an unbuffered writer, and
+	/// compares the two.
+	/// </summary>
+	/// <remarks>The log has <see cref="LineCount"/> lines, each with a dimmed timestamp, a level tag colored by severity,
+	///     and a message, the way a console logger writes them. Each line resets the rendition after the level tag and
+	///     again at its end, when there is nothing left to reset, which is what a logger that doesn't track the
+	///     terminal's state does.
+	///   <para>The unbuffered writer sends every text fragment and control function to the stream as its own write and
+	///     sends every rendition change, as <see cref="TerminalControlStreamWriter"/> did before it buffered its output.
+	///     Both writers write to a stream that only counts what it is given, so a run measures the writers alone.</para>
+	///   <para>The log is built from <see cref="Seed"/>, so runs with the same settings replay the same log.</para></remarks>
+	public sealed class TerminalWriterBenchmark {
+		int _lineCount = 100000, _bufferSize = 4096, _seed;
+		bool _7bit = true;
+
+		static readonly string[] __levels = new string[] { "DEBUG", "INFO ", "WARN ", "ERROR" };
+		static readonly SetGraphicRenditionParam[] __levelColors = new SetGraphicRenditionParam[] {
+			SetGraphicRenditionParam.Cyan, SetGraphicRenditionParam.Green,
+			SetGraphicRenditionParam.Yellow, SetGraphicRenditionParam.Red };
+		static readonly string[] __words = new string[] { "connection", "request", "stream", "channel", "opened", "closed",
+			"timed", "out", "after", "retry", "sent", "received", "bytes", "from", "to", "peer", "queue", "full" };
+
+	#region Settings
+		/// <summary>
+		/// Gets or sets the number of lines in the log.
+		/// </summary>
+		/// <value>The number of log lines replayed through each writer. The default is 100000.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than one.</exception>
+		public int LineCount {
+			get { return _lineCount; }
+			set {
+				if( value < 1 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_lineCount = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the buffer size of the buffered writer.
+		/// </summary>
+		/// <value>The number of bytes the <see cref="TerminalControlStreamWriter"/> collects before writing. The default is 4096.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than 64.</exception>
+		public int BufferSize {
+			get { return _bufferSize; }
+			set {
+				if( value < 64 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_bufferSize = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets a value that represents whether the writers use 7-bit control functions.
+		/// </summary>
+		/// <value>True to send control sequences in their 7-bit form, or false for the 8-bit form. The default is true.</value>
+		public bool Is7Bit {
+			get { return _7bit; }
+			set { _7bit = value; }
+		}
+
+		/// <summary>
+		/// Gets or sets the seed used to build the log.
+		/// </summary>
+		/// <value>The seed for the log's levels and messages. The default is zero.</value>
+		public int Seed {
+			get { return _seed; }
+			set { _seed = value; }
+		}
+	#endregion
+
+	#region Run
+		/// <summary>
+		/// Discards everything written to it, counting the bytes and the calls that wrote them.
+		/// </summary>
+		sealed class CountingStream : Stream {
+			public long Bytes, Writes;
+
+			public override bool CanRead { get { return false; } }
+			public override bool CanSeek { get { return false; } }
+			public override bool CanWrite { get { return true; } }
+
+			public override long Length {
+				get { throw new NotSupportedException(); }
+			}
+
+			public override long Position {
+				get { throw new NotSupportedException(); }
+				set { throw new NotSupportedException(); }
+			}
+
+			public override void Flush() {
+			}
+
+			public override int Read( byte[] buffer, int offset, int count ) {
+				throw new NotSupportedException();
+			}
+
+			public override long Seek( long offset, SeekOrigin origin ) {
+				throw new NotSupportedException();
+			}
+
+			public override void SetLength( long value ) {
+				throw new NotSupportedException();
+			}
+
+			public override void Write( byte[] buffer, int offset, int count ) {
+				Bytes += count;
+				Writes++;
+			}
+
+			public override void WriteByte( byte value ) {
+				Bytes++;
+				Writes++;
+			}
+		}
+
+		/// <summary>
+		/// Writes every text fragment and control function straight to the stream, with no buffering and no tracking of
+		/// the rendition.
+		/// </summary>
+		sealed class UnbufferedWriter : ITerminalControlWriter {
+			Stream _target;
+			bool _7bit;
+			byte[] _sequence = new byte[32];
+
+			public UnbufferedWriter( Stream target, bool is7bit ) {
+				_target = target;
+				_7bit = is7bit;
+			}
+
+			public void WriteText( char data ) {
+				byte[] buffer = Encoding.ASCII.GetBytes( new char[] { data } );
+				_target.Write( buffer, 0, buffer.Length );
+			}
+
+			public void WriteText( string data ) {
+				byte[] buffer = Encoding.ASCII.GetBytes( data );
+				_target.Write( buffer, 0, buffer.Length );
+			}
+
+			public void WriteText( char[] data, int offset, int count ) {
+				byte[] buffer = Encoding.ASCII.GetBytes( data, offset, count );
+				_target.Write( buffer, 0, buffer.Length );
+			}
+
+			public void WriteControlCode( C0 code ) {
+				_target.WriteByte( (byte) code );
+			}
+
+			public void WriteControlCode( C1 code ) {
+				if( _7bit ) {
+					_sequence[0] = 0x1B;
+					_sequence[1] = (byte)(((byte) code) - 0x40);
+					_target.Write( _sequence, 0, 2 );
+				}
+				else {
+					_target.WriteByte( (byte) code );
+				}
+			}
+
+			public void WriteControlSequence( int p1, int p2, ControlFinalCode final ) {
+				WriteControlSequence( p1, p2, (byte) final, false );
+			}
+
+			public void WriteControlSequence( int p1, int p2, ControlExtendedFinalCode final ) {
+				WriteControlSequence( p1, p2, (byte) final, true );
+			}
+
+			void WriteControlSequence( int p1, int p2, byte final, bool extended ) {
+				StringBuilder builder = new StringBuilder();
+
+				if( p1 >= 0 )
+					builder.Append( p1 );
+
+				if( p2 >= 0 )
+					builder.Append( ';' ).Append( p2 );
+
+				int i = 0;
+
+				if( _7bit ) {
+					_sequence[i++] = 0x1B;
+					_sequence[i++] = 0x5B;
+				}
+				else {
+					_sequence[i++] = 0x9B;
+				}
+
+				i += Encoding.ASCII.GetBytes( builder.ToString(), 0, builder.Length, _sequence, i );
+
+				if( extended )
+					_sequence[i++] = 0x20;
+
+				_sequence[i++] = final;
+				_target.Write( _sequence, 0, i );
+			}
+
+			public void WriteIndependentControlFunction( IndependentControlFunction function ) {
+				_sequence[0] = 0x1B;
+				_sequence[1] = (byte) function;
+				_target.Write( _sequence, 0, 2 );
+			}
+
+			public void Flush() {
+				_target.Flush();
+			}
+		}
+
+		/// <summary>
+		/// One line of the log.
+		/// </summary>
+		struct LogLine {
+			public int Level;
+			public string Time, Message;
+		}
+
+		/// <summary>
+		/// Replays the log through both writers.
+		/// </summary>
+		/// <returns>A <see cref="TerminalWriterBenchmarkResult"/> comparing the two writers.</returns>
+		/// <remarks>Each writer replays the log once before it is timed, so that neither pays for loading and compiling code.</remarks>
+		public TerminalWriterBenchmarkResult Run() {
+			LogLine[] log = BuildLog();
+
+			CountingStream before = new CountingStream();
+			Replay( log, new UnbufferedWriter( Stream.Null, _7bit ) );
+			long start = Stopwatch.GetTimestamp();
+			Replay( log, new UnbufferedWriter( before, _7bit ) );
+			long beforeTicks = Stopwatch.GetTimestamp() - start;
+
+			CountingStream after = new CountingStream();
+			Replay( log, new TerminalControlStreamWriter( Stream.Null, _7bit, _bufferSize ) );
+			start = Stopwatch.GetTimestamp();
+			Replay( log, new TerminalControlStreamWriter( after, _7bit, _bufferSize ) );
+			long afterTicks = Stopwatch.GetTimestamp() - start;
+
+			return new TerminalWriterBenchmarkResult( log.Length,
+				ToTimeSpan( beforeTicks ), before.Bytes, before.Writes,
+				ToTimeSpan( afterTicks ), after.Bytes, after.Writes );
+		}
+
+		private LogLine[] BuildLog() {
+			Random random = new Random( _seed );
+			LogLine[] log = new LogLine[_lineCount];
+			StringBuilder builder = new StringBuilder();
+			DateTime time = new DateTime( 2006, 1, 1, 0, 0, 0 );
+
+			for( int i = 0; i < log.Length; i++ ) {
+				// Mostly routine lines, with the odd warning or error
+				int pick = random.Next( 100 );
+				log[i].Level = (pick < 40) ? 0 : (pick < 90) ? 1 : (pick < 98) ? 2 : 3;
+
+				time = time.AddMilliseconds( random.Next( 50 ) );
+				log[i].Time = time.ToString( "HH:mm:ss.fff", CultureInfo.InvariantCulture );
+
+				builder.Length = 0;
+
+				for( int words = random.Next( 4, 16 ); words != 0; words-- ) {
+					builder.Append( __words[random.Next( __words.Length )] );
+					builder.Append( ' ' );
+				}
+
+				builder.Append( random.Next( 100000 ) );
+				log[i].Message = builder.ToString();
+			}
+
+			return log;
+		}
+
+		private static void Replay( LogLine[] log, ITerminalControlWriter writer ) {
+			for( int i = 0; i < log.Length; i++ ) {
+				writer.WriteControlSequence( (int) SetGraphicRenditionParam.Faint, -1, ControlFinalCode.SetGraphicRendition );
+				writer.WriteText( log[i].Time );
+				writer.WriteText( ' ' );
+
+				writer.WriteControlSequence( (int) SetGraphicRenditionParam.NormalIntensity, (int) __levelColors[log[i].Level],
+					ControlFinalCode.SetGraphicRendition );
+
+				if( log[i].Level == 3 )
+					writer.WriteControlSequence( (int) SetGraphicRenditionParam.Bold, -1, ControlFinalCode.SetGraphicRendition );
+
+				writer.WriteText( __levels[log[i].Level] );
+				writer.WriteControlSequence( (int) SetGraphicRenditionParam.Default, -1, ControlFinalCode.SetGraphicRendition );
+				writer.WriteText( ' ' );
+				writer.WriteText( log[i].Message );
+				writer.WriteControlSequence( (int) SetGraphicRenditionParam.Default, -1, ControlFinalCode.SetGraphicRendition );
+				writer.WriteControlCode( C0.CarriageReturn );
+				writer.WriteControlCode( C0.LineFeed );
+			}
+
+			writer.Flush();
+		}
+
+		private static TimeSpan ToTimeSpan( long timestampDelta ) {
+			return TimeSpan.FromSeconds( (double) timestampDelta / (double) Stopwatch.Frequency );
+		}
+	#endregion
+	}
+
+	/// <summary>
+	/// Describes one run of a <see cref="TerminalWriterBenchmark"/>.
+	/// </summary>
+	public sealed class TerminalWriterBenchmarkResult {
+		int _lines;
+		TimeSpan _beforeElapsed, _afterElapsed;
+		long _beforeBytes, _beforeWrites, _afterBytes, _afterWrites;
+
+		internal TerminalWriterBenchmarkResult( int lines, TimeSpan beforeElapsed, long beforeBytes, long beforeWrites,
+				TimeSpan afterElapsed, long afterBytes, long afterWrites ) {
+			_lines = lines;
+			_beforeElapsed = beforeElapsed;
+			_beforeBytes = beforeBytes;
+			_beforeWrites = beforeWrites;
+			_afterElapsed = afterElapsed;
+			_afterBytes = afterBytes;
+			_afterWrites = afterWrites;
+		}
+
+		/// <summary>
+		/// Gets the number of lines replayed.
+		/// </summary>
+		/// <value>The number of log lines each writer wrote.</value>
+		public int Lines {
+			get { return _lines; }
+		}
+
+		/// <summary>
+		/// Gets the time the unbuffered writer took.
+		/// </summary>
+		/// <value>The time taken to replay the log through the unbuffered writer.</value>
+		public TimeSpan UnbufferedElapsed {
+			get { return _beforeElapsed; }
+		}
+
+		/// <summary>
+		/// Gets the number of bytes the unbuffered writer emitted.
+		/// </summary>
+		/// <value>The number of bytes written to the stream by the unbuffered writer.</value>
+		public long UnbufferedBytes {
+			get { return _beforeBytes; }
+		}
+
+		/// <summary>
+		/// Gets the number of writes the unbuffered writer made.
+		/// </summary>
+		/// <value>The number of calls the unbuffered writer made to write to the stream.</value>
+		public long UnbufferedWrites {
+			get { return _beforeWrites; }
+		}
+
+		/// <summary>
+		/// Gets the time the buffered writer took.
+		/// </summary>
+		/// <value>The time taken to replay the log through the <see cref="TerminalControlStreamWriter"/>, including the
+		///   final flush.</value>
+		public TimeSpan BufferedElapsed {
+			get { return _afterElapsed; }
+		}
+
+		/// <summary>
+		/// Gets the number of bytes the buffered writer emitted.
+		/// </summary>
+		/// <value>The number of bytes written to the stream by the <see cref="TerminalControlStreamWriter"/>.</value>
+		public long BufferedBytes {
+			get { return _afterBytes; }
+		}
+
+		/// <summary>
+		/// Gets the number of writes the buffered writer made.
+		/// </summary>
+		/// <value>The number of calls the <see cref="TerminalControlStreamWriter"/> made to write to the stream.</value>
+		public long BufferedWrites {
+			get { return _afterWrites; }
+		}
+
+		/// <summary>
+		/// Gets the rate at which the unbuffered writer wrote lines.
+		/// </summary>
+		/// <value>The number of log lines per second written by the unbuffered writer.</value>
+		public double UnbufferedLinesPerSecond {
+			get { return (double) _lines / Math.Max( _beforeElapsed.TotalSeconds, 1e-9 ); }
+		}
+
+		/// <summary>
+		/// Gets the rate at which the buffered writer wrote lines.
+		/// </summary>
+		/// <value>The number of log lines per second written by the <see cref="TerminalControlStreamWriter"/>.</value>
+		public double BufferedLinesPerSecond {
+			get { return (double) _lines / Math.Max( _afterElapsed.TotalSeconds, 1e-9 ); }
+		}
+
+		/// <summary>
+		/// Summarizes the run.
+		/// </summary>
+		/// <returns>A few lines comparing the throughput and output of the two writers.</returns>
+		public override string ToString() {
+			StringBuilder builder = new StringBuilder();
+
+			builder.AppendFormat( "{0} lines\r\n", _lines );
+			builder.AppendFormat( "unbuffered: {0:0.000} s, {1:0.0} lines/s, {2} bytes in {3} writes\r\n",
+				_beforeElapsed.TotalSeconds, UnbufferedLinesPerSecond, _beforeBytes, _beforeWrites );
+			builder.AppendFormat( "buffered:   {0:0.000} s, {1:0.0} lines/s, {2} bytes in {3} writes",
+				_afterElapsed.TotalSeconds, BufferedLinesPerSecond, _afterBytes, _afterWrites );
+
+			return builder.ToString();
+		}
+	}
+}
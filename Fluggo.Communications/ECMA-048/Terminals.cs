@@ -99,138 +99,351 @@ namespace Fluggo.Communications.Terminals {
 	}
 	#endif
 	
+	/// <summary>
+	/// Writes text and control functions to a stream of bytes.
+	/// </summary>
+	/// <remarks>Output is collected in a buffer and written to the stream when the buffer fills or <see cref="Flush"/> is
+	///     called, so a line of colored text becomes one write instead of one for every fragment and every color change.
+	///   <para>The writer also remembers the graphic rendition it has selected. A
+	///     <see cref="ControlFinalCode.SetGraphicRendition"/> parameter that would select an attribute that is already in
+	///     effect is dropped, and a sequence with nothing left is not sent at all. Until the first
+	///     <see cref="SetGraphicRenditionParam.Default"/>, only attributes the writer has set itself are known, and a
+	///     parameter the writer doesn't track, such as a font, makes the whole rendition unknown again.</para></remarks>
 	public class TerminalControlStreamWriter : ITerminalControlWriter {
+		const int __defaultBufferSize = 4096;
+
 		Stream _target;
 		bool _7bit;
-		byte[] _outBuffer = new byte[64];
-		Encoding _encoding;
+		byte[] _outBuffer;
+		int _outCount;
+		int[] _rendition = new int[(int) RenditionField.Count];
+
+		/// <summary>
+		/// Groups of graphic rendition parameters that replace one another.
+		/// </summary>
+		enum RenditionField {
+			Intensity,
+			Italic,
+			Underline,
+			Blink,
+			Image,
+			Conceal,
+			StrikeOut,
+			Foreground,
+			Background,
+
+			Count
+		}
+
+		static readonly int[] __renditionDefaults = new int[] {
+			(int) SetGraphicRenditionParam.NormalIntensity,
+			(int) SetGraphicRenditionParam.NoItalics,
+			(int) SetGraphicRenditionParam.NoUnderline,
+			(int) SetGraphicRenditionParam.Steady,
+			(int) SetGraphicRenditionParam.PositiveImage,
+			(int) SetGraphicRenditionParam.RevealedCharacters,
+			(int) SetGraphicRenditionParam.NoStrikeOut,
+			(int) SetGraphicRenditionParam.DefaultColor,
+			(int) SetGraphicRenditionParam.DefaultBackgroundColor
+		};
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='TerminalControlStreamWriter'/> class.
+		/// </summary>
+		/// <param name="target">Stream to which terminal control data should be written.</param>
+		/// <param name="is7bit">True if the terminal only accepts 7-bit encodings, or false if it accepts 8-bit encodings.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='target'/> is <see langword='null'/>.</exception>
+		public TerminalControlStreamWriter( Stream target, bool is7bit ) : this( target, is7bit, __defaultBufferSize ) {
+		}
 
 		/// <summary>
 		/// Creates a new instance of the <see cref='TerminalControlStreamWriter'/> class.
 		/// </summary>
 		/// <param name="target">Stream to which terminal control data should be written.</param>
 		/// <param name="is7bit">True if the terminal only accepts 7-bit encodings, or false if it accepts 8-bit encodings.</param>
+		/// <param name="bufferSize">Number of bytes to collect before writing to <paramref name="target"/>.</param>
 		/// <exception cref='ArgumentNullException'><paramref name='target'/> is <see langword='null'/>.</exception>
-		// <param name="useUnicode">True to use Unicode encoding for text, or false to use ASCII. If <paramref name="is7bit"/>
-		//   is set, only UTF-7 will be used for Unicode encodings. Otherwise, UTF-8 will be used and escape sequences will be
-		//   limited to their 7-bit forms.</param>
-		public TerminalControlStreamWriter( Stream target, bool is7bit/*, bool useUnicode*/ ) {
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="bufferSize"/> is less than 64.</exception>
+		public TerminalControlStreamWriter( Stream target, bool is7bit, int bufferSize ) {
 			if( target == null )
 				throw new ArgumentNullException( "target" );
 
+			// Room for the longest control sequence
+			if( bufferSize < 64 )
+				throw new ArgumentOutOfRangeException( "bufferSize" );
+
 			_target = target;
 			_7bit = is7bit;
-			
-			_encoding = Encoding.ASCII;
-/*			if( useUnicode ) {
-				// Choose the right encoder
-				_encoding = is7bit ? Encoding.UTF7 : Encoding.UTF8;
-				
-				// Make sure we stay out of the way of upper-range codes in UTF8
-				is7bit = true;
-			}
-			else {
-				_encoding = Encoding.ASCII;
-			}*/
+			_outBuffer = new byte[bufferSize];
 		}
-		
+
+		/// <summary>
+		/// Writes everything buffered so far to the stream and flushes it.
+		/// </summary>
+		public void Flush() {
+			FlushBuffer();
+			_target.Flush();
+		}
+
+		void FlushBuffer() {
+			if( _outCount == 0 )
+				return;
+
+			_target.Write( _outBuffer, 0, _outCount );
+			_outCount = 0;
+		}
+
+		void Reserve( int count ) {
+			if( _outBuffer.Length - _outCount < count )
+				FlushBuffer();
+		}
+
+	#region Text
 		public void WriteText( char[] data, int offset, int count ) {
-			byte[] buffer = _encoding.GetBytes( data, offset, count );
-			_target.Write( buffer, 0, buffer.Length );
+			new ArraySegment<char>( data, offset, count );
+			EncodeText( null, data, offset, count );
 		}
 		
 		public void WriteText( string data ) {
-			byte[] buffer = _encoding.GetBytes( data );
-			_target.Write( buffer, 0, buffer.Length );
+			if( data == null )
+				throw new ArgumentNullException( "data" );
+
+			EncodeText( data, null, 0, data.Length );
+		}
+
+		/// <summary>
+		/// Encodes text into the buffer, flushing it as it fills.
+		/// </summary>
+		/// <param name="text">String holding the text, or <see langword='null'/> if the text is in <paramref name="chars"/>.</param>
+		/// <param name="chars">Array holding the text, or <see langword='null'/> if the text is in <paramref name="text"/>.</param>
+		/// <param name="offset">Index of the first character of the text.</param>
+		/// <param name="count">Number of characters in the text.</param>
+		void EncodeText( string text, char[] chars, int offset, int count ) {
+			while( count != 0 ) {
+				if( _outCount == _outBuffer.Length )
+					FlushBuffer();
+
+				int length = Math.Min( count, _outBuffer.Length - _outCount );
+
+				if( chars != null ) {
+					for( int i = 0; i < length; i++ )
+						_outBuffer[_outCount++] = EncodeChar( chars[offset + i] );
+				}
+				else {
+					for( int i = 0; i < length; i++ )
+						_outBuffer[_outCount++] = EncodeChar( text[offset + i] );
+				}
+
+				offset += length;
+				count -= length;
+			}
 		}
 		
 		public void WriteText( char data ) {
-			byte[] buffer = _encoding.GetBytes( new char[] { data } );
-			_target.Write( buffer, 0, buffer.Length );
+			Reserve( 1 );
+			_outBuffer[_outCount++] = EncodeChar( data );
 		}
 
+		static byte EncodeChar( char data ) {
+			// Same as Encoding.ASCII
+			return (data < '\u0080') ? (byte) data : (byte) '?';
+		}
+	#endregion
+
+	#region Control functions
 		public void WriteControlCode( C0 code ) {
-			_target.WriteByte( (byte) code );
+			Reserve( 1 );
+			_outBuffer[_outCount++] = (byte) code;
 		}
 
 		public void WriteControlCode( C1 code ) {
+			Reserve( 2 );
+
 			if( _7bit ) {
-				_outBuffer[0] = 0x1B;
-				_outBuffer[1] = (byte)(((byte) code) - 0x40);
-				_target.Write( _outBuffer, 0, 2 );
+				_outBuffer[_outCount++] = 0x1B;
+				_outBuffer[_outCount++] = (byte)(((byte) code) - 0x40);
 			}
 			else {
-				_target.WriteByte( (byte) code );
+				_outBuffer[_outCount++] = (byte) code;
 			}
 		}
 
 		public void WriteControlSequence( int p1, int p2, ControlFinalCode final ) {
-			int i = 0;
-			
+			if( final == ControlFinalCode.SetGraphicRendition && !UpdateRendition( ref p1, ref p2 ) )
+				return;
+
+			WriteControlSequence( p1, p2, (byte) final, false );
+		}
+
+		public void WriteControlSequence( int p1, int p2, ControlExtendedFinalCode final ) {
+			WriteControlSequence( p1, p2, (byte) final, true );
+		}
+
+		void WriteControlSequence( int p1, int p2, byte final, bool extended ) {
+			// CSI, two ten-digit parameters and a separator, an intermediate and the final
+			Reserve( 26 );
+
 			if( _7bit ) {
-				_outBuffer[i++] = 0x1B;
-				_outBuffer[i++] = 0x5B;
+				_outBuffer[_outCount++] = 0x1B;
+				_outBuffer[_outCount++] = 0x5B;
 			}
 			else {
-				_outBuffer[i++] = 0x9B;
+				_outBuffer[_outCount++] = 0x9B;
 			}
 			
 			if( p1 >= 0 )
-				WriteParam( ref i, p1 );
+				WriteParam( p1 );
 			
 			if( p2 >= 0 ) {
-				_outBuffer[i++] = 0x3B;
-				WriteParam( ref i, p2 );
+				_outBuffer[_outCount++] = 0x3B;
+				WriteParam( p2 );
 			}
-			
-			_outBuffer[i++] = (byte) final;
-			_target.Write( _outBuffer, 0, i );
+
+			if( extended )
+				_outBuffer[_outCount++] = 0x20;
+
+			_outBuffer[_outCount++] = final;
 		}
 		
-		void WriteParam( ref int i, int param ) {
-			Stack<byte> stack = new Stack<byte>();
-			
-			do {
-				stack.Push( (byte)((param % 10) + 0x30) );
+		void WriteParam( int param ) {
+			int digits = 1;
+
+			for( int rest = param / 10; rest != 0; rest /= 10 )
+				digits++;
+
+			_outCount += digits;
+
+			for( int i = _outCount - 1; digits != 0; i--, digits-- ) {
+				_outBuffer[i] = (byte)((param % 10) + 0x30);
 				param /= 10;
-			} while( param != 0 );
-			
-			while( stack.Count != 0 )
-				_outBuffer[i++] = stack.Pop();
+			}
 		}
 
-		public void WriteControlSequence( int p1, int p2, ControlExtendedFinalCode final ) {
-			int i = 0;
+		public void WriteIndependentControlFunction( IndependentControlFunction function ) {
+			Reserve( 2 );
 
-			if( _7bit ) {
-				_outBuffer[i++] = 0x1B;
-				_outBuffer[i++] = 0x5B;
+			_outBuffer[_outCount++] = 0x1B;
+			_outBuffer[_outCount++] = (byte) function;
+
+			// The terminal is back to whatever its initial rendition is
+			if( function == IndependentControlFunction.Ris )
+				Array.Clear( _rendition, 0, _rendition.Length );
+		}
+	#endregion
+
+	#region Graphic rendition
+		/// <summary>
+		/// Applies the parameters of an SGR sequence to the known rendition and drops the ones that change nothing.
+		/// </summary>
+		/// <param name="p1">Reference to the first parameter. On return, the first parameter to send, or -1 if none.</param>
+		/// <param name="p2">Reference to the second parameter. On return, the second parameter to send, or -1 if none.</param>
+		/// <returns>True if the sequence should be sent, or false if it would change nothing.</returns>
+		/// <remarks>The parameters are applied in order, so dropping one that was already in effect when it was reached never
+		///   changes the result.</remarks>
+		bool UpdateRendition( ref int p1, ref int p2 ) {
+			// No parameters at all means the default rendition
+			if( p1 < 0 && p2 < 0 )
+				p1 = (int) SetGraphicRenditionParam.Default;
+
+			bool send1 = p1 >= 0 && ApplyRendition( p1 );
+			bool send2 = p2 >= 0 && ApplyRendition( p2 );
+
+			if( !send1 ) {
+				if( !send2 )
+					return false;
+
+				p1 = p2;
+				p2 = -1;
 			}
-			else {
-				_outBuffer[i++] = 0x9B;
+			else if( !send2 ) {
+				p2 = -1;
 			}
 
-			if( p1 >= 0 )
-				WriteParam( ref i, p1 );
+			return true;
+		}
 
-			if( p2 >= 0 ) {
-				_outBuffer[i++] = 0x3B;
-				WriteParam( ref i, p2 );
+		/// <summary>
+		/// Applies one SGR parameter to the known rendition.
+		/// </summary>
+		/// <returns>True if the parameter changes the rendition or can't be tracked, or false if it is already in effect.</returns>
+		/// <remarks>A parameter that can't be tracked leaves the whole rendition unknown.</remarks>
+		bool ApplyRendition( int param ) {
+			if( param == (int) SetGraphicRenditionParam.Default ) {
+				bool changed = false;
+
+				for( int i = 0; i < _rendition.Length; i++ ) {
+					if( _rendition[i] != __renditionDefaults[i] ) {
+						_rendition[i] = __renditionDefaults[i];
+						changed = true;
+					}
+				}
+
+				return changed;
 			}
 
-			_outBuffer[i++] = 0x20;
-			_outBuffer[i++] = (byte) final;
-			_target.Write( _outBuffer, 0, i );
+			int field = GetRenditionField( param );
+
+			// The writer can't say what an untracked parameter changes, fonts for one, so it forgets everything
+			// it knows; the next SGR 0 and every other attribute then go out as if nothing had been set
+			if( field == -1 ) {
+				Array.Clear( _rendition, 0, _rendition.Length );
+				return true;
+			}
+
+			if( _rendition[field] == param )
+				return false;
+
+			_rendition[field] = param;
+			return true;
 		}
 
-		public void WriteIndependentControlFunction( IndependentControlFunction function ) {
-			int i = 0;
+		static int GetRenditionField( int param ) {
+			switch( param ) {
+				case (int) SetGraphicRenditionParam.Bold:
+				case (int) SetGraphicRenditionParam.Faint:
+				case (int) SetGraphicRenditionParam.NormalIntensity:
+					return (int) RenditionField.Intensity;
 
-			_outBuffer[i++] = 0x1B;
-			_outBuffer[i++] = (byte) function;
-			
-			_target.Write( _outBuffer, 0, i );
+				// NoItalics cancels Fraktur too, so the three replace one another
+				case (int) SetGraphicRenditionParam.Italic:
+				case (int) SetGraphicRenditionParam.Fraktur:
+				case (int) SetGraphicRenditionParam.NoItalics:
+					return (int) RenditionField.Italic;
+
+				case (int) SetGraphicRenditionParam.Underline:
+				case (int) SetGraphicRenditionParam.DoubleUnderline:
+				case (int) SetGraphicRenditionParam.NoUnderline:
+					return (int) RenditionField.Underline;
+
+				case (int) SetGraphicRenditionParam.SlowBlink:
+				case (int) SetGraphicRenditionParam.FastBlink:
+				case (int) SetGraphicRenditionParam.Steady:
+					return (int) RenditionField.Blink;
+
+				case (int) SetGraphicRenditionParam.NegativeImage:
+				case (int) SetGraphicRenditionParam.PositiveImage:
+					return (int) RenditionField.Image;
+
+				case (int) SetGraphicRenditionParam.ConcealedCharacters:
+				case (int) SetGraphicRenditionParam.RevealedCharacters:
+					return (int) RenditionField.Conceal;
+
+				case (int) SetGraphicRenditionParam.StrikeOut:
+				case (int) SetGraphicRenditionParam.NoStrikeOut:
+					return (int) RenditionField.StrikeOut;
+			}
+
+			if( (param >= (int) SetGraphicRenditionParam.Black && param <= (int) SetGraphicRenditionParam.White) ||
+					param == (int) SetGraphicRenditionParam.DefaultColor )
+				return (int) RenditionField.Foreground;
+
+			if( (param >= (int) SetGraphicRenditionParam.BlackBackground && param <= (int) SetGraphicRenditionParam.WhiteBackground) ||
+					param == (int) SetGraphicRenditionParam.DefaultBackgroundColor )
+				return (int) RenditionField.Background;
+
+			return -1;
 		}
+	#endregion
 	}
 	
 	public interface ITerminalControlWriter {
@@ -242,6 +455,11 @@ namespace Fluggo.Communications.Terminals {
 		void WriteControlSequence( int p1, int p2, ControlFinalCode final );
 		void WriteControlSequence( int p1, int p2, ControlExtendedFinalCode final );
 		void WriteIndependentControlFunction( IndependentControlFunction function );
+
+		/// <summary>
+		/// Passes along anything the writer is holding.
+		/// </summary>
+		void Flush();
 	}
 	
 	[Flags]
@@ -375,5 +593,9 @@ namespace Fluggo.Communications.Terminals {
 		public void WriteIndependentControlFunction( IndependentControlFunction function ) {
 			Console.Write( function );
 		}
+
+		public void Flush() {
+			Console.Out.Flush();
+		}
 	}
 }
\ No newline at end of file
@@ -0,0 +1,246 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.IO;
+
+namespace Fluggo.Communications
+{
+	/// <summary>
+	/// Presents ranges of several message buffers as one message buffer.
+	/// </summary>
+	/// <remarks>The parts are not copied; the chain only keeps references to the buffers it was given and reads from them
+	///   when it's copied out. A chain with one part is a cheap way to take a slice of another buffer.
+	///   <para>Add all of the parts before handing the chain to anyone else. The class is not thread-safe while it's
+	///     being built.</para></remarks>
+	public class ChainedMessageBuffer : IMessageBuffer {
+		IMessageBuffer[] _buffers;
+		int[] _offsets, _lengths;
+		int _count, _length;
+
+		/// <summary>
+		/// Creates a new, empty instance of the <see cref='ChainedMessageBuffer'/> class.
+		/// </summary>
+		public ChainedMessageBuffer() {
+			_buffers = new IMessageBuffer[4];
+			_offsets = new int[4];
+			_lengths = new int[4];
+		}
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='ChainedMessageBuffer'/> class over part of another buffer.
+		/// </summary>
+		/// <param name="buffer">Buffer to take the range from.</param>
+		/// <param name="offset">Offset in <paramref name="buffer"/> at which the range begins.</param>
+		/// <param name="length">Length of the range.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='buffer'/> is <see langword='null'/>.</exception>
+		/// <exception cref='ArgumentOutOfRangeException'><paramref name='offset'/> and <paramref name='length'/> do not specify
+		///   a valid range in <paramref name="buffer"/>.</exception>
+		public ChainedMessageBuffer( IMessageBuffer buffer, int offset, int length ) {
+			_buffers = new IMessageBuffer[1];
+			_offsets = new int[1];
+			_lengths = new int[1];
+			Append( buffer, offset, length );
+		}
+
+		/// <summary>
+		/// Adds a range of a buffer to the end of the chain.
+		/// </summary>
+		/// <param name="buffer">Buffer to take the range from.</param>
+		/// <param name="offset">Offset in <paramref name="buffer"/> at which the range begins.</param>
+		/// <param name="length">Length of the range.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='buffer'/> is <see langword='null'/>.</exception>
+		/// <exception cref='ArgumentOutOfRangeException'><paramref name='offset'/> and <paramref name='length'/> do not specify
+		///   a valid range in <paramref name="buffer"/>.</exception>
+		public void Append( IMessageBuffer buffer, int offset, int length ) {
+			if( buffer == null )
+				throw new ArgumentNullException( "buffer" );
+
+			if( offset < 0 || offset > buffer.Length )
+				throw new ArgumentOutOfRangeException( "offset" );
+
+			if( length < 0 || offset + length > buffer.Length )
+				throw new ArgumentOutOfRangeException( "length" );
+
+			if( length == 0 )
+				return;
+
+			if( _count == _buffers.Length ) {
+				int capacity = _count * 2;
+				Array.Resize( ref _buffers, capacity );
+				Array.Resize( ref _offsets, capacity );
+				Array.Resize( ref _lengths, capacity );
+			}
+
+			_buffers[_count] = buffer;
+			_offsets[_count] = offset;
+			_lengths[_count] = length;
+			_count++;
+			_length += length;
+		}
+
+		/// <summary>
+		/// Gets the number of parts in the chain.
+		/// </summary>
+		/// <value>The number of non-empty ranges that have been added.</value>
+		public int PartCount {
+			get { return _count; }
+		}
+
+		/// <summary>
+		/// Copies the contents of the message buffer to the given byte array.
+		/// </summary>
+		/// <param name="buffer">Buffer to receive the results.</param>
+		/// <param name="index">Index in <paramref name="buffer"/> at which to start copying.</param>
+		/// <remarks>There must be enough room in the buffer to store <see cref="Length"/> bytes.</remarks>
+		public void CopyTo( byte[] buffer, int index ) {
+			CopyTo( 0, buffer, index, _length );
+		}
+
+		public void CopyTo( int sourceIndex, byte[] destBuffer, int destIndex, int length ) {
+			if( sourceIndex < 0 || sourceIndex > _length )
+				throw new ArgumentOutOfRangeException( "sourceIndex" );
+
+			if( length < 0 || (sourceIndex + length) > _length )
+				throw new ArgumentOutOfRangeException( "length" );
+
+			for( int i = 0; i < _count && length != 0; i++ ) {
+				if( sourceIndex >= _lengths[i] ) {
+					sourceIndex -= _lengths[i];
+					continue;
+				}
+
+				int copy = Math.Min( _lengths[i] - sourceIndex, length );
+				_buffers[i].CopyTo( _offsets[i] + sourceIndex, destBuffer, destIndex, copy );
+
+				sourceIndex = 0;
+				destIndex += copy;
+				length -= copy;
+			}
+		}
+
+		/// <summary>
+		/// Gets a read-only stream of the buffer data.
+		/// </summary>
+		/// <returns>A read-only stream of the buffer data.</returns>
+		public Stream GetStream() {
+			return new ChainStream( this );
+		}
+
+		/// <summary>
+		/// Gets the length of the message buffer, in bytes.
+		/// </summary>
+		/// <value>The length of the message buffer, in bytes.</value>
+		public int Length {
+			get { return _length; }
+		}
+
+	#region ChainStream
+		sealed class ChainStream : Stream {
+			ChainedMessageBuffer _owner;
+			int _position;
+
+			public ChainStream( ChainedMessageBuffer owner ) {
+				_owner = owner;
+			}
+
+			public override bool CanRead {
+				get { return _owner != null; }
+			}
+
+			public override bool CanSeek {
+				get { return _owner != null; }
+			}
+
+			public override bool CanWrite {
+				get { return false; }
+			}
+
+			public override long Length {
+				get {
+					CheckOpen();
+					return _owner._length;
+				}
+			}
+
+			public override long Position {
+				get {
+					CheckOpen();
+					return _position;
+				}
+				set {
+					CheckOpen();
+
+					if( value < 0 || value > _owner._length )
+						throw new ArgumentOutOfRangeException( "value" );
+
+					_position = (int) value;
+				}
+			}
+
+			public override int Read( byte[] buffer, int offset, int count ) {
+				new ArraySegment<byte>( buffer, offset, count );
+				CheckOpen();
+
+				count = Math.Min( count, _owner._length - _position );
+				_owner.CopyTo( _position, buffer, offset, count );
+				_position += count;
+
+				return count;
+			}
+
+			public override long Seek( long offset, SeekOrigin origin ) {
+				switch( origin ) {
+					case SeekOrigin.Current:
+						offset += Position;
+						break;
+
+					case SeekOrigin.End:
+						offset += Length;
+						break;
+				}
+
+				Position = offset;
+				return offset;
+			}
+
+			public override void Flush() {
+			}
+
+			public override void SetLength( long value ) {
+				throw new NotSupportedException();
+			}
+
+			public override void Write( byte[] buffer, int offset, int count ) {
+				throw new NotSupportedException();
+			}
+
+			protected override void Dispose( bool disposing ) {
+				_owner = null;
+				base.Dispose( disposing );
+			}
+
+			private void CheckOpen() {
+				if( _owner == null )
+					throw new ObjectDisposedException( null );
+			}
+		}
+	#endregion
+	}
+}
@@ -0,0 +1,45 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+
+namespace Fluggo.Communications
+{
+	/// <summary>
+	/// Marks where a fragment falls in a message.
+	/// </summary>
+	/// <remarks>The values match the B and E bits of an SCTP DATA chunk. A message sent in one fragment has both flags.</remarks>
+	[Flags]
+	public enum FragmentFlags : byte {
+		/// <summary>
+		/// The fragment is in the middle of a message.
+		/// </summary>
+		None = 0,
+
+		/// <summary>
+		/// The fragment is the last in its message.
+		/// </summary>
+		End = 0x01,
+
+		/// <summary>
+		/// The fragment is the first in its message.
+		/// </summary>
+		Begin = 0x02,
+	}
+}
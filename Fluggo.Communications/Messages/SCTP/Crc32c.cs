@@ -0,0 +1,139 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+
+namespace Fluggo.Communications {
+	/// <summary>
+	/// Computes the CRC32c (Castagnoli) checksum used by SCTP.
+	/// </summary>
+	/// <remarks>The checksum is defined in RFC 3309. This implementation uses the slicing-by-8 method: eight 256-entry
+	///   tables let it fold in eight bytes per step with independent lookups, instead of one byte per step with each lookup
+	///   waiting on the last.</remarks>
+	[CLSCompliant(false)]
+	public static class Crc32c {
+		const uint __polynomial = 0x82F63B78;	// 0x1EDC6F41, bit-reversed
+		static readonly uint[] __table = CreateTable();
+
+		private static uint[] CreateTable() {
+			uint[] table = new uint[8 * 256];
+
+			for( uint n = 0; n < 256; n++ ) {
+				uint crc = n;
+
+				for( int bit = 0; bit < 8; bit++ )
+					crc = ((crc & 1) != 0) ? (crc >> 1) ^ __polynomial : crc >> 1;
+
+				table[n] = crc;
+			}
+
+			// Table k gives the effect of a byte followed by k zero bytes
+			for( int k = 1; k < 8; k++ ) {
+				for( int n = 0; n < 256; n++ ) {
+					uint previous = table[(k - 1) * 256 + n];
+					table[k * 256 + n] = (previous >> 8) ^ table[previous & 0xFF];
+				}
+			}
+
+			return table;
+		}
+
+		/// <summary>
+		/// Computes the checksum of a range of bytes.
+		/// </summary>
+		/// <param name="buffer">Array containing the data.</param>
+		/// <param name="offset">Offset in <paramref name="buffer"/> at which the data begins.</param>
+		/// <param name="count">Number of bytes to include.</param>
+		/// <returns>The CRC32c of the data.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='buffer'/> is <see langword='null'/>.</exception>
+		/// <exception cref='ArgumentOutOfRangeException'><paramref name='offset'/> or <paramref name='count'/> is negative.</exception>
+		/// <exception cref='ArgumentException'><paramref name='offset'/> and <paramref name='count'/> do not specify a valid
+		///   range in <paramref name="buffer"/>.</exception>
+		public static uint Compute( byte[] buffer, int offset, int count ) {
+			return Append( 0, buffer, offset, count );
+		}
+
+		/// <summary>
+		/// Continues a checksum over more data.
+		/// </summary>
+		/// <param name="crc">Checksum of the data so far, as returned by <see cref="Compute"/> or an earlier call to this
+		///   method. Use zero to start a new checksum.</param>
+		/// <param name="buffer">Array containing the data.</param>
+		/// <param name="offset">Offset in <paramref name="buffer"/> at which the data begins.</param>
+		/// <param name="count">Number of bytes to include.</param>
+		/// <returns>The CRC32c of the data so far followed by the given data.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='buffer'/> is <see langword='null'/>.</exception>
+		/// <exception cref='ArgumentOutOfRangeException'><paramref name='offset'/> or <paramref name='count'/> is negative.</exception>
+		/// <exception cref='ArgumentException'><paramref name='offset'/> and <paramref name='count'/> do not specify a valid
+		///   range in <paramref name="buffer"/>.</exception>
+		public static uint Append( uint crc, byte[] buffer, int offset, int count ) {
+			new ArraySegment<byte>( buffer, offset, count );
+
+			uint[] table = __table;
+			int end = offset + count;
+			crc = ~crc;
+
+			while( end - offset >= 8 ) {
+				uint low = crc ^ (uint)(buffer[offset] | (buffer[offset + 1] << 8) | (buffer[offset + 2] << 16) | (buffer[offset + 3] << 24));
+				uint high = (uint)(buffer[offset + 4] | (buffer[offset + 5] << 8) | (buffer[offset + 6] << 16) | (buffer[offset + 7] << 24));
+
+				crc = table[7 * 256 + (int)(low & 0xFF)] ^ table[6 * 256 + (int)((low >> 8) & 0xFF)] ^
+					table[5 * 256 + (int)((low >> 16) & 0xFF)] ^ table[4 * 256 + (int)(low >> 24)] ^
+					table[3 * 256 + (int)(high & 0xFF)] ^ table[2 * 256 + (int)((high >> 8) & 0xFF)] ^
+					table[256 + (int)((high >> 16) & 0xFF)] ^ table[high >> 24];
+
+				offset += 8;
+			}
+
+			while( offset < end )
+				crc = (crc >> 8) ^ table[(crc ^ buffer[offset++]) & 0xFF];
+
+			return ~crc;
+		}
+
+		/// <summary>
+		/// Writes a checksum in the byte order SCTP uses.
+		/// </summary>
+		/// <param name="crc">Checksum to write.</param>
+		/// <param name="buffer">Array to write to.</param>
+		/// <param name="offset">Offset in <paramref name="buffer"/> at which to write the four bytes of the checksum.</param>
+		/// <remarks>The reflected algorithm leaves the checksum byte-swapped relative to network order, so it goes on the wire
+		///   least significant byte first (RFC 3309, appendix).</remarks>
+		public static void Write( uint crc, byte[] buffer, int offset ) {
+			new ArraySegment<byte>( buffer, offset, 4 );
+
+			buffer[offset] = (byte) crc;
+			buffer[offset + 1] = (byte)(crc >> 8);
+			buffer[offset + 2] = (byte)(crc >> 16);
+			buffer[offset + 3] = (byte)(crc >> 24);
+		}
+
+		/// <summary>
+		/// Reads a checksum written by <see cref="Write"/>.
+		/// </summary>
+		/// <param name="buffer">Array to read from.</param>
+		/// <param name="offset">Offset in <paramref name="buffer"/> of the four bytes of the checksum.</param>
+		/// <returns>The checksum.</returns>
+		public static uint Read( byte[] buffer, int offset ) {
+			new ArraySegment<byte>( buffer, offset, 4 );
+
+			return (uint)(buffer[offset] | (buffer[offset + 1] << 8) | (buffer[offset + 2] << 16) | (buffer[offset + 3] << 24));
+		}
+	}
+}
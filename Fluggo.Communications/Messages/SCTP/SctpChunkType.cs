@@ -121,6 +121,11 @@ namespace Fluggo.Communications {
 		/// Shutdown complete.
 		/// </summary>
 		ShutdownComplete = 14,
+
+		/// <summary>
+		/// Forward cumulative TSN, from the partial reliability extension (RFC 3758).
+		/// </summary>
+		ForwardTsn = 192,
 		
 		/// <summary>
 		/// Mask used to determine the action taken when a chunk type is not recognized.
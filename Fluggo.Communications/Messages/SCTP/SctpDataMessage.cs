@@ -48,7 +48,8 @@ namespace Fluggo.Communications {
 		}
 
 		private static byte FlagsFromDeliveryOptions( DeliveryOptions options ) {
-			byte flags = 0;
+			// Messages are never fragmented at this level, so every chunk is both the beginning and the end
+			byte flags = 0x03;
 
 			if( (options & DeliveryOptions.Unordered) == DeliveryOptions.Unordered )
 				flags |= 0x04;
@@ -79,6 +80,25 @@ namespace Fluggo.Communications {
 			_payload.CopyTo( buffer, offset + 16 );
 		}
 
+		/// <summary>
+		/// Gets the transmission sequence number of the chunk.
+		/// </summary>
+		/// <value>The TSN that identifies this chunk within the association.</value>
+		[CLSCompliant(false)]
+		public uint Tsn {
+			get { return _tsn; }
+		}
+
+		/// <summary>
+		/// Gets the stream sequence number of the chunk.
+		/// </summary>
+		/// <value>The position of this message in its stream. Unordered messages carry a stream sequence number, but
+		///   it isn't used.</value>
+		[CLSCompliant(false)]
+		public ushort StreamSequenceNumber {
+			get { return _ssn; }
+		}
+
 		public IMessageBuffer MessageBuffer {
 			get { return _payload; }
 		}
@@ -94,5 +114,13 @@ namespace Fluggo.Communications {
 		public DeliveryOptions Options {
 			get { return _options; }
 		}
+
+		/// <summary>
+		/// Gets the index of the stream the message belongs to.
+		/// </summary>
+		/// <value>The stream identifier from the chunk.</value>
+		public override int Channel {
+			get { return _streamID; }
+		}
 	}
 }
\ No newline at end of file
@@ -0,0 +1,89 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.IO;
+
+namespace Fluggo.Communications {
+	/// <summary>
+	/// Represents a FORWARD TSN chunk, which tells the receiver to stop waiting for abandoned data.
+	/// </summary>
+	/// <remarks>For each ordered stream that had messages abandoned, the chunk carries the largest abandoned stream sequence
+	///   number so the receiver can deliver what's queued behind it (RFC 3758, section 3.2).</remarks>
+	public class SctpForwardTsnMessage : SctpMessage {
+		uint _newCumulativeTsn;
+		ushort[] _streams;
+		int _streamCount;
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='SctpForwardTsnMessage'/> class.
+		/// </summary>
+		/// <param name="newCumulativeTsn">The TSN the receiver should treat as its new cumulative TSN.</param>
+		/// <param name="streams">Array of stream identifier and stream sequence number pairs, two elements per stream. This
+		///   can be <see langword='null'/> if <paramref name="streamCount"/> is zero.</param>
+		/// <param name="streamCount">Number of streams in <paramref name="streams"/>.</param>
+		/// <exception cref='ArgumentOutOfRangeException'><paramref name='streamCount'/> is negative or larger than
+		///   <paramref name="streams"/> allows.</exception>
+		[CLSCompliant(false)]
+		public SctpForwardTsnMessage( uint newCumulativeTsn, ushort[] streams, int streamCount )
+			: base( SctpChunkType.ForwardTsn, 0, GetLength( streams, streamCount ) ) {
+			_newCumulativeTsn = newCumulativeTsn;
+			_streams = streams;
+			_streamCount = streamCount;
+		}
+
+		private static int GetLength( ushort[] streams, int streamCount ) {
+			if( streamCount < 0 || streamCount * 2 > (streams == null ? 0 : streams.Length) )
+				throw new ArgumentOutOfRangeException( "streamCount" );
+
+			int length = 8 + streamCount * 4;
+
+			if( length > ushort.MaxValue )
+				throw new IOException( "The forward TSN chunk was too large." );
+
+			return length;
+		}
+
+		public override void CopyChunk( byte[] buffer, int offset ) {
+			base.CopyChunk( buffer, offset );
+
+			NetworkBitConverter.Copy( _newCumulativeTsn, buffer, offset + 4 );
+
+			for( int i = 0; i < _streamCount * 2; i++ )
+				NetworkBitConverter.Copy( _streams[i], buffer, offset + 8 + i * 2 );
+		}
+
+		/// <summary>
+		/// Gets the new cumulative TSN.
+		/// </summary>
+		/// <value>The TSN the receiver should treat as its new cumulative TSN.</value>
+		[CLSCompliant(false)]
+		public uint NewCumulativeTsn {
+			get { return _newCumulativeTsn; }
+		}
+
+		/// <summary>
+		/// Gets the number of streams listed in the chunk.
+		/// </summary>
+		/// <value>The number of stream and stream sequence number pairs in the chunk.</value>
+		public int StreamCount {
+			get { return _streamCount; }
+		}
+	}
+}
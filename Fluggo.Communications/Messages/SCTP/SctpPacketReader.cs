@@ -0,0 +1,210 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+
+namespace Fluggo.Communications {
+	/// <summary>
+	/// Walks the chunks of an SCTP packet in place.
+	/// </summary>
+	/// <remarks>The reader is a structure that only tracks offsets into the packet, so parsing a packet allocates nothing.
+	///     Call <see cref="MoveNext"/> to step to each chunk, then read its fields from <see cref="Buffer"/> starting at
+	///     <see cref="ChunkOffset"/>.
+	///   <para>The reader does not check the checksum on its own; call <see cref="IsChecksumValid"/> first.</para></remarks>
+	public struct SctpPacketReader {
+		byte[] _buffer;
+		int _start, _end, _next, _chunkOffset, _chunkLength;
+		bool _malformed;
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='SctpPacketReader'/> structure.
+		/// </summary>
+		/// <param name="buffer">Array containing the packet.</param>
+		/// <param name="offset">Offset in <paramref name="buffer"/> at which the packet begins.</param>
+		/// <param name="count">Length of the packet.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='buffer'/> is <see langword='null'/>.</exception>
+		/// <exception cref='ArgumentException'><paramref name='offset'/> and <paramref name='count'/> do not specify a valid
+		///   range in <paramref name="buffer"/>, or <paramref name="count"/> is shorter than the common header.</exception>
+		public SctpPacketReader( byte[] buffer, int offset, int count ) {
+			new ArraySegment<byte>( buffer, offset, count );
+
+			if( count < SctpPacketWriter.CommonHeaderLength )
+				throw new ArgumentException( "The packet is shorter than the SCTP common header.", "count" );
+
+			_buffer = buffer;
+			_start = offset;
+			_end = offset + count;
+			_next = offset + SctpPacketWriter.CommonHeaderLength;
+			_chunkOffset = -1;
+			_chunkLength = 0;
+			_malformed = false;
+		}
+
+	#region Common header
+		/// <summary>
+		/// Gets the source port from the common header.
+		/// </summary>
+		/// <value>The source port.</value>
+		[CLSCompliant(false)]
+		public ushort SourcePort {
+			get { return NetworkBitConverter.ToUInt16( _buffer, _start ); }
+		}
+
+		/// <summary>
+		/// Gets the destination port from the common header.
+		/// </summary>
+		/// <value>The destination port.</value>
+		[CLSCompliant(false)]
+		public ushort DestinationPort {
+			get { return NetworkBitConverter.ToUInt16( _buffer, _start + 2 ); }
+		}
+
+		/// <summary>
+		/// Gets the verification tag from the common header.
+		/// </summary>
+		/// <value>The verification tag.</value>
+		[CLSCompliant(false)]
+		public uint VerificationTag {
+			get { return NetworkBitConverter.ToUInt32( _buffer, _start + 4 ); }
+		}
+
+		/// <summary>
+		/// Gets a value that indicates whether the packet's CRC32c checksum is correct.
+		/// </summary>
+		/// <value>True if the checksum matches the packet, false otherwise.</value>
+		/// <remarks>The checksum is computed as though the checksum field were zero, without changing the packet.</remarks>
+		public bool IsChecksumValid {
+			get {
+				uint crc = Crc32c.Compute( _buffer, _start, 8 );
+				crc = Crc32c.Append( crc, __zeroChecksum, 0, 4 );
+				crc = Crc32c.Append( crc, _buffer, _start + SctpPacketWriter.CommonHeaderLength, _end - _start - SctpPacketWriter.CommonHeaderLength );
+
+				return crc == Crc32c.Read( _buffer, _start + 8 );
+			}
+		}
+
+		static readonly byte[] __zeroChecksum = new byte[4];
+	#endregion
+
+	#region Chunks
+		/// <summary>
+		/// Moves to the next chunk in the packet.
+		/// </summary>
+		/// <returns>True if the reader is on a chunk, or false if there are no more chunks or the next one is malformed.</returns>
+		public bool MoveNext() {
+			if( _malformed || _next + 4 > _end ) {
+				_chunkOffset = -1;
+				return false;
+			}
+
+			int length = NetworkBitConverter.ToUInt16( _buffer, _next + 2 );
+
+			if( length < 4 || _next + length > _end ) {
+				_malformed = true;
+				_chunkOffset = -1;
+				return false;
+			}
+
+			_chunkOffset = _next;
+			_chunkLength = length;
+
+			// Chunks are padded to a multiple of four bytes; the padding after the last one may be missing
+			_next = Math.Min( _next + ((length + 3) & ~3), _end );
+			return true;
+		}
+
+		/// <summary>
+		/// Stops reading, so that the next call to <see cref="MoveNext"/> returns false.
+		/// </summary>
+		/// <remarks>Use this for an unrecognized chunk type whose upper bits say to stop processing the packet.</remarks>
+		public void Stop() {
+			_next = _end;
+		}
+
+		/// <summary>
+		/// Gets a value that indicates whether reading stopped at a chunk with a bad length.
+		/// </summary>
+		/// <value>True if a chunk length ran past the end of the packet or was too short, false otherwise.</value>
+		public bool IsMalformed {
+			get { return _malformed; }
+		}
+
+		/// <summary>
+		/// Gets the array containing the packet.
+		/// </summary>
+		/// <value>The array passed to the constructor.</value>
+		public byte[] Buffer {
+			get { return _buffer; }
+		}
+
+		/// <summary>
+		/// Gets the offset of the current chunk.
+		/// </summary>
+		/// <value>The offset in <see cref="Buffer"/> of the current chunk's header.</value>
+		/// <exception cref='InvalidOperationException'>The reader is not on a chunk.</exception>
+		public int ChunkOffset {
+			get {
+				CheckChunk();
+				return _chunkOffset;
+			}
+		}
+
+		/// <summary>
+		/// Gets the unpadded length of the current chunk.
+		/// </summary>
+		/// <value>The length of the current chunk, including its header.</value>
+		/// <exception cref='InvalidOperationException'>The reader is not on a chunk.</exception>
+		public int ChunkLength {
+			get {
+				CheckChunk();
+				return _chunkLength;
+			}
+		}
+
+		/// <summary>
+		/// Gets the type of the current chunk.
+		/// </summary>
+		/// <value>The chunk type from the current chunk's header.</value>
+		/// <exception cref='InvalidOperationException'>The reader is not on a chunk.</exception>
+		public SctpChunkType ChunkType {
+			get {
+				CheckChunk();
+				return (SctpChunkType) _buffer[_chunkOffset];
+			}
+		}
+
+		/// <summary>
+		/// Gets the flags of the current chunk.
+		/// </summary>
+		/// <value>The flags from the current chunk's header.</value>
+		/// <exception cref='InvalidOperationException'>The reader is not on a chunk.</exception>
+		public byte ChunkFlags {
+			get {
+				CheckChunk();
+				return _buffer[_chunkOffset + 1];
+			}
+		}
+
+		private void CheckChunk() {
+			if( _chunkOffset < 0 )
+				throw new InvalidOperationException( "The reader is not positioned on a chunk." );
+		}
+	#endregion
+	}
+}
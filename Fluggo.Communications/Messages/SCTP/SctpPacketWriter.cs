@@ -0,0 +1,172 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+
+namespace Fluggo.Communications {
+	/// <summary>
+	/// Bundles SCTP chunks into a packet no larger than the path MTU.
+	/// </summary>
+	/// <remarks>The writer owns one buffer the size of the path MTU and builds each packet in place: the common header,
+	///     then each chunk padded to a multiple of four bytes, then the CRC32c checksum once the packet is finished. Control
+	///     chunks should be appended before DATA chunks (RFC 2960, section 6.10).
+	///   <para>The segment returned by <see cref="Finish"/> refers to the writer's buffer, so it must be sent before the
+	///     writer is reset. The writer is not thread-safe.</para></remarks>
+	public sealed class SctpPacketWriter {
+		/// <summary>
+		/// The length of the SCTP common header.
+		/// </summary>
+		public const int CommonHeaderLength = 12;
+
+		byte[] _buffer;
+		int _length, _chunkCount;
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='SctpPacketWriter'/> class.
+		/// </summary>
+		/// <param name="maximumLength">Largest packet to build, in bytes.</param>
+		/// <exception cref='ArgumentOutOfRangeException'><paramref name='maximumLength'/> is too small to hold the common
+		///   header and a chunk header.</exception>
+		public SctpPacketWriter( int maximumLength ) {
+			if( maximumLength < CommonHeaderLength + 4 )
+				throw new ArgumentOutOfRangeException( "maximumLength" );
+
+			_buffer = new byte[maximumLength];
+			Reset();
+		}
+
+		/// <summary>
+		/// Gets the largest packet the writer will build.
+		/// </summary>
+		/// <value>The maximum packet length, in bytes.</value>
+		public int MaximumLength {
+			get { return _buffer.Length; }
+		}
+
+		/// <summary>
+		/// Gets the length of the packet so far.
+		/// </summary>
+		/// <value>The number of bytes written, including the common header and padding.</value>
+		public int Length {
+			get { return _length; }
+		}
+
+		/// <summary>
+		/// Gets the number of chunks in the packet so far.
+		/// </summary>
+		/// <value>The number of chunks appended since the last reset.</value>
+		public int ChunkCount {
+			get { return _chunkCount; }
+		}
+
+		/// <summary>
+		/// Starts a new packet with zero ports and verification tag.
+		/// </summary>
+		public void Reset() {
+			Reset( 0, 0, 0 );
+		}
+
+		/// <summary>
+		/// Starts a new packet.
+		/// </summary>
+		/// <param name="sourcePort">Source port to put in the common header.</param>
+		/// <param name="destinationPort">Destination port to put in the common header.</param>
+		/// <param name="verificationTag">Verification tag to put in the common header.</param>
+		[CLSCompliant(false)]
+		public void Reset( ushort sourcePort, ushort destinationPort, uint verificationTag ) {
+			NetworkBitConverter.Copy( sourcePort, _buffer, 0 );
+			NetworkBitConverter.Copy( destinationPort, _buffer, 2 );
+			NetworkBitConverter.Copy( verificationTag, _buffer, 4 );
+			_length = CommonHeaderLength;
+			_chunkCount = 0;
+		}
+
+		/// <summary>
+		/// Determines whether a chunk of the given length would fit in the packet.
+		/// </summary>
+		/// <param name="chunkLength">Unpadded length of the chunk.</param>
+		/// <returns>True if the chunk would fit, false otherwise.</returns>
+		public bool CanAppend( int chunkLength ) {
+			return chunkLength >= 4 && _length + PadLength( chunkLength ) <= _buffer.Length;
+		}
+
+		/// <summary>
+		/// Adds a chunk to the packet if there's room.
+		/// </summary>
+		/// <param name="chunk">Chunk to add.</param>
+		/// <returns>True if the chunk was added, false if it didn't fit.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='chunk'/> is <see langword='null'/>.</exception>
+		public bool TryAppend( SctpMessage chunk ) {
+			if( chunk == null )
+				throw new ArgumentNullException( "chunk" );
+
+			if( !CanAppend( chunk.ChunkLength ) )
+				return false;
+
+			chunk.CopyChunk( _buffer, _length );
+			Advance( chunk.ChunkLength );
+			return true;
+		}
+
+		/// <summary>
+		/// Adds an encoded chunk to the packet if there's room.
+		/// </summary>
+		/// <param name="chunk">Array containing the chunk, as written by <see cref="SctpMessage.CopyChunk"/>.</param>
+		/// <param name="offset">Offset in <paramref name="chunk"/> at which the chunk begins.</param>
+		/// <param name="count">Unpadded length of the chunk.</param>
+		/// <returns>True if the chunk was added, false if it didn't fit.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='chunk'/> is <see langword='null'/>.</exception>
+		/// <exception cref='ArgumentException'><paramref name='offset'/> and <paramref name='count'/> do not specify a valid
+		///   range in <paramref name="chunk"/>.</exception>
+		public bool TryAppend( byte[] chunk, int offset, int count ) {
+			new ArraySegment<byte>( chunk, offset, count );
+
+			if( !CanAppend( count ) )
+				return false;
+
+			Buffer.BlockCopy( chunk, offset, _buffer, _length, count );
+			Advance( count );
+			return true;
+		}
+
+		/// <summary>
+		/// Computes the checksum and returns the finished packet.
+		/// </summary>
+		/// <returns>The packet, which refers to the writer's own buffer.</returns>
+		public ArraySegment<byte> Finish() {
+			NetworkBitConverter.Copy( 0, _buffer, 8 );
+			Crc32c.Write( Crc32c.Compute( _buffer, 0, _length ), _buffer, 8 );
+			return new ArraySegment<byte>( _buffer, 0, _length );
+		}
+
+		private void Advance( int chunkLength ) {
+			int padded = PadLength( chunkLength );
+
+			for( int i = _length + chunkLength; i < _length + padded; i++ )
+				_buffer[i] = 0;
+
+			_length += padded;
+			_chunkCount++;
+		}
+
+		private static int PadLength( int length ) {
+			return (length + 3) & ~3;
+		}
+	}
+}
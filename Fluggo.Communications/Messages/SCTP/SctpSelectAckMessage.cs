@@ -0,0 +1,128 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.IO;
+
+namespace Fluggo.Communications {
+	/// <summary>
+	/// Represents a selective acknowledgement (SACK) chunk.
+	/// </summary>
+	/// <remarks>Gap ack blocks are given as pairs of offsets from the cumulative TSN ack, start first, the way they
+	///   appear on the wire (RFC 2960, section 3.3.4).</remarks>
+	public class SctpSelectAckMessage : SctpMessage {
+		uint _cumulativeTsnAck;
+		int _receiveWindow;
+		ushort[] _gapBlocks;
+		uint[] _duplicateTsns;
+		int _gapBlockCount, _duplicateCount;
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='SctpSelectAckMessage'/> class.
+		/// </summary>
+		/// <param name="cumulativeTsnAck">The last TSN received before the first break in the sequence.</param>
+		/// <param name="receiveWindow">The receive window, in bytes, being advertised.</param>
+		/// <param name="gapBlocks">Array of start and end offsets of the gap ack blocks, two elements per block. This
+		///   can be <see langword='null'/> if <paramref name="gapBlockCount"/> is zero.</param>
+		/// <param name="gapBlockCount">Number of gap ack blocks in <paramref name="gapBlocks"/>.</param>
+		/// <param name="duplicateTsns">Array of duplicate TSNs received since the last SACK. This can be
+		///   <see langword='null'/> if <paramref name="duplicateCount"/> is zero.</param>
+		/// <param name="duplicateCount">Number of duplicate TSNs in <paramref name="duplicateTsns"/>.</param>
+		/// <exception cref='ArgumentOutOfRangeException'><paramref name='gapBlockCount'/> or <paramref name='duplicateCount'/>
+		///   is negative or larger than its array allows.</exception>
+		/// <remarks>The arrays are not copied, so they shouldn't be changed until the chunk has been copied out with
+		///   <see cref="CopyChunk"/>.</remarks>
+		[CLSCompliant(false)]
+		public SctpSelectAckMessage( uint cumulativeTsnAck, int receiveWindow, ushort[] gapBlocks, int gapBlockCount,
+				uint[] duplicateTsns, int duplicateCount )
+			: base( SctpChunkType.SelectAck, 0, GetLength( gapBlocks, gapBlockCount, duplicateTsns, duplicateCount ) ) {
+			_cumulativeTsnAck = cumulativeTsnAck;
+			_receiveWindow = receiveWindow;
+			_gapBlocks = gapBlocks;
+			_gapBlockCount = gapBlockCount;
+			_duplicateTsns = duplicateTsns;
+			_duplicateCount = duplicateCount;
+		}
+
+		private static int GetLength( ushort[] gapBlocks, int gapBlockCount, uint[] duplicateTsns, int duplicateCount ) {
+			if( gapBlockCount < 0 || gapBlockCount > ushort.MaxValue || gapBlockCount * 2 > (gapBlocks == null ? 0 : gapBlocks.Length) )
+				throw new ArgumentOutOfRangeException( "gapBlockCount" );
+
+			if( duplicateCount < 0 || duplicateCount > ushort.MaxValue || duplicateCount > (duplicateTsns == null ? 0 : duplicateTsns.Length) )
+				throw new ArgumentOutOfRangeException( "duplicateCount" );
+
+			int length = 16 + gapBlockCount * 4 + duplicateCount * 4;
+
+			if( length > ushort.MaxValue )
+				throw new IOException( "The selective acknowledgement was too large." );
+
+			return length;
+		}
+
+		public override void CopyChunk( byte[] buffer, int offset ) {
+			base.CopyChunk( buffer, offset );
+
+			NetworkBitConverter.Copy( _cumulativeTsnAck, buffer, offset + 4 );
+			NetworkBitConverter.Copy( _receiveWindow, buffer, offset + 8 );
+			NetworkBitConverter.Copy( (ushort) _gapBlockCount, buffer, offset + 12 );
+			NetworkBitConverter.Copy( (ushort) _duplicateCount, buffer, offset + 14 );
+
+			int index = offset + 16;
+
+			for( int i = 0; i < _gapBlockCount * 2; i++, index += 2 )
+				NetworkBitConverter.Copy( _gapBlocks[i], buffer, index );
+
+			for( int i = 0; i < _duplicateCount; i++, index += 4 )
+				NetworkBitConverter.Copy( _duplicateTsns[i], buffer, index );
+		}
+
+		/// <summary>
+		/// Gets the cumulative TSN ack.
+		/// </summary>
+		/// <value>The last TSN received before the first break in the sequence.</value>
+		[CLSCompliant(false)]
+		public uint CumulativeTsnAck {
+			get { return _cumulativeTsnAck; }
+		}
+
+		/// <summary>
+		/// Gets the advertised receive window.
+		/// </summary>
+		/// <value>The number of bytes the sender of the SACK has room to receive.</value>
+		public int ReceiveWindow {
+			get { return _receiveWindow; }
+		}
+
+		/// <summary>
+		/// Gets the number of gap ack blocks in the chunk.
+		/// </summary>
+		/// <value>The number of gap ack blocks in the chunk.</value>
+		public int GapBlockCount {
+			get { return _gapBlockCount; }
+		}
+
+		/// <summary>
+		/// Gets the number of duplicate TSNs reported in the chunk.
+		/// </summary>
+		/// <value>The number of duplicate TSNs reported in the chunk.</value>
+		public int DuplicateCount {
+			get { return _duplicateCount; }
+		}
+	}
+}
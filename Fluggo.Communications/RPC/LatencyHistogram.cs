@@ -0,0 +1,227 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Diagnostics;
+using System.Threading;
+
+namespace Fluggo.Communications {
+	/// <summary>
+	/// Records a distribution of latencies in microseconds.
+	/// </summary>
+	/// <remarks>Values are counted in logarithmic buckets, each power of two split into sixteen linear sub-buckets, so any
+	///     recorded value can be recovered to within about six percent no matter how large it is. The histogram uses a fixed
+	///     amount of memory and never allocates after it is created.
+	///   <para>Recording a value takes a handful of interlocked operations and no locks, so any number of threads can record
+	///     into the same histogram at once. Statistics read from a live histogram may be slightly out of step with each other;
+	///     call <see cref="CreateSnapshot"/> to get a copy that doesn't change.</para></remarks>
+	public sealed class LatencyHistogram {
+		const int __subBucketBitLength = 4, __subBucketCount = 1 << __subBucketBitLength;
+		const int __linearBucketCount = __subBucketCount * 2;
+		const int __bucketCount = __linearBucketCount + (62 - __subBucketBitLength) * __subBucketCount;
+
+		long[] _buckets = new long[__bucketCount];
+		long _count, _total, _max;
+
+		/// <summary>
+		/// Records a latency.
+		/// </summary>
+		/// <param name="microseconds">Latency to record, in microseconds. Negative values are recorded as zero.</param>
+		public void Record( long microseconds ) {
+			if( microseconds < 0 )
+				microseconds = 0;
+
+			Interlocked.Increment( ref _buckets[GetBucketIndex( microseconds )] );
+			Interlocked.Increment( ref _count );
+			Interlocked.Add( ref _total, microseconds );
+
+			long max = Interlocked.Read( ref _max );
+
+			while( microseconds > max ) {
+				long oldMax = Interlocked.CompareExchange( ref _max, microseconds, max );
+
+				if( oldMax == max )
+					break;
+
+				max = oldMax;
+			}
+		}
+
+		/// <summary>
+		/// Records the time elapsed since a <see cref="Stopwatch"/> timestamp.
+		/// </summary>
+		/// <param name="startTimestamp">Value returned from <see cref="Stopwatch.GetTimestamp"/> when the timed operation started.</param>
+		public void RecordSince( long startTimestamp ) {
+			Record( TimestampToMicroseconds( Stopwatch.GetTimestamp() - startTimestamp ) );
+		}
+
+		/// <summary>
+		/// Gets the number of values recorded.
+		/// </summary>
+		/// <value>The number of values recorded.</value>
+		public long Count {
+			get {
+				return Interlocked.Read( ref _count );
+			}
+		}
+
+		/// <summary>
+		/// Gets the largest value recorded.
+		/// </summary>
+		/// <value>The largest value recorded, in microseconds, or zero if no values have been recorded.</value>
+		public long Max {
+			get {
+				return Interlocked.Read( ref _max );
+			}
+		}
+
+		/// <summary>
+		/// Gets the mean of the values recorded.
+		/// </summary>
+		/// <value>The mean of the values recorded, in microseconds, or zero if no values have been recorded.</value>
+		public double Mean {
+			get {
+				long count = Count;
+
+				if( count == 0 )
+					return 0.0;
+
+				return (double) Interlocked.Read( ref _total ) / (double) count;
+			}
+		}
+
+		/// <summary>
+		/// Gets the value at the given percentile.
+		/// </summary>
+		/// <param name="percentile">Percentile to find, from zero to one hundred. For example, 99.9 finds the value that
+		///   99.9 percent of the recorded values are at or below.</param>
+		/// <returns>The largest value that falls in the same bucket as the value at the given percentile, in microseconds,
+		///   or zero if no values have been recorded.</returns>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="percentile"/> is less than zero or greater than one hundred.</exception>
+		public long GetValueAtPercentile( double percentile ) {
+			if( percentile < 0.0 || percentile > 100.0 )
+				throw new ArgumentOutOfRangeException( "percentile" );
+
+			long total = 0;
+
+			for( int i = 0; i < _buckets.Length; i++ )
+				total += Interlocked.Read( ref _buckets[i] );
+
+			if( total == 0 )
+				return 0;
+
+			long rank = (long) Math.Ceiling( percentile / 100.0 * (double) total );
+
+			if( rank < 1 )
+				rank = 1;
+
+			long seen = 0;
+
+			for( int i = 0; i < _buckets.Length; i++ ) {
+				seen += Interlocked.Read( ref _buckets[i] );
+
+				if( seen >= rank )
+					return Math.Min( GetBucketHighValue( i ), Max );
+			}
+
+			return Max;
+		}
+
+		/// <summary>
+		/// Gets the median of the values recorded.
+		/// </summary>
+		/// <value>The value at the fiftieth percentile, in microseconds.</value>
+		public long P50 {
+			get {
+				return GetValueAtPercentile( 50.0 );
+			}
+		}
+
+		/// <summary>
+		/// Gets the value at the 99th percentile.
+		/// </summary>
+		/// <value>The value at the 99th percentile, in microseconds.</value>
+		public long P99 {
+			get {
+				return GetValueAtPercentile( 99.0 );
+			}
+		}
+
+		/// <summary>
+		/// Gets the value at the 99.9th percentile.
+		/// </summary>
+		/// <value>The value at the 99.9th percentile, in microseconds.</value>
+		public long P999 {
+			get {
+				return GetValueAtPercentile( 99.9 );
+			}
+		}
+
+		/// <summary>
+		/// Creates a copy of the histogram as it is now.
+		/// </summary>
+		/// <returns>A new <see cref="LatencyHistogram"/> with the same values as this one.</returns>
+		public LatencyHistogram CreateSnapshot() {
+			LatencyHistogram result = new LatencyHistogram();
+
+			for( int i = 0; i < _buckets.Length; i++ ) {
+				long count = Interlocked.Read( ref _buckets[i] );
+				result._buckets[i] = count;
+				result._count += count;
+			}
+
+			result._total = Interlocked.Read( ref _total );
+			result._max = Interlocked.Read( ref _max );
+
+			return result;
+		}
+
+		/// <summary>
+		/// Converts a difference of <see cref="Stopwatch"/> timestamps to microseconds.
+		/// </summary>
+		/// <param name="timestampDelta">Difference of two values returned from <see cref="Stopwatch.GetTimestamp"/>.</param>
+		/// <returns>The equivalent number of microseconds.</returns>
+		public static long TimestampToMicroseconds( long timestampDelta ) {
+			return (long)((double) timestampDelta * 1000000.0 / (double) Stopwatch.Frequency);
+		}
+
+		private static int GetBucketIndex( long value ) {
+			if( value < __linearBucketCount )
+				return (int) value;
+
+			// Shift the value down until only the most significant bit and the sub-bucket bits below it are left
+			int shift = 1;
+
+			while( (value >> shift) >= __linearBucketCount )
+				shift++;
+
+			return __linearBucketCount + (shift - 1) * __subBucketCount + (int)(value >> shift) - __subBucketCount;
+		}
+
+		private static long GetBucketHighValue( int index ) {
+			if( index < __linearBucketCount )
+				return index;
+
+			int shift = (index - __linearBucketCount) / __subBucketCount + 1;
+			long subBucket = (index - __linearBucketCount) % __subBucketCount + __subBucketCount;
+
+			return ((subBucket + 1) << shift) - 1;
+		}
+	}
+}
@@ -40,17 +40,31 @@ namespace Fluggo.Communications
 		ChannelMultiplexer _mux;
 		Channel _shortRpcChannel;
 		UnidirectionalStreamPool _pool;
-		Dictionary<int, OutboundStreamRequest> _outboundsWaitingForResponses = new Dictionary<int, OutboundStreamRequest>();
+		CallTable _outboundsWaitingForResponses = new CallTable();
 		IRequestFactoryProvider _factoryProvider;
-		Dictionary<int, IRequestReceiver> _localTargets = new Dictionary<int, IRequestReceiver>();
+		Dictionary<int, LocalTarget> _localTargets = new Dictionary<int, LocalTarget>();
+		Dictionary<string, int> _localTargetIDs = new Dictionary<string, int>();
+		int _nextLocalTargetID;
+		Dictionary<string, Dictionary<Guid, LongRequestTarget>> _remoteTargets = new Dictionary<string, Dictionary<Guid, LongRequestTarget>>();
+		int _shortFormThreshold = 8;
+		TimeSpan _missingTargetTimeout = TimeSpan.FromSeconds( 30.0 );
+		const int __maxLocalTargets = 4096;
 		IServiceProvider _serviceProvider;
 		IResourceProvider _resourceProvider;
 		AsyncCallback _receiveStreamCallback, _receiveMessageCallback;
 		IRequestControlService _abortService;
 		const int __callIDBitLength = 24, __contextIDBitLength = 16, __targetIDBitLength = 32;
 		const int __uriLength = 256;
-		int _nextCallID = 0;
 //		int _defaultBufferSize = 8192;
+		bool _batchShortCalls;
+		object _batchLock = new object();
+		byte[] _batch;
+		int _batchCount;
+		bool _batchFlushQueued;
+		WaitCallback _flushBatchCallback;
+		RequestDispatcher _dispatcher;
+		RpcMetrics _metrics;
+		const int __batchRecordLengthBitLength = 16;
 		
 		public RequestChannel( IServiceProvider serviceProvider, IRequestFactoryProvider factoryProvider, ChannelMultiplexer mux, int startIndex, int count ) {
 			if( mux == null )
@@ -78,6 +92,7 @@ namespace Fluggo.Communications
 			
 			_receiveStreamCallback = HandleReceiveStream;
 			_receiveMessageCallback = HandleReceiveMessage;
+			_flushBatchCallback = HandleFlushBatch;
 
 			// Channel interfaces
 			//_receiverFactories.Add( typeof( IRequestControlService ).GUID, new AbortRequestReceiverFactory() );
@@ -98,6 +113,26 @@ namespace Fluggo.Communications
 
 			_pool.BeginReceiveStream( _receiveStreamCallback, null );
 		}
+
+		/// <summary>
+		/// Gets or sets a value that represents whether small calls are batched on the short call channel.
+		/// </summary>
+		/// <value>True if small requests and responses are packed together into batch messages, false if each is sent
+		///   in its own message. The default is false.</value>
+		/// <remarks>When batching is on, a small call is added to a pending batch message instead of being sent right away.
+		///     The batch is sent when it fills up or when a thread pool thread gets around to it, whichever comes first, so
+		///     calls made in quick succession share a message. Each call in the batch keeps its own call ID, so responses
+		///     are matched to requests exactly as they are without batching.
+		///   <para>All channels can receive batches, but only turn this on when the far end is known to understand them.
+		///     This setting has no effect on channels created with only one stream.</para></remarks>
+		public bool BatchShortCalls {
+			get {
+				return _batchShortCalls;
+			}
+			set {
+				_batchShortCalls = value;
+			}
+		}
 		
 		class TargetRegistration {
 			Guid _iid;
@@ -149,6 +184,12 @@ namespace Fluggo.Communications
 			/// a target ID.
 			/// </summary>
 			ShortForm = 4,
+
+			/// <summary>
+			/// The message is a batch of complete messages. The flags will be followed by a series of records, each of which
+			/// is a 16-bit length followed by a message of that many bytes. No other flags are set on the batch itself.
+			/// </summary>
+			Batch = 8,
 		}
 
 		// Services which should appear in the basic RPC service:
@@ -240,7 +281,15 @@ namespace Fluggo.Communications
 				_shortRpcChannel.BeginReceive( _receiveMessageCallback, null );
 				calledNext = true;
 				
-				HandleInboundStream( buffer.GetStream() );
+				byte[] flags = new byte[1];
+
+				if( buffer.Length != 0 )
+					buffer.CopyTo( 0, flags, 0, 1 );
+
+				if( ((RpcMessageFlags) flags[0] & RpcMessageFlags.Batch) == RpcMessageFlags.Batch )
+					HandleInboundBatch( buffer );
+				else
+					HandleInboundStream( buffer.GetStream() );
 			}
 			catch( Exception ex ) {
 				#warning Report warning/error message back, and funnel the stream into /dev/null to clear the channel
@@ -281,9 +330,108 @@ namespace Fluggo.Communications
 			}
 		}
 		
+		private void HandleInboundBatch( IMessageBuffer buffer ) {
+			byte[] batch = new byte[buffer.Length];
+			buffer.CopyTo( batch, 0 );
+
+			int offset = 1;
+
+			while( offset != batch.Length ) {
+				if( batch.Length - offset < 2 ) {
+					_ts.TraceEvent( TraceEventType.Error, 0, "A batch message ended in the middle of a record header." );
+					return;
+				}
+
+				int length = (batch[offset] << 8) | batch[offset + 1];
+				offset += 2;
+
+				if( length > batch.Length - offset ) {
+					_ts.TraceEvent( TraceEventType.Error, 0, "A batch message contained a record that ran past the end of the message." );
+					return;
+				}
+
+				HandleInboundStream( new MemoryStream( batch, offset, length, false ) );
+				offset += length;
+			}
+		}
+
+		/// <summary>
+		/// Sends a complete small request or response on the short call channel, batching it if requested.
+		/// </summary>
+		/// <param name="buffer">Buffer containing the message.</param>
+		/// <param name="count">Length of the message.</param>
+		private void SendShortMessage( byte[] buffer, int count ) {
+			int maxLength = _shortRpcChannel.MaximumPayloadLength;
+			bool batchable = count <= (1 << __batchRecordLengthBitLength) - 1 && count + 3 <= maxLength;
+
+			if( !_batchShortCalls || !batchable ) {
+				lock( _batchLock ) {
+					if( _batchCount != 0 ) {
+						// Keep this message behind the ones already waiting in the batch
+						FlushBatch();
+						_shortRpcChannel.Send( buffer, 0, count );
+						return;
+					}
+				}
+
+				_shortRpcChannel.Send( buffer, 0, count );
+				return;
+			}
+
+			lock( _batchLock ) {
+				if( _batch == null || _batch.Length != maxLength )
+					_batch = new byte[maxLength];
+
+				if( _batchCount + 2 + count > _batch.Length )
+					FlushBatch();
+
+				if( _batchCount == 0 )
+					_batch[_batchCount++] = (byte) RpcMessageFlags.Batch;
+
+				_batch[_batchCount++] = (byte)(count >> 8);
+				_batch[_batchCount++] = (byte) count;
+				Buffer.BlockCopy( buffer, 0, _batch, _batchCount, count );
+				_batchCount += count;
+
+				if( !_batchFlushQueued ) {
+					_batchFlushQueued = true;
+					ThreadPool.QueueUserWorkItem( _flushBatchCallback );
+				}
+			}
+		}
+
+		private void HandleFlushBatch( object state ) {
+			try {
+				lock( _batchLock ) {
+					_batchFlushQueued = false;
+					FlushBatch();
+				}
+			}
+			catch( Exception ex ) {
+				_ts.TraceEvent( TraceEventType.Error, 0, "A batch of short calls could not be sent: {0}", ex.Message );
+			}
+		}
+
+		/// <summary>
+		/// Sends the pending batch, if any. The caller must hold the batch lock.
+		/// </summary>
+		private void FlushBatch() {
+			if( _batchCount == 0 )
+				return;
+
+			try {
+				_shortRpcChannel.Send( _batch, 0, _batchCount );
+			}
+			finally {
+				_batchCount = 0;
+			}
+		}
+		
 		private void HandleInboundStream( Stream stream ) {
 			RpcMessageFlags flags = RpcMessageFlags.None;
 			int callID = -1;
+			RpcMetrics metrics = _metrics;
+			long startTimestamp = (metrics != null) ? Stopwatch.GetTimestamp() : 0;
 		
 			try {
 				BitReader reader = new BitReader( stream, 1 );
@@ -292,17 +440,13 @@ namespace Fluggo.Communications
 				
 				if( (flags & RpcMessageFlags.Response) == RpcMessageFlags.Response ) {
 					try {
-						lock( _outboundsWaitingForResponses ) {
-							// Response
-							OutboundStreamRequest request;
+						// Response
+						OutboundStreamRequest request = _outboundsWaitingForResponses.Take( callID );
 
-							if( !_outboundsWaitingForResponses.TryGetValue( callID, out request ) ) {
-								throw new Exception( "Response received for an invalid call #" + callID.ToString() );
-							}
-							
-							request.SetResponseStream( stream );
-							_outboundsWaitingForResponses.Remove( callID );
-						}
+						if( request == null )
+							throw new Exception( "Response received for an invalid call #" + callID.ToString() );
+						
+						request.SetResponseStream( stream );
 					}
 					catch( Exception ex ) {
 						_ts.TraceEvent( TraceEventType.Information, 0, "Aborting inbound response {0}: {1}", callID, ex.Message );
@@ -311,30 +455,60 @@ namespace Fluggo.Communications
 					}
 				}
 				else {
+					Guid iid = Guid.Empty;
+
 					try {
 						// Request
 						int contextID = reader.ReadInt32( __contextIDBitLength );
 						IRequestReceiver receiver;
+						string target;
 						
 						if( (flags & RpcMessageFlags.ShortForm) == RpcMessageFlags.ShortForm ) {
-							int targetID = reader.ReadInt32( __targetIDBitLength );
-							receiver = GetRequestReceiver( targetID );
+							LocalTarget local = GetLocalTarget( reader.ReadInt32( __targetIDBitLength ) );
+							receiver = local.Receiver;
+							iid = local.InterfaceID;
+							target = local.ServiceUri;
 						}
 						else {
-							Guid iid = new Guid( reader.ReadBytes( 16 ) );
+							iid = new Guid( reader.ReadBytes( 16 ) );
 							string uri = reader.ReadString( __uriLength );
-							receiver = GetRequestReceiver( uri, iid );
+							target = uri;
+
+							try {
+								receiver = GetRequestReceiver( uri, iid );
+							}
+							catch {
+								// Let the caller know not to bother asking again for a while
+								if( uri.Length != 0 )
+									_abortService.DeclareTarget( uri, iid, -1 );
+
+								throw;
+							}
 						}
 						
 						InboundStreamRequest request = new InboundStreamRequest( this, new NotifyEndStream( stream, null, null ), callID,
 							(flags & RpcMessageFlags.OneWay) == RpcMessageFlags.OneWay );
 						
-						receiver.ProcessRequest( request );
+						RequestDispatcher dispatcher = _dispatcher;
+
+						if( dispatcher == null ) {
+							ProcessInboundRequest( receiver, request, callID, stream, iid, startTimestamp );
+						}
+						else {
+							if( !dispatcher.TryDispatch( iid, target, contextID, delegate {
+									ProcessInboundRequest( receiver, request, callID, stream, iid, startTimestamp );
+								} ) )
+								throw new Exception( "The server is too busy to accept the request." );
+						}
 					}
 					catch( Exception ex ) {
 						_ts.TraceEvent( TraceEventType.Information, 0, "Aborting inbound request {0}: {1}", callID, ex.Message );
 						_abortService.AbortRequest( false, callID, ex.Message );
 						Pipe.Redirect( stream, Stream.Null );
+
+						// A request whose target couldn't be resolved has no interface to be counted under
+						if( metrics != null && iid != Guid.Empty )
+							metrics.GetCallMetrics( false, iid, 0, 0 ).RecordAbort();
 					}
 				}
 			}
@@ -343,12 +517,132 @@ namespace Fluggo.Communications
 				Pipe.Redirect( stream, Stream.Null );
 			}
 		}
+
+		private void ProcessInboundRequest( IRequestReceiver receiver, InboundStreamRequest request, int callID, Stream stream, Guid iid, long startTimestamp ) {
+			RpcMetrics metrics = _metrics;
+
+			try {
+				receiver.ProcessRequest( request );
+
+				if( metrics != null ) {
+					RpcCallMetrics callMetrics = request.GetCallMetrics( metrics, iid );
+					callMetrics.RecordCall( startTimestamp );
+					callMetrics.RecordRequestBytes( request.RequestBytes );
+					callMetrics.RecordResponseBytes( request.ResponseBytes );
+				}
+			}
+			catch( Exception ex ) {
+				_ts.TraceEvent( TraceEventType.Information, 0, "Aborting inbound request {0}: {1}", callID, ex.Message );
+				_abortService.AbortRequest( false, callID, ex.Message );
+				Pipe.Redirect( stream, Stream.Null );
+
+				if( metrics != null )
+					request.GetCallMetrics( metrics, iid ).RecordAbort();
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the dispatcher that runs inbound requests.
+		/// </summary>
+		/// <value>A <see cref="RequestDispatcher"/> that runs inbound requests on the thread pool within its limits, or
+		///   <see langword='null'/> to run each request on the thread that received it. The default is <see langword='null'/>.</value>
+		/// <remarks>Requests that the dispatcher rejects are aborted back to the caller.</remarks>
+		public RequestDispatcher Dispatcher {
+			get {
+				return _dispatcher;
+			}
+			set {
+				_dispatcher = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the metrics collected for calls on this channel.
+		/// </summary>
+		/// <value>An <see cref="RpcMetrics"/> that records every call made or received on this channel, or <see langword='null'/>
+		///   to collect no metrics. The default is <see langword='null'/>.</value>
+		/// <remarks>Register the interfaces used on the channel with <see cref="RpcMetrics.RegisterInterface"/> to have their
+		///     calls counted by method. Window stalls are read from the multiplexer under this channel.
+		///   <para>Calls already in progress when this property is set are not recorded.</para></remarks>
+		/// <exception cref="InvalidOperationException">The given metrics are already in use on another multiplexer.</exception>
+		public RpcMetrics Metrics {
+			get {
+				return _metrics;
+			}
+			set {
+				if( value != null ) {
+					value.Attach( _mux );
+					value.RegisterInterface( typeof(IRequestControlService) );
+				}
+
+				_metrics = value;
+			}
+		}
+
+		/// <summary>
+		/// Collects the leading bits of a call payload, which hold the method code.
+		/// </summary>
+		/// <param name="lead">Reference to the bits collected so far, most significant bit first.</param>
+		/// <param name="leadBitCount">Reference to the number of bits collected so far.</param>
+		/// <param name="buffer">Buffer containing the next bytes of the payload.</param>
+		/// <param name="offset">Offset of the next bytes in <paramref name="buffer"/>.</param>
+		/// <param name="count">Number of bytes available in <paramref name="buffer"/>.</param>
+		private static void CaptureLead( ref uint lead, ref int leadBitCount, byte[] buffer, int offset, int count ) {
+			while( leadBitCount < 32 && count-- > 0 ) {
+				lead |= (uint) buffer[offset++] << (24 - leadBitCount);
+				leadBitCount += 8;
+			}
+		}
 		
-	#region RequestSenderResolve
-/*		private object GetRequestSender( int targetID ) {
-			return _localTargets[targetID];			// Throws exception if not found
-		}*/
+		/// <summary>
+		/// Gets or sets the number of calls after which a target is switched to the short form.
+		/// </summary>
+		/// <value>The number of long-form calls made to a target before the far end is asked to assign it a short target ID,
+		///   or zero to never ask. The default is eight.</value>
+		/// <remarks>Once the far end assigns an ID, calls to the target carry the 32-bit ID in place of the interface GUID
+		///   and the target URI. Far ends that don't support this ignore the request, and the target stays in the long form.</remarks>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="value"/> is less than zero.</exception>
+		public int ShortFormThreshold {
+			get {
+				return _shortFormThreshold;
+			}
+			set {
+				if( value < 0 )
+					throw new ArgumentOutOfRangeException( "value" );
 
+				_shortFormThreshold = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets how long a target the far end doesn't have is remembered as missing.
+		/// </summary>
+		/// <value>The length of time calls to a missing target fail without being sent. The default is thirty seconds.</value>
+		/// <remarks>When the far end can't find the service for a call, it says so, and the target is marked missing. Until the
+		///   time runs out, new calls to the target fail immediately and <see cref="IsTargetMissing"/> returns true.</remarks>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="value"/> is less than zero.</exception>
+		public TimeSpan MissingTargetTimeout {
+			get {
+				return _missingTargetTimeout;
+			}
+			set {
+				if( value < TimeSpan.Zero )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_missingTargetTimeout = value;
+			}
+		}
+
+	#region RequestSenderResolve
+		/// <summary>
+		/// Gets a proxy for a service on the far end.
+		/// </summary>
+		/// <param name="path">Path of the resource offering the service.</param>
+		/// <param name="iid">GUID of the service interface.</param>
+		/// <returns>A proxy that implements the service interface by making calls across the channel.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='path'/> is <see langword='null'/>.</exception>
+		/// <exception cref="ArgumentException"><paramref name="path"/> is empty.</exception>
+		/// <remarks>Proxies are cached, so asking for the same path and interface again returns the same proxy.</remarks>
 		public object GetRequestSender( string path, Guid iid ) {
 			if( path == null )
 				throw new ArgumentNullException( "path" );
@@ -367,7 +661,90 @@ namespace Fluggo.Communications
 /*			if( path != ResourceTable.RootPath && _resourceProvider == null )
 				throw new Exception( "External resources are not available on this channel." );*/
 
-			return ResolveRequestSender( iid ).CreateRequestSender( new LongRequestTarget( this, path, iid ) );
+			LongRequestTarget target = GetRemoteTarget( path, iid, true );
+			object proxy = target.Proxy;
+
+			if( proxy == null ) {
+				// Two threads may race to create the proxy, but proxies are interchangeable
+				proxy = ResolveRequestSender( iid ).CreateRequestSender( target );
+				target.Proxy = proxy;
+			}
+
+			return proxy;
+		}
+
+		/// <summary>
+		/// Determines whether the far end has recently reported that it has no service at the given path.
+		/// </summary>
+		/// <param name="path">Path of the resource offering the service.</param>
+		/// <param name="iid">GUID of the service interface.</param>
+		/// <returns>True if calls to the service are known to fail, false otherwise.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='path'/> is <see langword='null'/>.</exception>
+		public bool IsTargetMissing( string path, Guid iid ) {
+			if( path == null )
+				throw new ArgumentNullException( "path" );
+
+			LongRequestTarget target = GetRemoteTarget( path, iid, false );
+			return target != null && target.IsMissing;
+		}
+
+		private LongRequestTarget GetRemoteTarget( string path, Guid iid, bool create ) {
+			lock( _remoteTargets ) {
+				Dictionary<Guid, LongRequestTarget> targets;
+				LongRequestTarget target;
+
+				if( !_remoteTargets.TryGetValue( path, out targets ) ) {
+					if( !create )
+						return null;
+
+					targets = new Dictionary<Guid, LongRequestTarget>();
+					_remoteTargets.Add( path, targets );
+				}
+
+				if( !targets.TryGetValue( iid, out target ) && create ) {
+					target = new LongRequestTarget( this, path, iid );
+					targets.Add( iid, target );
+				}
+
+				return target;
+			}
+		}
+
+		/// <summary>
+		/// Asks the far end to assign a short target ID to a busy target.
+		/// </summary>
+		/// <param name="target">Target to promote.</param>
+		private void RequestShortForm( LongRequestTarget target ) {
+			try {
+				_abortService.RequestTargetID( target.ServiceUri, target.InterfaceID );
+			}
+			catch( Exception ex ) {
+				_ts.TraceEvent( TraceEventType.Warning, 0, "Could not request a target ID for {0} at \"{1}\": {2}", target.InterfaceID, target.ServiceUri, ex.Message );
+			}
+		}
+
+		/// <summary>
+		/// Handles the far end's answer to a target ID request or a failed call.
+		/// </summary>
+		/// <param name="uri">URI of the target.</param>
+		/// <param name="iid">GUID of the target interface.</param>
+		/// <param name="targetID">The short target ID assigned by the far end, or -1 if the far end has no such target.</param>
+		private void DeclareLocalTarget( string uri, Guid iid, int targetID ) {
+			LongRequestTarget target = GetRemoteTarget( uri, iid, false );
+
+			if( target == null ) {
+				_ts.TraceEvent( TraceEventType.Information, 0, "Far end declared target ID {0} for unknown target {1} at \"{2}\"", targetID, iid, uri );
+				return;
+			}
+
+			if( targetID == -1 ) {
+				_ts.TraceEvent( TraceEventType.Information, 0, "Far end has no target {0} at \"{1}\"", iid, uri );
+				target.MarkMissing( DateTime.UtcNow + _missingTargetTimeout );
+			}
+			else {
+				_ts.TraceEvent( TraceEventType.Verbose, 0, "Far end assigned target ID {0} to {1} at \"{2}\"", targetID, iid, uri );
+				target.Promote( new ShortRequestTarget( this, new TargetRegistration( targetID, uri, iid ) ) );
+			}
 		}
 
 		private RequestSenderFactory ResolveRequestSender( Guid guid ) {
@@ -400,8 +777,75 @@ namespace Fluggo.Communications
 	#endregion
 		
 	#region RequestReceiverResolve
-		private IRequestReceiver GetRequestReceiver( int targetID ) {
-			return _localTargets[targetID];			// Throws exception if not found
+		/// <summary>
+		/// Represents a local target that the far end can call with a short target ID.
+		/// </summary>
+		sealed class LocalTarget : TargetRegistration {
+			IRequestReceiver _receiver;
+
+			public LocalTarget( int localTargetID, string uri, Guid iid, IRequestReceiver receiver )
+				: base( localTargetID, uri, iid ) {
+				if( receiver == null )
+					throw new ArgumentNullException( "receiver" );
+
+				_receiver = receiver;
+			}
+
+			public IRequestReceiver Receiver
+				{ get { return _receiver; } }
+		}
+
+		private LocalTarget GetLocalTarget( int targetID ) {
+			lock( _localTargets ) {
+				return _localTargets[targetID];			// Throws exception if not found
+			}
+		}
+
+		/// <summary>
+		/// Assigns a short target ID to a local target at the far end's request, and sends the answer back.
+		/// </summary>
+		/// <param name="uri">URI of the target.</param>
+		/// <param name="iid">GUID of the target interface.</param>
+		/// <remarks>The receiver is resolved once and kept for the life of the channel.</remarks>
+		private void AssignLocalTargetID( string uri, Guid iid ) {
+			if( uri.Length == 0 )
+				return;
+
+			string key = iid.ToString() + uri;
+			int targetID;
+
+			lock( _localTargets ) {
+				if( _localTargetIDs.TryGetValue( key, out targetID ) ) {
+					_abortService.DeclareTarget( uri, iid, targetID );
+					return;
+				}
+
+				if( _localTargets.Count >= __maxLocalTargets ) {
+					_ts.TraceEvent( TraceEventType.Warning, 0, "Out of short target IDs; {0} at \"{1}\" stays in the long form", iid, uri );
+					return;
+				}
+			}
+
+			IRequestReceiver receiver;
+
+			try {
+				receiver = GetRequestReceiver( uri, iid );
+			}
+			catch( Exception ex ) {
+				_ts.TraceEvent( TraceEventType.Information, 0, "Could not assign a target ID to {0} at \"{1}\": {2}", iid, uri, ex.Message );
+				_abortService.DeclareTarget( uri, iid, -1 );
+				return;
+			}
+
+			lock( _localTargets ) {
+				if( !_localTargetIDs.TryGetValue( key, out targetID ) ) {
+					targetID = _nextLocalTargetID++;
+					_localTargets.Add( targetID, new LocalTarget( targetID, uri, iid, receiver ) );
+					_localTargetIDs.Add( key, targetID );
+				}
+			}
+
+			_abortService.DeclareTarget( uri, iid, targetID );
 		}
 		
 		private IRequestReceiver GetRequestReceiver( string uri, Guid iid ) {
@@ -467,26 +911,132 @@ namespace Fluggo.Communications
 		/// Allocates an outbound call ID to the given request.
 		/// </summary>
 		/// <param name="request"><see cref="OutboundStreamRequest"/> which needs a call ID.</param>
+		/// <param name="oneWay">True if the request expects no response. The call ID of a one-way request is
+		///   released immediately, since nothing will ever come back to release it.</param>
 		/// <returns>A call ID for the given request.</returns>
-		private int AllocateCallID( OutboundStreamRequest request ) {
-			lock( _outboundsWaitingForResponses ) {
-				if( _outboundsWaitingForResponses.Count == (1 << __callIDBitLength) )
-					throw new IOException( "An outbound call ID could not be allocated because the active call table is full." );
-			
-				// Find an empty call ID
-				for( ;; ) {
-					int nextCallID = _nextCallID++;
+		private int AllocateCallID( OutboundStreamRequest request, bool oneWay ) {
+			int callID = _outboundsWaitingForResponses.Allocate( request );
 
-					if( _nextCallID == (1 << __callIDBitLength) )
-						_nextCallID = 0;
+			if( oneWay )
+				_outboundsWaitingForResponses.Take( callID );
 
-					if( !_outboundsWaitingForResponses.ContainsKey( nextCallID ) ) {
-						_outboundsWaitingForResponses[nextCallID] = request;
-						return nextCallID;
+			return callID;
+		}
+
+	#region CallTable
+		/// <summary>
+		/// Tracks outbound requests that are waiting for responses.
+		/// </summary>
+		/// <remarks>Call IDs are made of a slot index in the low bits and a generation counter in the high bits. Free slots
+		///     are kept on a free list, so allocating and releasing an ID take constant time no matter how full the table is.
+		///     The generation is bumped each time a slot is released, so a late or bogus response for a recycled slot doesn't
+		///     match the slot's new request.
+		///   <para>Slots are stored in fixed-size chunks that are allocated as the table grows and never moved. Matching a
+		///     response only reads the chunk and swaps the slot out with a compare-exchange; the table's lock is only taken
+		///     to push and pop the free list.</para></remarks>
+		sealed class CallTable {
+			const int __slotBitLength = 16, __chunkBitLength = 8;
+			const int __generationMask = (1 << (__callIDBitLength - __slotBitLength)) - 1;
+			const int __slotMask = (1 << __slotBitLength) - 1, __chunkMask = (1 << __chunkBitLength) - 1;
+
+			sealed class Chunk {
+				public OutboundStreamRequest[] Requests = new OutboundStreamRequest[1 << __chunkBitLength];
+				public int[] Generations = new int[1 << __chunkBitLength];
+				public int[] NextFree = new int[1 << __chunkBitLength];
+			}
+
+			Chunk[] _chunks = new Chunk[1 << (__slotBitLength - __chunkBitLength)];
+			object _lock = new object();
+			int _freeHead = -1, _slotCount, _activeCount;
+
+			/// <summary>
+			/// Gets the number of requests in the table.
+			/// </summary>
+			/// <value>The number of call IDs currently allocated.</value>
+			public int Count {
+				get { return _activeCount; }
+			}
+
+			/// <summary>
+			/// Allocates a call ID and stores the request under it.
+			/// </summary>
+			/// <param name="request">Request to store. Its <see cref="OutboundStreamRequest.CallID"/> is set before it becomes visible
+			///   to <see cref="Take"/>.</param>
+			/// <returns>The allocated call ID.</returns>
+			/// <exception cref="IOException">The table is full.</exception>
+			public int Allocate( OutboundStreamRequest request ) {
+				if( request == null )
+					throw new ArgumentNullException( "request" );
+
+				lock( _lock ) {
+					int slot;
+					Chunk chunk;
+
+					if( _freeHead != -1 ) {
+						slot = _freeHead;
+						chunk = _chunks[slot >> __chunkBitLength];
+						_freeHead = chunk.NextFree[slot & __chunkMask];
+					}
+					else if( _slotCount <= __slotMask ) {
+						slot = _slotCount;
+						chunk = _chunks[slot >> __chunkBitLength];
+
+						if( chunk == null ) {
+							chunk = new Chunk();
+
+							// Make sure the chunk's arrays are visible before the chunk is
+							Thread.MemoryBarrier();
+							_chunks[slot >> __chunkBitLength] = chunk;
+						}
+
+						_slotCount++;
+					}
+					else {
+						throw new IOException( "An outbound call ID could not be allocated because the active call table is full." );
 					}
+
+					int callID = (chunk.Generations[slot & __chunkMask] << __slotBitLength) | slot;
+					request.CallID = callID;
+					Interlocked.Exchange<OutboundStreamRequest>( ref chunk.Requests[slot & __chunkMask], request );
+					_activeCount++;
+
+					return callID;
 				}
 			}
+
+			/// <summary>
+			/// Removes the request with the given call ID from the table and releases the ID.
+			/// </summary>
+			/// <param name="callID">Call ID of the request.</param>
+			/// <returns>The request, or <see langword='null'/> if no request in the table has that call ID. If two threads
+			///   try to take the same request, only one of them receives it.</returns>
+			public OutboundStreamRequest Take( int callID ) {
+				int slot = callID & __slotMask;
+				Chunk chunk = _chunks[slot >> __chunkBitLength];
+
+				if( chunk == null )
+					return null;
+
+				OutboundStreamRequest request = chunk.Requests[slot & __chunkMask];
+
+				if( request == null || request.CallID != callID )
+					return null;
+
+				if( Interlocked.CompareExchange<OutboundStreamRequest>( ref chunk.Requests[slot & __chunkMask], null, request ) != request )
+					return null;
+
+				lock( _lock ) {
+					int index = slot & __chunkMask;
+					chunk.Generations[index] = (chunk.Generations[index] + 1) & __generationMask;
+					chunk.NextFree[index] = _freeHead;
+					_freeHead = slot;
+					_activeCount--;
+				}
+
+				return request;
+			}
 		}
+	#endregion
 		
 	#region ShortRequestTarget
 		/// <summary>
@@ -533,7 +1083,7 @@ namespace Fluggo.Communications
 
 			public IStreamRequest StartRequest( bool oneWay ) {
 				// Find the current context, if any
-				return new OutboundStreamRequest( _channel, LocalContext.ID, _registration.LocalTargetID, oneWay );
+				return new OutboundStreamRequest( _channel, LocalContext.ID, _registration.LocalTargetID, _registration.InterfaceID, oneWay );
 			}
 		}
 	#endregion
@@ -546,6 +1096,10 @@ namespace Fluggo.Communications
 			RequestChannel _channel;
 			string _uri;
 			Guid _iid;
+			object _proxy;
+			int _callCount;
+			volatile ShortRequestTarget _shortTarget;
+			long _missingUntil;
 
 			/// <summary>
 			/// Creates a new instance of the <see cref='LongRequestTarget'/> class.
@@ -584,7 +1138,56 @@ namespace Fluggo.Communications
 				get { return _iid; }
 			}
 
+			/// <summary>
+			/// Gets or sets the cached proxy for this target.
+			/// </summary>
+			/// <value>The proxy created for this target, or <see langword='null'/> if none has been created yet.</value>
+			public object Proxy {
+				get { return _proxy; }
+				set { _proxy = value; }
+			}
+
+			/// <summary>
+			/// Gets a value that represents whether the far end has recently said it has no such target.
+			/// </summary>
+			/// <value>True if calls to this target are known to fail, false otherwise.</value>
+			public bool IsMissing {
+				get { return DateTime.UtcNow.Ticks < Interlocked.Read( ref _missingUntil ); }
+			}
+
+			/// <summary>
+			/// Marks the target as missing.
+			/// </summary>
+			/// <param name="until">Time, in UTC, until which calls to the target should fail without being sent.</param>
+			public void MarkMissing( DateTime until ) {
+				_shortTarget = null;
+				Interlocked.Exchange( ref _callCount, 0 );
+				Interlocked.Exchange( ref _missingUntil, until.Ticks );
+			}
+
+			/// <summary>
+			/// Switches the target to the short form.
+			/// </summary>
+			/// <param name="shortTarget"><see cref="ShortRequestTarget"/> with the ID assigned by the far end.</param>
+			public void Promote( ShortRequestTarget shortTarget ) {
+				Interlocked.Exchange( ref _missingUntil, 0 );
+				_shortTarget = shortTarget;
+			}
+
 			public IStreamRequest StartRequest( bool oneWay ) {
+				ShortRequestTarget shortTarget = _shortTarget;
+
+				if( shortTarget != null )
+					return shortTarget.StartRequest( oneWay );
+
+				if( IsMissing )
+					throw new Exception( "The far end has no service " + _iid.ToString() + " at \"" + _uri + "\"." );
+
+				int threshold = _channel._shortFormThreshold;
+
+				if( threshold != 0 && _uri.Length != 0 && Interlocked.Increment( ref _callCount ) == threshold )
+					_channel.RequestShortForm( this );
+
 				// Find the current context, if any
 				return new OutboundStreamRequest( _channel, LocalContext.ID, _uri, _iid, oneWay );
 			}
@@ -635,6 +1238,11 @@ namespace Fluggo.Communications
 			bool _closed;
 			Exception _ex;
 			object _tag;
+			long _bytesRead;
+			uint _lead;
+			int _leadBitCount;
+			byte[] _pendingBuffer;
+			int _pendingOffset;
 
 			/// <summary>
 			/// Creates a new instance of the <see cref='NotifyEndStream'/> class.
@@ -660,10 +1268,30 @@ namespace Fluggo.Communications
 			/// <value>The user object.</value>
 			public object Tag { get { return _tag; } set { _tag = value; } }
 
+			/// <summary>
+			/// Gets the number of bytes read from the stream.
+			/// </summary>
+			/// <value>The number of bytes read from the stream so far.</value>
+			public long BytesRead { get { return _bytesRead; } }
+
+			/// <summary>
+			/// Gets the first bits read from the stream.
+			/// </summary>
+			/// <value>Up to the first 32 bits read from the stream, most significant bit first.</value>
+			public uint Lead { get { return _lead; } }
+
+			/// <summary>
+			/// Gets the number of valid bits in <see cref="Lead"/>.
+			/// </summary>
+			/// <value>The number of valid bits in <see cref="Lead"/>.</value>
+			public int LeadBitCount { get { return _leadBitCount; } }
+
 			public override IAsyncResult BeginRead( byte[] buffer, int offset, int count, AsyncCallback callback, object state ) {
 				if( _ex != null )
 					throw _ex;
 				
+				_pendingBuffer = buffer;
+				_pendingOffset = offset;
 				return base.BeginRead( buffer, offset, count, callback, state );
 			}
 			
@@ -675,6 +1303,8 @@ namespace Fluggo.Communications
 
 				if( count != 0 && result == 0 )
 					OnClosed();
+				else
+					OnRead( buffer, offset, result );
 
 				return result;
 			}
@@ -684,6 +1314,10 @@ namespace Fluggo.Communications
 				
 				if( result == 0 )
 					OnClosed();
+				else
+					OnRead( _pendingBuffer, _pendingOffset, result );
+
+				_pendingBuffer = null;
 					
 				if( _ex != null )
 					throw _ex;
@@ -697,11 +1331,27 @@ namespace Fluggo.Communications
 				
 				int result = base.ReadByte();
 
-				if( result == -1 )
+				if( result == -1 ) {
 					OnClosed();
+				}
+				else {
+					if( _leadBitCount < 32 ) {
+						_lead |= (uint) result << (24 - _leadBitCount);
+						_leadBitCount += 8;
+					}
+
+					_bytesRead++;
+				}
 
 				return result;
 			}
+
+			private void OnRead( byte[] buffer, int offset, int count ) {
+				if( _leadBitCount < 32 )
+					CaptureLead( ref _lead, ref _leadBitCount, buffer, offset, count );
+
+				_bytesRead += count;
+			}
 			
 			/// <summary>
 			/// Sets an exception on the stream.
@@ -773,6 +1423,30 @@ namespace Fluggo.Communications
 
 				return _responseStream = CallStream.CreateResponseStream( _channel, _call );
 			}
+
+			/// <summary>
+			/// Gets the number of request payload bytes the receiver read.
+			/// </summary>
+			public long RequestBytes {
+				get { return _inboundStream.BytesRead; }
+			}
+
+			/// <summary>
+			/// Gets the number of response payload bytes the receiver wrote.
+			/// </summary>
+			public long ResponseBytes {
+				get { return (_responseStream != null) ? ((CallStream) _responseStream).PayloadLength : 0; }
+			}
+
+			/// <summary>
+			/// Gets the metrics for the method this request called.
+			/// </summary>
+			/// <param name="metrics">Metrics of the channel.</param>
+			/// <param name="interfaceID">GUID of the interface that was called.</param>
+			/// <returns>The <see cref="RpcCallMetrics"/> for the method, decoded from the start of the request payload.</returns>
+			public RpcCallMetrics GetCallMetrics( RpcMetrics metrics, Guid interfaceID ) {
+				return metrics.GetCallMetrics( false, interfaceID, _inboundStream.Lead, _inboundStream.LeadBitCount );
+			}
 		}
 	#endregion
 
@@ -783,25 +1457,74 @@ namespace Fluggo.Communications
 			Stream _responseStream;
 			bool _oneWay, _requestStreamCalled;
 			Exception _ex;
-
-			public OutboundStreamRequest( RequestChannel channel, int context, int target, bool oneWay ) {
+			int _callID;
+			RpcMetrics _metrics;
+			RpcCallMetrics _callMetrics;
+			Guid _interfaceID;
+			long _startTimestamp;
+			bool _aborted;
+
+			public OutboundStreamRequest( RequestChannel channel, int context, int target, Guid interfaceID, bool oneWay ) {
 				if( channel == null )
 					throw new ArgumentNullException( "channel" );
 					
-				int call = channel.AllocateCallID( this );
+				int call = channel.AllocateCallID( this, oneWay );
 
 				_oneWay = oneWay;
 				_outStream = CallStream.CreateRequestStream( channel, call, context, target, oneWay );
+				StartMetrics( channel, interfaceID );
 			}
 
 			public OutboundStreamRequest( RequestChannel channel, int context, string uri, Guid interfaceID, bool oneWay ) {
 				if( channel == null )
 					throw new ArgumentNullException( "channel" );
 
-				int call = channel.AllocateCallID( this );
+				int call = channel.AllocateCallID( this, oneWay );
 
 				_oneWay = oneWay;
 				_outStream = CallStream.CreateRequestStream( channel, call, context, uri, interfaceID, oneWay );
+				StartMetrics( channel, interfaceID );
+			}
+
+			private void StartMetrics( RequestChannel channel, Guid interfaceID ) {
+				_metrics = channel._metrics;
+
+				if( _metrics == null )
+					return;
+
+				_interfaceID = interfaceID;
+				_startTimestamp = Stopwatch.GetTimestamp();
+				_outStream.Request = this;
+			}
+
+			/// <summary>
+			/// Records the request in the channel's metrics when the request stream is closed.
+			/// </summary>
+			/// <param name="payloadLength">Number of payload bytes written to the request stream.</param>
+			/// <param name="lead">The first bits of the payload, most significant bit first.</param>
+			/// <param name="leadBitCount">Number of valid bits in <paramref name="lead"/>.</param>
+			public void OnRequestSent( long payloadLength, uint lead, int leadBitCount ) {
+				if( _aborted )
+					return;
+
+				_callMetrics = _metrics.GetCallMetrics( true, _interfaceID, lead, leadBitCount );
+				_callMetrics.RecordRequestBytes( payloadLength );
+
+				if( _oneWay )
+					_callMetrics.RecordCall( _startTimestamp );
+			}
+
+			private void HandleResponseEnded( object sender, EventArgs e ) {
+				_callMetrics.RecordResponseBytes( ((NotifyEndStream) sender).BytesRead );
+			}
+
+			/// <summary>
+			/// Gets or sets the call ID assigned to this request.
+			/// </summary>
+			/// <value>The call ID assigned by the channel's call table.</value>
+			public int CallID {
+				get { return _callID; }
+				set { _callID = value; }
 			}
 
 			public bool IsOutbound { get { return true; } }
@@ -819,6 +1542,11 @@ namespace Fluggo.Communications
 				if( _responseStream != null )
 					throw new InvalidOperationException( "The response stream has already been set." );
 
+				if( _callMetrics != null ) {
+					_callMetrics.RecordCall( _startTimestamp );
+					stream = new NotifyEndStream( stream, HandleResponseEnded, null );
+				}
+
 				_responseStream = stream;
 				_event.Set();
 			}
@@ -839,6 +1567,17 @@ namespace Fluggo.Communications
 			}
 			
 			public void Abort( Exception ex ) {
+				if( _metrics != null && !_aborted ) {
+					_aborted = true;
+
+					RpcCallMetrics callMetrics = _callMetrics;
+
+					if( callMetrics == null )
+						callMetrics = _metrics.GetCallMetrics( true, _interfaceID, 0, 0 );
+
+					callMetrics.RecordAbort();
+				}
+
 				_outStream.Close();
 				_ex = ex;
 				_event.Set();
@@ -853,6 +1592,11 @@ namespace Fluggo.Communications
 			byte[] _buffer;
 			int _bufferCount;
 			object _lock = new object();
+			OutboundStreamRequest _request;
+			bool _inPayload;
+			long _payloadLength;
+			uint _lead;
+			int _leadBitCount;
 
 			private CallStream( RequestChannel owner ) {
 				if( owner == null )
@@ -881,6 +1625,7 @@ namespace Fluggo.Communications
 				writer.WriteBytes( interfaceID.ToByteArray(), 0, 16 );
 				writer.WriteString( uri, __uriLength );
 				writer.Flush();
+				stream._inPayload = true;
 				
 				return stream;
 			}
@@ -899,6 +1644,7 @@ namespace Fluggo.Communications
 				writer.Write( contextID, __contextIDBitLength );
 				writer.Write( targetID, __targetIDBitLength );
 				writer.Flush();
+				stream._inPayload = true;
 
 				return stream;
 			}
@@ -911,10 +1657,26 @@ namespace Fluggo.Communications
 				writer.Write( (int) flags, 8 );
 				writer.Write( callID, __callIDBitLength );
 				writer.Flush();
+				stream._inPayload = true;
 
 				return stream;
 			}
 
+			/// <summary>
+			/// Gets or sets the outbound request to notify when the stream is closed.
+			/// </summary>
+			public OutboundStreamRequest Request {
+				get { return _request; }
+				set { _request = value; }
+			}
+
+			/// <summary>
+			/// Gets the number of payload bytes written to the stream, not counting the header.
+			/// </summary>
+			public long PayloadLength {
+				get { return _payloadLength; }
+			}
+
 			public override bool CanRead {
 				get { return false; }
 			}
@@ -972,6 +1734,13 @@ namespace Fluggo.Communications
 			public override void Write( byte[] buffer, int offset, int count ) {
 				new ArraySegment<byte>( buffer, offset, count );
 
+				if( _inPayload ) {
+					if( _leadBitCount < 32 )
+						CaptureLead( ref _lead, ref _leadBitCount, buffer, offset, count );
+
+					_payloadLength += count;
+				}
+
 				// Are we still storing up data?
 				if( _buffer != null ) {
 					int readCount = Math.Min( count, _buffer.Length - _bufferCount );
@@ -1009,9 +1778,16 @@ namespace Fluggo.Communications
 				base.Dispose( disposing );
 
 				if( disposing ) {
+					// Record the request before the last of it goes out, so the response can't beat us to it
+					if( _request != null ) {
+						OutboundStreamRequest request = _request;
+						_request = null;
+						request.OnRequestSent( _payloadLength, _lead, _leadBitCount );
+					}
+
 					if( _buffer != null ) {
 						if( _owner._shortRpcChannel != null ) {
-							_owner._shortRpcChannel.Send( _buffer, 0, _bufferCount );
+							_owner.SendShortMessage( _buffer, _bufferCount );
 						}
 						else {
 							_root = _owner._pool.GetStream();
@@ -1073,6 +1849,14 @@ namespace Fluggo.Communications
 						case 3:
 							_channel.ReportLocalWarning( reader.ReadString( __abortStringMaxLength ) );
 							break;
+
+						case 4:
+							_channel.AssignLocalTargetID( reader.ReadString( __uriLength ), new Guid( reader.ReadBytes( 16 ) ) );
+							break;
+
+						case 5:
+							_channel.DeclareLocalTarget( reader.ReadString( __uriLength ), new Guid( reader.ReadBytes( 16 ) ), reader.ReadInt32( __targetIDBitLength ) );
+							break;
 						
 						default:
 							throw new NotSupportedException();
@@ -1104,6 +1888,23 @@ namespace Fluggo.Communications
 			void AbortChannel( string message );
 			
 			void ReportWarning( string message );
+
+			/// <summary>
+			/// Asks the callee to assign a short target ID to a target.
+			/// </summary>
+			/// <param name="uri">URI of the target.</param>
+			/// <param name="iid">GUID of the target interface.</param>
+			/// <remarks>The callee answers with <see cref="DeclareTarget"/>, or not at all if it won't assign an ID.</remarks>
+			void RequestTargetID( string uri, Guid iid );
+
+			/// <summary>
+			/// Tells the caller the short target ID of a target, or that the target doesn't exist.
+			/// </summary>
+			/// <param name="uri">URI of the target.</param>
+			/// <param name="iid">GUID of the target interface.</param>
+			/// <param name="targetID">Short target ID the caller may use in place of the URI and GUID, or -1 if there is
+			///   no such target.</param>
+			void DeclareTarget( string uri, Guid iid, int targetID );
 		}
 		
 		class RequestControlSenderFactory : RequestSenderFactory {
@@ -1175,14 +1976,42 @@ namespace Fluggo.Communications
 					writer.WriteString( message, __abortStringMaxLength );
 					writer.Close();
 				}
+
+				public void RequestTargetID( string uri, Guid iid ) {
+					if( uri == null )
+						throw new ArgumentNullException( "uri" );
+
+					IStreamRequest request = _target.StartRequest( true );
+					BitWriter writer = new BitWriter( request.GetRequestStream() );
+
+					writer.Write( 4, 4 );
+					writer.WriteString( uri, __uriLength );
+					writer.WriteBytes( iid.ToByteArray(), 0, 16 );
+					writer.Close();
+				}
+
+				public void DeclareTarget( string uri, Guid iid, int targetID ) {
+					if( uri == null )
+						throw new ArgumentNullException( "uri" );
+
+					IStreamRequest request = _target.StartRequest( true );
+					BitWriter writer = new BitWriter( request.GetRequestStream() );
+
+					writer.Write( 5, 4 );
+					writer.WriteString( uri, __uriLength );
+					writer.WriteBytes( iid.ToByteArray(), 0, 16 );
+					writer.Write( targetID, __targetIDBitLength );
+					writer.Close();
+				}
 			}
 		}
 		
 		private void AbortLocalRequest( bool outbound, int callID, string message ) {
 			if( outbound ) {
-				OutboundStreamRequest request;
+				// No response is coming for an aborted request, so free up its call ID
+				OutboundStreamRequest request = _outboundsWaitingForResponses.Take( callID );
 
-				if( !_outboundsWaitingForResponses.TryGetValue( callID, out request ) ) {
+				if( request == null ) {
 					_ts.TraceEvent( TraceEventType.Warning, 0, "Attempt to abort nonexistent outbound request {0} with the message: {1}", callID, message );
 					return;
 				}
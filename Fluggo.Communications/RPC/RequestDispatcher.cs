@@ -0,0 +1,478 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Threading;
+
+namespace Fluggo.Communications {
+	/// <summary>
+	/// Runs inbound requests for a <see cref="RequestChannel"/> on the thread pool, within concurrency limits.
+	/// </summary>
+	/// <remarks>Without a dispatcher, a <see cref="RequestChannel"/> runs each request on the thread that received it. With
+	///     a dispatcher, requests are admitted to a bounded queue and run on thread pool threads as long as:
+	///   <list type="bullet">
+	///     <item><description>fewer than the interface's limit of requests for the same interface are running, if the
+	///       interface is known,</description></item>
+	///     <item><description>fewer than <see cref="TargetConcurrency"/> requests for the same target are running, and</description></item>
+	///     <item><description>if <see cref="OrderedContexts"/> is set, no earlier request in the same context is running or waiting.</description></item>
+	///   </list>
+	///   <para>When the queue is full, new requests are rejected immediately, and the channel aborts them back to the caller
+	///     instead of letting them pile up behind slow ones.</para></remarks>
+	public sealed class RequestDispatcher {
+		static TraceSource _ts = new TraceSource( "RequestDispatcher", SourceLevels.Error );
+		object _lock = new object();
+		Dictionary<int, Queue<WorkItem>> _waitingByContext = new Dictionary<int, Queue<WorkItem>>();
+		Dictionary<Guid, Queue<WorkItem>> _waitingByInterface = new Dictionary<Guid, Queue<WorkItem>>();
+		Dictionary<string, Queue<WorkItem>> _waitingByTarget = new Dictionary<string, Queue<WorkItem>>();
+		Dictionary<Guid, int> _interfaceLimits = new Dictionary<Guid, int>();
+		Dictionary<Guid, int> _runningByInterface = new Dictionary<Guid, int>();
+		Dictionary<string, int> _runningByTarget = new Dictionary<string, int>();
+		Dictionary<int, bool> _busyContexts = new Dictionary<int, bool>();
+		WaitCallback _runCallback;
+		int _maxQueueLength, _interfaceConcurrency, _targetConcurrency;
+		bool _orderedContexts;
+
+		// Counters
+		int _running, _waitingCount, _maxQueueDepth;
+		long _admitted, _rejected, _completed, _failed;
+		long _totalServiceTicks, _maxServiceTicks;
+
+		sealed class WorkItem {
+			public Guid InterfaceID;
+			public string Target;
+			public int ContextID;
+			public bool HoldsContext;
+			public ThreadStart Work;
+		}
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='RequestDispatcher'/> class.
+		/// </summary>
+		/// <param name="maxQueueLength">Maximum number of requests that can wait to run. Requests beyond this are rejected,
+		///   unless they can start right away.</param>
+		/// <param name="interfaceConcurrency">Default maximum number of requests for any one interface that can run at once.
+		///   Use <see cref="SetInterfaceConcurrency"/> to set the limit for specific interfaces.</param>
+		/// <param name="targetConcurrency">Maximum number of requests for any one target that can run at once.</param>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="maxQueueLength"/> is less than zero.
+		///   <para> OR </para>
+		///   <para><paramref name="interfaceConcurrency"/> or <paramref name="targetConcurrency"/> is less than one.</para></exception>
+		public RequestDispatcher( int maxQueueLength, int interfaceConcurrency, int targetConcurrency ) {
+			if( maxQueueLength < 0 )
+				throw new ArgumentOutOfRangeException( "maxQueueLength" );
+
+			if( interfaceConcurrency < 1 )
+				throw new ArgumentOutOfRangeException( "interfaceConcurrency" );
+
+			if( targetConcurrency < 1 )
+				throw new ArgumentOutOfRangeException( "targetConcurrency" );
+
+			_maxQueueLength = maxQueueLength;
+			_interfaceConcurrency = interfaceConcurrency;
+			_targetConcurrency = targetConcurrency;
+			_runCallback = HandleRun;
+		}
+
+		/// <summary>
+		/// Sets the maximum number of requests for the given interface that can run at once.
+		/// </summary>
+		/// <param name="interfaceID">GUID of the interface.</param>
+		/// <param name="limit">Maximum number of concurrent requests for the interface.</param>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="limit"/> is less than one.</exception>
+		public void SetInterfaceConcurrency( Guid interfaceID, int limit ) {
+			if( limit < 1 )
+				throw new ArgumentOutOfRangeException( "limit" );
+
+			List<WorkItem> ready = new List<WorkItem>();
+
+			lock( _lock ) {
+				_interfaceLimits[interfaceID] = limit;
+				WakeInterface( interfaceID, ready );
+			}
+
+			StartReady( ready );
+		}
+
+		/// <summary>
+		/// Gets or sets a value that represents whether requests within a context run in the order they arrived.
+		/// </summary>
+		/// <value>True if requests that share a nonzero context ID run one at a time, in order, or false if they can run
+		///   concurrently. The default is false. Requests in the default context, zero, are never ordered.</value>
+		public bool OrderedContexts {
+			get { return _orderedContexts; }
+			set {
+				List<WorkItem> ready = new List<WorkItem>();
+
+				lock( _lock ) {
+					_orderedContexts = value;
+
+					if( !value ) {
+						// Requests held back only by their contexts can go now
+						foreach( Queue<WorkItem> queue in _waitingByContext.Values ) {
+							foreach( WorkItem item in queue )
+								TryStart( item, ready );
+						}
+
+						_waitingByContext.Clear();
+					}
+				}
+
+				StartReady( ready );
+			}
+		}
+
+		/// <summary>
+		/// Gets the maximum number of requests for any one target that can run at once.
+		/// </summary>
+		/// <value>The maximum number of concurrent requests per target.</value>
+		public int TargetConcurrency {
+			get { return _targetConcurrency; }
+		}
+
+		/// <summary>
+		/// Gets the maximum number of requests that can wait to run.
+		/// </summary>
+		/// <value>The maximum length of the admission queue.</value>
+		public int MaxQueueLength {
+			get { return _maxQueueLength; }
+		}
+
+	#region Counters
+		/// <summary>
+		/// Gets the number of requests waiting to run.
+		/// </summary>
+		/// <value>The current depth of the admission queue.</value>
+		public int QueueDepth {
+			get { lock( _lock ) { return _waitingCount; } }
+		}
+
+		/// <summary>
+		/// Gets the greatest number of requests that have waited to run at once.
+		/// </summary>
+		/// <value>The high-water mark of the admission queue.</value>
+		public int MaxQueueDepth {
+			get { return _maxQueueDepth; }
+		}
+
+		/// <summary>
+		/// Gets the number of requests running.
+		/// </summary>
+		/// <value>The number of requests currently running.</value>
+		public int RunningCount {
+			get { return _running; }
+		}
+
+		/// <summary>
+		/// Gets the number of requests admitted to the queue.
+		/// </summary>
+		/// <value>The total number of requests admitted since the dispatcher was created.</value>
+		public long AdmittedCount {
+			get { return Interlocked.Read( ref _admitted ); }
+		}
+
+		/// <summary>
+		/// Gets the number of requests rejected because the queue was full.
+		/// </summary>
+		/// <value>The total number of requests rejected since the dispatcher was created.</value>
+		public long RejectedCount {
+			get { return Interlocked.Read( ref _rejected ); }
+		}
+
+		/// <summary>
+		/// Gets the number of requests that have finished running.
+		/// </summary>
+		/// <value>The total number of requests completed, including those that failed.</value>
+		public long CompletedCount {
+			get { return Interlocked.Read( ref _completed ); }
+		}
+
+		/// <summary>
+		/// Gets the number of requests that threw an exception while running.
+		/// </summary>
+		/// <value>The total number of failed requests.</value>
+		public long FailedCount {
+			get { return Interlocked.Read( ref _failed ); }
+		}
+
+		/// <summary>
+		/// Gets the total time spent running requests.
+		/// </summary>
+		/// <value>The sum of the service times of all completed requests.</value>
+		public TimeSpan TotalServiceTime {
+			get { return TicksToTimeSpan( Interlocked.Read( ref _totalServiceTicks ) ); }
+		}
+
+		/// <summary>
+		/// Gets the longest time spent running a single request.
+		/// </summary>
+		/// <value>The greatest service time of any completed request.</value>
+		public TimeSpan MaxServiceTime {
+			get { return TicksToTimeSpan( Interlocked.Read( ref _maxServiceTicks ) ); }
+		}
+
+		private static TimeSpan TicksToTimeSpan( long stopwatchTicks ) {
+			return TimeSpan.FromSeconds( (double) stopwatchTicks / (double) Stopwatch.Frequency );
+		}
+	#endregion
+
+		/// <summary>
+		/// Admits a request to the queue.
+		/// </summary>
+		/// <param name="interfaceID">GUID of the request's interface, or <see cref="Guid.Empty"/> if it isn't known. Requests
+		///   with no known interface aren't held to any interface's limit.</param>
+		/// <param name="target">Key identifying the request's target.</param>
+		/// <param name="contextID">Context ID of the request.</param>
+		/// <param name="work">Delegate that processes the request. It is expected to handle its own errors.</param>
+		/// <returns>True if the request was admitted, or false if the queue was full.</returns>
+		internal bool TryDispatch( Guid interfaceID, string target, int contextID, ThreadStart work ) {
+			if( target == null )
+				throw new ArgumentNullException( "target" );
+
+			if( work == null )
+				throw new ArgumentNullException( "work" );
+
+			WorkItem item = new WorkItem();
+			item.InterfaceID = interfaceID;
+			item.Target = target;
+			item.ContextID = contextID;
+			item.Work = work;
+
+			List<WorkItem> ready = new List<WorkItem>();
+
+			lock( _lock ) {
+				if( _waitingCount >= _maxQueueLength && !CanRun( item ) ) {
+					_rejected++;
+					return false;
+				}
+
+				_admitted++;
+				_waitingCount++;
+				TryStart( item, ready );
+
+				if( _waitingCount > _maxQueueDepth )
+					_maxQueueDepth = _waitingCount;
+			}
+
+			StartReady( ready );
+			return true;
+		}
+
+		/// <summary>
+		/// Determines whether the item could start right away. The caller must hold the lock.
+		/// </summary>
+		private bool CanRun( WorkItem item ) {
+			if( _orderedContexts && item.ContextID != 0 && !item.HoldsContext && _busyContexts.ContainsKey( item.ContextID ) )
+				return false;
+
+			return !IsInterfaceFull( item.InterfaceID ) && !IsTargetFull( item.Target );
+		}
+
+		private bool IsInterfaceFull( Guid interfaceID ) {
+			if( interfaceID == Guid.Empty )
+				return false;
+
+			int running, limit;
+
+			if( !_interfaceLimits.TryGetValue( interfaceID, out limit ) )
+				limit = _interfaceConcurrency;
+
+			return _runningByInterface.TryGetValue( interfaceID, out running ) && running >= limit;
+		}
+
+		private bool IsTargetFull( string target ) {
+			int running;
+			return _runningByTarget.TryGetValue( target, out running ) && running >= _targetConcurrency;
+		}
+
+		/// <summary>
+		/// Starts the item if nothing holds it back, or parks it behind the first thing that does. The caller must hold
+		/// the lock.
+		/// </summary>
+		/// <remarks>A waiting item sits in exactly one queue: its context's, its interface's, or its target's. When
+		///   something is released, only the queue for that context, interface or target is looked at, so the cost of a
+		///   completion doesn't grow with the number of waiting requests.
+		///   <para>In an ordered context, the item at the head of the context's queue keeps the context reserved while it
+		///   waits on its interface or target, so later requests in the context can't get around it.</para></remarks>
+		private void TryStart( WorkItem item, List<WorkItem> ready ) {
+			if( _orderedContexts && item.ContextID != 0 && !item.HoldsContext ) {
+				if( _busyContexts.ContainsKey( item.ContextID ) ) {
+					Park( _waitingByContext, item.ContextID, item );
+					return;
+				}
+
+				_busyContexts[item.ContextID] = true;
+				item.HoldsContext = true;
+			}
+
+			if( IsInterfaceFull( item.InterfaceID ) ) {
+				Park( _waitingByInterface, item.InterfaceID, item );
+				return;
+			}
+
+			if( IsTargetFull( item.Target ) ) {
+				Park( _waitingByTarget, item.Target, item );
+				return;
+			}
+
+			Acquire( item );
+			_waitingCount--;
+			ready.Add( item );
+		}
+
+		private static void Park<TKey>( Dictionary<TKey, Queue<WorkItem>> queues, TKey key, WorkItem item ) {
+			Queue<WorkItem> queue;
+
+			if( !queues.TryGetValue( key, out queue ) ) {
+				queue = new Queue<WorkItem>();
+				queues.Add( key, queue );
+			}
+
+			queue.Enqueue( item );
+		}
+
+		private static WorkItem Unpark<TKey>( Dictionary<TKey, Queue<WorkItem>> queues, TKey key ) {
+			Queue<WorkItem> queue;
+
+			if( !queues.TryGetValue( key, out queue ) )
+				return null;
+
+			WorkItem item = queue.Dequeue();
+
+			if( queue.Count == 0 )
+				queues.Remove( key );
+
+			return item;
+		}
+
+		/// <summary>
+		/// Retries the requests waiting on an interface while the interface has room. The caller must hold the lock.
+		/// </summary>
+		private void WakeInterface( Guid interfaceID, List<WorkItem> ready ) {
+			while( !IsInterfaceFull( interfaceID ) ) {
+				WorkItem item = Unpark( _waitingByInterface, interfaceID );
+
+				if( item == null )
+					return;
+
+				TryStart( item, ready );
+			}
+		}
+
+		/// <summary>
+		/// Retries the requests waiting on a target while the target has room. The caller must hold the lock.
+		/// </summary>
+		private void WakeTarget( string target, List<WorkItem> ready ) {
+			while( !IsTargetFull( target ) ) {
+				WorkItem item = Unpark( _waitingByTarget, target );
+
+				if( item == null )
+					return;
+
+				TryStart( item, ready );
+			}
+		}
+
+		private void StartReady( List<WorkItem> ready ) {
+			foreach( WorkItem item in ready )
+				ThreadPool.QueueUserWorkItem( _runCallback, item );
+		}
+
+		private void Acquire( WorkItem item ) {
+			int running;
+
+			if( item.InterfaceID != Guid.Empty ) {
+				_runningByInterface.TryGetValue( item.InterfaceID, out running );
+				_runningByInterface[item.InterfaceID] = running + 1;
+			}
+
+			_runningByTarget.TryGetValue( item.Target, out running );
+			_runningByTarget[item.Target] = running + 1;
+
+			_running++;
+		}
+
+		/// <summary>
+		/// Gives back what the item held and starts whatever was waiting on it. The caller must hold the lock.
+		/// </summary>
+		private void Release( WorkItem item, List<WorkItem> ready ) {
+			int running;
+
+			if( item.InterfaceID != Guid.Empty ) {
+				running = _runningByInterface[item.InterfaceID] - 1;
+
+				if( running == 0 )
+					_runningByInterface.Remove( item.InterfaceID );
+				else
+					_runningByInterface[item.InterfaceID] = running;
+			}
+
+			running = _runningByTarget[item.Target] - 1;
+
+			if( running == 0 )
+				_runningByTarget.Remove( item.Target );
+			else
+				_runningByTarget[item.Target] = running;
+
+			_running--;
+
+			if( item.HoldsContext ) {
+				_busyContexts.Remove( item.ContextID );
+
+				WorkItem next = Unpark( _waitingByContext, item.ContextID );
+
+				if( next != null )
+					TryStart( next, ready );
+			}
+
+			if( item.InterfaceID != Guid.Empty )
+				WakeInterface( item.InterfaceID, ready );
+
+			WakeTarget( item.Target, ready );
+		}
+
+		private void HandleRun( object state ) {
+			WorkItem item = (WorkItem) state;
+			long start = Stopwatch.GetTimestamp();
+
+			try {
+				item.Work();
+			}
+			catch( Exception ex ) {
+				Interlocked.Increment( ref _failed );
+				_ts.TraceEvent( TraceEventType.Error, 0, "A dispatched request failed: {0}", ex.ToString() );
+			}
+			finally {
+				long elapsed = Stopwatch.GetTimestamp() - start;
+				List<WorkItem> ready = new List<WorkItem>();
+
+				lock( _lock ) {
+					Release( item, ready );
+					_completed++;
+					_totalServiceTicks += elapsed;
+
+					if( elapsed > _maxServiceTicks )
+						_maxServiceTicks = elapsed;
+				}
+
+				StartReady( ready );
+			}
+		}
+	}
+}
@@ -0,0 +1,630 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Collections.Generic;
+using System.ComponentModel.Design;
+using System.Diagnostics;
+using System.IO;
+using System.Reflection;
+using System.Reflection.Emit;
+using System.Runtime.InteropServices;
+using System.Text;
+using System.Threading;
+using Fluggo.CodeGeneration.IL;
+using Fluggo.Communications.Serialization;
+using Fluggo.Resources;
+
+namespace Fluggo.Communications {
+	/// <summary>
+	/// Service called by <see cref="RpcLoadGenerator"/>.
+	/// </summary>
+	/// <remarks>The first eight bytes of each payload, if there are that many, carry the <see cref="Stopwatch"/> timestamp
+	///   at which the call was made, so the receiving side can measure how long one-way calls take to arrive.</remarks>
+	[Guid( "5B0E3B71-2C4D-4f0e-9A51-0D8C3E6A7F12" )]
+	public interface ILoadTestService {
+		/// <summary>
+		/// Makes a call that waits for the far end to finish.
+		/// </summary>
+		/// <param name="payload">Data to send.</param>
+		void Call( [MaxLength( RpcLoadGenerator.MaxPayloadLength )] byte[] payload );
+
+		/// <summary>
+		/// Makes a call that doesn't wait for a response.
+		/// </summary>
+		/// <param name="payload">Data to send.</param>
+		[OneWay]
+		void Post( [MaxLength( RpcLoadGenerator.MaxPayloadLength )] byte[] payload );
+	}
+
+	/// <summary>
+	/// Drives a mix of calls through a pair of <see cref="RequestChannel">RequestChannels</see> connected by a
+	/// <see cref="LoopbackTransport"/> and measures how fast they go.
+	/// </summary>
+	/// <remarks>The generator builds the same stack as <see cref="RpcResourceProvider"/>, a <see cref="RequestChannel"/> over a
+	///     <see cref="ChannelMultiplexer"/> over a <see cref="MessageChannelOverStream"/>, on both ends of a connection
+	///     from <see cref="Transport"/>. It then starts <see cref="Concurrency"/> threads that each make calls on
+	///     <see cref="ILoadTestService"/> until <see cref="CallCount"/> calls have been made or <see cref="Duration"/> has
+	///     passed, whichever comes first.
+	///   <para>Each call picks a payload size from the sizes added with <see cref="AddCallSize"/>, in proportion to their
+	///     weights, and is made one-way with probability <see cref="OneWayRatio"/>. Every thread draws from its own
+	///     <see cref="Random"/> seeded from <see cref="Seed"/>, so a run with the same settings makes the same calls in the
+	///     same order on each thread.</para>
+	///   <para>Because both ends live in one process, a run measures the cost of the RPC stack itself plus whatever the
+	///     transport is set up to add, which makes it suitable for comparing changes to the stack on one machine.</para></remarks>
+	public sealed class RpcLoadGenerator {
+		/// <summary>
+		/// The largest payload the generator can send in one call.
+		/// </summary>
+		public const int MaxPayloadLength = 1 << 20;
+
+		/// <summary>
+		/// The number of outstanding calls made by a generator from <see cref="CreateStressTest"/>.
+		/// </summary>
+		public const int StressConcurrency = 10000;
+
+		const int __timestampLength = 8;
+
+		// Calling threads do little more than block in the proxy, so they can get by with far less than the default
+		// stack; this is what lets a run keep ten thousand of them outstanding
+		const int __callerStackSize = 128 * 1024;
+
+		LoopbackTransport _transport = new LoopbackTransport();
+		List<int> _sizes = new List<int>(), _weights = new List<int>();
+		int _concurrency = 1, _seed;
+		long _callCount = 10000;
+		TimeSpan _duration = TimeSpan.MaxValue, _drainTimeout = TimeSpan.FromSeconds( 5.0 );
+		double _oneWayRatio;
+
+	#region Settings
+		/// <summary>
+		/// Gets or sets the transport that connects the two ends.
+		/// </summary>
+		/// <value>The <see cref="LoopbackTransport"/> used to create the connection for each run. The default is a transport
+		///   with no latency, bandwidth limit or loss.</value>
+		/// <exception cref='ArgumentNullException'>The value is <see langword='null'/>.</exception>
+		public LoopbackTransport Transport {
+			get { return _transport; }
+			set {
+				if( value == null )
+					throw new ArgumentNullException( "value" );
+
+				_transport = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the number of threads making calls at once.
+		/// </summary>
+		/// <value>The number of calling threads. The default is one.</value>
+		/// <remarks>Each thread has at most one call outstanding, so this is also the most calls that can be outstanding
+		///   at once. Values in the thousands are fine; see <see cref="CreateStressTest"/>.</remarks>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than one.</exception>
+		public int Concurrency {
+			get { return _concurrency; }
+			set {
+				if( value < 1 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_concurrency = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the total number of calls to make.
+		/// </summary>
+		/// <value>The number of calls made by all threads together. The default is 10000.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than one.</exception>
+		public long CallCount {
+			get { return _callCount; }
+			set {
+				if( value < 1 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_callCount = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the longest time to make calls for.
+		/// </summary>
+		/// <value>The time after which threads stop starting new calls, even if <see cref="CallCount"/> hasn't been reached.
+		///   The default is <see cref="TimeSpan.MaxValue"/>, which runs until all of the calls have been made.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is not positive.</exception>
+		public TimeSpan Duration {
+			get { return _duration; }
+			set {
+				if( value <= TimeSpan.Zero )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_duration = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the fraction of calls that are made one-way.
+		/// </summary>
+		/// <value>A probability from zero to one. The default is zero.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than zero or greater than one.</exception>
+		public double OneWayRatio {
+			get { return _oneWayRatio; }
+			set {
+				if( value < 0.0 || value > 1.0 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_oneWayRatio = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the seed for the calling threads.
+		/// </summary>
+		/// <value>The seed for the first thread. Each later thread uses the next seed. The default is zero.</value>
+		public int Seed {
+			get { return _seed; }
+			set { _seed = value; }
+		}
+
+		/// <summary>
+		/// Gets or sets how long to wait for one-way calls to arrive after the last call is made.
+		/// </summary>
+		/// <value>The longest time to wait for outstanding one-way calls before the run ends. The default is five seconds.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is negative.</exception>
+		public TimeSpan DrainTimeout {
+			get { return _drainTimeout; }
+			set {
+				if( value < TimeSpan.Zero )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_drainTimeout = value;
+			}
+		}
+
+		/// <summary>
+		/// Adds a payload size to the call mix.
+		/// </summary>
+		/// <param name="payloadLength">Number of bytes in the payload.</param>
+		/// <param name="weight">Relative number of calls that should use this size.</param>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="payloadLength"/> is less than zero or greater
+		///   than <see cref="MaxPayloadLength"/>.
+		///   <para> OR </para>
+		///   <para><paramref name="weight"/> is less than one.</para></exception>
+		/// <remarks>If no sizes are added, every call carries 64 bytes.</remarks>
+		public void AddCallSize( int payloadLength, int weight ) {
+			if( payloadLength < 0 || payloadLength > MaxPayloadLength )
+				throw new ArgumentOutOfRangeException( "payloadLength" );
+
+			if( weight < 1 )
+				throw new ArgumentOutOfRangeException( "weight" );
+
+			_sizes.Add( payloadLength );
+			_weights.Add( weight );
+		}
+
+		/// <summary>
+		/// Removes all payload sizes from the call mix.
+		/// </summary>
+		public void ClearCallSizes() {
+			_sizes.Clear();
+			_weights.Clear();
+		}
+
+		/// <summary>
+		/// Creates a generator that keeps <see cref="StressConcurrency"/> two-way calls outstanding at once.
+		/// </summary>
+		/// <returns>A generator with <see cref="Concurrency"/> set to <see cref="StressConcurrency"/>, small payloads,
+		///   and enough calls for each thread to make twenty.</returns>
+		/// <remarks>Use this to see how the call table, the dispatcher and the multiplexer hold up with a large backlog of
+		///   calls. <see cref="RpcLoadResult.PeakOutstandingCalls"/> shows how many calls were actually in flight at once,
+		///   and <see cref="RpcLoadResult.Latency"/> the round-trip times at that level. The settings can be changed
+		///   before calling <see cref="Run"/>.</remarks>
+		public static RpcLoadGenerator CreateStressTest() {
+			RpcLoadGenerator generator = new RpcLoadGenerator();
+			generator.Concurrency = StressConcurrency;
+			generator.CallCount = StressConcurrency * 20L;
+			generator.AddCallSize( 64, 1 );
+
+			return generator;
+		}
+	#endregion
+
+	#region Run
+		/// <summary>
+		/// Holds everything the calling threads share during a run.
+		/// </summary>
+		sealed class RunState {
+			public ILoadTestService Proxy;
+			public int[] Sizes, CumulativeWeights;
+			public double OneWayRatio;
+			public long CallsLeft, Deadline;
+			public long Calls, OneWayCalls, Errors, RequestBytes;
+			public int Outstanding, PeakOutstanding;
+			public LatencyHistogram Latency = new LatencyHistogram();
+			public ManualResetEvent StartGate = new ManualResetEvent( false );
+		}
+
+		/// <summary>
+		/// Receives calls on the far end of the connection.
+		/// </summary>
+		sealed class LoadTestService : ILoadTestService, IServiceProvider {
+			public long OneWayCalls;
+			public LatencyHistogram OneWayLatency = new LatencyHistogram();
+
+			public void Call( byte[] payload ) {
+			}
+
+			public void Post( byte[] payload ) {
+				if( payload != null && payload.Length >= __timestampLength )
+					OneWayLatency.RecordSince( NetworkBitConverter.ToInt64( payload, 0 ) );
+
+				Interlocked.Increment( ref OneWayCalls );
+			}
+
+			public object GetService( Type serviceType ) {
+				if( serviceType == typeof(ILoadTestService) )
+					return this;
+
+				return null;
+			}
+		}
+
+		/// <summary>
+		/// Supplies the generated sender and receiver for <see cref="ILoadTestService"/>.
+		/// </summary>
+		sealed class FactoryProvider : IRequestFactoryProvider {
+			// Generated types need a cache module; one dynamic module serves every run
+			static BitSerializer __serializer = CreateSerializer();
+
+			private static BitSerializer CreateSerializer() {
+				AssemblyName name = new AssemblyName( "Fluggo.Communications.RpcLoadGenerator.Runtime" );
+				AssemblyBuilder assembly = AppDomain.CurrentDomain.DefineDynamicAssembly( name, AssemblyBuilderAccess.Run );
+
+				return new BitSerializer( null, new ModuleGeneratorContext( assembly.DefineDynamicModule( name.Name ), false ) );
+			}
+
+			public RequestReceiverFactory GetRequestReceiverFactory( Guid iid ) {
+				if( iid != typeof(ILoadTestService).GUID )
+					return null;
+
+				return __serializer.GenerateRequestReceiverFactory( typeof(ILoadTestService) );
+			}
+
+			public RequestSenderFactory GetRequestSenderFactory( Guid iid ) {
+				if( iid != typeof(ILoadTestService).GUID )
+					return null;
+
+				return __serializer.GenerateRequestSenderFactory( typeof(ILoadTestService) );
+			}
+		}
+
+		/// <summary>
+		/// Makes one run with the current settings.
+		/// </summary>
+		/// <returns>An <see cref="RpcLoadResult"/> describing the run.</returns>
+		/// <remarks>A new connection is created for each run and closed when the run ends. Calls that throw are counted
+		///   in <see cref="RpcLoadResult.Errors"/> and don't stop the run.</remarks>
+		public RpcLoadResult Run() {
+			Stream clientStream, serverStream;
+			_transport.CreateStreams( out clientStream, out serverStream );
+
+			LoadTestService service = new LoadTestService();
+			FactoryProvider factoryProvider = new FactoryProvider();
+			ChannelMultiplexer clientMux = new ChannelMultiplexer( new MessageChannelOverStream( clientStream ), 2, 2, 2048 );
+			ChannelMultiplexer serverMux = new ChannelMultiplexer( new MessageChannelOverStream( serverStream ), 2, 2, 2048 );
+
+			try {
+				RequestChannel client = new RequestChannel( new ServiceContainer(), factoryProvider, clientMux, 0, 2 );
+				new RequestChannel( service, factoryProvider, serverMux, 0, 2 );
+
+				RpcMetrics metrics = new RpcMetrics();
+				metrics.RegisterInterface( typeof(ILoadTestService) );
+				client.Metrics = metrics;
+
+				RunState state = new RunState();
+				state.Proxy = (ILoadTestService) client.GetRequestSender( ResourceTable.RootPath, typeof(ILoadTestService).GUID );
+				state.OneWayRatio = _oneWayRatio;
+				state.CallsLeft = _callCount;
+				BuildCallMix( state );
+
+				Thread[] threads = new Thread[_concurrency];
+
+				for( int i = 0; i < threads.Length; i++ ) {
+					threads[i] = new Thread( RunCaller, __callerStackSize );
+					threads[i].Name = "RpcLoadGenerator caller " + i.ToString();
+					threads[i].IsBackground = true;
+				}
+
+				// Starting thousands of threads takes a while; hold them all at the gate so that isn't timed
+				for( int i = 0; i < threads.Length; i++ )
+					threads[i].Start( new object[] { state, _seed + i } );
+
+				long start = Stopwatch.GetTimestamp();
+				state.Deadline = (_duration == TimeSpan.MaxValue) ? long.MaxValue :
+					start + (long)(_duration.TotalSeconds * (double) Stopwatch.Frequency);
+				state.StartGate.Set();
+
+				for( int i = 0; i < threads.Length; i++ )
+					threads[i].Join();
+
+				state.StartGate.Close();
+
+				// One-way calls may still be on their way
+				long drainDeadline = Stopwatch.GetTimestamp() + (long)(_drainTimeout.TotalSeconds * (double) Stopwatch.Frequency);
+
+				while( Interlocked.Read( ref service.OneWayCalls ) < Interlocked.Read( ref state.OneWayCalls ) &&
+						Stopwatch.GetTimestamp() < drainDeadline )
+					Thread.Sleep( 1 );
+
+				TimeSpan elapsed = TimeSpan.FromTicks( LatencyHistogram.TimestampToMicroseconds( Stopwatch.GetTimestamp() - start ) * 10L );
+
+				return new RpcLoadResult( elapsed, state.Calls, state.OneWayCalls, Interlocked.Read( ref service.OneWayCalls ),
+					state.Errors, state.RequestBytes, _concurrency, state.PeakOutstanding, state.Latency,
+					service.OneWayLatency.CreateSnapshot(), metrics.GetSnapshot() );
+			}
+			finally {
+				clientMux.Close();
+				serverMux.Close();
+			}
+		}
+
+		private void BuildCallMix( RunState state ) {
+			if( _sizes.Count == 0 ) {
+				state.Sizes = new int[] { 64 };
+				state.CumulativeWeights = new int[] { 1 };
+				return;
+			}
+
+			state.Sizes = _sizes.ToArray();
+			state.CumulativeWeights = new int[_weights.Count];
+
+			int total = 0;
+
+			for( int i = 0; i < _weights.Count; i++ ) {
+				total = checked(total + _weights[i]);
+				state.CumulativeWeights[i] = total;
+			}
+		}
+
+		private static void RunCaller( object parameter ) {
+			object[] parameters = (object[]) parameter;
+			RunState state = (RunState) parameters[0];
+			Random random = new Random( (int) parameters[1] );
+
+			// One buffer per size, so the calls themselves don't allocate payloads
+			byte[][] payloads = new byte[state.Sizes.Length][];
+
+			for( int i = 0; i < payloads.Length; i++ ) {
+				payloads[i] = new byte[state.Sizes[i]];
+				random.NextBytes( payloads[i] );
+			}
+
+			int totalWeight = state.CumulativeWeights[state.CumulativeWeights.Length - 1];
+			state.StartGate.WaitOne();
+
+			while( Interlocked.Decrement( ref state.CallsLeft ) >= 0 ) {
+				long now = Stopwatch.GetTimestamp();
+
+				if( now >= state.Deadline )
+					return;
+
+				int pick = random.Next( totalWeight ), index = 0;
+
+				while( pick >= state.CumulativeWeights[index] )
+					index++;
+
+				byte[] payload = payloads[index];
+				bool oneWay = state.OneWayRatio != 0.0 && random.NextDouble() < state.OneWayRatio;
+
+				if( payload.Length >= __timestampLength )
+					NetworkBitConverter.Copy( now, payload, 0 );
+
+				RecordOutstanding( state, Interlocked.Increment( ref state.Outstanding ) );
+
+				try {
+					if( oneWay ) {
+						state.Proxy.Post( payload );
+						Interlocked.Increment( ref state.OneWayCalls );
+					}
+					else {
+						state.Proxy.Call( payload );
+						state.Latency.RecordSince( now );
+						Interlocked.Increment( ref state.Calls );
+					}
+
+					Interlocked.Add( ref state.RequestBytes, payload.Length );
+				}
+				catch( Exception ex ) {
+					Interlocked.Increment( ref state.Errors );
+					_ts.TraceEvent( TraceEventType.Warning, 0, "Load test call failed: {0}", ex );
+				}
+				finally {
+					Interlocked.Decrement( ref state.Outstanding );
+				}
+			}
+		}
+
+		private static void RecordOutstanding( RunState state, int outstanding ) {
+			int peak = state.PeakOutstanding;
+
+			while( outstanding > peak ) {
+				int oldPeak = Interlocked.CompareExchange( ref state.PeakOutstanding, outstanding, peak );
+
+				if( oldPeak == peak )
+					return;
+
+				peak = oldPeak;
+			}
+		}
+
+		static TraceSource _ts = new TraceSource( "RpcLoadGenerator", SourceLevels.Error );
+	#endregion
+	}
+
+	/// <summary>
+	/// Describes one run of an <see cref="RpcLoadGenerator"/>.
+	/// </summary>
+	public sealed class RpcLoadResult {
+		TimeSpan _elapsed;
+		long _calls, _oneWayCalls, _oneWayCallsReceived, _errors, _requestBytes;
+		int _concurrency, _peakOutstandingCalls;
+		LatencyHistogram _latency, _oneWayLatency;
+		RpcMetricsSnapshot _metrics;
+
+		internal RpcLoadResult( TimeSpan elapsed, long calls, long oneWayCalls, long oneWayCallsReceived, long errors,
+				long requestBytes, int concurrency, int peakOutstandingCalls, LatencyHistogram latency,
+				LatencyHistogram oneWayLatency, RpcMetricsSnapshot metrics ) {
+			_elapsed = elapsed;
+			_calls = calls;
+			_oneWayCalls = oneWayCalls;
+			_oneWayCallsReceived = oneWayCallsReceived;
+			_errors = errors;
+			_requestBytes = requestBytes;
+			_concurrency = concurrency;
+			_peakOutstandingCalls = peakOutstandingCalls;
+			_latency = latency;
+			_oneWayLatency = oneWayLatency;
+			_metrics = metrics;
+		}
+
+		/// <summary>
+		/// Gets the length of the run.
+		/// </summary>
+		/// <value>The time from the first call to the arrival of the last one-way call.</value>
+		public TimeSpan Elapsed {
+			get { return _elapsed; }
+		}
+
+		/// <summary>
+		/// Gets the number of two-way calls that completed.
+		/// </summary>
+		/// <value>The number of two-way calls that returned without an error.</value>
+		public long Calls {
+			get { return _calls; }
+		}
+
+		/// <summary>
+		/// Gets the number of one-way calls that were sent.
+		/// </summary>
+		/// <value>The number of one-way calls made without an error.</value>
+		public long OneWayCalls {
+			get { return _oneWayCalls; }
+		}
+
+		/// <summary>
+		/// Gets the number of one-way calls that arrived.
+		/// </summary>
+		/// <value>The number of one-way calls the far end received before the run ended.</value>
+		public long OneWayCallsReceived {
+			get { return _oneWayCallsReceived; }
+		}
+
+		/// <summary>
+		/// Gets the number of calls that failed.
+		/// </summary>
+		/// <value>The number of calls that threw an exception.</value>
+		public long Errors {
+			get { return _errors; }
+		}
+
+		/// <summary>
+		/// Gets the number of payload bytes sent.
+		/// </summary>
+		/// <value>The total length of the payloads of all successful calls.</value>
+		public long RequestBytes {
+			get { return _requestBytes; }
+		}
+
+		/// <summary>
+		/// Gets the number of threads that made calls.
+		/// </summary>
+		/// <value>The <see cref="RpcLoadGenerator.Concurrency"/> of the run.</value>
+		public int Concurrency {
+			get { return _concurrency; }
+		}
+
+		/// <summary>
+		/// Gets the largest number of calls that were outstanding at once.
+		/// </summary>
+		/// <value>The most calls, two-way and one-way, that had been started but not yet returned at any moment in the
+		///   run. This is at most <see cref="Concurrency"/>.</value>
+		public int PeakOutstandingCalls {
+			get { return _peakOutstandingCalls; }
+		}
+
+		/// <summary>
+		/// Gets the rate at which calls were made.
+		/// </summary>
+		/// <value>The number of successful calls, two-way and one-way, per second.</value>
+		public double CallsPerSecond {
+			get { return (double)(_calls + _oneWayCalls) / Math.Max( _elapsed.TotalSeconds, 1e-9 ); }
+		}
+
+		/// <summary>
+		/// Gets the rate at which payload bytes were sent.
+		/// </summary>
+		/// <value>The number of payload bytes sent per second.</value>
+		public double BytesPerSecond {
+			get { return (double) _requestBytes / Math.Max( _elapsed.TotalSeconds, 1e-9 ); }
+		}
+
+		/// <summary>
+		/// Gets the round-trip times of the two-way calls.
+		/// </summary>
+		/// <value>A <see cref="LatencyHistogram"/> of the time each two-way call took, as seen by the caller.</value>
+		public LatencyHistogram Latency {
+			get { return _latency; }
+		}
+
+		/// <summary>
+		/// Gets the delivery times of the one-way calls.
+		/// </summary>
+		/// <value>A <see cref="LatencyHistogram"/> of the time from making each one-way call to its arrival at the far end.
+		///   Calls with payloads shorter than eight bytes can't be timed and aren't included.</value>
+		public LatencyHistogram OneWayLatency {
+			get { return _oneWayLatency; }
+		}
+
+		/// <summary>
+		/// Gets the metrics the calling end collected during the run.
+		/// </summary>
+		/// <value>An <see cref="RpcMetricsSnapshot"/> with per-method counts and the multiplexer's window stalls.</value>
+		public RpcMetricsSnapshot Metrics {
+			get { return _metrics; }
+		}
+
+		/// <summary>
+		/// Summarizes the run.
+		/// </summary>
+		/// <returns>A few lines giving the throughput and latency percentiles of the run.</returns>
+		public override string ToString() {
+			StringBuilder builder = new StringBuilder();
+
+			builder.AppendFormat( "{0} calls, {1} one-way ({2} received), {3} errors in {4:0.000} s\r\n",
+				_calls, _oneWayCalls, _oneWayCallsReceived, _errors, _elapsed.TotalSeconds );
+			builder.AppendFormat( "{0} threads, {1} calls outstanding at peak\r\n", _concurrency, _peakOutstandingCalls );
+			builder.AppendFormat( "{0:0.0} calls/s, {1:0.0} KB/s\r\n", CallsPerSecond, BytesPerSecond / 1024.0 );
+			builder.AppendFormat( "two-way us: p50 {0} p99 {1} p99.9 {2} max {3} mean {4:0.0}\r\n",
+				_latency.P50, _latency.P99, _latency.P999, _latency.Max, _latency.Mean );
+			builder.AppendFormat( "one-way us: p50 {0} p99 {1} p99.9 {2} max {3} mean {4:0.0}",
+				_oneWayLatency.P50, _oneWayLatency.P99, _oneWayLatency.P999, _oneWayLatency.Max, _oneWayLatency.Mean );
+
+			return builder.ToString();
+		}
+	}
+}
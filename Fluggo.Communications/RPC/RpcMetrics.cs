@@ -0,0 +1,402 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Collections.Generic;
+using System.Reflection;
+using System.Threading;
+using Fluggo.Communications.Serialization;
+
+namespace Fluggo.Communications {
+	/// <summary>
+	/// Collects call counts, latencies, and payload sizes for the calls made over a <see cref="RequestChannel"/>.
+	/// </summary>
+	/// <remarks>Calls are counted separately for each interface, method, and direction. The method of a call is found by
+	///     decoding the method code at the start of its payload, which only works for interfaces that have been registered
+	///     with <see cref="RegisterInterface"/>; calls to other interfaces are counted under the interface alone.
+	///   <para>Recording a call doesn't take any locks once its method has been seen. The first call to each method takes
+	///     the same lock as <see cref="RegisterInterface"/>, so a registration never loses counts recorded alongside it.
+	///     Call <see cref="GetSnapshot"/> to read everything that has been collected so far.</para></remarks>
+	public sealed class RpcMetrics {
+		Dictionary<Guid, InterfaceEntry> _interfaces = new Dictionary<Guid, InterfaceEntry>();
+		object _lock = new object();
+		ChannelMultiplexer _mux;
+
+		sealed class InterfaceEntry {
+			public Guid InterfaceID;
+			public Type InterfaceType;
+			public MethodInfo[] Methods;
+			public int MethodPrecision;
+
+			// One slot per method, plus a last slot for calls whose method is unknown
+			public RpcCallMetrics[] Inbound, Outbound;
+		}
+
+		/// <summary>
+		/// Registers an interface so that calls to it can be counted by method.
+		/// </summary>
+		/// <param name="interfaceType">Interface type whose calls are to be counted.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='interfaceType'/> is <see langword='null'/>.</exception>
+		/// <exception cref="ArgumentException"><paramref name="interfaceType"/> is not an interface.</exception>
+		public void RegisterInterface( Type interfaceType ) {
+			if( interfaceType == null )
+				throw new ArgumentNullException( "interfaceType" );
+
+			if( !interfaceType.IsInterface )
+				throw new ArgumentException( "The given type is not an interface.", "interfaceType" );
+
+			InterfaceEntry existing;
+
+			if( _interfaces.TryGetValue( interfaceType.GUID, out existing ) && existing.InterfaceType != null )
+				return;
+
+			InterfaceEntry entry = new InterfaceEntry();
+			entry.InterfaceID = interfaceType.GUID;
+			entry.InterfaceType = interfaceType;
+			entry.Methods = BitSerializer.GetRemoteMethods( interfaceType, out entry.MethodPrecision );
+			entry.Inbound = new RpcCallMetrics[entry.Methods.Length + 1];
+			entry.Outbound = new RpcCallMetrics[entry.Methods.Length + 1];
+
+			lock( _lock ) {
+				if( _interfaces.TryGetValue( interfaceType.GUID, out existing ) ) {
+					if( existing.InterfaceType != null )
+						return;
+
+					// Keep what was counted before the interface was known
+					entry.Inbound[entry.Methods.Length] = existing.Inbound[0];
+					entry.Outbound[entry.Methods.Length] = existing.Outbound[0];
+				}
+
+				Publish( entry );
+			}
+		}
+
+		/// <summary>
+		/// Gets the metrics for calls to the given method.
+		/// </summary>
+		/// <param name="outbound">True to get the metrics for calls made by this side, false for calls received.</param>
+		/// <param name="interfaceID">GUID of the interface being called.</param>
+		/// <param name="lead">The first bits of the call's payload, most significant bit first.</param>
+		/// <param name="leadBitCount">Number of valid bits in <paramref name="lead"/>.</param>
+		/// <returns>The <see cref="RpcCallMetrics"/> for the method, or for the interface if the method can't be decoded.</returns>
+		internal RpcCallMetrics GetCallMetrics( bool outbound, Guid interfaceID, uint lead, int leadBitCount ) {
+			InterfaceEntry entry;
+			RpcCallMetrics[] slots;
+			int slot;
+
+			if( _interfaces.TryGetValue( interfaceID, out entry ) ) {
+				slot = FindSlot( entry, outbound, lead, leadBitCount, out slots );
+
+				if( slots[slot] != null )
+					return slots[slot];
+			}
+
+			lock( _lock ) {
+				// Look again under the lock: RegisterInterface may have replaced the entry, and metrics added to the old
+				// one would never be seen
+				if( !_interfaces.TryGetValue( interfaceID, out entry ) ) {
+					entry = new InterfaceEntry();
+					entry.InterfaceID = interfaceID;
+					entry.Inbound = new RpcCallMetrics[1];
+					entry.Outbound = new RpcCallMetrics[1];
+					Publish( entry );
+				}
+
+				slot = FindSlot( entry, outbound, lead, leadBitCount, out slots );
+				RpcCallMetrics result = slots[slot];
+
+				if( result == null ) {
+					result = new RpcCallMetrics( outbound, interfaceID, entry.InterfaceType,
+						(slot < slots.Length - 1) ? entry.Methods[slot].Name : null );
+					Interlocked.Exchange<RpcCallMetrics>( ref slots[slot], result );
+				}
+
+				return result;
+			}
+		}
+
+		/// <summary>
+		/// Finds the slot for a call in an interface entry.
+		/// </summary>
+		/// <returns>The index of the method's slot in <paramref name="slots"/>, or of the last slot if the method can't be
+		///   decoded.</returns>
+		private static int FindSlot( InterfaceEntry entry, bool outbound, uint lead, int leadBitCount, out RpcCallMetrics[] slots ) {
+			slots = outbound ? entry.Outbound : entry.Inbound;
+
+			if( entry.Methods != null && leadBitCount >= entry.MethodPrecision ) {
+				int method = (entry.MethodPrecision == 0) ? 0 : (int)(lead >> (32 - entry.MethodPrecision));
+
+				if( method < entry.Methods.Length )
+					return method;
+			}
+
+			return slots.Length - 1;
+		}
+
+		/// <summary>
+		/// Adds an entry to the interface table. The caller must hold the lock.
+		/// </summary>
+		/// <param name="entry">Entry to add.</param>
+		/// <remarks>The table is copied on write so that lookups never need the lock.</remarks>
+		private void Publish( InterfaceEntry entry ) {
+			Dictionary<Guid, InterfaceEntry> interfaces = new Dictionary<Guid, InterfaceEntry>( _interfaces );
+			interfaces[entry.InterfaceID] = entry;
+			_interfaces = interfaces;
+		}
+
+		/// <summary>
+		/// Associates these metrics with the multiplexer the calls are carried over.
+		/// </summary>
+		/// <param name="mux"><see cref="ChannelMultiplexer"/> whose window stalls are reported in snapshots.</param>
+		/// <exception cref="InvalidOperationException">These metrics are already in use on another multiplexer.</exception>
+		internal void Attach( ChannelMultiplexer mux ) {
+			if( mux == null )
+				throw new ArgumentNullException( "mux" );
+
+			lock( _lock ) {
+				if( _mux != null && _mux != mux )
+					throw new InvalidOperationException( "These metrics are already in use on another channel." );
+
+				_mux = mux;
+			}
+		}
+
+		/// <summary>
+		/// Takes a snapshot of the metrics.
+		/// </summary>
+		/// <returns>An <see cref="RpcMetricsSnapshot"/> with copies of all of the metrics collected so far.</returns>
+		public RpcMetricsSnapshot GetSnapshot() {
+			List<RpcCallMetrics> calls = new List<RpcCallMetrics>();
+
+			foreach( InterfaceEntry entry in _interfaces.Values ) {
+				foreach( RpcCallMetrics metrics in entry.Outbound ) {
+					if( metrics != null )
+						calls.Add( metrics.CreateSnapshot() );
+				}
+
+				foreach( RpcCallMetrics metrics in entry.Inbound ) {
+					if( metrics != null )
+						calls.Add( metrics.CreateSnapshot() );
+				}
+			}
+
+			int[] stallCounts;
+			TimeSpan[] stallTimes;
+			ChannelMultiplexer mux = _mux;
+
+			if( mux != null ) {
+				stallCounts = new int[mux.OutboundChannelCount];
+				stallTimes = new TimeSpan[mux.OutboundChannelCount];
+
+				for( int i = 0; i < stallCounts.Length; i++ ) {
+					stallCounts[i] = mux.GetWindowStallCount( i );
+					stallTimes[i] = mux.GetWindowStallTime( i );
+				}
+			}
+			else {
+				stallCounts = new int[0];
+				stallTimes = new TimeSpan[0];
+			}
+
+			return new RpcMetricsSnapshot( DateTime.UtcNow, calls.ToArray(), stallCounts, stallTimes );
+		}
+	}
+
+	/// <summary>
+	/// Holds the counters for calls to one method in one direction.
+	/// </summary>
+	public sealed class RpcCallMetrics {
+		bool _outbound;
+		Guid _interfaceID;
+		Type _interfaceType;
+		string _methodName;
+		long _callCount, _abortedCount, _requestBytes, _responseBytes;
+		LatencyHistogram _latency;
+
+		internal RpcCallMetrics( bool outbound, Guid interfaceID, Type interfaceType, string methodName ) {
+			_outbound = outbound;
+			_interfaceID = interfaceID;
+			_interfaceType = interfaceType;
+			_methodName = methodName;
+			_latency = new LatencyHistogram();
+		}
+
+		/// <summary>
+		/// Gets a value that represents the direction of the calls.
+		/// </summary>
+		/// <value>True if these are calls made by this side of the channel, false if they are calls received from the far end.</value>
+		public bool IsOutbound {
+			get { return _outbound; }
+		}
+
+		/// <summary>
+		/// Gets the GUID of the interface that was called.
+		/// </summary>
+		/// <value>The GUID of the interface that was called.</value>
+		public Guid InterfaceID {
+			get { return _interfaceID; }
+		}
+
+		/// <summary>
+		/// Gets the type of the interface that was called.
+		/// </summary>
+		/// <value>The type of the interface that was called, or <see langword='null'/> if the interface was not registered.</value>
+		public Type InterfaceType {
+			get { return _interfaceType; }
+		}
+
+		/// <summary>
+		/// Gets the name of the method that was called.
+		/// </summary>
+		/// <value>The name of the method that was called, or <see langword='null'/> if these counters are for all calls to
+		///   the interface whose method couldn't be determined.</value>
+		public string MethodName {
+			get { return _methodName; }
+		}
+
+		/// <summary>
+		/// Gets the number of calls that completed.
+		/// </summary>
+		/// <value>The number of calls that completed. Aborted calls are not included.</value>
+		public long CallCount {
+			get { return Interlocked.Read( ref _callCount ); }
+		}
+
+		/// <summary>
+		/// Gets the number of calls that were aborted.
+		/// </summary>
+		/// <value>The number of calls that were aborted by either side.</value>
+		public long AbortedCount {
+			get { return Interlocked.Read( ref _abortedCount ); }
+		}
+
+		/// <summary>
+		/// Gets the total size of the request payloads.
+		/// </summary>
+		/// <value>The total number of bytes in the request payloads of completed calls, not counting the RPC header.</value>
+		public long RequestBytes {
+			get { return Interlocked.Read( ref _requestBytes ); }
+		}
+
+		/// <summary>
+		/// Gets the total size of the response payloads.
+		/// </summary>
+		/// <value>The total number of bytes in the response payloads of completed calls, not counting the RPC header.</value>
+		public long ResponseBytes {
+			get { return Interlocked.Read( ref _responseBytes ); }
+		}
+
+		/// <summary>
+		/// Gets the latencies of the calls.
+		/// </summary>
+		/// <value>A <see cref="LatencyHistogram"/> of call latencies. For outbound calls, this is the time from the start of
+		///   the request until the response arrives, or until the request is sent for one-way calls. For inbound calls, this
+		///   is the time from the arrival of the request until the call has been processed.</value>
+		public LatencyHistogram Latency {
+			get { return _latency; }
+		}
+
+		internal void RecordCall( long startTimestamp ) {
+			Interlocked.Increment( ref _callCount );
+			_latency.RecordSince( startTimestamp );
+		}
+
+		internal void RecordAbort() {
+			Interlocked.Increment( ref _abortedCount );
+		}
+
+		internal void RecordRequestBytes( long count ) {
+			Interlocked.Add( ref _requestBytes, count );
+		}
+
+		internal void RecordResponseBytes( long count ) {
+			Interlocked.Add( ref _responseBytes, count );
+		}
+
+		internal RpcCallMetrics CreateSnapshot() {
+			RpcCallMetrics result = new RpcCallMetrics( _outbound, _interfaceID, _interfaceType, _methodName );
+			result._callCount = CallCount;
+			result._abortedCount = AbortedCount;
+			result._requestBytes = RequestBytes;
+			result._responseBytes = ResponseBytes;
+			result._latency = _latency.CreateSnapshot();
+
+			return result;
+		}
+
+		public override string ToString() {
+			return string.Format( "{0} {1}.{2}: {3} calls, {4} aborted, p50 {5} us, p99 {6} us, p99.9 {7} us",
+				_outbound ? "Out" : "In",
+				(_interfaceType != null) ? _interfaceType.Name : _interfaceID.ToString(),
+				(_methodName != null) ? _methodName : "?",
+				CallCount, AbortedCount, _latency.P50, _latency.P99, _latency.P999 );
+		}
+	}
+
+	/// <summary>
+	/// Holds a copy of the metrics of an RPC channel taken at one point in time.
+	/// </summary>
+	public sealed class RpcMetricsSnapshot {
+		DateTime _time;
+		RpcCallMetrics[] _calls;
+		int[] _windowStallCounts;
+		TimeSpan[] _windowStallTimes;
+
+		internal RpcMetricsSnapshot( DateTime time, RpcCallMetrics[] calls, int[] windowStallCounts, TimeSpan[] windowStallTimes ) {
+			_time = time;
+			_calls = calls;
+			_windowStallCounts = windowStallCounts;
+			_windowStallTimes = windowStallTimes;
+		}
+
+		/// <summary>
+		/// Gets the time the snapshot was taken.
+		/// </summary>
+		/// <value>The time the snapshot was taken, in UTC.</value>
+		public DateTime Time {
+			get { return _time; }
+		}
+
+		/// <summary>
+		/// Gets the call metrics.
+		/// </summary>
+		/// <value>An array of <see cref="RpcCallMetrics"/>, one for each interface, method, and direction that has seen calls.</value>
+		public RpcCallMetrics[] Calls {
+			get { return _calls; }
+		}
+
+		/// <summary>
+		/// Gets the number of times each outbound channel had to wait for the far end to open its receive window.
+		/// </summary>
+		/// <value>An array with the number of window stalls on each outbound channel of the multiplexer, or an empty array
+		///   if the metrics are not attached to a multiplexer.</value>
+		public int[] WindowStallCounts {
+			get { return _windowStallCounts; }
+		}
+
+		/// <summary>
+		/// Gets the total time each outbound channel spent waiting for the far end to open its receive window.
+		/// </summary>
+		/// <value>An array with the time spent in window stalls on each outbound channel of the multiplexer, or an empty array
+		///   if the metrics are not attached to a multiplexer.</value>
+		public TimeSpan[] WindowStallTimes {
+			get { return _windowStallTimes; }
+		}
+	}
+}
@@ -46,6 +46,7 @@ namespace Fluggo.Communications {
 		BitSerializer _serializer;
 		ChannelMultiplexer _mux;
 		RequestChannel _rpc;
+		RpcMetrics _metrics;
 		
 		// BJC: Here's how I think we can solve the service-declaration problem on sub-paths.
 		// Just create a new RpcResourceProvider-ish instance for it. Let it expire on garbage-collection.
@@ -246,6 +247,36 @@ namespace Fluggo.Communications {
 					_remoteKnownServices[serviceType] = true;
 				}
 			}
+
+			RpcMetrics metrics = _metrics;
+
+			if( metrics != null )
+				metrics.RegisterInterface( serviceType );
+		}
+
+		/// <summary>
+		/// Gets or sets the metrics collected for calls made and received by this provider.
+		/// </summary>
+		/// <value>An <see cref="RpcMetrics"/> that records every call on the underlying channel, or <see langword='null'/>
+		///   to collect no metrics. The default is <see langword='null'/>.</value>
+		/// <remarks>All of the service types known to this provider are registered with the metrics, so calls to them are
+		///   counted by method. Call <see cref="RpcMetrics.GetSnapshot"/> to read the metrics.</remarks>
+		/// <exception cref="InvalidOperationException">The given metrics are already in use on another provider.</exception>
+		public RpcMetrics Metrics {
+			get {
+				return _metrics;
+			}
+			set {
+				if( value != null ) {
+					lock( _knownServiceLock ) {
+						foreach( Type serviceType in _knownServiceTypes.Values )
+							value.RegisterInterface( serviceType );
+					}
+				}
+
+				_rpc.Metrics = value;
+				_metrics = value;
+			}
 		}
 		
 		/// <summary>
@@ -271,12 +302,24 @@ namespace Fluggo.Communications {
 			return GetService( serviceType, ResourceTable.RootPath );
 		}
 		
+		/// <summary>
+		/// Gets a service from a resource on the far end.
+		/// </summary>
+		/// <param name="serviceType"><see cref="Type"/> of the requested service.</param>
+		/// <param name="path">Path of the resource.</param>
+		/// <returns>The requested service, or <see langword="null"/> if the far end doesn't offer it or has recently reported
+		///   that it has no such service at <paramref name="path"/>.</returns>
+		/// <remarks>Proxies are cached by path and service type, so repeated lookups don't build new proxies, and lookups
+		///   that recently failed on the far end are answered here without going over the channel.</remarks>
 		public object GetService( Type serviceType, string path ) {
 			AddKnownServiceType( serviceType );
 			
 			if( !_remoteKnownServices.Contains( serviceType ) )
 				return null;
 
+			if( _rpc.IsTargetMissing( path, serviceType.GUID ) )
+				return null;
+
 			return _rpc.GetRequestSender( path, serviceType.GUID );
 		}
 		
@@ -286,6 +329,10 @@ namespace Fluggo.Communications {
 		
 		public T GetService<T>( string path ) {
 			AddKnownServiceType( typeof( T ) );
+
+			if( _rpc.IsTargetMissing( path, typeof( T ).GUID ) )
+				return default(T);
+
 			return (T) _rpc.GetRequestSender( path, typeof( T ).GUID );
 		}
 		
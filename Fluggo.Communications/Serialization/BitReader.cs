@@ -31,6 +31,7 @@ namespace Fluggo.Communications.Serialization
 		byte[] _buffer;
 		Stream _stream;
 		int _bitsLeft, _currentByte, _bytesInBuffer;
+		long _bytesBeforeBuffer;
 
 		/// <summary>
 		/// Creates a new instance of the <see cref="BitReader"/> class.
@@ -62,6 +63,7 @@ namespace Fluggo.Communications.Serialization
 			_currentByte = 0;
 			_bytesInBuffer = 1;
 			_bitsLeft = 0;
+			_bytesBeforeBuffer = -1L;
 		}
 
 		public void Close() {
@@ -93,6 +95,7 @@ namespace Fluggo.Communications.Serialization
 			_currentByte++;
 
 			if( _currentByte == _bytesInBuffer ) {
+				_bytesBeforeBuffer += _bytesInBuffer;
 				_bytesInBuffer = _stream.Read( _buffer, 0, _buffer.Length );
 
 				if( _bytesInBuffer == 0 )
@@ -251,5 +254,111 @@ namespace Fluggo.Communications.Serialization
 
 			return value[0];
 		}
+
+		/// <summary>
+		/// Gets the number of bits read so far.
+		/// </summary>
+		/// <value>The number of bits read or skipped from this reader.</value>
+		public long BitPosition {
+			get {
+				return (_bytesBeforeBuffer + _currentByte) * 8L + (8 - _bitsLeft);
+			}
+		}
+
+		/// <summary>
+		/// Skips the given number of bits.
+		/// </summary>
+		/// <param name="bitCount">Number of bits to skip.</param>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="bitCount"/> is less than zero.</exception>
+		/// <exception cref="EndOfStreamException">The end of the stream was reached before all of the bits were skipped.</exception>
+		/// <remarks>Bits that are already buffered are skipped in place. Beyond that, the underlying stream is sought
+		///   forward if it supports seeking; otherwise, the bytes are read and discarded.</remarks>
+		public void Skip( long bitCount ) {
+			if( bitCount < 0L )
+				throw new ArgumentOutOfRangeException( "bitCount" );
+
+			if( bitCount <= _bitsLeft ) {
+				_bitsLeft -= (int) bitCount;
+				return;
+			}
+
+			bitCount -= _bitsLeft;
+			_bitsLeft = 0;
+
+			long wholeBytes = bitCount / 8L;
+			int extraBits = (int) (bitCount % 8L);
+			long bufferedBytes = _bytesInBuffer - _currentByte - 1;
+
+			if( wholeBytes <= bufferedBytes ) {
+				_currentByte += (int) wholeBytes;
+			}
+			else {
+				long unbufferedBytes = wholeBytes - bufferedBytes;
+
+				if( _stream.CanSeek ) {
+					if( _stream.Position + unbufferedBytes > _stream.Length )
+						throw new EndOfStreamException();
+
+					_stream.Seek( unbufferedBytes, SeekOrigin.Current );
+				}
+				else {
+					for( long left = unbufferedBytes; left != 0L; ) {
+						int read = _stream.Read( _buffer, 0, (int) Math.Min( left, (long) _buffer.Length ) );
+
+						if( read == 0 )
+							throw new EndOfStreamException();
+
+						left -= read;
+					}
+				}
+
+				// Leave us at the end of an empty buffer, as if the last skipped byte had been read
+				_bytesBeforeBuffer += _bytesInBuffer + unbufferedBytes - 1L;
+				_bytesInBuffer = 1;
+				_currentByte = 0;
+			}
+
+			if( extraBits != 0 ) {
+				AdvanceByte();
+				_bitsLeft -= extraBits;
+			}
+		}
+
+		/// <summary>
+		/// Skips ahead to the given bit position.
+		/// </summary>
+		/// <param name="bitPosition">Bit position, as reported by <see cref="BitPosition"/>, to skip to.</param>
+		/// <exception cref="IOException">The reader has already read past <paramref name="bitPosition"/>.</exception>
+		/// <exception cref="EndOfStreamException">The end of the stream was reached before <paramref name="bitPosition"/>.</exception>
+		public void SkipTo( long bitPosition ) {
+			long position = BitPosition;
+
+			if( bitPosition < position )
+				throw new IOException( "The reader has already read past the requested position. The data may be corrupt." );
+
+			Skip( bitPosition - position );
+		}
+
+		/// <summary>
+		/// Reads the ordinal of the next field group.
+		/// </summary>
+		/// <returns>The ordinal of the next field group, or -1 if there are no more groups. If a group is returned, call
+		///   <see cref="ReadGroupEnd"/> to read its length.</returns>
+		/// <remarks>Field groups are written by <see cref="BitWriter.EndGroup"/> and terminated by <see cref="BitWriter.EndGroups"/>.</remarks>
+		public int ReadGroupOrdinal() {
+			if( !ReadBoolean() )
+				return -1;
+
+			return ReadInt32( BitWriter.GroupOrdinalPrecision );
+		}
+
+		/// <summary>
+		/// Reads the length of the current field group.
+		/// </summary>
+		/// <returns>The bit position of the end of the group. Pass this to <see cref="SkipTo"/> to skip the rest of the group.</returns>
+		public long ReadGroupEnd() {
+			long bitLength = ReadInt64( BitWriter.GroupLengthPrecision );
+			return BitPosition + bitLength;
+		}
 	}
 }
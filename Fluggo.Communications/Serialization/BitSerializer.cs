@@ -54,6 +54,12 @@ namespace Fluggo.Communications.Serialization
 		 * same ordinal are sorted alphabetically. (Therefore, the default sort order is the same as if all the relative orders
 		 * were set to zero.)
 		 * 
+		 * If any field of a compound type has a FieldGroupAttribute, the type is instead stored as a series of field groups
+		 * in ascending order of their ordinals. Each group is prefixed with a one bit, its 16-bit ordinal, and its 32-bit
+		 * length in bits, followed by the group's fields in the order above. A zero bit ends the series. Readers skip
+		 * groups they don't recognize, and skip any bits left over at the end of groups they do, so new groups can be added
+		 * to a type without breaking older readers.
+		 * 
 		 * Some types can have a custom serializer. If an attribute with a custom serializer is specified,
 		 * it is used. Otherwise, the BitSerializer's internal table is searched for proxies, and finally,
 		 * the default serialization is used.
@@ -255,9 +261,28 @@ namespace Fluggo.Communications.Serialization
 						if( typeCode != -1 )
 							attrs.StoreTypeCodeFieldValue( obj, typeCode );
 
-						foreach( FieldInfo field in GetSerializableFields( type, true ) ) {
-							// Members of a compound type
-							field.SetValue( obj, DeserializeValue( reader, field.FieldType, field.GetCustomAttributes( false ) ) );
+						FieldInfo[] fields = GetSerializableFields( type, true );
+						SortedList<int, List<FieldInfo>> groups = GetFieldGroups( fields );
+
+						if( groups == null ) {
+							foreach( FieldInfo field in fields ) {
+								// Members of a compound type
+								field.SetValue( obj, DeserializeValue( reader, field.FieldType, field.GetCustomAttributes( false ) ) );
+							}
+						}
+						else {
+							for( int ordinal = reader.ReadGroupOrdinal(); ordinal != -1; ordinal = reader.ReadGroupOrdinal() ) {
+								long groupEnd = reader.ReadGroupEnd();
+								List<FieldInfo> groupFields;
+
+								if( groups.TryGetValue( ordinal, out groupFields ) ) {
+									foreach( FieldInfo field in groupFields )
+										field.SetValue( obj, DeserializeValue( reader, field.FieldType, field.GetCustomAttributes( false ) ) );
+								}
+
+								// Skip unknown groups and anything a newer writer appended to a known one
+								reader.SkipTo( groupEnd );
+							}
 						}
 						
 						return obj;
@@ -405,9 +430,26 @@ namespace Fluggo.Communications.Serialization
 							attrs.SerializeTypeCode( writer, valueType, out type );
 						}
 
-						foreach( FieldInfo field in GetSerializableFields( type, true ) ) {
-							// Members of a compound type
-							SerializeValue( writer, field.GetValue( value ), field.FieldType, field.GetCustomAttributes( false ) );
+						FieldInfo[] fields = GetSerializableFields( type, true );
+						SortedList<int, List<FieldInfo>> groups = GetFieldGroups( fields );
+
+						if( groups == null ) {
+							foreach( FieldInfo field in fields ) {
+								// Members of a compound type
+								SerializeValue( writer, field.GetValue( value ), field.FieldType, field.GetCustomAttributes( false ) );
+							}
+						}
+						else {
+							foreach( KeyValuePair<int, List<FieldInfo>> group in groups ) {
+								BitWriter groupWriter = writer.BeginGroup();
+
+								foreach( FieldInfo field in group.Value )
+									SerializeValue( groupWriter, field.GetValue( value ), field.FieldType, field.GetCustomAttributes( false ) );
+
+								writer.EndGroup( group.Key, groupWriter );
+							}
+
+							writer.EndGroups();
 						}
 					}
 
@@ -712,8 +754,33 @@ namespace Fluggo.Communications.Serialization
 		}
 		
 		private Expression GenerateSerializeCompoundTypeExpression( ObjectProxy bitWriter, Expression value ) {
+			FieldInfo[] fields = GetSerializableFields( value.ResultType, true );
+			SortedList<int, List<FieldInfo>> groups = GetFieldGroups( fields );
+
+			if( groups == null )
+				return GenerateSerializeFieldsExpression( bitWriter, value, fields );
+
+			ListExpression block = new ListExpression( true );
+
+			foreach( KeyValuePair<int, List<FieldInfo>> group in groups ) {
+				Local groupWriter;
+
+				block.AddRange(
+					Comment( "Field group {0}", group.Key ),
+					Declare( typeof(BitWriter), "group" + group.Key.ToString() + "Writer", bitWriter.Call( "BeginGroup" ), out groupWriter ),
+					GenerateSerializeFieldsExpression( groupWriter, value, group.Value.ToArray() ),
+					bitWriter.Call( "EndGroup", group.Key, groupWriter ),
+					BlankLine
+				);
+			}
+
+			block.Add( bitWriter.Call( "EndGroups" ) );
+			return block;
+		}
+
+		private Expression GenerateSerializeFieldsExpression( ObjectProxy bitWriter, Expression value, FieldInfo[] fields ) {
 			return new ListExpression(
-				Array.ConvertAll<FieldInfo, Expression>( GetSerializableFields( value.ResultType, true ), delegate( FieldInfo field ) {
+				Array.ConvertAll<FieldInfo, Expression>( fields, delegate( FieldInfo field ) {
 					return GetSerializeExpression( bitWriter, Field( value, field ), field.Name, field.GetCustomAttributes( false ) );
 				} )
 			);
@@ -955,8 +1022,36 @@ namespace Fluggo.Communications.Serialization
 		}
 
 		private Expression GenerateDeserializeCompoundTypeExpression( ObjectProxy bitReader, ObjectProxy result, Local ulongTemp ) {
+			FieldInfo[] fields = GetSerializableFields( result.Type, true );
+			SortedList<int, List<FieldInfo>> groups = GetFieldGroups( fields );
+
+			if( groups == null )
+				return GenerateDeserializeFieldsExpression( bitReader, result, ulongTemp, fields );
+
+			// Groups we don't know fall through to the default case and are skipped
+			Expression[] cases = new Expression[groups.Keys[groups.Count - 1] + 1];
+
+			foreach( KeyValuePair<int, List<FieldInfo>> group in groups )
+				cases[group.Key] = GenerateDeserializeFieldsExpression( bitReader, result, ulongTemp, group.Value.ToArray() );
+
+			Local ordinal, groupEnd;
+
+			return List(
+				Declare<long>( "groupEnd", out groupEnd ),
+				For( Declare<int>( "groupOrdinal", bitReader.Call( "ReadGroupOrdinal" ), out ordinal ), NotEquals( ordinal, -1 ),
+						ordinal.Set( bitReader.Call( "ReadGroupOrdinal" ) ),
+					List(
+						groupEnd.Set( bitReader.Call( "ReadGroupEnd" ) ),
+						Switch( ordinal, cases, null ),
+						bitReader.Call( "SkipTo", groupEnd )
+					)
+				)
+			);
+		}
+
+		private Expression GenerateDeserializeFieldsExpression( ObjectProxy bitReader, ObjectProxy result, Local ulongTemp, FieldInfo[] fields ) {
 			return new ListExpression(
-				Array.ConvertAll<FieldInfo, Expression>( GetSerializableFields( result.Type, true ), delegate( FieldInfo field ) {
+				Array.ConvertAll<FieldInfo, Expression>( fields, delegate( FieldInfo field ) {
 					return GetDeserializeExpression( bitReader, new Field( result.Get(), field ), ulongTemp, 
 						new BitSerializerParameterInfo( field, _options ) );
 				} )
@@ -980,7 +1075,7 @@ namespace Fluggo.Communications.Serialization
 				if( _receiverTypes.TryGetValue( interfaceType, out receiverType ) )
 					return new LocalReceiverFactory( interfaceType, receiverType );
 
-				TypeGeneratorContext typeCxt = _cacheModule.DefineType( "__requestReceiver." + interfaceType.FullName.Replace( '+', '_' ),
+				TypeGeneratorContext typeCxt = _cacheModule.DefineType( GetReceiverTypeName( interfaceType ),
 					TypeAttributes.Public | TypeAttributes.Sealed );
 				typeCxt.AddInterface( typeof(IRequestReceiver) );
 				Field targetField = typeCxt.DefineField( "_target", interfaceType, FieldAttributes.Private );
@@ -996,10 +1091,6 @@ namespace Fluggo.Communications.Serialization
 				
 				MethodGeneratorContext methodCxt = typeCxt.DefineOverrideMethod( typeof(IRequestReceiver).GetMethod("ProcessRequest") );
 				Param request = methodCxt.DefineParameter( 0, "request" );
-				
-				object[] attributes = interfaceType.GetCustomAttributes( typeof(MaxLengthAttribute), false );
-				MaxLengthAttribute maxLength = (attributes.Length != 0) ? (MaxLengthAttribute) attributes[0] : null;
-				int methodPrecision = (maxLength != null) ? maxLength.Precision : 32;
 				Local reader, ulongTemp;
 				
 				methodCxt.AddExpressionRange(
@@ -1008,18 +1099,8 @@ namespace Fluggo.Communications.Serialization
 					Declare<ulong>( "ulongTemp", out ulongTemp )
 				);
 					
-				MethodInfo[] methods = Array.FindAll<MethodInfo>(
-					interfaceType.GetMethods( BindingFlags.Public | BindingFlags.Instance | BindingFlags.FlattenHierarchy ),
-					delegate( MethodInfo method ) {
-						return method.GetCustomAttributes( typeof(IgnoreAttribute), true ).Length == 0;
-					}
-				);
-				
-				if( maxLength != null && methods.Length >= maxLength.MaxLength )
-					throw new Exception( "There are too many methods for the given maximum length." );
-					
-				if( maxLength == null )
-					methodPrecision = GetPrecision( (ulong) methods.Length );
+				int methodPrecision;
+				MethodInfo[] methods = GetRemoteMethods( interfaceType, out methodPrecision );
 					
 				Expression[] cases = Array.ConvertAll<MethodInfo, Expression>( methods, delegate( MethodInfo method ) {
 					ListExpression block = new ListExpression( true );
@@ -1072,7 +1153,7 @@ namespace Fluggo.Communications.Serialization
 				if( _senderTypes.TryGetValue( interfaceType, out senderType ) )
 					return new LocalSenderFactory( senderType );
 
-				TypeGeneratorContext typeCxt = _cacheModule.DefineType( "__requestSender." + interfaceType.FullName.Replace( '+', '_' ),
+				TypeGeneratorContext typeCxt = _cacheModule.DefineType( GetSenderTypeName( interfaceType ),
 					TypeAttributes.Public | TypeAttributes.Sealed );
 				typeCxt.AddInterface( interfaceType );
 				Field targetField = typeCxt.DefineField( "_target", typeof(IRequestTarget), FieldAttributes.Private );
@@ -1086,24 +1167,10 @@ namespace Fluggo.Communications.Serialization
 					targetField.Set( target )
 				);
 
-				MethodInfo[] methods = Array.FindAll<MethodInfo>(
-					interfaceType.GetMethods( BindingFlags.Public | BindingFlags.Instance | BindingFlags.FlattenHierarchy ),
-					delegate( MethodInfo method ) {
-						return method.GetCustomAttributes( typeof( IgnoreAttribute ), true ).Length == 0;
-					}
-				);
-
-				object[] attributes = interfaceType.GetCustomAttributes( typeof( MaxLengthAttribute ), false );
-				MaxLengthAttribute maxLength = (attributes.Length != 0) ? (MaxLengthAttribute) attributes[0] : null;
-				int methodPrecision = (maxLength != null) ? maxLength.Precision : 32;
+				int methodPrecision;
+				MethodInfo[] methods = GetRemoteMethods( interfaceType, out methodPrecision );
 				int currentMethod = 0;
 
-				if( maxLength != null && methods.Length >= maxLength.MaxLength )
-					throw new Exception( "There are too many methods for the given maximum length." );
-
-				if( maxLength == null )
-					methodPrecision = GetPrecision( (ulong) methods.Length );
-
 				foreach( MethodInfo method in methods ) {
 					MethodGeneratorContext methodCxt = typeCxt.DefineOverrideMethod( method );
 					Local writer, request;
@@ -1135,6 +1202,76 @@ namespace Fluggo.Communications.Serialization
 			}
 		}
 
+		/// <summary>
+		/// Gets the methods of an interface that can be called remotely, in method code order.
+		/// </summary>
+		/// <param name="interfaceType">Interface type to examine.</param>
+		/// <param name="methodPrecision">Reference to a variable that receives the number of bits used to encode
+		///   a method code for this interface.</param>
+		/// <returns>An array of the remotely callable methods of the interface. A method's method code is its index
+		///   in this array.</returns>
+		internal static MethodInfo[] GetRemoteMethods( Type interfaceType, out int methodPrecision ) {
+			MethodInfo[] methods = Array.FindAll<MethodInfo>(
+				interfaceType.GetMethods( BindingFlags.Public | BindingFlags.Instance | BindingFlags.FlattenHierarchy ),
+				delegate( MethodInfo method ) {
+					return method.GetCustomAttributes( typeof(IgnoreAttribute), true ).Length == 0;
+				}
+			);
+
+			object[] attributes = interfaceType.GetCustomAttributes( typeof(MaxLengthAttribute), false );
+			MaxLengthAttribute maxLength = (attributes.Length != 0) ? (MaxLengthAttribute) attributes[0] : null;
+
+			if( maxLength != null && methods.Length >= maxLength.MaxLength )
+				throw new Exception( "There are too many methods for the given maximum length." );
+
+			if( maxLength != null )
+				methodPrecision = maxLength.Precision;
+			else
+				methodPrecision = GetPrecision( (ulong) methods.Length );
+
+			return methods;
+		}
+
+		private static string GetReceiverTypeName( Type interfaceType ) {
+			return "__requestReceiver." + interfaceType.FullName.Replace( '+', '_' );
+		}
+
+		private static string GetSenderTypeName( Type interfaceType ) {
+			return "__requestSender." + interfaceType.FullName.Replace( '+', '_' );
+		}
+
+		/// <summary>
+		/// Adopts the request sender and receiver types for an interface from an assembly saved by an earlier generation.
+		/// </summary>
+		/// <param name="assembly">Assembly containing types generated by a <see cref="BitSerializer"/> with the same options.</param>
+		/// <param name="interfaceType">Type of the interface whose generated types should be adopted.</param>
+		/// <returns>True if both types were found in <paramref name="assembly"/>, false otherwise.</returns>
+		/// <remarks>The caller is responsible for making sure that <paramref name="assembly"/> was generated from the same
+		///   interface and type shapes; see <see cref="BitSerializerAssemblyCache"/>.</remarks>
+		internal bool AdoptPrecompiledTypes( Assembly assembly, Type interfaceType ) {
+			if( assembly == null )
+				throw new ArgumentNullException( "assembly" );
+
+			if( interfaceType == null )
+				throw new ArgumentNullException( "interfaceType" );
+
+			if( _receiverTypes == null )
+				throw new InvalidOperationException( "Precompiled types can only be adopted when a cache module is supplied to the constructor." );
+
+			Type receiverType = assembly.GetType( GetReceiverTypeName( interfaceType ), false );
+			Type senderType = assembly.GetType( GetSenderTypeName( interfaceType ), false );
+
+			if( receiverType == null || senderType == null )
+				return false;
+
+			lock( _localLock ) {
+				_receiverTypes[interfaceType] = receiverType;
+				_senderTypes[interfaceType] = senderType;
+			}
+
+			return true;
+		}
+
 		private class LocalReceiverFactory : RequestReceiverFactory {
 			Type _receiverType, _interfaceType;
 			
@@ -1199,7 +1336,7 @@ namespace Fluggo.Communications.Serialization
 		/// <param name="includeInherited">True to include inherited fields, false otherwise. If true, the fields
 		///   of the base type appear, sorted, before the fields of the derived type.</param>
 		/// <returns>The serializable members of the type.</returns>
-		private static FieldInfo[] GetSerializableFields( Type type, bool includeInherited ) {
+		internal static FieldInfo[] GetSerializableFields( Type type, bool includeInherited ) {
 			// Get the properties and fields and sort them.
 			FieldInfo[] declaredMembers = type.GetFields( BindingFlags.Public | BindingFlags.Instance | BindingFlags.DeclaredOnly );
 			SortMembers( declaredMembers );
@@ -1217,6 +1354,44 @@ namespace Fluggo.Communications.Serialization
 			return result;
 		}
 
+		/// <summary>
+		/// Sorts serializable fields into their field groups.
+		/// </summary>
+		/// <param name="fields">Fields, in serialization order, as returned from <see cref="GetSerializableFields"/>.</param>
+		/// <returns>The fields of each group, keyed and sorted by group ordinal, or <see langword='null'/> if none of the
+		///   fields has a <see cref="FieldGroupAttribute"/>. Fields without the attribute are placed in group zero.</returns>
+		internal static SortedList<int, List<FieldInfo>> GetFieldGroups( FieldInfo[] fields ) {
+			SortedList<int, List<FieldInfo>> groups = null;
+			int[] ordinals = new int[fields.Length];
+
+			for( int i = 0; i < fields.Length; i++ ) {
+				object[] attrs = fields[i].GetCustomAttributes( typeof(FieldGroupAttribute), true );
+
+				if( attrs.Length != 0 ) {
+					ordinals[i] = ((FieldGroupAttribute) attrs[0]).Ordinal;
+
+					if( groups == null )
+						groups = new SortedList<int, List<FieldInfo>>();
+				}
+			}
+
+			if( groups == null )
+				return null;
+
+			for( int i = 0; i < fields.Length; i++ ) {
+				List<FieldInfo> group;
+
+				if( !groups.TryGetValue( ordinals[i], out group ) ) {
+					group = new List<FieldInfo>();
+					groups.Add( ordinals[i], group );
+				}
+
+				group.Add( fields[i] );
+			}
+
+			return groups;
+		}
+
 		private static void SortMembers( MemberInfo[] members ) {
 			if( members == null )
 				throw new ArgumentNullException( "members" );
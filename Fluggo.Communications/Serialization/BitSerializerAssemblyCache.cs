@@ -0,0 +1,349 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Reflection;
+using System.Reflection.Emit;
+using System.Security.Cryptography;
+using System.Text;
+using Fluggo.CodeGeneration.IL;
+
+namespace Fluggo.Communications.Serialization {
+	/// <summary>
+	/// Saves the request senders and receivers generated by a <see cref="BitSerializer"/> to disk and reloads them on later runs.
+	/// </summary>
+	/// <remarks>Generating request factories for a large number of interfaces can add seconds to startup. This class generates
+	///     the factories for a known set of interfaces ahead of time and saves them to an assembly whose name contains a hash of
+	///     the interface and type shapes. On the next start, the assembly with the matching hash is loaded instead. If any of the
+	///     shapes change, so does the hash, and the types are regenerated.
+	///   <para>Interfaces that were not added to the cache can still be used with the <see cref="BitSerializer"/> returned by
+	///     <see cref="Load"/>; their types are generated at run time as usual.</para></remarks>
+	public sealed class BitSerializerAssemblyCache {
+		static TraceSource _ts = new TraceSource( "BitSerializerAssemblyCache", SourceLevels.Error );
+		static readonly BitSerializerOptions __defaultOptions = new BitSerializerOptions();
+		const int __formatVersion = 1;
+		const string __assemblyExtension = ".dll";
+		string _directory, _name;
+		BitSerializerOptions _options;
+		List<Type> _interfaces = new List<Type>();
+		bool _loadedFromCache;
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='BitSerializerAssemblyCache'/> class.
+		/// </summary>
+		/// <param name="directory">Directory in which the generated assemblies are stored.</param>
+		/// <param name="name">Base name of the generated assemblies. The shape hash is appended to this name.</param>
+		/// <param name="options">Optional <see cref="BitSerializerOptions"/> instance to apply to all serialization that the
+		///   generated types perform.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='directory'/> is <see langword='null'/>.
+		///   <para>-or-</para>
+		///   <para><paramref name='name'/> is <see langword='null'/>.</para></exception>
+		/// <exception cref="ArgumentException"><paramref name="name"/> is empty.</exception>
+		public BitSerializerAssemblyCache( string directory, string name, BitSerializerOptions options ) {
+			if( directory == null )
+				throw new ArgumentNullException( "directory" );
+
+			if( name == null )
+				throw new ArgumentNullException( "name" );
+
+			if( name.Length == 0 )
+				throw new ArgumentException( "The name was empty.", "name" );
+
+			_directory = directory;
+			_name = name;
+			_options = options;
+
+			if( _options == null )
+				_options = __defaultOptions;
+		}
+
+		/// <summary>
+		/// Adds an interface to the set of interfaces generated ahead of time.
+		/// </summary>
+		/// <param name="interfaceType">Type of the interface.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='interfaceType'/> is <see langword='null'/>.</exception>
+		/// <exception cref='ArgumentException'><paramref name='interfaceType'/> does not represent an interface.</exception>
+		public void AddInterface( Type interfaceType ) {
+			if( interfaceType == null )
+				throw new ArgumentNullException( "interfaceType" );
+
+			if( !interfaceType.IsInterface )
+				throw new ArgumentException( "The given type is not an interface.", "interfaceType" );
+
+			if( !_interfaces.Contains( interfaceType ) )
+				_interfaces.Add( interfaceType );
+		}
+
+		/// <summary>
+		/// Gets a value that represents whether the last call to <see cref="Load"/> used a saved assembly.
+		/// </summary>
+		/// <value>True if the types were loaded from disk, false if they were regenerated.</value>
+		public bool LoadedFromCache {
+			get { return _loadedFromCache; }
+		}
+
+		/// <summary>
+		/// Gets the path of the assembly that matches the current set of interfaces.
+		/// </summary>
+		/// <value>The full path of the assembly that <see cref="Load"/> will look for or create.</value>
+		public string AssemblyPath {
+			get { return Path.Combine( _directory, GetAssemblyName( ComputeShapeHash() ) + __assemblyExtension ); }
+		}
+
+		/// <summary>
+		/// Loads the saved request types, generating and saving them first if necessary.
+		/// </summary>
+		/// <returns>A <see cref="BitSerializer"/> that can create request sender and receiver factories for all of the
+		///   interfaces added to this cache, along with any other interfaces.</returns>
+		/// <remarks>If the saved assembly cannot be loaded, or the new assembly cannot be saved, the failure is traced
+		///   and the types are generated in memory instead. This method never fails just because the cache is unusable.</remarks>
+		public BitSerializer Load() {
+			string assemblyName = GetAssemblyName( ComputeShapeHash() );
+			string fileName = assemblyName + __assemblyExtension;
+			string path = Path.Combine( _directory, fileName );
+
+			if( File.Exists( path ) ) {
+				BitSerializer serializer = TryLoad( path );
+
+				if( serializer != null ) {
+					_loadedFromCache = true;
+					return serializer;
+				}
+			}
+
+			_loadedFromCache = false;
+			return Generate( assemblyName, fileName );
+		}
+
+		private BitSerializer TryLoad( string path ) {
+			try {
+				Assembly assembly = Assembly.LoadFrom( path );
+				BitSerializer serializer = CreateRuntimeSerializer();
+
+				foreach( Type interfaceType in _interfaces ) {
+					if( !serializer.AdoptPrecompiledTypes( assembly, interfaceType ) ) {
+						_ts.TraceEvent( TraceEventType.Warning, 0, "The cached assembly {0} has no types for {1}, regenerating",
+							path, interfaceType.FullName );
+						return null;
+					}
+				}
+
+				_ts.TraceEvent( TraceEventType.Information, 0, "Loaded {0} interfaces from {1}", _interfaces.Count, path );
+				return serializer;
+			}
+			catch( Exception ex ) {
+				_ts.TraceEvent( TraceEventType.Warning, 0, "The cached assembly {0} could not be loaded, \"{1}\", regenerating", path, ex.Message );
+				return null;
+			}
+		}
+
+		private BitSerializer Generate( string assemblyName, string fileName ) {
+			AssemblyGeneratorContext assemblyCxt = AssemblyGeneratorContext.CreateAssembly( assemblyName, _directory, fileName, false );
+			BitSerializer serializer = new BitSerializer( _options, assemblyCxt.DefineModule( assemblyName ) );
+
+			foreach( Type interfaceType in _interfaces ) {
+				serializer.GenerateRequestReceiverFactory( interfaceType );
+				serializer.GenerateRequestSenderFactory( interfaceType );
+			}
+
+			// Finish off the method cache type so that it makes it into the saved assembly
+			serializer.Dispose();
+
+			try {
+				Directory.CreateDirectory( _directory );
+				assemblyCxt.Save();
+				RemoveStaleAssemblies( fileName );
+			}
+			catch( IOException ex ) {
+				_ts.TraceEvent( TraceEventType.Warning, 0, "Could not save {0} to {1}, \"{2}\"", fileName, _directory, ex.Message );
+			}
+			catch( UnauthorizedAccessException ex ) {
+				_ts.TraceEvent( TraceEventType.Warning, 0, "Could not save {0} to {1}, \"{2}\"", fileName, _directory, ex.Message );
+			}
+
+			return serializer;
+		}
+
+		private BitSerializer CreateRuntimeSerializer() {
+			// Types for interfaces outside of the cache still need somewhere to go
+			AssemblyName name = new AssemblyName( _name + ".Runtime" );
+			AssemblyBuilder assembly = AppDomain.CurrentDomain.DefineDynamicAssembly( name, AssemblyBuilderAccess.Run );
+
+			return new BitSerializer( _options, new ModuleGeneratorContext( assembly.DefineDynamicModule( name.Name ), false ) );
+		}
+
+		private void RemoveStaleAssemblies( string currentFileName ) {
+			foreach( string path in Directory.GetFiles( _directory, _name + ".*" + __assemblyExtension ) ) {
+				string fileName = Path.GetFileName( path );
+
+				if( string.Compare( fileName, currentFileName, StringComparison.OrdinalIgnoreCase ) == 0 )
+					continue;
+
+				// Only touch files that look like ours: <name>.<hash>.dll
+				string hash = fileName.Substring( _name.Length + 1, fileName.Length - _name.Length - 1 - __assemblyExtension.Length );
+
+				if( !IsHash( hash ) )
+					continue;
+
+				try {
+					File.Delete( path );
+				}
+				catch( IOException ex ) {
+					// Probably still loaded by another process
+					_ts.TraceEvent( TraceEventType.Information, 0, "Could not remove stale assembly {0}, \"{1}\"", path, ex.Message );
+				}
+				catch( UnauthorizedAccessException ex ) {
+					_ts.TraceEvent( TraceEventType.Information, 0, "Could not remove stale assembly {0}, \"{1}\"", path, ex.Message );
+				}
+			}
+		}
+
+		private string GetAssemblyName( string hash ) {
+			return _name + "." + hash;
+		}
+
+	#region Shape hash
+		/// <summary>
+		/// Computes a hash of the shapes of all of the added interfaces and the types they serialize.
+		/// </summary>
+		/// <returns>A hexadecimal string that changes whenever anything that affects the generated code changes.</returns>
+		/// <remarks>The hash covers the interfaces' GUIDs and methods, the parameter and field types reachable from them
+		///   along with their serialization attributes, the serializer options, and the version of this library.</remarks>
+		public string ComputeShapeHash() {
+			StringBuilder shape = new StringBuilder();
+			Dictionary<Type, bool> visited = new Dictionary<Type, bool>();
+			Queue<Type> pending = new Queue<Type>();
+
+			shape.AppendFormat( "format {0}\n", __formatVersion );
+			shape.AppendFormat( "generator {0}\n", typeof(BitSerializer).Assembly.GetName().Version );
+			shape.AppendFormat( "options {0} {1}\n", _options.MaxArrayLength, _options.MaxStringLength );
+
+			List<Type> interfaces = new List<Type>( _interfaces );
+			interfaces.Sort( delegate( Type x, Type y ) {
+				return string.CompareOrdinal( x.FullName, y.FullName );
+			} );
+
+			foreach( Type interfaceType in interfaces )
+				AppendInterfaceShape( shape, interfaceType, pending );
+
+			while( pending.Count != 0 ) {
+				Type type = pending.Dequeue();
+
+				if( visited.ContainsKey( type ) )
+					continue;
+
+				visited[type] = true;
+				AppendTypeShape( shape, type, pending );
+			}
+
+			byte[] hash;
+
+			using( SHA1 sha = SHA1.Create() )
+				hash = sha.ComputeHash( Encoding.UTF8.GetBytes( shape.ToString() ) );
+
+			StringBuilder result = new StringBuilder( hash.Length * 2 );
+
+			foreach( byte b in hash )
+				result.Append( b.ToString( "x2" ) );
+
+			return result.ToString();
+		}
+
+		private static void AppendInterfaceShape( StringBuilder shape, Type interfaceType, Queue<Type> pending ) {
+			shape.AppendFormat( "interface {0} {1}\n", interfaceType.FullName, interfaceType.GUID );
+			AppendAttributes( shape, CustomAttributeData.GetCustomAttributes( interfaceType ) );
+
+			// Method codes are assigned in this order, so the order itself is part of the shape
+			foreach( MethodInfo method in interfaceType.GetMethods( BindingFlags.Public | BindingFlags.Instance | BindingFlags.FlattenHierarchy ) ) {
+				shape.AppendFormat( " method {0} : {1}\n", method.Name, method.ReturnType.FullName );
+				AppendAttributes( shape, CustomAttributeData.GetCustomAttributes( method ) );
+
+				foreach( ParameterInfo param in method.GetParameters() ) {
+					shape.AppendFormat( "  param {0} : {1}\n", param.Name, param.ParameterType.FullName );
+					AppendAttributes( shape, CustomAttributeData.GetCustomAttributes( param ) );
+					EnqueueReferencedTypes( param.ParameterType, param.GetCustomAttributes( typeof(DerivedTypeCodeAttribute), true ), pending );
+				}
+			}
+		}
+
+		private static void AppendTypeShape( StringBuilder shape, Type type, Queue<Type> pending ) {
+			if( type.IsArray ) {
+				pending.Enqueue( type.GetElementType() );
+				return;
+			}
+
+			if( type.IsEnum ) {
+				shape.AppendFormat( "enum {0} : {1}\n", type.FullName, Enum.GetUnderlyingType( type ).FullName );
+				return;
+			}
+
+			if( Type.GetTypeCode( type ) != TypeCode.Object || type == typeof(Guid) )
+				return;
+
+			shape.AppendFormat( "type {0}\n", type.FullName );
+
+			foreach( FieldInfo field in BitSerializer.GetSerializableFields( type, true ) ) {
+				shape.AppendFormat( " field {0} : {1}\n", field.Name, field.FieldType.FullName );
+				AppendAttributes( shape, CustomAttributeData.GetCustomAttributes( field ) );
+				EnqueueReferencedTypes( field.FieldType, field.GetCustomAttributes( typeof(DerivedTypeCodeAttribute), true ), pending );
+			}
+		}
+
+		private static void EnqueueReferencedTypes( Type type, object[] typeCodes, Queue<Type> pending ) {
+			if( type.IsByRef )
+				type = type.GetElementType();
+
+			pending.Enqueue( type );
+
+			foreach( DerivedTypeCodeAttribute attr in typeCodes ) {
+				if( attr.Type != null )
+					pending.Enqueue( attr.Type );
+			}
+		}
+
+		private static void AppendAttributes( StringBuilder shape, IList<CustomAttributeData> attributes ) {
+			// Attribute order isn't guaranteed by reflection, so sort the text forms
+			List<string> list = new List<string>( attributes.Count );
+
+			foreach( CustomAttributeData data in attributes )
+				list.Add( data.ToString() );
+
+			list.Sort( StringComparer.Ordinal );
+
+			foreach( string attr in list )
+				shape.Append( "  " ).Append( attr ).Append( '\n' );
+		}
+
+		private static bool IsHash( string value ) {
+			if( value.Length != 40 )
+				return false;
+
+			foreach( char c in value ) {
+				if( !((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')) )
+					return false;
+			}
+
+			return true;
+		}
+	#endregion
+	}
+}
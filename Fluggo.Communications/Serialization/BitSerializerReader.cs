@@ -0,0 +1,298 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Reflection;
+
+namespace Fluggo.Communications.Serialization {
+	/// <summary>
+	/// Reads a message written by a <see cref="BitSerializer"/> one piece at a time.
+	/// </summary>
+	/// <remarks>Unlike <see cref="BitSerializer.DeserializeMessage"/>, which builds the entire object graph before returning,
+	///     this reader lets the caller walk the message in order: step into compound values with
+	///     <see cref="ReadObjectStart(Type,object[])"/> and <see cref="ReadNextField"/>, read small values whole with
+	///     <see cref="ReadValue(Type,object[])"/>, and read large arrays with <see cref="ReadArray{T}(object[])"/>, which
+	///     decodes each element only as it is enumerated. Since the underlying <see cref="BitReader"/> only reads from its
+	///     stream when it needs more bits, elements can be processed while the rest of the message is still arriving.
+	///   <para>The message must be read in the order it was written. Moving on to the next value before an array has been
+	///     fully enumerated decodes and discards the rest of the array.</para></remarks>
+	public sealed class BitSerializerReader : IDisposable {
+		BitSerializer _serializer;
+		BitReader _reader;
+		Stack<ObjectFrame> _frames = new Stack<ObjectFrame>();
+
+		// State of the array currently being enumerated
+		int _arrayVersion;
+		int _elementsLeft;
+		Type _elementType;
+		object[] _elementAttributes;
+
+		sealed class ObjectFrame {
+			public FieldInfo[] Fields;
+			public SortedList<int, List<FieldInfo>> Groups;
+			public List<FieldInfo> GroupFields;
+			public long GroupEnd;
+			public int Index;
+		}
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='BitSerializerReader'/> class.
+		/// </summary>
+		/// <param name="serializer"><see cref="BitSerializer"/> whose options and rules were used to write the message.</param>
+		/// <param name="stream">Stream containing the message.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='serializer'/> is <see langword='null'/>.
+		///   <para> OR </para>
+		///   <para><paramref name='stream'/> is <see langword='null'/>.</para></exception>
+		/// <exception cref="ArgumentException"><paramref name='stream'/> does not support reading.</exception>
+		public BitSerializerReader( BitSerializer serializer, Stream stream ) {
+			if( serializer == null )
+				throw new ArgumentNullException( "serializer" );
+
+			if( stream == null )
+				throw new ArgumentNullException( "stream" );
+
+			_serializer = serializer;
+			_reader = new BitReader( stream );
+		}
+
+		/// <summary>
+		/// Gets the underlying <see cref="BitReader"/>.
+		/// </summary>
+		/// <value>The <see cref="BitReader"/> this reader decodes from.</value>
+		public BitReader BaseReader {
+			get {
+				FinishArray();
+				return _reader;
+			}
+		}
+
+		/// <summary>
+		/// Reads a whole value from the message.
+		/// </summary>
+		/// <param name="type">The expected type of the value.</param>
+		/// <param name="attributes">Optional array of attributes used to change the decoding of the value. These must be the
+		///   same significant attributes used to encode the value.</param>
+		/// <returns>The deserialized value.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='type'/> is <see langword='null'/>.</exception>
+		public object ReadValue( Type type, object[] attributes ) {
+			if( type == null )
+				throw new ArgumentNullException( "type" );
+
+			FinishArray();
+			return _serializer.DeserializeValue( _reader, type, attributes );
+		}
+
+		/// <summary>
+		/// Reads the value of a field of the compound value being read.
+		/// </summary>
+		/// <param name="field">Field returned from <see cref="ReadNextField"/>.</param>
+		/// <returns>The deserialized value of the field.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='field'/> is <see langword='null'/>.</exception>
+		public object ReadValue( FieldInfo field ) {
+			if( field == null )
+				throw new ArgumentNullException( "field" );
+
+			return ReadValue( field.FieldType, field.GetCustomAttributes( false ) );
+		}
+
+		/// <summary>
+		/// Reads an array from the message, decoding its elements on demand.
+		/// </summary>
+		/// <typeparam name="T">Element type of the array.</typeparam>
+		/// <param name="attributes">Optional array of attributes used to change the decoding of the array. These must be the
+		///   same significant attributes used to encode the array.</param>
+		/// <returns>An enumerable that decodes the elements of the array as they are enumerated, or <see langword='null'/>
+		///   if a null array was stored. The enumerable can only be enumerated once, and only until the next read on this
+		///   reader.</returns>
+		/// <remarks>Only the array's length is read by this call.</remarks>
+		public IEnumerable<T> ReadArray<T>( object[] attributes ) {
+			FinishArray();
+
+			BitSerializerParameterInfo attrs = new BitSerializerParameterInfo( typeof(T[]), "value", attributes, _serializer.Options );
+
+			if( !attrs.IsRequired ) {
+				if( !_reader.ReadBoolean() )
+					return null;
+			}
+
+			_elementsLeft = _reader.ReadInt32( BitSerializer.GetPrecision( (ulong) attrs.MaxLength ) );
+			_elementType = typeof(T);
+			_elementAttributes = attrs.GetElementAttributes();
+
+			return EnumerateArray<T>( ++_arrayVersion );
+		}
+
+		/// <summary>
+		/// Reads an array field of the compound value being read, decoding its elements on demand.
+		/// </summary>
+		/// <typeparam name="T">Element type of the array.</typeparam>
+		/// <param name="field">Field returned from <see cref="ReadNextField"/>.</param>
+		/// <returns>An enumerable that decodes the elements of the array as they are enumerated, or <see langword='null'/>
+		///   if a null array was stored.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='field'/> is <see langword='null'/>.</exception>
+		/// <exception cref="ArgumentException"><paramref name="field"/> is not of type <typeparamref name="T"/>[].</exception>
+		public IEnumerable<T> ReadArray<T>( FieldInfo field ) {
+			if( field == null )
+				throw new ArgumentNullException( "field" );
+
+			if( field.FieldType != typeof(T[]) )
+				throw new ArgumentException( "The field is not an array of the given element type.", "field" );
+
+			return ReadArray<T>( field.GetCustomAttributes( false ) );
+		}
+
+		private IEnumerable<T> EnumerateArray<T>( int version ) {
+			while( true ) {
+				if( version != _arrayVersion )
+					throw new InvalidOperationException( "The reader has moved past this array." );
+
+				if( _elementsLeft == 0 )
+					yield break;
+
+				_elementsLeft--;
+				yield return (T) _serializer.DeserializeValue( _reader, typeof(T), _elementAttributes );
+			}
+		}
+
+		private void FinishArray() {
+			// Discard whatever the caller didn't enumerate
+			while( _elementsLeft != 0 ) {
+				_elementsLeft--;
+				_serializer.DeserializeValue( _reader, _elementType, _elementAttributes );
+			}
+
+			_arrayVersion++;
+		}
+
+		/// <summary>
+		/// Begins reading a compound value.
+		/// </summary>
+		/// <param name="type">The expected type of the value.</param>
+		/// <param name="attributes">Optional array of attributes used to change the decoding of the value. These must be the
+		///   same significant attributes used to encode the value.</param>
+		/// <returns>The type of the stored value, which may be a type derived from <paramref name="type"/>, or <see langword='null'/>
+		///   if a null value was stored. If a type is returned, call <see cref="ReadNextField"/> until it returns <see langword='null'/>
+		///   to read the value's fields.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='type'/> is <see langword='null'/>.</exception>
+		/// <exception cref="ArgumentException"><paramref name="type"/> is not a compound type.</exception>
+		public Type ReadObjectStart( Type type, object[] attributes ) {
+			if( type == null )
+				throw new ArgumentNullException( "type" );
+
+			if( Type.GetTypeCode( type ) != TypeCode.Object || type.IsArray || type == typeof(Guid) )
+				throw new ArgumentException( "The given type is not a compound type.", "type" );
+
+			FinishArray();
+
+			BitSerializerParameterInfo attrs = new BitSerializerParameterInfo( type, "value", attributes, _serializer.Options );
+
+			if( !type.IsValueType ) {
+				if( !attrs.IsRequired && !_reader.ReadBoolean() )
+					return null;
+
+				if( attrs.NeedsTypeCode ) {
+					int typeCode = attrs.DeserializeTypeCode( _reader, out type );
+
+					if( type == null )
+						throw new IOException( "The encoded type code, " + typeCode.ToString() + ", was not present in the code table. You may need to update your metadata or allow a null substitution." );
+				}
+			}
+
+			ObjectFrame frame = new ObjectFrame();
+			frame.Fields = BitSerializer.GetSerializableFields( type, true );
+			frame.Groups = BitSerializer.GetFieldGroups( frame.Fields );
+			_frames.Push( frame );
+
+			return type;
+		}
+
+		/// <summary>
+		/// Begins reading a compound field of the compound value being read.
+		/// </summary>
+		/// <param name="field">Field returned from <see cref="ReadNextField"/>.</param>
+		/// <returns>The type of the stored value, or <see langword='null'/> if a null value was stored.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='field'/> is <see langword='null'/>.</exception>
+		public Type ReadObjectStart( FieldInfo field ) {
+			if( field == null )
+				throw new ArgumentNullException( "field" );
+
+			return ReadObjectStart( field.FieldType, field.GetCustomAttributes( false ) );
+		}
+
+		/// <summary>
+		/// Moves to the next field of the compound value being read.
+		/// </summary>
+		/// <returns>The next field, whose value must be read with <see cref="ReadValue(FieldInfo)"/>,
+		///   <see cref="ReadArray{T}(FieldInfo)"/>, or <see cref="ReadObjectStart(FieldInfo)"/> before calling this method again; or <see langword='null'/> if all of the fields
+		///   of the value have been read.</returns>
+		/// <exception cref="InvalidOperationException">No compound value is being read.</exception>
+		/// <remarks>Field groups that this side doesn't know are skipped automatically.</remarks>
+		public FieldInfo ReadNextField() {
+			if( _frames.Count == 0 )
+				throw new InvalidOperationException( "No compound value is being read." );
+
+			FinishArray();
+
+			ObjectFrame frame = _frames.Peek();
+
+			if( frame.Groups == null ) {
+				if( frame.Index < frame.Fields.Length )
+					return frame.Fields[frame.Index++];
+
+				_frames.Pop();
+				return null;
+			}
+
+			while( frame.GroupFields == null || frame.Index == frame.GroupFields.Count ) {
+				if( frame.GroupFields != null ) {
+					_reader.SkipTo( frame.GroupEnd );
+					frame.GroupFields = null;
+				}
+
+				int ordinal = _reader.ReadGroupOrdinal();
+
+				if( ordinal == -1 ) {
+					_frames.Pop();
+					return null;
+				}
+
+				frame.GroupEnd = _reader.ReadGroupEnd();
+				frame.Index = 0;
+
+				if( !frame.Groups.TryGetValue( ordinal, out frame.GroupFields ) )
+					_reader.SkipTo( frame.GroupEnd );
+			}
+
+			return frame.GroupFields[frame.Index++];
+		}
+
+		/// <summary>
+		/// Closes the reader and the underlying stream.
+		/// </summary>
+		public void Close() {
+			_reader.Close();
+		}
+
+		void IDisposable.Dispose() {
+			Close();
+		}
+	}
+}
@@ -32,6 +32,17 @@ namespace Fluggo.Communications.Serialization
 		byte[] _buffer;
 		int _currentByte;
 		int _bitsLeft;
+		long _bytesWritten;
+
+		/// <summary>
+		/// The number of bits used to store the ordinal of a field group.
+		/// </summary>
+		public const int GroupOrdinalPrecision = 16;
+
+		/// <summary>
+		/// The number of bits used to store the length, in bits, of a field group.
+		/// </summary>
+		public const int GroupLengthPrecision = 32;
 
 		/// <summary>
 		/// Creates a new instance of the <see cref="BitWriter"/> class.
@@ -119,8 +130,20 @@ namespace Fluggo.Communications.Serialization
 			if( _currentByte != 0 ) {
 				// Flush the remaining contents to the stream
 				_stream.Write( _buffer, 0, _currentByte );
+				_bytesWritten += _currentByte;
 				_currentByte = 0;
 				_buffer[0] = 0;
+				_bitsLeft = 8;
+			}
+		}
+
+		/// <summary>
+		/// Gets the number of bits written so far.
+		/// </summary>
+		/// <value>The number of bits written to this writer, including any padding added by <see cref="Flush"/>.</value>
+		public long BitPosition {
+			get {
+				return (_bytesWritten + _currentByte) * 8L + (8 - _bitsLeft);
 			}
 		}
 
@@ -146,6 +169,7 @@ namespace Fluggo.Communications.Serialization
 
 			if( _currentByte == _buffer.Length ) {
 				_stream.Write( _buffer, 0, _buffer.Length );
+				_bytesWritten += _buffer.Length;
 				_currentByte = 0;
 			}
 
@@ -364,5 +388,74 @@ namespace Fluggo.Communications.Serialization
 		public void Write( char value ) {
 			WriteString( new string( value, 1 ), 1 );
 		}
+
+	#region Field groups
+		/// <summary>
+		/// Creates a writer for the contents of a field group.
+		/// </summary>
+		/// <returns>A <see cref="BitWriter"/> that collects the group's contents in memory. Pass it to <see cref="EndGroup"/>
+		///   when the group is complete.</returns>
+		/// <remarks>A group's contents are collected separately so that the group can be prefixed with its length, which
+		///   lets a reader skip the group without decoding it.</remarks>
+		public BitWriter BeginGroup() {
+			return new BitWriter( new MemoryStream(), _buffer.Length );
+		}
+
+		/// <summary>
+		/// Writes a field group to the stream, prefixed with its ordinal and length.
+		/// </summary>
+		/// <param name="ordinal">Ordinal of the group.</param>
+		/// <param name="group"><see cref="BitWriter"/> returned from <see cref="BeginGroup"/> containing the group's contents.
+		///   The writer cannot be used after this call.</param>
+		/// <exception cref="ArgumentNullException"><paramref name="group"/> is <see langword='null'/>.</exception>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="ordinal"/> is less than zero or greater than <see cref="FieldGroupAttribute.MaxOrdinal"/>.</exception>
+		/// <exception cref="ArgumentException"><paramref name="group"/> was not created by <see cref="BeginGroup"/>.
+		///   <para> OR </para>
+		///   <para>The group is too long to be stored.</para></exception>
+		public void EndGroup( int ordinal, BitWriter group ) {
+			if( group == null )
+				throw new ArgumentNullException( "group" );
+
+			if( ordinal < 0 || ordinal > FieldGroupAttribute.MaxOrdinal )
+				throw new ArgumentOutOfRangeException( "ordinal" );
+
+			MemoryStream groupStream = group._stream as MemoryStream;
+
+			if( groupStream == null )
+				throw new ArgumentException( "The given writer was not created with BeginGroup.", "group" );
+
+			long bitLength = group.BitPosition;
+
+			if( bitLength > (long) uint.MaxValue )
+				throw new ArgumentException( "The field group is too long to be stored.", "group" );
+
+			group.Flush();
+
+			Write( true );
+			Write( ordinal, GroupOrdinalPrecision );
+			Write( (ulong) bitLength, GroupLengthPrecision );
+			WriteBits( groupStream.GetBuffer(), bitLength );
+		}
+
+		/// <summary>
+		/// Marks the end of a series of field groups.
+		/// </summary>
+		public void EndGroups() {
+			Write( false );
+		}
+
+		private void WriteBits( byte[] buffer, long bitCount ) {
+			int byteIndex = 0;
+
+			while( bitCount >= 8 ) {
+				Write( buffer[byteIndex++], 8 );
+				bitCount -= 8;
+			}
+
+			// The remaining bits are the most significant bits of the last byte
+			if( bitCount != 0 )
+				Write( (byte) (buffer[byteIndex] >> (8 - (int) bitCount)), (int) bitCount );
+		}
+	#endregion
 	}
 }
@@ -0,0 +1,67 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Collections.Generic;
+using System.Text;
+
+namespace Fluggo.Communications.Serialization
+{
+	/// <summary>
+	/// Places a field in a versioned, skippable field group.
+	/// </summary>
+	/// <remarks>If any field of a compound type carries this attribute, the type is stored as a series of
+	///     length-prefixed groups instead of a flat run of fields. Each group is tagged with its ordinal and bit length,
+	///     so a reader that doesn't know a group can skip it without decoding it. Fields without this attribute belong
+	///     to group zero.
+	///   <para>Ordinals are part of the wire format. To evolve a type, add new fields in a new group rather than
+	///     adding them to an existing one, and never reuse the ordinal of a group that has been removed.</para></remarks>
+	[AttributeUsage( AttributeTargets.Field, AllowMultiple = false )]
+	public sealed class FieldGroupAttribute : SerializationAttribute
+	{
+		/// <summary>
+		/// The largest ordinal that can be assigned to a field group.
+		/// </summary>
+		public const int MaxOrdinal = (1 << BitWriter.GroupOrdinalPrecision) - 1;
+
+		int _ordinal;
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='FieldGroupAttribute'/> class.
+		/// </summary>
+		/// <param name="ordinal">Stable ordinal of the group. Groups are written in ascending order of ordinal.</param>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="ordinal"/> is less than zero or greater than <see cref="MaxOrdinal"/>.</exception>
+		public FieldGroupAttribute( int ordinal ) {
+			if( ordinal < 0 || ordinal > MaxOrdinal )
+				throw new ArgumentOutOfRangeException( "ordinal" );
+
+			_ordinal = ordinal;
+		}
+
+		/// <summary>
+		/// Gets the ordinal of the group.
+		/// </summary>
+		/// <value>The stable ordinal of the group that contains the field.</value>
+		public int Ordinal {
+			get {
+				return _ordinal;
+			}
+		}
+	}
+}
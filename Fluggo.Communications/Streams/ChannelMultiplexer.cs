@@ -163,6 +163,39 @@ namespace Fluggo.Communications
 				
 			return _maxRwnd[channel];
 		}
+
+		/// <summary>
+		/// Gets the number of outbound channels.
+		/// </summary>
+		/// <value>The number of channels messages can be sent on.</value>
+		public int OutboundChannelCount
+			{ get { return _sndQueues.Length; } }
+
+		/// <summary>
+		/// Gets the number of times a message on the given outbound channel had to wait for the far end's receive window.
+		/// </summary>
+		/// <param name="channel">Outbound channel to check.</param>
+		/// <returns>The number of messages that could not be sent right away because they didn't fit in the receive window.</returns>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="channel"/> is less than zero or not less than <see cref="OutboundChannelCount"/>.</exception>
+		public int GetWindowStallCount( int channel ) {
+			if( channel < 0 || channel >= _sndQueues.Length )
+				throw new ArgumentOutOfRangeException( "channel" );
+
+			return _sndQueues[channel].StallCount;
+		}
+
+		/// <summary>
+		/// Gets the total time messages on the given outbound channel have spent waiting for the far end's receive window.
+		/// </summary>
+		/// <param name="channel">Outbound channel to check.</param>
+		/// <returns>The total time spent in window stalls on the channel.</returns>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="channel"/> is less than zero or not less than <see cref="OutboundChannelCount"/>.</exception>
+		public TimeSpan GetWindowStallTime( int channel ) {
+			if( channel < 0 || channel >= _sndQueues.Length )
+				throw new ArgumentOutOfRangeException( "channel" );
+
+			return _sndQueues[channel].StallTime;
+		}
 		
 	#region Receive support
 		#region ReceiverQueueItem
@@ -413,6 +446,8 @@ namespace Fluggo.Communications
 			int _rwnd;
 			int _maxRwnd;
 			AutoResetEvent _rwndSignal = new AutoResetEvent( false );
+			int _stallCount;
+			long _stallTicks;
 
 			#region SenderQueueItem
 			/// <summary>
@@ -429,6 +464,7 @@ namespace Fluggo.Communications
 				SendingQueue _queue;
 				IDataMessage _message;
 				bool _willCompleteSync;
+				long _stallStart;
 
 				public SenderQueueItem( SendingQueue queue, IDataMessage message, AsyncCallback callback, object state )
 					: base( callback, state ) {
@@ -454,16 +490,21 @@ namespace Fluggo.Communications
 									if( _message.MessageBuffer.Length > Thread.VolatileRead( ref _queue._rwnd ) ) {
 										_ts.TraceEvent( TraceEventType.Verbose, 0, "Waiting to send, message size {0} > rwnd {1}",
 											_message.MessageBuffer.Length, _queue._rwnd );
+										BeginStall();
 										return _queue._rwndSignal;
 									}
 								}
 								else {
 									_ts.TraceEvent( TraceEventType.Verbose, 0, "Waiting to send, message size {0} > rwnd {1}",
 										_message.MessageBuffer.Length, _queue._rwnd );
+									BeginStall();
 									return _queue._rwndSignal;
 								}
 							}
 
+							if( _stallStart != 0 )
+								Interlocked.Add( ref _queue._stallTicks, Stopwatch.GetTimestamp() - _stallStart );
+
 							_state = SendItemState.ClearedRwnd;
 							goto case SendItemState.ClearedRwnd;
 
@@ -478,6 +519,14 @@ namespace Fluggo.Communications
 					return null;
 				}
 
+				private void BeginStall() {
+					// Only count the first wait; the queue may retry several times before the window opens far enough
+					if( _stallStart == 0 ) {
+						_stallStart = Stopwatch.GetTimestamp();
+						Interlocked.Increment( ref _queue._stallCount );
+					}
+				}
+
 				private void HandleEndSend( IAsyncResult result ) {
 					try {
 						_queue._owner._channel.EndSend( result );
@@ -556,6 +605,18 @@ namespace Fluggo.Communications
 					return _rwnd;
 				}
 			}
+
+			public int StallCount {
+				get {
+					return Thread.VolatileRead( ref _stallCount );
+				}
+			}
+
+			public TimeSpan StallTime {
+				get {
+					return TimeSpan.FromTicks( (long)((double) Interlocked.Read( ref _stallTicks ) * TimeSpan.TicksPerSecond / Stopwatch.Frequency) );
+				}
+			}
 		}
 		#endregion
 
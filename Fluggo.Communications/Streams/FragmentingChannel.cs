@@ -0,0 +1,437 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.IO;
+using System.Threading;
+
+namespace Fluggo.Communications {
+	/// <summary>
+	/// Carries messages of any length over a channel with a limited message size, such as a channel from a
+	/// <see cref="ChannelMultiplexer"/>.
+	/// </summary>
+	/// <remarks>Each message is split into fragments no larger than <see cref="FragmentLength"/>. Every fragment starts
+	///     with one byte of <see cref="FragmentFlags"/>, which mark the first and last fragments of the message the way the
+	///     B and E bits do in SCTP.
+	///   <para><see cref="Receive"/> puts a message back together as a <see cref="ChainedMessageBuffer"/> that refers to
+	///     the fragments as they were received, so nothing is copied. A receiver that can work on a message as it arrives
+	///     can call <see cref="ReceiveFragment"/> instead and handle each fragment without waiting for the rest. A sender
+	///     that doesn't know the length of a message up front can likewise send it in pieces with
+	///     <see cref="SendFragment"/>.</para>
+	///   <para>Only one receive operation, of either kind, may be outstanding at a time, since fragments have to be taken
+	///     in order. Sends may come from any thread; the fragments of one message are never interleaved with another's.</para></remarks>
+	public class FragmentingChannel : Channel {
+		const int __defaultFragmentLength = 16384;
+
+		Channel _channel;
+		int _receiving;
+		bool _receiveInMessage;
+		byte[] _flagBuffer = new byte[1];
+
+		object _sendLock = new object();
+		byte[] _sendBuffer;
+		bool _sendInMessage;
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='FragmentingChannel'/> class.
+		/// </summary>
+		/// <param name="channel">Channel to send the fragments over. Fragments will be as large as it allows.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='channel'/> is <see langword='null'/>.</exception>
+		/// <exception cref='ArgumentException'><paramref name='channel'/> can't carry a fragment with at least one byte of data.</exception>
+		public FragmentingChannel( Channel channel )
+			: this( channel, channel == null ? 0 : GetDefaultFragmentLength( channel ) ) {
+		}
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='FragmentingChannel'/> class.
+		/// </summary>
+		/// <param name="channel">Channel to send the fragments over.</param>
+		/// <param name="fragmentLength">Largest fragment to send, including its one-byte header.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='channel'/> is <see langword='null'/>.</exception>
+		/// <exception cref='ArgumentOutOfRangeException'><paramref name='fragmentLength'/> is less than two or larger than
+		///   <paramref name="channel"/> allows.</exception>
+		public FragmentingChannel( Channel channel, int fragmentLength ) {
+			if( channel == null )
+				throw new ArgumentNullException( "channel" );
+
+			if( fragmentLength < 2 || (channel.MaximumPayloadLength != -1 && fragmentLength > channel.MaximumPayloadLength) )
+				throw new ArgumentOutOfRangeException( "fragmentLength" );
+
+			_channel = channel;
+			_sendBuffer = new byte[fragmentLength];
+		}
+
+		private static int GetDefaultFragmentLength( Channel channel ) {
+			int max = channel.MaximumPayloadLength;
+
+			if( max == -1 )
+				return __defaultFragmentLength;
+
+			if( max < 2 )
+				throw new ArgumentException( "The channel's messages are too small to carry fragments.", "channel" );
+
+			return max;
+		}
+
+		/// <summary>
+		/// Gets the largest fragment the channel sends.
+		/// </summary>
+		/// <value>The largest fragment sent on the underlying channel, including its one-byte header.</value>
+		public int FragmentLength {
+			get { return _sendBuffer.Length; }
+		}
+
+	#region Receive
+		sealed class ReassemblyResult : BaseAsyncResult {
+			FragmentingChannel _owner;
+			ChainedMessageBuffer _message;
+			AsyncCallback _receiveCallback;
+			bool _sync = true, _ended;
+
+			public ReassemblyResult( FragmentingChannel owner, AsyncCallback callback, object state )
+				: base( callback, state ) {
+				_owner = owner;
+				_receiveCallback = HandleReceive;
+			}
+
+			public void Start() {
+				for( ;; ) {
+					IAsyncResult result;
+
+					try {
+						result = _owner._channel.BeginReceive( _receiveCallback, null );
+					}
+					catch( Exception ex ) {
+						_owner.EndReceiving();
+						CompleteError( ex );
+						return;
+					}
+
+					if( !result.CompletedSynchronously || Handle( result ) )
+						return;
+				}
+			}
+
+			private void HandleReceive( IAsyncResult result ) {
+				if( result.CompletedSynchronously )
+					return;
+
+				_sync = false;
+
+				if( !Handle( result ) )
+					Start();
+			}
+
+			private bool Handle( IAsyncResult result ) {
+				try {
+					IMessageBuffer packet = _owner._channel.EndReceive( result );
+					FragmentFlags flags;
+
+					if( !_owner.ReadFlags( packet, out flags ) ) {
+						_ended = true;
+					}
+					else {
+						if( _message == null )
+							_message = new ChainedMessageBuffer();
+
+						_message.Append( packet, 1, packet.Length - 1 );
+
+						if( (flags & FragmentFlags.End) == 0 )
+							return false;
+					}
+				}
+				catch( Exception ex ) {
+					_owner.EndReceiving();
+					CompleteError( ex );
+					return true;
+				}
+
+				_owner.EndReceiving();
+				Complete( _sync );
+				return true;
+			}
+
+			public new IMessageBuffer End() {
+				base.End();
+				return _ended ? null : _message;
+			}
+		}
+
+		/// <summary>
+		/// Begins receiving a whole message.
+		/// </summary>
+		/// <param name="callback">An optional <see cref="AsyncCallback"/> delegate that references the method to invoke
+		///   when the receive operation is complete.</param>
+		/// <param name="state">A user-defined object containing information about the asynchronous operation.
+		///   This object is passed to the <paramref name="callback"/> delegate when the operation completes.</param>
+		/// <returns>An <see cref='IAsyncResult'/> object indicating the status of the asynchronous operation.</returns>
+		/// <exception cref='InvalidOperationException'>Another receive operation is in progress, or part of a message has
+		///   already been taken with <see cref="ReceiveFragment"/>.</exception>
+		public override IAsyncResult BeginReceive( AsyncCallback callback, object state ) {
+			BeginReceiving( true );
+
+			ReassemblyResult result = new ReassemblyResult( this, callback, state );
+			result.Start();
+			return result;
+		}
+
+		/// <summary>
+		/// Ends an asynchronous receive operation.
+		/// </summary>
+		/// <param name="result">A reference to the outstanding asynchronous request.</param>
+		/// <returns>The message, or <see langword='null'/> if the channel has closed.</returns>
+		/// <exception cref="ArgumentNullException"><paramref name="result"/> is <see langword='null'/>.</exception>
+		/// <exception cref="ArgumentException"><paramref name='result'/> did not originate from a <see cref='BeginReceive'/>
+		///   call on the current object.</exception>
+		/// <exception cref='IOException'>The fragments were out of sequence, or the channel closed in the middle of a message.</exception>
+		public override IMessageBuffer EndReceive( IAsyncResult result ) {
+			if( result == null )
+				throw new ArgumentNullException( "result" );
+
+			ReassemblyResult reassembly = result as ReassemblyResult;
+
+			if( reassembly == null )
+				throw new ArgumentException( "The given asynchronous result did not originate from a BeginReceive call on this object.", "result" );
+
+			return reassembly.End();
+		}
+
+		/// <summary>
+		/// Receives a whole message.
+		/// </summary>
+		/// <returns>The message, or <see langword='null'/> if the channel has closed.</returns>
+		/// <exception cref='InvalidOperationException'>Another receive operation is in progress, or part of a message has
+		///   already been taken with <see cref="ReceiveFragment"/>.</exception>
+		/// <exception cref='IOException'>The fragments were out of sequence, or the channel closed in the middle of a message.</exception>
+		public override IMessageBuffer Receive() {
+			BeginReceiving( true );
+
+			try {
+				ChainedMessageBuffer message = new ChainedMessageBuffer();
+
+				for( ;; ) {
+					IMessageBuffer packet = _channel.Receive();
+					FragmentFlags flags;
+
+					if( !ReadFlags( packet, out flags ) )
+						return null;
+
+					message.Append( packet, 1, packet.Length - 1 );
+
+					if( (flags & FragmentFlags.End) != 0 )
+						return message;
+				}
+			}
+			finally {
+				EndReceiving();
+			}
+		}
+
+		/// <summary>
+		/// Begins receiving the next fragment of a message.
+		/// </summary>
+		/// <param name="callback">An optional <see cref="AsyncCallback"/> delegate that references the method to invoke
+		///   when the receive operation is complete.</param>
+		/// <param name="state">A user-defined object containing information about the asynchronous operation.
+		///   This object is passed to the <paramref name="callback"/> delegate when the operation completes.</param>
+		/// <returns>An <see cref='IAsyncResult'/> object indicating the status of the asynchronous operation.</returns>
+		/// <exception cref='InvalidOperationException'>Another receive operation is in progress.</exception>
+		public IAsyncResult BeginReceiveFragment( AsyncCallback callback, object state ) {
+			BeginReceiving( false );
+
+			try {
+				return _channel.BeginReceive( callback, state );
+			}
+			catch {
+				EndReceiving();
+				throw;
+			}
+		}
+
+		/// <summary>
+		/// Ends an asynchronous fragment receive operation.
+		/// </summary>
+		/// <param name="result">A reference to the outstanding asynchronous request.</param>
+		/// <param name="flags">Receives the flags that say where the fragment falls in its message.</param>
+		/// <returns>The fragment's data, or <see langword='null'/> if the channel has closed.</returns>
+		/// <exception cref="ArgumentNullException"><paramref name="result"/> is <see langword='null'/>.</exception>
+		/// <exception cref='IOException'>The fragments were out of sequence, or the channel closed in the middle of a message.</exception>
+		public IMessageBuffer EndReceiveFragment( IAsyncResult result, out FragmentFlags flags ) {
+			if( result == null )
+				throw new ArgumentNullException( "result" );
+
+			try {
+				return GetFragment( _channel.EndReceive( result ), out flags );
+			}
+			finally {
+				EndReceiving();
+			}
+		}
+
+		/// <summary>
+		/// Receives the next fragment of a message.
+		/// </summary>
+		/// <param name="flags">Receives the flags that say where the fragment falls in its message.</param>
+		/// <returns>The fragment's data, or <see langword='null'/> if the channel has closed.</returns>
+		/// <exception cref='InvalidOperationException'>Another receive operation is in progress.</exception>
+		/// <exception cref='IOException'>The fragments were out of sequence, or the channel closed in the middle of a message.</exception>
+		/// <remarks>The returned buffer refers to the fragment as it was received; it is not copied.</remarks>
+		public IMessageBuffer ReceiveFragment( out FragmentFlags flags ) {
+			BeginReceiving( false );
+
+			try {
+				return GetFragment( _channel.Receive(), out flags );
+			}
+			finally {
+				EndReceiving();
+			}
+		}
+
+		private IMessageBuffer GetFragment( IMessageBuffer packet, out FragmentFlags flags ) {
+			if( !ReadFlags( packet, out flags ) )
+				return null;
+
+			return new ChainedMessageBuffer( packet, 1, packet.Length - 1 );
+		}
+
+		/// <summary>
+		/// Reads the flags from a fragment and checks them against the message in progress.
+		/// </summary>
+		/// <returns>True if <paramref name="packet"/> is a fragment, or false if the channel has closed.</returns>
+		private bool ReadFlags( IMessageBuffer packet, out FragmentFlags flags ) {
+			if( packet == null || packet.Length == 0 ) {
+				flags = FragmentFlags.Begin | FragmentFlags.End;
+
+				if( _receiveInMessage )
+					throw new IOException( "The channel closed in the middle of a message." );
+
+				return false;
+			}
+
+			packet.CopyTo( 0, _flagBuffer, 0, 1 );
+			flags = (FragmentFlags)(_flagBuffer[0] & (byte)(FragmentFlags.Begin | FragmentFlags.End));
+
+			bool begin = (flags & FragmentFlags.Begin) != 0;
+
+			if( begin && _receiveInMessage )
+				throw new IOException( "A fragment began a new message before the last message ended." );
+
+			if( !begin && !_receiveInMessage )
+				throw new IOException( "A fragment arrived that was not part of any message." );
+
+			_receiveInMessage = (flags & FragmentFlags.End) == 0;
+			return true;
+		}
+
+		private void BeginReceiving( bool wholeMessage ) {
+			if( Interlocked.CompareExchange( ref _receiving, 1, 0 ) != 0 )
+				throw new InvalidOperationException( "Another receive operation is already in progress." );
+
+			if( wholeMessage && _receiveInMessage ) {
+				EndReceiving();
+				throw new InvalidOperationException( "Part of a message has already been received. Receive the rest with ReceiveFragment." );
+			}
+		}
+
+		private void EndReceiving() {
+			Interlocked.Exchange( ref _receiving, 0 );
+		}
+	#endregion
+
+	#region Send
+		/// <summary>
+		/// Sends a message.
+		/// </summary>
+		/// <param name="buffer">Byte array containing the message to send.</param>
+		/// <param name="offset">Index in <paramref name="buffer"/> at which the message begins.</param>
+		/// <param name="count">Length of the message in bytes.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='buffer'/> is <see langword='null'/>.</exception>
+		/// <exception cref='ArgumentException'><paramref name='offset'/> and <paramref name='count'/> do not specify a valid
+		///   range in <paramref name="buffer"/>.</exception>
+		/// <exception cref='InvalidOperationException'>A message started with <see cref="SendFragment"/> hasn't been finished.</exception>
+		public override void Send( byte[] buffer, int offset, int count ) {
+			lock( _sendLock ) {
+				if( _sendInMessage )
+					throw new InvalidOperationException( "A message started with SendFragment has not been finished." );
+
+				SendFragment( buffer, offset, count, true );
+			}
+		}
+
+		/// <summary>
+		/// Sends part of a message.
+		/// </summary>
+		/// <param name="buffer">Byte array containing the data to send.</param>
+		/// <param name="offset">Index in <paramref name="buffer"/> at which the data begins.</param>
+		/// <param name="count">Length of the data in bytes.</param>
+		/// <param name="endOfMessage">True if this is the end of the message, false if more will follow.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='buffer'/> is <see langword='null'/>.</exception>
+		/// <exception cref='ArgumentException'><paramref name='offset'/> and <paramref name='count'/> do not specify a valid
+		///   range in <paramref name="buffer"/>.</exception>
+		/// <remarks>Data larger than <see cref="FragmentLength"/> is split into several fragments. Until the message is
+		///   ended, calls to <see cref="Send"/> will fail, so only one thread should be sending this way at a time.</remarks>
+		public void SendFragment( byte[] buffer, int offset, int count, bool endOfMessage ) {
+			new ArraySegment<byte>( buffer, offset, count );
+
+			lock( _sendLock ) {
+				if( count == 0 && !endOfMessage )
+					return;
+
+				int room = _sendBuffer.Length - 1;
+
+				do {
+					int length = Math.Min( count, room );
+					FragmentFlags flags = _sendInMessage ? FragmentFlags.None : FragmentFlags.Begin;
+
+					if( endOfMessage && length == count )
+						flags |= FragmentFlags.End;
+
+					// The underlying channel wants each message contiguous, so this is the one copy on the way out
+					_sendBuffer[0] = (byte) flags;
+					Buffer.BlockCopy( buffer, offset, _sendBuffer, 1, length );
+					_channel.Send( _sendBuffer, 0, length + 1 );
+
+					_sendInMessage = (flags & FragmentFlags.End) == 0;
+					offset += length;
+					count -= length;
+				} while( count != 0 );
+			}
+		}
+	#endregion
+
+		public override bool CanReceive {
+			get { return _channel.CanReceive; }
+		}
+
+		public override bool CanSend {
+			get { return _channel.CanSend; }
+		}
+
+		public override int ReceiveWindow {
+			get { return _channel.ReceiveWindow; }
+		}
+
+		protected override void Dispose( bool disposing ) {
+			if( disposing )
+				_channel.Close();
+
+			base.Dispose( disposing );
+		}
+	}
+}
@@ -0,0 +1,685 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Threading;
+
+namespace Fluggo.Communications {
+	/// <summary>
+	/// Creates in-process connections that behave like a network link with a given latency, bandwidth and loss rate.
+	/// </summary>
+	/// <remarks>Each direction of a connection is modelled as a link that sends one write (or message) at a time at
+	///     <see cref="BytesPerSecond"/> and delivers it <see cref="Latency"/> later, in order, on a thread of its own.
+	///     Loss is decided by a <see cref="Random"/> seeded from <see cref="Seed"/>, so the same sequence of writes on the same
+	///     transport settings loses the same packets from run to run.
+	///   <para>Streams created by <see cref="CreateStreams"/> are reliable, so a lost write is delivered one
+	///     <see cref="RetransmitTimeout"/> late instead of not at all, holding up everything behind it the way a lost segment
+	///     holds up a TCP connection. Channels created by <see cref="CreateChannels"/> really drop the message; use loss on
+	///     channels only with a protocol that recovers from it on its own, such as <see cref="SctpAssociation"/>, since
+	///     <see cref="ChannelMultiplexer"/> does not. Channels can also deliver messages out of order; see
+	///     <see cref="ReorderRate"/>.</para>
+	///   <para>Change the settings before creating connections. Connections that already exist keep the settings they were
+	///     created with.</para></remarks>
+	public sealed class LoopbackTransport {
+		int _bufferSize = 65536, _maximumPayloadLength = ushort.MaxValue - 8, _seed, _linkCount;
+		TimeSpan _latency = TimeSpan.Zero, _retransmitTimeout = TimeSpan.FromMilliseconds( 200.0 ),
+			_reorderHoldTime = TimeSpan.FromMilliseconds( 10.0 );
+		long _bytesPerSecond;
+		double _lossRate, _reorderRate;
+		long _lostCount, _reorderedCount, _deliveredCount, _deliveredBytes;
+		static TraceSource _ts = new TraceSource( "LoopbackTransport", SourceLevels.Error );
+
+	#region Settings
+		/// <summary>
+		/// Gets or sets the number of bytes each direction can hold before writers block.
+		/// </summary>
+		/// <value>The number of bytes that can be written in one direction before the reader catches up. The default is 65536.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than one.</exception>
+		/// <remarks>This is both the size of the receiving <see cref="Pipe"/> and the most data a link will hold in flight.</remarks>
+		public int BufferSize {
+			get { return _bufferSize; }
+			set {
+				if( value < 1 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_bufferSize = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the one-way delay of each link.
+		/// </summary>
+		/// <value>The time between the moment a write finishes going out on the link and the moment it arrives at the
+		///   other end. The default is zero.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is negative.</exception>
+		public TimeSpan Latency {
+			get { return _latency; }
+			set {
+				if( value < TimeSpan.Zero )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_latency = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the bandwidth of each link.
+		/// </summary>
+		/// <value>The number of bytes each direction can carry per second, or zero if bandwidth is unlimited. The default is zero.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is negative.</exception>
+		public long BytesPerSecond {
+			get { return _bytesPerSecond; }
+			set {
+				if( value < 0 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_bytesPerSecond = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the fraction of writes or messages that are lost.
+		/// </summary>
+		/// <value>A probability from zero to one. The default is zero.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than zero or greater than one.</exception>
+		public double LossRate {
+			get { return _lossRate; }
+			set {
+				if( value < 0.0 || value > 1.0 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_lossRate = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the fraction of channel messages that are delivered out of order.
+		/// </summary>
+		/// <value>A probability from zero to one. The default is zero.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than zero or greater than one.</exception>
+		/// <remarks>A reordered message is held back and delivered just after the next message sent on the same link, or
+		///   <see cref="ReorderHoldTime"/> after it was due if nothing else is sent. Streams are never reordered.</remarks>
+		public double ReorderRate {
+			get { return _reorderRate; }
+			set {
+				if( value < 0.0 || value > 1.0 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_reorderRate = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the extra delay a lost write suffers on a stream.
+		/// </summary>
+		/// <value>The time it takes a stream to recover a lost write. The default is 200 milliseconds.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is negative.</exception>
+		public TimeSpan RetransmitTimeout {
+			get { return _retransmitTimeout; }
+			set {
+				if( value < TimeSpan.Zero )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_retransmitTimeout = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the longest time a reordered message is held back.
+		/// </summary>
+		/// <value>The time after which a message held back for reordering is delivered even if no other message has been
+		///   sent on its link. The default is 10 milliseconds.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is negative.</exception>
+		/// <remarks>Without this, the last message sent before a pause would wait for the pause to end, which a
+		///   protocol with timers of its own would see as a loss.</remarks>
+		public TimeSpan ReorderHoldTime {
+			get { return _reorderHoldTime; }
+			set {
+				if( value < TimeSpan.Zero )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_reorderHoldTime = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the largest message channels created by this transport will carry.
+		/// </summary>
+		/// <value>The maximum payload length, in bytes, of channels returned from <see cref="CreateChannels"/>. The default
+		///   is the same as <see cref="MessageChannelOverStream"/>.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than one.</exception>
+		public int MaximumPayloadLength {
+			get { return _maximumPayloadLength; }
+			set {
+				if( value < 1 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_maximumPayloadLength = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the seed used to decide which writes are lost.
+		/// </summary>
+		/// <value>The seed for the first link created. Each later link uses the next seed. The default is zero.</value>
+		public int Seed {
+			get { return _seed; }
+			set { _seed = value; }
+		}
+	#endregion
+
+	#region Statistics
+		/// <summary>
+		/// Gets the number of writes and messages lost on all links of this transport.
+		/// </summary>
+		/// <value>The number of writes and messages the transport has lost. Lost stream writes are counted even though
+		///   they are eventually delivered.</value>
+		public long LostCount {
+			get { return Interlocked.Read( ref _lostCount ); }
+		}
+
+		/// <summary>
+		/// Gets the number of channel messages held back to be delivered out of order.
+		/// </summary>
+		/// <value>The number of messages the transport has reordered.</value>
+		public long ReorderedCount {
+			get { return Interlocked.Read( ref _reorderedCount ); }
+		}
+
+		/// <summary>
+		/// Gets the number of writes and messages delivered on all links of this transport.
+		/// </summary>
+		/// <value>The number of writes and messages that have arrived at the far end of a link.</value>
+		public long DeliveredCount {
+			get { return Interlocked.Read( ref _deliveredCount ); }
+		}
+
+		/// <summary>
+		/// Gets the number of bytes delivered on all links of this transport.
+		/// </summary>
+		/// <value>The number of bytes that have arrived at the far end of a link.</value>
+		public long DeliveredBytes {
+			get { return Interlocked.Read( ref _deliveredBytes ); }
+		}
+	#endregion
+
+		/// <summary>
+		/// Creates a pair of streams that communicate to each other over shaped links.
+		/// </summary>
+		/// <param name="firstStream">Reference to a variable. On return, this contains a reference to the
+		///   first stream created.</param>
+		/// <param name="secondStream">Reference to a variable. On return, this contains a reference to the
+		///   second stream created.</param>
+		/// <remarks>Writes to the first stream can be read from the second stream, and vice versa. If the transport has no
+		///     latency, bandwidth limit or loss, this is the same as <see cref="Pipe.CreateLoopback"/>.
+		///   <para>Writes return as soon as the data has been queued on the link. Closing a stream closes the far end's
+		///     read side once everything written before it has been delivered.</para></remarks>
+		public void CreateStreams( out Stream firstStream, out Stream secondStream ) {
+			if( IsUnshaped ) {
+				Pipe.CreateLoopback( _bufferSize, out firstStream, out secondStream );
+				return;
+			}
+
+			Pipe firstPipe = new Pipe( _bufferSize ), secondPipe = new Pipe( _bufferSize );
+
+			firstStream = new LinkStream( firstPipe, secondPipe, CreateLink() );
+			secondStream = new LinkStream( secondPipe, firstPipe, CreateLink() );
+		}
+
+		/// <summary>
+		/// Creates a pair of message channels that communicate to each other over shaped links.
+		/// </summary>
+		/// <param name="firstChannel">Reference to a variable. On return, this contains a reference to the
+		///   first channel created.</param>
+		/// <param name="secondChannel">Reference to a variable. On return, this contains a reference to the
+		///   second channel created.</param>
+		/// <remarks>Messages sent on the first channel can be received from the second channel, and vice versa. Each message
+		///     is copied when it is sent, so the sender can reuse its buffer right away. The channels can be handed straight
+		///     to <see cref="ChannelMultiplexer"/> without a stream and framing in between.</remarks>
+		public void CreateChannels( out Channel<IDataMessage> firstChannel, out Channel<IDataMessage> secondChannel ) {
+			LoopbackChannel first = new LoopbackChannel( CreateLink(), _maximumPayloadLength );
+			LoopbackChannel second = new LoopbackChannel( CreateLink(), _maximumPayloadLength );
+
+			first.Peer = second;
+			second.Peer = first;
+
+			firstChannel = first;
+			secondChannel = second;
+		}
+
+		private bool IsUnshaped {
+			get { return _latency == TimeSpan.Zero && _bytesPerSecond == 0 && _lossRate == 0.0; }
+		}
+
+		private Link CreateLink() {
+			return new Link( this, _seed + Interlocked.Increment( ref _linkCount ) - 1 );
+		}
+
+	#region Link
+		/// <summary>
+		/// One direction of a connection.
+		/// </summary>
+		/// <remarks>The link keeps a queue of deliveries in the order they were sent. Its thread waits for the delivery at the
+		///   head of the queue to come due and then runs it, so a delivery that was held back by loss holds back everything
+		///   behind it too.</remarks>
+		sealed class Link {
+			struct Delivery {
+				public long Time;
+				public int Length;
+				public bool Final;
+				public WaitCallback Handler;
+				public object State;
+			}
+
+			LoopbackTransport _owner;
+			Queue<Delivery> _queue = new Queue<Delivery>();
+			object _lock = new object();
+			Random _random;
+			long _latencyTicks, _retransmitTicks, _reorderHoldTicks, _bytesPerSecond, _freeAt, _heldDeadline;
+			double _lossRate, _reorderRate;
+			int _maxQueuedBytes, _queuedBytes;
+			Delivery _held;
+			bool _closed, _holding;
+
+			public Link( LoopbackTransport owner, int seed ) {
+				_owner = owner;
+				_random = new Random( seed );
+				_latencyTicks = TimeSpanToTimestamp( owner._latency );
+				_retransmitTicks = TimeSpanToTimestamp( owner._retransmitTimeout );
+				_reorderHoldTicks = TimeSpanToTimestamp( owner._reorderHoldTime );
+				_bytesPerSecond = owner._bytesPerSecond;
+				_lossRate = owner._lossRate;
+				_reorderRate = owner._reorderRate;
+				_maxQueuedBytes = owner._bufferSize;
+
+				Thread thread = new Thread( Run );
+				thread.Name = "LoopbackTransport link";
+				thread.IsBackground = true;
+				thread.Start();
+			}
+
+			/// <summary>
+			/// Queues data on the link.
+			/// </summary>
+			/// <returns>True if the data will be delivered, false if it was lost.</returns>
+			/// <remarks>If more than a buffer's worth of data is already in flight, this blocks until some of it is delivered.</remarks>
+			public bool Send( int length, bool reliable, WaitCallback handler, object state ) {
+				lock( _lock ) {
+					while( !_closed && _queuedBytes != 0 && _queuedBytes + length > _maxQueuedBytes )
+						Monitor.Wait( _lock );
+
+					if( _closed )
+						throw new ObjectDisposedException( null );
+
+					// The link carries one write at a time, so a write can't start going out until the last one is done
+					long start = Math.Max( Stopwatch.GetTimestamp(), _freeAt );
+
+					if( _bytesPerSecond != 0 )
+						start += (long) length * Stopwatch.Frequency / _bytesPerSecond;
+
+					_freeAt = start;
+
+					Delivery delivery = new Delivery();
+					delivery.Time = start + _latencyTicks;
+					delivery.Length = length;
+					delivery.Handler = handler;
+					delivery.State = state;
+
+					if( _lossRate != 0.0 && _random.NextDouble() < _lossRate ) {
+						Interlocked.Increment( ref _owner._lostCount );
+
+						if( !reliable )
+							return false;
+
+						delivery.Time += _retransmitTicks;
+					}
+
+					if( !reliable && _reorderRate != 0.0 && _random.NextDouble() < _reorderRate ) {
+						// Hold this one back until the next message is sent or the hold time runs out; a message
+						// already held goes out now
+						Interlocked.Increment( ref _owner._reorderedCount );
+						ReleaseHeld( delivery.Time );
+
+						_held = delivery;
+						_heldDeadline = delivery.Time + _reorderHoldTicks;
+						_holding = true;
+
+						// Let the link's thread know when to let it go
+						Monitor.PulseAll( _lock );
+						return true;
+					}
+
+					_queue.Enqueue( delivery );
+					_queuedBytes += length;
+					ReleaseHeld( delivery.Time );
+					Monitor.PulseAll( _lock );
+				}
+
+				return true;
+			}
+
+			/// <summary>
+			/// Queues the delivery being held back for reordering, if there is one.
+			/// </summary>
+			/// <param name="time">Time of the delivery it was held back behind.</param>
+			private void ReleaseHeld( long time ) {
+				if( !_holding )
+					return;
+
+				_held.Time = Math.Max( _held.Time, time );
+				_queue.Enqueue( _held );
+				_queuedBytes += _held.Length;
+				_held = new Delivery();
+				_holding = false;
+				Monitor.PulseAll( _lock );
+			}
+
+			/// <summary>
+			/// Runs a handler after everything already queued has been delivered, and then stops the link.
+			/// </summary>
+			public void Shutdown( WaitCallback handler, object state ) {
+				lock( _lock ) {
+					if( _closed )
+						return;
+
+					Delivery delivery = new Delivery();
+					delivery.Time = Math.Max( Stopwatch.GetTimestamp(), _freeAt ) + _latencyTicks;
+					ReleaseHeld( delivery.Time );
+					delivery.Final = true;
+					delivery.Handler = handler;
+					delivery.State = state;
+
+					_queue.Enqueue( delivery );
+					_closed = true;
+					Monitor.PulseAll( _lock );
+				}
+			}
+
+			private void Run() {
+				for( ;; ) {
+					Delivery delivery;
+
+					lock( _lock ) {
+						while( _queue.Count == 0 ) {
+							if( !_holding ) {
+								Monitor.Wait( _lock );
+								continue;
+							}
+
+							long remaining = _heldDeadline - Stopwatch.GetTimestamp();
+
+							if( remaining <= 0 ) {
+								// Nothing else came along to overtake it
+								ReleaseHeld( _heldDeadline );
+								continue;
+							}
+
+							Monitor.Wait( _lock, (int) Math.Min( remaining * 1000L / Stopwatch.Frequency + 1, int.MaxValue ) );
+						}
+
+						delivery = _queue.Peek();
+					}
+
+					WaitUntil( delivery.Time );
+
+					lock( _lock ) {
+						_queue.Dequeue();
+						_queuedBytes -= delivery.Length;
+						Monitor.PulseAll( _lock );
+					}
+
+					try {
+						delivery.Handler( delivery.State );
+
+						if( !delivery.Final ) {
+							Interlocked.Increment( ref _owner._deliveredCount );
+							Interlocked.Add( ref _owner._deliveredBytes, delivery.Length );
+						}
+					}
+					catch( Exception ex ) {
+						_ts.TraceEvent( TraceEventType.Error, 0, "Exception while delivering on a loopback link: {0}", ex );
+					}
+
+					if( delivery.Final )
+						return;
+				}
+			}
+
+			private static void WaitUntil( long time ) {
+				for( ;; ) {
+					long remaining = time - Stopwatch.GetTimestamp();
+
+					if( remaining <= 0 )
+						return;
+
+					// Sleep for the bulk of the wait, but spin out the last millisecond or so; the scheduler can't do better
+					long milliseconds = remaining * 1000L / Stopwatch.Frequency;
+
+					if( milliseconds > 1 )
+						Thread.Sleep( (int) Math.Min( milliseconds - 1, int.MaxValue ) );
+					else
+						Thread.SpinWait( 100 );
+				}
+			}
+
+			private static long TimeSpanToTimestamp( TimeSpan value ) {
+				return (long)(value.TotalSeconds * (double) Stopwatch.Frequency);
+			}
+		}
+	#endregion
+
+	#region LinkStream
+		/// <summary>
+		/// Reads from one <see cref="Pipe"/> and sends writes over a link to another.
+		/// </summary>
+		sealed class LinkStream : Stream {
+			Pipe _readPipe, _writePipe;
+			Link _link;
+			WaitCallback _deliverCallback, _closeCallback;
+			bool _closed;
+
+			public LinkStream( Pipe readPipe, Pipe writePipe, Link link ) {
+				_readPipe = readPipe;
+				_writePipe = writePipe;
+				_link = link;
+				_deliverCallback = Deliver;
+				_closeCallback = ClosePeer;
+			}
+
+			public override bool CanRead {
+				get { return !_closed; }
+			}
+
+			public override bool CanSeek {
+				get { return false; }
+			}
+
+			public override bool CanWrite {
+				get { return !_closed; }
+			}
+
+			public override void Flush() {
+			}
+
+			public override long Length {
+				get { throw new NotSupportedException(); }
+			}
+
+			public override long Position {
+				get { throw new NotSupportedException(); }
+				set { throw new NotSupportedException(); }
+			}
+
+			public override long Seek( long offset, SeekOrigin origin ) {
+				throw new NotSupportedException();
+			}
+
+			public override void SetLength( long value ) {
+				throw new NotSupportedException();
+			}
+
+			public override IAsyncResult BeginRead( byte[] buffer, int offset, int count, AsyncCallback callback, object state ) {
+				return _readPipe.BeginRead( buffer, offset, count, callback, state );
+			}
+
+			public override int EndRead( IAsyncResult asyncResult ) {
+				return _readPipe.EndRead( asyncResult );
+			}
+
+			public override int Read( byte[] buffer, int offset, int count ) {
+				return _readPipe.Read( buffer, offset, count );
+			}
+
+			public override void Write( byte[] buffer, int offset, int count ) {
+				if( buffer == null )
+					throw new ArgumentNullException( "buffer" );
+
+				if( offset < 0 || offset > buffer.Length )
+					throw new ArgumentOutOfRangeException( "offset" );
+
+				if( count < 0 || count > buffer.Length - offset )
+					throw new ArgumentOutOfRangeException( "count" );
+
+				if( _closed )
+					throw new ObjectDisposedException( null );
+
+				if( count == 0 )
+					return;
+
+				byte[] data = new byte[count];
+				Buffer.BlockCopy( buffer, offset, data, 0, count );
+
+				_link.Send( count, true, _deliverCallback, data );
+			}
+
+			private void Deliver( object state ) {
+				byte[] data = (byte[]) state;
+				_writePipe.Write( data, 0, data.Length );
+			}
+
+			private void ClosePeer( object state ) {
+				_writePipe.Close();
+			}
+
+			protected override void Dispose( bool disposing ) {
+				if( disposing && !_closed ) {
+					_closed = true;
+					_link.Shutdown( _closeCallback, null );
+				}
+
+				base.Dispose( disposing );
+			}
+		}
+	#endregion
+
+	#region LoopbackChannel
+		/// <summary>
+		/// Sends messages over a link to the receive queue of another <see cref="LoopbackChannel"/>.
+		/// </summary>
+		sealed class LoopbackChannel : Channel<IDataMessage> {
+			Link _link;
+			LoopbackChannel _peer;
+			AsynchronousQueue<IDataMessage> _receiveQueue = new AsynchronousQueue<IDataMessage>();
+			WaitCallback _deliverCallback, _closeCallback;
+			int _maximumPayloadLength;
+			bool _closed;
+
+			public LoopbackChannel( Link link, int maximumPayloadLength ) {
+				_link = link;
+				_maximumPayloadLength = maximumPayloadLength;
+				_deliverCallback = Deliver;
+				_closeCallback = ClosePeer;
+			}
+
+			public LoopbackChannel Peer {
+				get { return _peer; }
+				set { _peer = value; }
+			}
+
+			public override int MaximumPayloadLength {
+				get { return _maximumPayloadLength; }
+			}
+
+			public override int ReceiveWindow {
+				get { return _maximumPayloadLength; }
+			}
+
+			public override bool CanReceive {
+				get { return true; }
+			}
+
+			public override bool CanSend {
+				get { return !_closed; }
+			}
+
+			public override IAsyncResult BeginReceive( AsyncCallback callback, object state ) {
+				return _receiveQueue.BeginDequeue( callback, state );
+			}
+
+			public override bool EndReceive( IAsyncResult result, out IDataMessage value ) {
+				// A null message marks the end of the channel
+				value = _receiveQueue.EndDequeue( result );
+				return value != null;
+			}
+
+			public override bool Receive( out IDataMessage value ) {
+				return EndReceive( BeginReceive( null, null ), out value );
+			}
+
+			public override void Send( IDataMessage value ) {
+				if( value == null )
+					throw new ArgumentNullException( "value" );
+
+				if( _closed )
+					throw new ObjectDisposedException( null );
+
+				IMessageBuffer buffer = value.MessageBuffer;
+
+				if( buffer.Length > _maximumPayloadLength )
+					throw new ArgumentException( "The message is larger than the maximum payload length of the channel.", "value" );
+
+				byte[] data = new byte[buffer.Length];
+				buffer.CopyTo( data, 0 );
+
+				_link.Send( data.Length, false, _deliverCallback, new SimpleDataMessage( value.Channel, data ) );
+			}
+
+			private void Deliver( object state ) {
+				_peer._receiveQueue.Enqueue( (IDataMessage) state );
+			}
+
+			private void ClosePeer( object state ) {
+				_peer._receiveQueue.Enqueue( null );
+			}
+
+			protected override void Dispose( bool disposing ) {
+				if( disposing && !_closed ) {
+					_closed = true;
+					_link.Shutdown( _closeCallback, null );
+				}
+
+				base.Dispose( disposing );
+			}
+		}
+	#endregion
+	}
+}
@@ -32,23 +32,22 @@ namespace Fluggo.Communications
 	/// Represents a list of interdependent queues.
 	/// </summary>
 	/// <typeparam name="T">Type of item stored in the queues.</typeparam>
+	/// <remarks>Each queue is a ring buffer that doubles when it fills, so once the rings have grown to their working size,
+	///   enqueueing and dequeueing allocate nothing. Every item is stamped with a sequence number from a counter shared by
+	///   all the queues; <see cref="Dequeue()"/> and <see cref="Peek()"/> take the queue head with the lowest number, which
+	///   costs a scan over the queues but leaves the per-queue operations constant-time.</remarks>
 	public class QueueList<T> {
-		class QueueItem {
-			public QueueItem( int queue, T value ) {
-				Queue = queue;
-				Value = value;
-			}
-			
-			public T Value;
-			public int Queue;
-			public QueueItem Previous;
-			public QueueItem Next;
+		struct Ring {
+			public T[] Items;
+			public long[] Sequences;
+			public int Head, Count;
 		}
-		
-		QueueItem _head, _tail;
-		QueueItem[] _headList;
+
+		const int __initialCapacity = 4;
+
+		Ring[] _queues;
+		long _nextSequence;
 		int _count;
-		int[] _queueCounts;
 
 		/// <summary>
 		/// Creates a new instance of the <see cref='QueueList'/> class.
@@ -58,8 +57,7 @@ namespace Fluggo.Communications
 			if( queueCount < 0 )
 				throw new ArgumentOutOfRangeException( "queueCount" );
 			
-			_headList = new QueueItem[queueCount];
-			_queueCounts = new int[queueCount];
+			_queues = new Ring[queueCount];
 		}
 		
 		/// <summary>
@@ -68,28 +66,41 @@ namespace Fluggo.Communications
 		/// <param name="queue">Zero-based index of the queue to which to add the item.</param>
 		/// <param name="value">Value of the item to add to the queue.</param>
 		public virtual void Enqueue( int queue, T value ) {
-			if( queue < 0 || queue >= _headList.Length )
+			if( queue < 0 || queue >= _queues.Length )
 				throw new ArgumentOutOfRangeException( "queue" );
 			
-			QueueItem item = new QueueItem( queue, value );
-			
-			// Add to main queue
-			if( _tail == null ) {
-				_head = item;
-				_tail = item;
-			}
-			else {
-				item.Previous = _tail;
-				_tail.Next = item;
-				_tail = item;
-			}
-			
-			// Index in head list 
-			if( _headList[queue] == null )
-				_headList[queue] = item;
-				
+			if( _queues[queue].Items == null || _queues[queue].Count == _queues[queue].Items.Length )
+				Grow( ref _queues[queue] );
+
+			Ring ring = _queues[queue];
+			int index = (ring.Head + ring.Count) % ring.Items.Length;
+
+			ring.Items[index] = value;
+			ring.Sequences[index] = _nextSequence++;
+			_queues[queue].Count++;
 			_count++;
-			_queueCounts[queue]++;
+		}
+
+		private static void Grow( ref Ring ring ) {
+			if( ring.Items == null ) {
+				ring.Items = new T[__initialCapacity];
+				ring.Sequences = new long[__initialCapacity];
+				return;
+			}
+
+			T[] items = new T[ring.Items.Length * 2];
+			long[] sequences = new long[items.Length];
+
+			// Unwrap the ring so the head lands at zero
+			int first = Math.Min( ring.Count, ring.Items.Length - ring.Head );
+			Array.Copy( ring.Items, ring.Head, items, 0, first );
+			Array.Copy( ring.Items, 0, items, first, ring.Count - first );
+			Array.Copy( ring.Sequences, ring.Head, sequences, 0, first );
+			Array.Copy( ring.Sequences, 0, sequences, first, ring.Count - first );
+
+			ring.Items = items;
+			ring.Sequences = sequences;
+			ring.Head = 0;
 		}
 		
 		/// <summary>
@@ -98,15 +109,7 @@ namespace Fluggo.Communications
 		/// <returns>Returns the item at the head of all the queues.</returns>
 		/// <exception cref="InvalidOperationException">All queues are empty.</exception>
 		public virtual T Dequeue() {
-			if( _head == null )
-				throw new InvalidOperationException();
-			
-			try {
-				return _head.Value;
-			}
-			finally {
-				Remove( _head );
-			}
+			return RemoveHead( FindOldestQueue() );
 		}
 		
 		/// <summary>
@@ -117,18 +120,13 @@ namespace Fluggo.Communications
 		/// <exception cref="ArgumentOutOfRangeException"><paramref name="queue"/> does to refer to a valid queue.</exception>
 		/// <exception cref="InvalidOperationException">The given queue is empty.</exception>
 		public virtual T Dequeue( int queue ) {
-			if( queue < 0 || queue >= _headList.Length )
+			if( queue < 0 || queue >= _queues.Length )
 				throw new ArgumentOutOfRangeException( "queue" );
 				
-			if( _headList[queue] == null )
+			if( _queues[queue].Count == 0 )
 				throw new InvalidOperationException();
 			
-			try {
-				return _headList[queue].Value;
-			}
-			finally {
-				Remove( _headList[queue] );
-			}
+			return RemoveHead( queue );
 		}
 		
 		/// <summary>
@@ -137,10 +135,8 @@ namespace Fluggo.Communications
 		/// <returns>Returns the item at the head of all the queues.</returns>
 		/// <exception cref="InvalidOperationException">All queues are empty.</exception>
 		public virtual T Peek() {
-			if( _head == null )
-				throw new InvalidOperationException();
-
-			return _head.Value;
+			Ring ring = _queues[FindOldestQueue()];
+			return ring.Items[ring.Head];
 		}
 
 		/// <summary>
@@ -151,60 +147,49 @@ namespace Fluggo.Communications
 		/// <exception cref="ArgumentOutOfRangeException"><paramref name="queue"/> does to refer to a valid queue.</exception>
 		/// <exception cref="InvalidOperationException">The given queue is empty.</exception>
 		public virtual T Peek( int queue ) {
-			if( queue < 0 || queue >= _headList.Length )
+			if( queue < 0 || queue >= _queues.Length )
 				throw new ArgumentOutOfRangeException( "queue" );
 
-			if( _headList[queue] == null )
+			if( _queues[queue].Count == 0 )
 				throw new InvalidOperationException();
 
-			return _headList[queue].Value;
+			return _queues[queue].Items[_queues[queue].Head];
 		}
-		
-		private void Remove( QueueItem item ) {
-			// Patch the hole
-			if( item.Previous != null ) {
-				if( item.Next != null ) {
-					// Middle of the list; tie the two neighbors together
-					item.Previous.Next = item.Next;
-					item.Next.Previous = item.Previous;
-				}
-				else {
-					// End of the list
-					item.Previous.Next = null;
-					_tail = item.Previous;
-				}
-			}
-			else {
-				if( item.Next != null ) {
-					// Head of the list
-					item.Next.Previous = null;
-					_head = _head.Next;
-				}
-				else {
-					// Only item in the list
-					_head = null;
-					_tail = null;
-				}
-			}
 
-			// Update the individual queue
-			QueueItem current = _headList[item.Queue].Next;
+		private int FindOldestQueue() {
+			if( _count == 0 )
+				throw new InvalidOperationException();
 
-			// Walk until we find the next one
-			while( current != null ) {
-				if( current.Queue == item.Queue ) {
-					_headList[item.Queue] = current;
-					break;
-				}
+			int oldest = -1;
+			long oldestSequence = long.MaxValue;
+
+			for( int i = 0; i < _queues.Length; i++ ) {
+				if( _queues[i].Count == 0 )
+					continue;
+
+				long sequence = _queues[i].Sequences[_queues[i].Head];
 
-				current = current.Next;
+				if( sequence < oldestSequence ) {
+					oldest = i;
+					oldestSequence = sequence;
+				}
 			}
 
-			if( current == null )
-				_headList[item.Queue] = null;
+			return oldest;
+		}
+		
+		private T RemoveHead( int queue ) {
+			Ring ring = _queues[queue];
+			T value = ring.Items[ring.Head];
 
+			// Let go of the reference so the ring doesn't keep the item alive
+			ring.Items[ring.Head] = default(T);
+
+			_queues[queue].Head = (ring.Head + 1) % ring.Items.Length;
+			_queues[queue].Count--;
 			_count--;
-			_queueCounts[item.Queue]--;
+
+			return value;
 		}
 
 		/// <summary>
@@ -222,7 +207,7 @@ namespace Fluggo.Communications
 		/// </summary>
 		/// <returns>Returns the number of items in the given queue.</returns>
 		public int GetQueueItemCount( int queue ) {
-			return _queueCounts[queue];
+			return _queues[queue].Count;
 		}
 
 		/// <summary>
@@ -231,7 +216,7 @@ namespace Fluggo.Communications
 		/// <value>The number of queues in this list.</value>
 		public int QueueCount {
 			get {
-				return _queueCounts.Length;
+				return _queues.Length;
 			}
 		}
 	}
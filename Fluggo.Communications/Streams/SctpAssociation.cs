@@ -0,0 +1,1455 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Threading;
+
+namespace Fluggo.Communications {
+	/// <summary>
+	/// Provides reliable, congestion-controlled delivery of messages over an unreliable datagram channel, using the
+	/// data transfer rules of SCTP.
+	/// </summary>
+	/// <remarks>Each message sent on the association becomes one DATA chunk with its own TSN. The receiver answers with SACK
+	///     chunks that carry the cumulative TSN ack and gap ack blocks for anything that arrived out of order, and the sender
+	///     retransmits a chunk when it has been reported missing three times (fast retransmit) or when the retransmission
+	///     timer expires. The congestion window follows RFC 2960, section 7.2: slow start up to the slow start threshold,
+	///     then one path MTU per round trip, halved on fast retransmit and reset to one MTU on a timeout.
+	///   <para>Messages with a <see cref="IDataMessage.MillisecondsLifetime"/> are partially reliable (RFC 3758). Once the
+	///     lifetime passes, the sender stops retransmitting the message and sends a FORWARD TSN chunk so the receiver
+	///     stops waiting for it.</para>
+	///   <para>The <see cref="IMessage.Channel"/> of each message selects the stream it is sent on. Messages are delivered in
+	///     order within a stream unless they are sent with <see cref="DeliveryOptions.Unordered"/>; a lost message on one
+	///     stream doesn't hold up the others.</para>
+	///   <para>Chunks waiting to go out are bundled into packets up to the <see cref="PathMtu"/>, control chunks first, and
+	///     each packet carries the CRC32c checksum of RFC 3309. Packets that fail the checksum are dropped.</para>
+	///   <para>The association does not perform the INIT handshake, heartbeats or shutdown. Both ends start at TSN zero,
+	///     so both must be created over a fresh channel, and closing the association closes the channel without waiting for
+	///     outstanding data to be acknowledged.</para></remarks>
+	public class SctpAssociation : Channel<IDataMessage> {
+		const int __dataHeaderLength = 16, __selectAckHeaderLength = 16;
+		const int __fastRetransmitThreshold = 3;
+		const int __maxDuplicates = 16;
+		const byte __unorderedFlag = 0x04;
+		const ushort __invalidStreamCause = 1;
+
+		Channel<IDataMessage> _channel;
+		object _lock = new object();
+		AsyncCallback _receiveCallback;
+		AsynchronousQueue<IDataMessage> _receiveQueue = new AsynchronousQueue<IDataMessage>();
+		Queue<byte[]> _controlQueue = new Queue<byte[]>();
+		Queue<OutboundChunk> _dataQueue = new Queue<OutboundChunk>();
+		SctpPacketWriter _packetWriter;
+		bool _transmitting, _closed, _endQueued;
+		long _packetsSent, _chunksSent, _checksumErrorCount;
+		static TraceSource _ts = new TraceSource( "SctpAssociation", SourceLevels.Error );
+
+		int _pathMtu = 1400, _sendBufferSize = 131072, _receiveBufferSize = 131072;
+		long _minRto, _maxRto, _initialRto, _sackDelay;
+
+	#region Chunk state
+		/// <summary>
+		/// Tracks one DATA chunk from the time it's sent until it's acknowledged or abandoned.
+		/// </summary>
+		sealed class OutboundChunk {
+			public uint Tsn;
+			public ushort Stream, Ssn;
+			public bool Unordered, NotBundled;
+			public byte[] Packet;
+			public int Length;
+			public long SentAt, ExpiresAt;
+			public int Transmissions, MissCount;
+			public bool InFlight, Acked, Abandoned, Retransmit, FastRetransmitted;
+		}
+
+		/// <summary>
+		/// Holds messages that arrived ahead of their turn on an ordered stream.
+		/// </summary>
+		sealed class InboundStream {
+			public ushort NextSsn;
+			public Dictionary<ushort, IDataMessage> Held;
+		}
+	#endregion
+
+	#region Sender state
+		List<OutboundChunk> _outstanding = new List<OutboundChunk>();
+		ushort[] _nextOutboundSsn;
+		uint _nextTsn, _cumAckPoint = uint.MaxValue, _advancedPeerAckPoint = uint.MaxValue, _fastRecoveryExit;
+		int _unsentIndex, _queuedBytes, _flightSize, _retransmitPending, _lifetimeCount;
+		int _cwnd, _ssthresh, _partialBytesAcked, _peerWindow;
+		bool _inFastRecovery, _peerWindowKnown, _rttMeasured, _t3Running;
+		long _srtt, _rttvar, _rto;
+		Timer _t3Timer;
+		long _retransmitCount, _fastRetransmitCount, _timeoutCount, _abandonedCount;
+	#endregion
+
+	#region Receiver state
+		InboundStream[] _inboundStreams;
+		uint _cumTsn = uint.MaxValue;
+		List<uint> _gapTsns = new List<uint>();
+		uint[] _duplicates = new uint[__maxDuplicates];
+		ushort[] _gapBlocks;
+		List<IDataMessage> _deliveries = new List<IDataMessage>();
+		int _duplicateCount, _receiveBuffered, _packetsSinceSack;
+		bool _sackTimerRunning, _windowUpdateNeeded;
+		Timer _sackTimer;
+	#endregion
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='SctpAssociation'/> class.
+		/// </summary>
+		/// <param name="channel">Datagram channel to carry the association's packets. The channel may lose, duplicate or
+		///   reorder messages. The association takes ownership of the channel and closes it when it's closed.</param>
+		/// <param name="streamCount">Number of streams in each direction. Messages must be sent on channels from zero to
+		///   one less than this number.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='channel'/> is <see langword='null'/>.</exception>
+		/// <exception cref='ArgumentOutOfRangeException'><paramref name='streamCount'/> is less than one or greater than 65536.</exception>
+		public SctpAssociation( Channel<IDataMessage> channel, int streamCount ) {
+			if( channel == null )
+				throw new ArgumentNullException( "channel" );
+
+			if( streamCount < 1 || streamCount > ushort.MaxValue + 1 )
+				throw new ArgumentOutOfRangeException( "streamCount" );
+
+			_channel = channel;
+			_nextOutboundSsn = new ushort[streamCount];
+			_inboundStreams = new InboundStream[streamCount];
+
+			_minRto = TimeSpanToTimestamp( TimeSpan.FromSeconds( 1.0 ) );
+			_maxRto = TimeSpanToTimestamp( TimeSpan.FromSeconds( 60.0 ) );
+			_initialRto = TimeSpanToTimestamp( TimeSpan.FromSeconds( 3.0 ) );
+			_sackDelay = TimeSpanToTimestamp( TimeSpan.FromMilliseconds( 200.0 ) );
+			_rto = _initialRto;
+
+			// Until the first SACK arrives, assume the peer has the same receive buffer as we do
+			_peerWindow = _receiveBufferSize;
+			_ssthresh = _receiveBufferSize;
+			_cwnd = InitialCongestionWindow;
+
+			_t3Timer = new Timer( T3Callback );
+			_sackTimer = new Timer( SackTimerCallback );
+			_receiveCallback = ReceiveCallback;
+
+			StartReceiving();
+		}
+
+	#region Settings
+		/// <summary>
+		/// Gets or sets the largest packet the association will send.
+		/// </summary>
+		/// <value>The path MTU, in bytes, not counting the headers of the underlying channel. The default is 1400. If the
+		///   underlying channel has a smaller <see cref="Channel{T}.MaximumPayloadLength"/>, that is used instead.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than 64.</exception>
+		/// <remarks>The path MTU is also the unit by which the congestion window grows and shrinks.</remarks>
+		public int PathMtu {
+			get {
+				int lowerLimit = _channel.MaximumPayloadLength;
+
+				if( lowerLimit != -1 && lowerLimit < _pathMtu )
+					return lowerLimit;
+
+				return _pathMtu;
+			}
+			set {
+				if( value < 64 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				lock( _lock ) {
+					_pathMtu = value;
+				}
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the number of payload bytes that can wait to be sent or acknowledged.
+		/// </summary>
+		/// <value>The size of the send buffer, in bytes. The default is 131072.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than one.</exception>
+		/// <remarks><see cref="Send"/> blocks while the send buffer is full.</remarks>
+		public int SendBufferSize {
+			get { return _sendBufferSize; }
+			set {
+				if( value < 1 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				lock( _lock ) {
+					_sendBufferSize = value;
+					Monitor.PulseAll( _lock );
+				}
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the number of payload bytes this end will hold for the application.
+		/// </summary>
+		/// <value>The size of the receive buffer, in bytes. The default is 131072.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than one.</exception>
+		/// <remarks>The receive buffer holds messages waiting for an earlier message on their stream and messages that have
+		///   not yet been received by the application. What's left of it is advertised to the peer as the receive window.</remarks>
+		public int ReceiveBufferSize {
+			get { return _receiveBufferSize; }
+			set {
+				if( value < 1 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_receiveBufferSize = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the retransmission timeout used before the round-trip time has been measured.
+		/// </summary>
+		/// <value>The initial retransmission timeout. The default is three seconds.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is not positive.</exception>
+		public TimeSpan InitialRetransmitTimeout {
+			get { return TimestampToTimeSpan( _initialRto ); }
+			set {
+				if( value <= TimeSpan.Zero )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				lock( _lock ) {
+					_initialRto = TimeSpanToTimestamp( value );
+
+					if( !_rttMeasured )
+						_rto = _initialRto;
+				}
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the smallest retransmission timeout.
+		/// </summary>
+		/// <value>The lower bound of the retransmission timeout. The default is one second.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is not positive.</exception>
+		/// <remarks>RFC 2960 calls for one second, which is far longer than the round trip of a local link. Lower it for
+		///   links where the round trip is known to be short.</remarks>
+		public TimeSpan MinimumRetransmitTimeout {
+			get { return TimestampToTimeSpan( _minRto ); }
+			set {
+				if( value <= TimeSpan.Zero )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_minRto = TimeSpanToTimestamp( value );
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the largest retransmission timeout.
+		/// </summary>
+		/// <value>The upper bound of the retransmission timeout, which limits how far repeated timeouts back off.
+		///   The default is sixty seconds.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is not positive.</exception>
+		public TimeSpan MaximumRetransmitTimeout {
+			get { return TimestampToTimeSpan( _maxRto ); }
+			set {
+				if( value <= TimeSpan.Zero )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_maxRto = TimeSpanToTimestamp( value );
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the longest time a SACK is delayed.
+		/// </summary>
+		/// <value>The time the receiver waits for a second packet before acknowledging the first. The default is
+		///   200 milliseconds.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is negative.</exception>
+		/// <remarks>Packets that arrive out of order or duplicated are always acknowledged right away.</remarks>
+		public TimeSpan SackDelay {
+			get { return TimestampToTimeSpan( _sackDelay ); }
+			set {
+				if( value < TimeSpan.Zero )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_sackDelay = TimeSpanToTimestamp( value );
+			}
+		}
+	#endregion
+
+	#region Statistics
+		/// <summary>
+		/// Gets the current congestion window.
+		/// </summary>
+		/// <value>The number of bytes the sender will have in flight at once.</value>
+		public int CongestionWindow {
+			get { return _cwnd; }
+		}
+
+		/// <summary>
+		/// Gets the smoothed round-trip time.
+		/// </summary>
+		/// <value>The smoothed round-trip time, or <see cref="TimeSpan.Zero"/> if no round trip has been measured yet.</value>
+		public TimeSpan SmoothedRoundTripTime {
+			get { return TimestampToTimeSpan( _srtt ); }
+		}
+
+		/// <summary>
+		/// Gets the current retransmission timeout.
+		/// </summary>
+		/// <value>The time the sender waits for an acknowledgement before retransmitting.</value>
+		public TimeSpan RetransmitTimeout {
+			get { return TimestampToTimeSpan( _rto ); }
+		}
+
+		/// <summary>
+		/// Gets the number of DATA chunks sent again.
+		/// </summary>
+		/// <value>The number of retransmissions of any kind.</value>
+		public long RetransmitCount {
+			get { return Interlocked.Read( ref _retransmitCount ); }
+		}
+
+		/// <summary>
+		/// Gets the number of DATA chunks sent again because the peer reported them missing.
+		/// </summary>
+		/// <value>The number of fast retransmissions.</value>
+		public long FastRetransmitCount {
+			get { return Interlocked.Read( ref _fastRetransmitCount ); }
+		}
+
+		/// <summary>
+		/// Gets the number of times the retransmission timer has expired.
+		/// </summary>
+		/// <value>The number of retransmission timeouts.</value>
+		public long TimeoutCount {
+			get { return Interlocked.Read( ref _timeoutCount ); }
+		}
+
+		/// <summary>
+		/// Gets the number of packets sent.
+		/// </summary>
+		/// <value>The number of packets sent on the underlying channel.</value>
+		public long PacketsSent {
+			get { return Interlocked.Read( ref _packetsSent ); }
+		}
+
+		/// <summary>
+		/// Gets the number of chunks sent.
+		/// </summary>
+		/// <value>The number of chunks of any type sent. Divided by <see cref="PacketsSent"/>, this gives the average
+		///   number of chunks bundled into each packet.</value>
+		public long ChunksSent {
+			get { return Interlocked.Read( ref _chunksSent ); }
+		}
+
+		/// <summary>
+		/// Gets the number of packets dropped because their checksum was wrong.
+		/// </summary>
+		/// <value>The number of packets received with a bad CRC32c checksum.</value>
+		public long ChecksumErrorCount {
+			get { return Interlocked.Read( ref _checksumErrorCount ); }
+		}
+
+		/// <summary>
+		/// Gets the number of messages abandoned because their lifetime expired.
+		/// </summary>
+		/// <value>The number of messages that may never have reached the peer.</value>
+		public long AbandonedCount {
+			get { return Interlocked.Read( ref _abandonedCount ); }
+		}
+	#endregion
+
+	#region Channel members
+		public override bool CanReceive {
+			get { return true; }
+		}
+
+		public override bool CanSend {
+			get { return !_closed; }
+		}
+
+		/// <summary>
+		/// Gets the maximum number of bytes that can be sent in a single message.
+		/// </summary>
+		/// <value>The <see cref="PathMtu"/> less the common header and the DATA chunk header, after rounding
+		///   the room for the chunk down to a multiple of four so that its padding fits too.</value>
+		public override int MaximumPayloadLength {
+			get { return ((PathMtu - SctpPacketWriter.CommonHeaderLength) & ~3) - __dataHeaderLength; }
+		}
+
+		/// <summary>
+		/// Gets the number of bytes that can be sent right away.
+		/// </summary>
+		/// <value>The smaller of the peer's receive window and the room left in the congestion window.</value>
+		public override int ReceiveWindow {
+			get {
+				lock( _lock ) {
+					return Math.Max( 0, Math.Min( _peerWindow, _cwnd - _flightSize ) );
+				}
+			}
+		}
+
+		public override IAsyncResult BeginReceive( AsyncCallback callback, object state ) {
+			return _receiveQueue.BeginDequeue( callback, state );
+		}
+
+		public override bool EndReceive( IAsyncResult result, out IDataMessage value ) {
+			// A null message marks the end of the association
+			value = _receiveQueue.EndDequeue( result );
+
+			if( value == null )
+				return false;
+
+			lock( _lock ) {
+				_receiveBuffered -= value.MessageBuffer.Length;
+
+				// If the last SACK told the peer to stop, tell it there's room again
+				if( !_closed && _windowUpdateNeeded && _receiveBufferSize - _receiveBuffered >= PathMtu )
+					QueueSelectAck();
+			}
+
+			FlushTransmissions();
+			return true;
+		}
+
+		public override bool Receive( out IDataMessage value ) {
+			return EndReceive( BeginReceive( null, null ), out value );
+		}
+
+		/// <summary>
+		/// Sends a message on the association.
+		/// </summary>
+		/// <param name="value">Message to send. Its <see cref="IMessage.Channel"/> is the stream to send it on.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='value'/> is <see langword='null'/>.</exception>
+		/// <exception cref='ArgumentException'>The message is larger than <see cref="MaximumPayloadLength"/>, or its
+		///   channel is not one of the association's streams.</exception>
+		/// <exception cref='ObjectDisposedException'>The association is closed.</exception>
+		/// <remarks>The message is copied, so the caller can reuse its buffer as soon as this returns. If the send buffer is
+		///   full, this blocks until enough of it has been acknowledged.</remarks>
+		public override void Send( IDataMessage value ) {
+			if( value == null )
+				throw new ArgumentNullException( "value" );
+
+			IMessageBuffer buffer = value.MessageBuffer;
+
+			if( buffer.Length > MaximumPayloadLength )
+				throw new ArgumentException( "The message is larger than the maximum payload length of the association.", "value" );
+
+			int stream = value.Channel;
+
+			if( stream < 0 || stream >= _nextOutboundSsn.Length )
+				throw new ArgumentException( "The message's channel is not a stream of the association.", "value" );
+
+			DeliveryOptions options = value.Options & DeliveryOptions.Unordered;
+			long now = Stopwatch.GetTimestamp();
+			int lifetime = value.MillisecondsLifetime;
+
+			lock( _lock ) {
+				while( !_closed && _queuedBytes != 0 && _queuedBytes + buffer.Length > _sendBufferSize )
+					Monitor.Wait( _lock );
+
+				if( _closed )
+					throw new ObjectDisposedException( null );
+
+				OutboundChunk chunk = new OutboundChunk();
+				chunk.Tsn = _nextTsn++;
+				chunk.Stream = (ushort) stream;
+				chunk.Unordered = options == DeliveryOptions.Unordered;
+				chunk.NotBundled = (value.Options & DeliveryOptions.NotBundled) == DeliveryOptions.NotBundled;
+				chunk.Ssn = chunk.Unordered ? (ushort) 0 : _nextOutboundSsn[stream]++;
+				chunk.Length = buffer.Length;
+				chunk.ExpiresAt = long.MaxValue;
+
+				if( lifetime >= 0 ) {
+					chunk.ExpiresAt = now + (long) lifetime * Stopwatch.Frequency / 1000L;
+					_lifetimeCount++;
+				}
+
+				SctpDataMessage data = new SctpDataMessage( stream, buffer, options, value.Protocol, chunk.Tsn, chunk.Ssn );
+				chunk.Packet = new byte[data.ChunkLength];
+				data.CopyChunk( chunk.Packet, 0 );
+
+				_outstanding.Add( chunk );
+				_queuedBytes += chunk.Length;
+
+				Pump( now );
+			}
+
+			FlushTransmissions();
+		}
+
+		protected override void Dispose( bool disposing ) {
+			if( disposing ) {
+				bool wasClosed;
+
+				lock( _lock ) {
+					wasClosed = _closed;
+					_closed = true;
+					_controlQueue.Clear();
+					_dataQueue.Clear();
+					Monitor.PulseAll( _lock );
+				}
+
+				if( !wasClosed ) {
+					_t3Timer.Dispose();
+					_sackTimer.Dispose();
+					_channel.Close();
+					QueueEnd();
+				}
+			}
+
+			base.Dispose( disposing );
+		}
+	#endregion
+
+	#region Sending
+		private int InitialCongestionWindow {
+			get {
+				int mtu = PathMtu;
+				return Math.Min( 4 * mtu, Math.Max( 2 * mtu, 4380 ) );
+			}
+		}
+
+		/// <summary>
+		/// Sends as much as the congestion and receive windows allow. Must be called with the lock held.
+		/// </summary>
+		/// <param name="now">The current <see cref="Stopwatch"/> timestamp.</param>
+		private void Pump( long now ) {
+			if( _closed )
+				return;
+
+			AbandonExpired( now );
+
+			// Chunks marked by a timeout go before anything new
+			for( int i = 0; i < _outstanding.Count && _retransmitPending != 0; i++ ) {
+				OutboundChunk chunk = _outstanding[i];
+
+				if( !chunk.Retransmit )
+					continue;
+
+				if( _flightSize != 0 && _flightSize + chunk.Length > _cwnd )
+					return;
+
+				chunk.Retransmit = false;
+				_retransmitPending--;
+				Transmit( chunk, now );
+			}
+
+			while( _unsentIndex < _outstanding.Count ) {
+				OutboundChunk chunk = _outstanding[_unsentIndex];
+
+				if( !chunk.Abandoned ) {
+					// With nothing in flight, one chunk always goes, which probes a closed receive window
+					if( _flightSize != 0 && (_flightSize + chunk.Length > _cwnd || chunk.Length > _peerWindow) )
+						return;
+
+					Transmit( chunk, now );
+				}
+
+				_unsentIndex++;
+			}
+		}
+
+		private void Transmit( OutboundChunk chunk, long now ) {
+			if( chunk.Transmissions != 0 )
+				Interlocked.Increment( ref _retransmitCount );
+
+			chunk.Transmissions++;
+			chunk.SentAt = now;
+			chunk.InFlight = true;
+			_flightSize += chunk.Length;
+			_peerWindow = Math.Max( 0, _peerWindow - chunk.Length );
+			_dataQueue.Enqueue( chunk );
+
+			if( !_t3Running )
+				StartT3();
+		}
+
+		/// <summary>
+		/// Marks chunks whose lifetime has passed as abandoned. Must be called with the lock held.
+		/// </summary>
+		private void AbandonExpired( long now ) {
+			if( _lifetimeCount == 0 )
+				return;
+
+			bool abandoned = false;
+
+			for( int i = 0; i < _outstanding.Count; i++ ) {
+				OutboundChunk chunk = _outstanding[i];
+
+				if( chunk.Acked || chunk.Abandoned || chunk.ExpiresAt > now )
+					continue;
+
+				Abandon( chunk );
+				abandoned = true;
+			}
+
+			if( abandoned )
+				AdvancePeerAckPoint();
+		}
+
+		/// <summary>
+		/// Gives up on a chunk and takes it out of the flight. Must be called with the lock held.
+		/// </summary>
+		/// <remarks>The caller should follow up with <see cref="AdvancePeerAckPoint"/>.</remarks>
+		private void Abandon( OutboundChunk chunk ) {
+			chunk.Abandoned = true;
+			Interlocked.Increment( ref _abandonedCount );
+
+			if( chunk.InFlight ) {
+				chunk.InFlight = false;
+				_flightSize -= chunk.Length;
+			}
+
+			if( chunk.Retransmit ) {
+				chunk.Retransmit = false;
+				_retransmitPending--;
+			}
+		}
+
+		/// <summary>
+		/// Moves the advanced peer ack point past any abandoned chunks at the head of the queue and tells the peer.
+		/// </summary>
+		private void AdvancePeerAckPoint() {
+			int count = 0;
+			bool anyAbandoned = false;
+
+			while( count < _outstanding.Count && (_outstanding[count].Abandoned || _outstanding[count].Acked) ) {
+				anyAbandoned |= _outstanding[count].Abandoned;
+				count++;
+			}
+
+			if( !anyAbandoned )
+				return;
+
+			uint point = _outstanding[count - 1].Tsn;
+
+			if( !TsnLess( _advancedPeerAckPoint, point ) )
+				return;
+
+			_advancedPeerAckPoint = point;
+			QueueForwardTsn();
+		}
+
+		private bool ForwardTsnPending {
+			get { return TsnLess( _cumAckPoint, _advancedPeerAckPoint ); }
+		}
+
+		/// <summary>
+		/// Queues a FORWARD TSN chunk for the advanced peer ack point. Must be called with the lock held.
+		/// </summary>
+		private void QueueForwardTsn() {
+			// Report the last abandoned SSN on each ordered stream so the peer can deliver what's behind it
+			Dictionary<ushort, ushort> streams = new Dictionary<ushort, ushort>();
+
+			for( int i = 0; i < _outstanding.Count && !TsnLess( _advancedPeerAckPoint, _outstanding[i].Tsn ); i++ ) {
+				OutboundChunk chunk = _outstanding[i];
+
+				if( chunk.Abandoned && !chunk.Unordered )
+					streams[chunk.Stream] = chunk.Ssn;
+			}
+
+			ushort[] pairs = new ushort[streams.Count * 2];
+			int index = 0;
+
+			foreach( KeyValuePair<ushort, ushort> pair in streams ) {
+				pairs[index++] = pair.Key;
+				pairs[index++] = pair.Value;
+			}
+
+			SctpForwardTsnMessage message = new SctpForwardTsnMessage( _advancedPeerAckPoint, pairs, streams.Count );
+			byte[] packet = new byte[message.ChunkLength];
+			message.CopyChunk( packet, 0 );
+			_controlQueue.Enqueue( packet );
+
+			if( !_t3Running )
+				StartT3();
+		}
+
+		/// <summary>
+		/// Bundles everything in the transmit queues into packets and sends them on the underlying channel.
+		/// </summary>
+		/// <remarks>Call this without the lock held. Only one thread sends at a time; if another thread is already sending,
+		///   it picks up whatever was queued. That thread is also the only one to touch the packet writer, so its buffer
+		///   can be reused from packet to packet.</remarks>
+		private void FlushTransmissions() {
+			lock( _lock ) {
+				if( _transmitting )
+					return;
+
+				_transmitting = true;
+			}
+
+			for( ;; ) {
+				ArraySegment<byte> packet;
+
+				lock( _lock ) {
+					if( _closed || (_controlQueue.Count == 0 && _dataQueue.Count == 0) ) {
+						_transmitting = false;
+						return;
+					}
+
+					packet = AssemblePacket();
+				}
+
+				if( packet.Count == 0 )
+					continue;
+
+				try {
+					_channel.Send( new SimpleDataMessage( 0, packet.Array, packet.Offset, packet.Count ) );
+					Interlocked.Increment( ref _packetsSent );
+				}
+				catch( Exception ex ) {
+					_ts.TraceEvent( TraceEventType.Error, 0, "Failed to send a packet, closing: {0}", ex );
+
+					lock( _lock ) {
+						_transmitting = false;
+					}
+
+					Close();
+					return;
+				}
+			}
+		}
+
+		/// <summary>
+		/// Fills a packet from the transmit queues. Must be called with the lock held.
+		/// </summary>
+		/// <returns>The finished packet, or an empty segment if the chunk at the head of the queue could never fit.</returns>
+		private ArraySegment<byte> AssemblePacket() {
+			int mtu = PathMtu;
+
+			if( _packetWriter == null || _packetWriter.MaximumLength != mtu )
+				_packetWriter = new SctpPacketWriter( mtu );
+
+			_packetWriter.Reset();
+
+			// Control chunks go ahead of data (RFC 2960, section 6.10)
+			while( _controlQueue.Count != 0 && _packetWriter.TryAppend( _controlQueue.Peek(), 0, _controlQueue.Peek().Length ) )
+				_controlQueue.Dequeue();
+
+			while( _dataQueue.Count != 0 ) {
+				OutboundChunk chunk = _dataQueue.Peek();
+
+				if( chunk.NotBundled && _packetWriter.ChunkCount != 0 )
+					break;
+
+				if( !_packetWriter.TryAppend( chunk.Packet, 0, chunk.Packet.Length ) )
+					break;
+
+				_dataQueue.Dequeue();
+
+				if( chunk.NotBundled )
+					break;
+			}
+
+			if( _packetWriter.ChunkCount == 0 ) {
+				// Whatever is at the head of the queues can't fit even on its own; take it out so the queues keep moving
+				if( _controlQueue.Count != 0 && !_packetWriter.CanAppend( _controlQueue.Peek().Length ) ) {
+					_ts.TraceEvent( TraceEventType.Warning, 0, "Dropped a control chunk too large for the path MTU" );
+					_controlQueue.Dequeue();
+				}
+				else if( _dataQueue.Count != 0 ) {
+					// DATA chunks fit the MTU they were queued under, but the path MTU may have shrunk since
+					OutboundChunk chunk = _dataQueue.Dequeue();
+					_ts.TraceEvent( TraceEventType.Warning, 0, "Abandoned TSN {0}, which no longer fits the path MTU", chunk.Tsn );
+
+					if( !chunk.Abandoned && !chunk.Acked ) {
+						Abandon( chunk );
+						AdvancePeerAckPoint();
+					}
+				}
+
+				return new ArraySegment<byte>();
+			}
+
+			Interlocked.Add( ref _chunksSent, _packetWriter.ChunkCount );
+			return _packetWriter.Finish();
+		}
+	#endregion
+
+	#region Acknowledgement
+		/// <summary>
+		/// Processes a SACK chunk. Must be called with the lock held.
+		/// </summary>
+		private void HandleSelectAck( byte[] packet, int offset, int length ) {
+			if( length < __selectAckHeaderLength )
+				return;
+
+			uint cumAck = NetworkBitConverter.ToUInt32( packet, offset + 4 );
+			int peerWindow = NetworkBitConverter.ToInt32( packet, offset + 8 );
+			int gapCount = NetworkBitConverter.ToUInt16( packet, offset + 12 );
+
+			if( __selectAckHeaderLength + gapCount * 4 > length )
+				return;
+
+			// An old SACK that arrived late says nothing new
+			if( TsnLess( cumAck, _cumAckPoint ) || !TsnLess( cumAck, _nextTsn ) )
+				return;
+
+			long now = Stopwatch.GetTimestamp();
+			int flightBefore = _flightSize, cumBytesAcked = 0, freedBytes = 0;
+			bool cumAdvanced = TsnLess( _cumAckPoint, cumAck );
+			OutboundChunk rttChunk = null;
+
+			// Everything up to the cumulative TSN ack is done with
+			int removeCount = 0;
+
+			while( removeCount < _outstanding.Count && !TsnLess( cumAck, _outstanding[removeCount].Tsn ) ) {
+				OutboundChunk chunk = _outstanding[removeCount];
+
+				if( !chunk.Acked && !chunk.Abandoned ) {
+					cumBytesAcked += chunk.Length;
+
+					// Karn's algorithm: only chunks sent once give a clean measurement
+					if( chunk.Transmissions == 1 )
+						rttChunk = chunk;
+				}
+
+				if( chunk.InFlight )
+					_flightSize -= chunk.Length;
+
+				if( chunk.Retransmit )
+					_retransmitPending--;
+
+				if( chunk.ExpiresAt != long.MaxValue )
+					_lifetimeCount--;
+
+				freedBytes += chunk.Length;
+				removeCount++;
+			}
+
+			if( removeCount != 0 ) {
+				_outstanding.RemoveRange( 0, removeCount );
+				_unsentIndex = Math.Max( 0, _unsentIndex - removeCount );
+				_queuedBytes -= freedBytes;
+			}
+
+			_cumAckPoint = cumAck;
+
+			if( TsnLess( _advancedPeerAckPoint, _cumAckPoint ) )
+				_advancedPeerAckPoint = _cumAckPoint;
+
+			if( rttChunk != null )
+				UpdateRetransmitTimeout( now - rttChunk.SentAt );
+
+			// Gap ack blocks come in order, so one pass over the outstanding chunks covers them all
+			bool newlyGapAcked = false;
+			uint highestNewlyAcked = cumAck;
+			int index = 0;
+
+			for( int gap = 0; gap < gapCount; gap++ ) {
+				uint start = cumAck + NetworkBitConverter.ToUInt16( packet, offset + 16 + gap * 4 );
+				uint end = cumAck + NetworkBitConverter.ToUInt16( packet, offset + 18 + gap * 4 );
+
+				while( index < _outstanding.Count && TsnLess( _outstanding[index].Tsn, start ) )
+					index++;
+
+				for( ; index < _outstanding.Count && !TsnLess( end, _outstanding[index].Tsn ); index++ ) {
+					OutboundChunk chunk = _outstanding[index];
+
+					if( chunk.Acked || chunk.Transmissions == 0 )
+						continue;
+
+					chunk.Acked = true;
+					newlyGapAcked = true;
+					highestNewlyAcked = chunk.Tsn;
+
+					if( chunk.InFlight ) {
+						chunk.InFlight = false;
+						_flightSize -= chunk.Length;
+					}
+
+					if( chunk.Retransmit ) {
+						chunk.Retransmit = false;
+						_retransmitPending--;
+					}
+				}
+			}
+
+			if( _inFastRecovery && !TsnLess( cumAck, _fastRecoveryExit ) )
+				_inFastRecovery = false;
+
+			if( newlyGapAcked )
+				CountMissIndications( highestNewlyAcked, now );
+
+			if( cumAdvanced && !_inFastRecovery )
+				GrowCongestionWindow( cumBytesAcked, flightBefore );
+
+			if( !_peerWindowKnown ) {
+				_peerWindowKnown = true;
+				_ssthresh = Math.Max( peerWindow, 4 * PathMtu );
+			}
+
+			_peerWindow = Math.Max( 0, peerWindow - _flightSize );
+
+			if( _flightSize == 0 && _retransmitPending == 0 && !ForwardTsnPending )
+				StopT3();
+			else if( cumAdvanced )
+				StartT3();
+
+			if( freedBytes != 0 )
+				Monitor.PulseAll( _lock );
+
+			Pump( now );
+		}
+
+		/// <summary>
+		/// Counts a miss for each chunk below the highest newly acknowledged TSN and fast retransmits the ones that have
+		/// been missed often enough.
+		/// </summary>
+		private void CountMissIndications( uint highestNewlyAcked, long now ) {
+			int mtu = PathMtu;
+
+			for( int i = 0; i < _outstanding.Count && TsnLess( _outstanding[i].Tsn, highestNewlyAcked ); i++ ) {
+				OutboundChunk chunk = _outstanding[i];
+
+				if( chunk.Acked || chunk.Abandoned || !chunk.InFlight || chunk.FastRetransmitted )
+					continue;
+
+				// RFC 2960 waits for a fourth report; RFC 4960 settled on three
+				if( ++chunk.MissCount < __fastRetransmitThreshold )
+					continue;
+
+				if( !_inFastRecovery ) {
+					_inFastRecovery = true;
+					_fastRecoveryExit = _nextTsn - 1;
+					_ssthresh = Math.Max( _cwnd / 2, 4 * mtu );
+					_cwnd = _ssthresh;
+					_partialBytesAcked = 0;
+				}
+
+				// Fast retransmit goes out regardless of the congestion window; the chunk stays in flight
+				chunk.FastRetransmitted = true;
+				chunk.Transmissions++;
+				chunk.SentAt = now;
+				_dataQueue.Enqueue( chunk );
+				Interlocked.Increment( ref _retransmitCount );
+				Interlocked.Increment( ref _fastRetransmitCount );
+				StartT3();
+			}
+		}
+
+		private void GrowCongestionWindow( int bytesAcked, int flightBefore ) {
+			int mtu = PathMtu;
+
+			// Only grow when the window was actually in use; the pump leaves less than a chunk of it unused
+			if( flightBefore + mtu <= _cwnd )
+				return;
+
+			if( _cwnd <= _ssthresh ) {
+				_cwnd += Math.Min( bytesAcked, mtu );
+				return;
+			}
+
+			_partialBytesAcked += bytesAcked;
+
+			if( _partialBytesAcked >= _cwnd ) {
+				_partialBytesAcked -= _cwnd;
+				_cwnd += mtu;
+			}
+		}
+
+		private void UpdateRetransmitTimeout( long rtt ) {
+			if( !_rttMeasured ) {
+				_rttMeasured = true;
+				_srtt = rtt;
+				_rttvar = rtt / 2;
+			}
+			else {
+				_rttvar = (3 * _rttvar + Math.Abs( _srtt - rtt )) / 4;
+				_srtt = (7 * _srtt + rtt) / 8;
+			}
+
+			_rto = Math.Min( Math.Max( _srtt + 4 * _rttvar, _minRto ), _maxRto );
+		}
+	#endregion
+
+	#region Retransmission timer
+		private void StartT3() {
+			_t3Running = true;
+			_t3Timer.Change( TimestampToMilliseconds( _rto ), Timeout.Infinite );
+		}
+
+		private void StopT3() {
+			_t3Running = false;
+			_t3Timer.Change( Timeout.Infinite, Timeout.Infinite );
+		}
+
+		private void T3Callback( object state ) {
+			lock( _lock ) {
+				if( _closed || !_t3Running )
+					return;
+
+				_t3Running = false;
+				Interlocked.Increment( ref _timeoutCount );
+
+				_ssthresh = Math.Max( _cwnd / 2, 4 * PathMtu );
+				_cwnd = PathMtu;
+				_partialBytesAcked = 0;
+				_inFastRecovery = false;
+				_rto = Math.Min( _rto * 2, _maxRto );
+
+				// Everything in flight is presumed lost and goes out again as the window allows
+				for( int i = 0; i < _outstanding.Count; i++ ) {
+					OutboundChunk chunk = _outstanding[i];
+
+					if( !chunk.InFlight )
+						continue;
+
+					chunk.InFlight = false;
+					chunk.MissCount = 0;
+					chunk.FastRetransmitted = false;
+					_flightSize -= chunk.Length;
+
+					if( !chunk.Abandoned && !chunk.Retransmit ) {
+						chunk.Retransmit = true;
+						_retransmitPending++;
+					}
+				}
+
+				if( ForwardTsnPending )
+					QueueForwardTsn();
+
+				Pump( Stopwatch.GetTimestamp() );
+			}
+
+			FlushTransmissions();
+		}
+	#endregion
+
+	#region Receiving
+		private void StartReceiving() {
+			for( ;; ) {
+				IAsyncResult result;
+
+				try {
+					result = _channel.BeginReceive( _receiveCallback, null );
+				}
+				catch( Exception ex ) {
+					_ts.TraceEvent( TraceEventType.Error, 0, "Failed to start a receive: {0}", ex );
+					QueueEnd();
+					return;
+				}
+
+				if( !result.CompletedSynchronously )
+					return;
+
+				if( !HandleReceive( result ) )
+					return;
+			}
+		}
+
+		private void ReceiveCallback( IAsyncResult result ) {
+			if( result.CompletedSynchronously )
+				return;
+
+			if( HandleReceive( result ) )
+				StartReceiving();
+		}
+
+		/// <summary>
+		/// Finishes a receive on the underlying channel and processes the packet.
+		/// </summary>
+		/// <returns>True if the association should keep receiving, false if the channel has ended.</returns>
+		private bool HandleReceive( IAsyncResult result ) {
+			IDataMessage message;
+
+			try {
+				if( !_channel.EndReceive( result, out message ) ) {
+					_ts.TraceEvent( TraceEventType.Stop, 0, "End of channel" );
+					QueueEnd();
+					return false;
+				}
+			}
+			catch( Exception ex ) {
+				if( !_closed )
+					_ts.TraceEvent( TraceEventType.Error, 0, "Failed to receive: {0}", ex );
+
+				QueueEnd();
+				return false;
+			}
+
+			// One copy per packet; delivered messages refer into it rather than copying their payloads again
+			IMessageBuffer buffer = message.MessageBuffer;
+
+			if( buffer.Length < SctpPacketWriter.CommonHeaderLength ) {
+				_ts.TraceEvent( TraceEventType.Warning, 0, "Dropped a packet too short for the common header" );
+				return true;
+			}
+
+			byte[] packet = new byte[buffer.Length];
+			buffer.CopyTo( packet, 0 );
+
+			SctpPacketReader reader = new SctpPacketReader( packet, 0, packet.Length );
+
+			if( !reader.IsChecksumValid ) {
+				Interlocked.Increment( ref _checksumErrorCount );
+				_ts.TraceEvent( TraceEventType.Warning, 0, "Dropped a packet with a bad checksum" );
+				return true;
+			}
+
+			lock( _lock ) {
+				if( _closed )
+					return false;
+
+				HandlePacket( ref reader );
+			}
+
+			// Deliveries were collected under the lock so they reach the queue in the order they were decided
+			for( int i = 0; i < _deliveries.Count; i++ )
+				_receiveQueue.Enqueue( _deliveries[i] );
+
+			_deliveries.Clear();
+			FlushTransmissions();
+			return true;
+		}
+
+		/// <summary>
+		/// Processes each chunk in a packet. Must be called with the lock held.
+		/// </summary>
+		private void HandlePacket( ref SctpPacketReader reader ) {
+			byte[] packet = reader.Buffer;
+			bool gotData = false, sackNow = false;
+
+			while( reader.MoveNext() ) {
+				int offset = reader.ChunkOffset, length = reader.ChunkLength;
+
+				switch( reader.ChunkType ) {
+					case SctpChunkType.Data:
+						gotData = true;
+						sackNow |= HandleData( packet, offset, length, reader.ChunkFlags );
+						break;
+
+					case SctpChunkType.SelectAck:
+						HandleSelectAck( packet, offset, length );
+						break;
+
+					case SctpChunkType.ForwardTsn:
+						HandleForwardTsn( packet, offset, length );
+						gotData = true;
+						sackNow = true;
+						break;
+
+					case SctpChunkType.Error:
+						// Nothing here recovers from an operation error, but it shouldn't stop the chunks after it
+						_ts.TraceEvent( TraceEventType.Warning, 0, "Peer reported an operation error (cause {0})",
+							(length >= 6) ? NetworkBitConverter.ToUInt16( packet, offset + 4 ) : 0 );
+						break;
+
+					default:
+						// The high bits of an unknown type say whether to skip it or give up on the packet
+						if( (reader.ChunkType & SctpChunkType.UnrecognizedSkip) == 0 ) {
+							_ts.TraceEvent( TraceEventType.Warning, 0, "Stopped at unrecognized chunk type {0}", packet[offset] );
+							reader.Stop();
+						}
+
+						break;
+				}
+			}
+
+			if( reader.IsMalformed )
+				_ts.TraceEvent( TraceEventType.Warning, 0, "Stopped at a chunk with a bad length" );
+
+			if( !gotData )
+				return;
+
+			_packetsSinceSack++;
+
+			if( sackNow || _gapTsns.Count != 0 || _packetsSinceSack >= 2 || _sackDelay == 0 )
+				QueueSelectAck();
+			else if( !_sackTimerRunning ) {
+				_sackTimerRunning = true;
+				_sackTimer.Change( TimestampToMilliseconds( _sackDelay ), Timeout.Infinite );
+			}
+		}
+
+		/// <summary>
+		/// Accepts a DATA chunk. Must be called with the lock held.
+		/// </summary>
+		/// <returns>True if the chunk should be acknowledged right away.</returns>
+		private bool HandleData( byte[] packet, int offset, int length, byte flags ) {
+			if( length < __dataHeaderLength )
+				return true;
+
+			uint tsn = NetworkBitConverter.ToUInt32( packet, offset + 4 );
+			int stream = NetworkBitConverter.ToUInt16( packet, offset + 8 );
+			ushort ssn = NetworkBitConverter.ToUInt16( packet, offset + 10 );
+			int protocol = NetworkBitConverter.ToInt32( packet, offset + 12 );
+			int payloadLength = length - __dataHeaderLength;
+
+			if( !TsnLess( _cumTsn, tsn ) || _gapTsns.BinarySearch( tsn, TsnComparer.Instance ) >= 0 ) {
+				if( _duplicateCount < _duplicates.Length )
+					_duplicates[_duplicateCount++] = tsn;
+
+				return true;
+			}
+
+			bool validStream = stream < _inboundStreams.Length;
+
+			// Drop data we have no room for, unless it's next in line; holding that back could stall every stream
+			if( validStream && tsn != _cumTsn + 1 && _receiveBuffered + payloadLength > _receiveBufferSize )
+				return true;
+
+			if( tsn == _cumTsn + 1 ) {
+				_cumTsn = tsn;
+				AdvanceCumulativeTsn();
+			}
+			else {
+				_gapTsns.Insert( ~_gapTsns.BinarySearch( tsn, TsnComparer.Instance ), tsn );
+			}
+
+			// Data for a stream that doesn't exist is acknowledged like any other, so the TSN sequence
+			// keeps moving, but the payload is discarded and the peer told why (RFC 2960 section 6.5)
+			if( !validStream ) {
+				_ts.TraceEvent( TraceEventType.Warning, 0, "Dropped data for stream {0}, which doesn't exist", stream );
+				QueueInvalidStreamError( stream );
+				return true;
+			}
+
+			bool unordered = (flags & __unorderedFlag) != 0;
+			SctpDataMessage message = new SctpDataMessage( stream,
+				new MessageBufferWrapper( packet, offset + __dataHeaderLength, payloadLength ),
+				unordered ? DeliveryOptions.Unordered : DeliveryOptions.None, protocol, tsn, ssn );
+
+			_receiveBuffered += payloadLength;
+
+			if( unordered ) {
+				_deliveries.Add( message );
+				return false;
+			}
+
+			InboundStream inbound = GetInboundStream( stream );
+
+			if( ssn == inbound.NextSsn ) {
+				_deliveries.Add( message );
+				inbound.NextSsn++;
+				DeliverHeld( inbound );
+			}
+			else if( SsnLess( inbound.NextSsn, ssn ) ) {
+				if( inbound.Held == null )
+					inbound.Held = new Dictionary<ushort, IDataMessage>();
+
+				inbound.Held[ssn] = message;
+			}
+			else {
+				// Behind the stream, which only happens if the sender abandoned it after all
+				_receiveBuffered -= payloadLength;
+			}
+
+			return false;
+		}
+
+		/// <summary>
+		/// Processes a FORWARD TSN chunk. Must be called with the lock held.
+		/// </summary>
+		private void HandleForwardTsn( byte[] packet, int offset, int length ) {
+			if( length < 8 )
+				return;
+
+			uint newCumTsn = NetworkBitConverter.ToUInt32( packet, offset + 4 );
+
+			if( TsnLess( _cumTsn, newCumTsn ) ) {
+				int drop = 0;
+
+				while( drop < _gapTsns.Count && !TsnLess( newCumTsn, _gapTsns[drop] ) )
+					drop++;
+
+				_gapTsns.RemoveRange( 0, drop );
+				_cumTsn = newCumTsn;
+				AdvanceCumulativeTsn();
+			}
+
+			for( int index = offset + 8; index + 4 <= offset + length; index += 4 ) {
+				int stream = NetworkBitConverter.ToUInt16( packet, index );
+				ushort ssn = NetworkBitConverter.ToUInt16( packet, index + 2 );
+
+				if( stream >= _inboundStreams.Length )
+					continue;
+
+				InboundStream inbound = GetInboundStream( stream );
+
+				if( SsnLess( ssn, inbound.NextSsn ) )
+					continue;
+
+				// Deliver whatever did arrive up to the skipped message, then move past it
+				while( inbound.NextSsn != (ushort)(ssn + 1) ) {
+					IDataMessage held;
+
+					if( inbound.Held != null && inbound.Held.TryGetValue( inbound.NextSsn, out held ) ) {
+						inbound.Held.Remove( inbound.NextSsn );
+						_deliveries.Add( held );
+					}
+
+					inbound.NextSsn++;
+				}
+
+				DeliverHeld( inbound );
+			}
+		}
+
+		private void AdvanceCumulativeTsn() {
+			int count = 0;
+
+			while( count < _gapTsns.Count && _gapTsns[count] == _cumTsn + 1 ) {
+				_cumTsn++;
+				count++;
+			}
+
+			_gapTsns.RemoveRange( 0, count );
+		}
+
+		private InboundStream GetInboundStream( int stream ) {
+			InboundStream inbound = _inboundStreams[stream];
+
+			if( inbound == null ) {
+				inbound = new InboundStream();
+				_inboundStreams[stream] = inbound;
+			}
+
+			return inbound;
+		}
+
+		private void DeliverHeld( InboundStream inbound ) {
+			if( inbound.Held == null )
+				return;
+
+			IDataMessage held;
+
+			while( inbound.Held.TryGetValue( inbound.NextSsn, out held ) ) {
+				inbound.Held.Remove( inbound.NextSsn );
+				_deliveries.Add( held );
+				inbound.NextSsn++;
+			}
+		}
+
+		/// <summary>
+		/// Queues an ERROR chunk telling the peer it sent data on a stream that doesn't exist. Must be called with the lock held.
+		/// </summary>
+		/// <param name="stream">Stream identifier from the rejected DATA chunk.</param>
+		private void QueueInvalidStreamError( int stream ) {
+			// Chunk header, then a single Invalid Stream Identifier cause: code, length, stream, reserved
+			byte[] packet = new byte[12];
+			packet[0] = (byte) SctpChunkType.Error;
+			NetworkBitConverter.Copy( (ushort) packet.Length, packet, 2 );
+			NetworkBitConverter.Copy( __invalidStreamCause, packet, 4 );
+			NetworkBitConverter.Copy( (ushort) 8, packet, 6 );
+			NetworkBitConverter.Copy( (ushort) stream, packet, 8 );
+			_controlQueue.Enqueue( packet );
+		}
+
+		/// <summary>
+		/// Queues a SACK describing what has been received. Must be called with the lock held.
+		/// </summary>
+		private void QueueSelectAck() {
+			int mtu = PathMtu;
+			int maxGapBlocks = Math.Max( 0, (mtu - SctpPacketWriter.CommonHeaderLength - __selectAckHeaderLength - _duplicateCount * 4) / 4 );
+
+			if( _gapBlocks == null || _gapBlocks.Length < maxGapBlocks * 2 )
+				_gapBlocks = new ushort[maxGapBlocks * 2];
+
+			// Runs of consecutive TSNs above the cumulative TSN become gap ack blocks
+			int gapBlockCount = 0;
+
+			for( int i = 0; i < _gapTsns.Count && gapBlockCount < maxGapBlocks; ) {
+				uint start = _gapTsns[i] - _cumTsn;
+
+				if( start > ushort.MaxValue )
+					break;
+
+				int j = i + 1;
+
+				while( j < _gapTsns.Count && _gapTsns[j] == _gapTsns[j - 1] + 1 && _gapTsns[j] - _cumTsn <= ushort.MaxValue )
+					j++;
+
+				_gapBlocks[gapBlockCount * 2] = (ushort) start;
+				_gapBlocks[gapBlockCount * 2 + 1] = (ushort)(_gapTsns[j - 1] - _cumTsn);
+				gapBlockCount++;
+				i = j;
+			}
+
+			int window = Math.Max( 0, _receiveBufferSize - _receiveBuffered );
+			_windowUpdateNeeded = window < mtu;
+
+			SctpSelectAckMessage sack = new SctpSelectAckMessage( _cumTsn, window, _gapBlocks, gapBlockCount, _duplicates, _duplicateCount );
+			byte[] packet = new byte[sack.ChunkLength];
+			sack.CopyChunk( packet, 0 );
+			_controlQueue.Enqueue( packet );
+
+			_duplicateCount = 0;
+			_packetsSinceSack = 0;
+
+			if( _sackTimerRunning ) {
+				_sackTimerRunning = false;
+				_sackTimer.Change( Timeout.Infinite, Timeout.Infinite );
+			}
+		}
+
+		private void SackTimerCallback( object state ) {
+			lock( _lock ) {
+				if( _closed || !_sackTimerRunning )
+					return;
+
+				_sackTimerRunning = false;
+
+				if( _packetsSinceSack != 0 )
+					QueueSelectAck();
+			}
+
+			FlushTransmissions();
+		}
+
+		private void QueueEnd() {
+			lock( _lock ) {
+				if( _endQueued )
+					return;
+
+				_endQueued = true;
+			}
+
+			_receiveQueue.Enqueue( null );
+		}
+	#endregion
+
+	#region Sequence numbers
+		/// <summary>
+		/// Compares TSNs using serial number arithmetic, so the comparison holds across wraparound.
+		/// </summary>
+		sealed class TsnComparer : IComparer<uint> {
+			public static readonly TsnComparer Instance = new TsnComparer();
+
+			public int Compare( uint x, uint y ) {
+				return (int)(x - y);
+			}
+		}
+
+		private static bool TsnLess( uint a, uint b ) {
+			return (int)(a - b) < 0;
+		}
+
+		private static bool SsnLess( ushort a, ushort b ) {
+			return (short)(a - b) < 0;
+		}
+
+		private static long TimeSpanToTimestamp( TimeSpan value ) {
+			return (long)(value.TotalSeconds * (double) Stopwatch.Frequency);
+		}
+
+		private static TimeSpan TimestampToTimeSpan( long value ) {
+			return TimeSpan.FromTicks( LatencyHistogram.TimestampToMicroseconds( value ) * 10L );
+		}
+
+		private static int TimestampToMilliseconds( long value ) {
+			return (int) Math.Min( Math.Max( value * 1000L / Stopwatch.Frequency, 1L ), int.MaxValue );
+		}
+	#endregion
+	}
+}
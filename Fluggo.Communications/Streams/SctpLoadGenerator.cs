@@ -0,0 +1,557 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Diagnostics;
+using System.Text;
+using System.Threading;
+
+namespace Fluggo.Communications {
+	/// <summary>
+	/// Sends messages through a pair of <see cref="SctpAssociation">SctpAssociations</see> connected by a lossy
+	/// <see cref="LoopbackTransport"/> and checks that they arrive intact and in order.
+	/// </summary>
+	/// <remarks>Each message carries its sequence number and the <see cref="Stopwatch"/> timestamp at which it was sent.
+	///     Messages go round-robin over <see cref="StreamCount"/> streams, and the receiving end checks that no message
+	///     arrives twice and that ordered messages arrive in order within their stream.
+	///   <para>Set <see cref="LoopbackTransport.LossRate"/> and <see cref="LoopbackTransport.ReorderRate"/> on
+	///     <see cref="Transport"/> to exercise retransmission. With no <see cref="Lifetime"/>, every message should arrive;
+	///     with one, the run measures how many messages partial reliability gives up on.</para></remarks>
+	public sealed class SctpLoadGenerator {
+		const int __headerLength = 12;
+
+		LoopbackTransport _transport = new LoopbackTransport();
+		int _messageCount = 10000, _messageLength = 1024, _streamCount = 4;
+		double _unorderedRatio;
+		TimeSpan _lifetime = TimeSpan.Zero, _retransmitTimeout = TimeSpan.FromMilliseconds( 100.0 ),
+			_drainTimeout = TimeSpan.FromSeconds( 30.0 );
+		int _seed;
+
+	#region Settings
+		/// <summary>
+		/// Gets or sets the transport that connects the two ends.
+		/// </summary>
+		/// <value>The <see cref="LoopbackTransport"/> used to create the channels for each run. The default is a transport
+		///   with no latency, bandwidth limit, loss or reordering.</value>
+		/// <exception cref='ArgumentNullException'>The value is <see langword='null'/>.</exception>
+		public LoopbackTransport Transport {
+			get { return _transport; }
+			set {
+				if( value == null )
+					throw new ArgumentNullException( "value" );
+
+				_transport = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the number of messages to send.
+		/// </summary>
+		/// <value>The number of messages sent in a run. The default is 10000.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than one.</exception>
+		public int MessageCount {
+			get { return _messageCount; }
+			set {
+				if( value < 1 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_messageCount = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the length of each message.
+		/// </summary>
+		/// <value>The number of bytes in each message. The default is 1024.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than 12, which is the space needed for the
+		///   sequence number and timestamp.</exception>
+		/// <remarks>The length must also fit in the <see cref="SctpAssociation.MaximumPayloadLength"/> of the association.</remarks>
+		public int MessageLength {
+			get { return _messageLength; }
+			set {
+				if( value < __headerLength )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_messageLength = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the number of streams the messages are spread over.
+		/// </summary>
+		/// <value>The number of streams. The default is four.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than one or greater than 65536.</exception>
+		public int StreamCount {
+			get { return _streamCount; }
+			set {
+				if( value < 1 || value > ushort.MaxValue + 1 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_streamCount = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the fraction of messages sent unordered.
+		/// </summary>
+		/// <value>A probability from zero to one. The default is zero.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than zero or greater than one.</exception>
+		public double UnorderedRatio {
+			get { return _unorderedRatio; }
+			set {
+				if( value < 0.0 || value > 1.0 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_unorderedRatio = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the lifetime of each message.
+		/// </summary>
+		/// <value>The time after which the sender abandons a message that hasn't been acknowledged, or
+		///   <see cref="TimeSpan.Zero"/> for fully reliable delivery. The default is zero.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is negative.</exception>
+		public TimeSpan Lifetime {
+			get { return _lifetime; }
+			set {
+				if( value < TimeSpan.Zero )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_lifetime = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the initial and minimum retransmission timeout of the associations.
+		/// </summary>
+		/// <value>The retransmission timeout used before the round trip has been measured, and the least it can fall to
+		///   afterwards. The default is 100 milliseconds.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is not positive.</exception>
+		/// <remarks>The one-second minimum RFC 2960 asks for would make every timeout on a loopback link dominate the run.</remarks>
+		public TimeSpan RetransmitTimeout {
+			get { return _retransmitTimeout; }
+			set {
+				if( value <= TimeSpan.Zero )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_retransmitTimeout = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets how long to wait for messages to arrive after the last one is sent.
+		/// </summary>
+		/// <value>The longest time to wait for outstanding messages before the run ends. The default is thirty seconds.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is negative.</exception>
+		public TimeSpan DrainTimeout {
+			get { return _drainTimeout; }
+			set {
+				if( value < TimeSpan.Zero )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_drainTimeout = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the seed used to choose which messages are sent unordered.
+		/// </summary>
+		/// <value>The seed for the sending thread. The default is zero.</value>
+		public int Seed {
+			get { return _seed; }
+			set { _seed = value; }
+		}
+	#endregion
+
+	#region Run
+		/// <summary>
+		/// Holds what the receiving end has seen during a run.
+		/// </summary>
+		sealed class ReceiveState {
+			public SctpAssociation Association;
+			public AsyncCallback Callback;
+			public bool[] Seen;
+			public int[] LastOrdered;
+			public long Received, Duplicates, OutOfOrder, Corrupt, ReceivedBytes;
+			public LatencyHistogram Latency = new LatencyHistogram();
+			public ManualResetEvent Done = new ManualResetEvent( false );
+		}
+
+		/// <summary>
+		/// Runs the load test.
+		/// </summary>
+		/// <returns>An <see cref="SctpLoadResult"/> describing the run.</returns>
+		/// <remarks>A new pair of channels is created for each run and closed when the run ends. The run ends when every
+		///   message has arrived, or <see cref="DrainTimeout"/> after the last message was sent.</remarks>
+		public SctpLoadResult Run() {
+			Channel<IDataMessage> clientChannel, serverChannel;
+			_transport.CreateChannels( out clientChannel, out serverChannel );
+
+			SctpAssociation client = CreateAssociation( clientChannel );
+			SctpAssociation server = CreateAssociation( serverChannel );
+
+			try {
+				ReceiveState state = new ReceiveState();
+				state.Association = server;
+				state.Callback = ReceiveCallback;
+				state.Seen = new bool[_messageCount];
+				state.LastOrdered = new int[_streamCount];
+
+				for( int i = 0; i < state.LastOrdered.Length; i++ )
+					state.LastOrdered[i] = -1;
+
+				StartReceiving( state );
+
+				Random random = new Random( _seed );
+				byte[] payload = new byte[_messageLength];
+				random.NextBytes( payload );
+
+				int lifetime = (_lifetime == TimeSpan.Zero) ? -1 : (int) Math.Min( _lifetime.TotalMilliseconds, int.MaxValue );
+				long start = Stopwatch.GetTimestamp();
+
+				for( int i = 0; i < _messageCount; i++ ) {
+					bool unordered = _unorderedRatio != 0.0 && random.NextDouble() < _unorderedRatio;
+
+					NetworkBitConverter.Copy( unordered ? ~i : i, payload, 0 );
+					NetworkBitConverter.Copy( Stopwatch.GetTimestamp(), payload, 4 );
+
+					client.Send( new LoadMessage( i % _streamCount, payload,
+						unordered ? DeliveryOptions.Unordered : DeliveryOptions.None, lifetime ) );
+				}
+
+				state.Done.WaitOne( (int) Math.Min( _drainTimeout.TotalMilliseconds, int.MaxValue ), false );
+
+				TimeSpan elapsed = TimeSpan.FromTicks( LatencyHistogram.TimestampToMicroseconds( Stopwatch.GetTimestamp() - start ) * 10L );
+
+				lock( state ) {
+					return new SctpLoadResult( elapsed, _messageCount, state.Received, state.Duplicates, state.OutOfOrder,
+						state.Corrupt, state.ReceivedBytes, client.RetransmitCount, client.FastRetransmitCount,
+						client.TimeoutCount, client.AbandonedCount, client.PacketsSent, client.ChunksSent, state.Latency.CreateSnapshot() );
+				}
+			}
+			finally {
+				client.Close();
+				server.Close();
+			}
+		}
+
+		private SctpAssociation CreateAssociation( Channel<IDataMessage> channel ) {
+			SctpAssociation association = new SctpAssociation( channel, _streamCount );
+			association.InitialRetransmitTimeout = _retransmitTimeout;
+			association.MinimumRetransmitTimeout = _retransmitTimeout;
+			return association;
+		}
+
+		private static void StartReceiving( ReceiveState state ) {
+			for( ;; ) {
+				IAsyncResult result = state.Association.BeginReceive( state.Callback, state );
+
+				if( !result.CompletedSynchronously )
+					return;
+
+				if( !HandleReceive( result ) )
+					return;
+			}
+		}
+
+		private static void ReceiveCallback( IAsyncResult result ) {
+			if( result.CompletedSynchronously )
+				return;
+
+			if( HandleReceive( result ) )
+				StartReceiving( (ReceiveState) result.AsyncState );
+		}
+
+		private static bool HandleReceive( IAsyncResult result ) {
+			ReceiveState state = (ReceiveState) result.AsyncState;
+			IDataMessage message;
+
+			try {
+				if( !state.Association.EndReceive( result, out message ) )
+					return false;
+			}
+			catch( Exception ex ) {
+				_ts.TraceEvent( TraceEventType.Error, 0, "Receive failed: {0}", ex );
+				return false;
+			}
+
+			IMessageBuffer buffer = message.MessageBuffer;
+			byte[] header = new byte[__headerLength];
+
+			lock( state ) {
+				if( buffer.Length < __headerLength ) {
+					state.Corrupt++;
+					return true;
+				}
+
+				buffer.CopyTo( 0, header, 0, __headerLength );
+
+				int sequence = NetworkBitConverter.ToInt32( header, 0 );
+				bool unordered = sequence < 0;
+
+				if( unordered )
+					sequence = ~sequence;
+
+				if( sequence >= state.Seen.Length ) {
+					state.Corrupt++;
+					return true;
+				}
+
+				if( state.Seen[sequence] ) {
+					state.Duplicates++;
+					return true;
+				}
+
+				state.Seen[sequence] = true;
+				state.Received++;
+				state.ReceivedBytes += buffer.Length;
+				state.Latency.RecordSince( NetworkBitConverter.ToInt64( header, 4 ) );
+
+				if( !unordered ) {
+					int stream = message.Channel;
+
+					if( sequence < state.LastOrdered[stream] )
+						state.OutOfOrder++;
+					else
+						state.LastOrdered[stream] = sequence;
+				}
+
+				if( state.Received == state.Seen.Length )
+					state.Done.Set();
+			}
+
+			return true;
+		}
+
+		/// <summary>
+		/// A message with a lifetime and delivery options, which <see cref="SimpleDataMessage"/> can't carry.
+		/// </summary>
+		sealed class LoadMessage : IDataMessage {
+			int _channel, _lifetime;
+			IMessageBuffer _buffer;
+			DeliveryOptions _options;
+			object _tag;
+
+			public LoadMessage( int channel, byte[] payload, DeliveryOptions options, int lifetime ) {
+				_channel = channel;
+				_buffer = new MessageBufferWrapper( payload );
+				_options = options;
+				_lifetime = lifetime;
+			}
+
+			public IMessageBuffer MessageBuffer {
+				get { return _buffer; }
+			}
+
+			public int Protocol {
+				get { return -1; }
+			}
+
+			public int MillisecondsLifetime {
+				get { return _lifetime; }
+			}
+
+			public DeliveryOptions Options {
+				get { return _options; }
+			}
+
+			public object Tag {
+				get { return _tag; }
+				set { _tag = value; }
+			}
+
+			public int Channel {
+				get { return _channel; }
+			}
+		}
+
+		static TraceSource _ts = new TraceSource( "SctpLoadGenerator", SourceLevels.Error );
+	#endregion
+	}
+
+	/// <summary>
+	/// Describes one run of an <see cref="SctpLoadGenerator"/>.
+	/// </summary>
+	public sealed class SctpLoadResult {
+		TimeSpan _elapsed;
+		long _sent, _received, _duplicates, _outOfOrder, _corrupt, _receivedBytes;
+		long _retransmits, _fastRetransmits, _timeouts, _abandoned, _packets, _chunks;
+		LatencyHistogram _latency;
+
+		internal SctpLoadResult( TimeSpan elapsed, long sent, long received, long duplicates, long outOfOrder, long corrupt,
+				long receivedBytes, long retransmits, long fastRetransmits, long timeouts, long abandoned, long packets, long chunks,
+				LatencyHistogram latency ) {
+			_elapsed = elapsed;
+			_sent = sent;
+			_received = received;
+			_duplicates = duplicates;
+			_outOfOrder = outOfOrder;
+			_corrupt = corrupt;
+			_receivedBytes = receivedBytes;
+			_retransmits = retransmits;
+			_fastRetransmits = fastRetransmits;
+			_timeouts = timeouts;
+			_abandoned = abandoned;
+			_packets = packets;
+			_chunks = chunks;
+			_latency = latency;
+		}
+
+		/// <summary>
+		/// Gets the length of the run.
+		/// </summary>
+		/// <value>The time from the first message sent to the last message received, or to the end of the drain timeout.</value>
+		public TimeSpan Elapsed {
+			get { return _elapsed; }
+		}
+
+		/// <summary>
+		/// Gets the number of messages sent.
+		/// </summary>
+		/// <value>The number of messages handed to the sending association.</value>
+		public long MessagesSent {
+			get { return _sent; }
+		}
+
+		/// <summary>
+		/// Gets the number of distinct messages received.
+		/// </summary>
+		/// <value>The number of messages that arrived, not counting duplicates.</value>
+		public long MessagesReceived {
+			get { return _received; }
+		}
+
+		/// <summary>
+		/// Gets the number of messages delivered more than once.
+		/// </summary>
+		/// <value>The number of duplicate deliveries, which should be zero.</value>
+		public long Duplicates {
+			get { return _duplicates; }
+		}
+
+		/// <summary>
+		/// Gets the number of ordered messages delivered out of order within their stream.
+		/// </summary>
+		/// <value>The number of ordering violations, which should be zero.</value>
+		public long OutOfOrder {
+			get { return _outOfOrder; }
+		}
+
+		/// <summary>
+		/// Gets the number of messages that arrived damaged.
+		/// </summary>
+		/// <value>The number of messages too short or with an impossible sequence number, which should be zero.</value>
+		public long Corrupt {
+			get { return _corrupt; }
+		}
+
+		/// <summary>
+		/// Gets the number of DATA chunks the sender retransmitted.
+		/// </summary>
+		/// <value>The number of retransmissions of any kind.</value>
+		public long Retransmits {
+			get { return _retransmits; }
+		}
+
+		/// <summary>
+		/// Gets the number of DATA chunks the sender fast retransmitted.
+		/// </summary>
+		/// <value>The number of retransmissions made because the receiver reported a chunk missing.</value>
+		public long FastRetransmits {
+			get { return _fastRetransmits; }
+		}
+
+		/// <summary>
+		/// Gets the number of times the sender's retransmission timer expired.
+		/// </summary>
+		/// <value>The number of retransmission timeouts.</value>
+		public long Timeouts {
+			get { return _timeouts; }
+		}
+
+		/// <summary>
+		/// Gets the number of messages the sender abandoned.
+		/// </summary>
+		/// <value>The number of messages whose lifetime expired before they were acknowledged.</value>
+		public long Abandoned {
+			get { return _abandoned; }
+		}
+
+		/// <summary>
+		/// Gets the number of packets the sender sent.
+		/// </summary>
+		/// <value>The number of packets the sending association put on the channel.</value>
+		public long PacketsSent {
+			get { return _packets; }
+		}
+
+		/// <summary>
+		/// Gets the number of chunks the sender sent.
+		/// </summary>
+		/// <value>The number of chunks of any type the sending association bundled into its packets.</value>
+		public long ChunksSent {
+			get { return _chunks; }
+		}
+
+		/// <summary>
+		/// Gets the rate at which messages arrived.
+		/// </summary>
+		/// <value>The number of distinct messages received per second.</value>
+		public double MessagesPerSecond {
+			get { return (double) _received / Math.Max( _elapsed.TotalSeconds, 1e-9 ); }
+		}
+
+		/// <summary>
+		/// Gets the rate at which payload bytes arrived.
+		/// </summary>
+		/// <value>The number of payload bytes received per second.</value>
+		public double BytesPerSecond {
+			get { return (double) _receivedBytes / Math.Max( _elapsed.TotalSeconds, 1e-9 ); }
+		}
+
+		/// <summary>
+		/// Gets the delivery times of the messages.
+		/// </summary>
+		/// <value>A <see cref="LatencyHistogram"/> of the time from sending each message to its arrival at the far end.</value>
+		public LatencyHistogram Latency {
+			get { return _latency; }
+		}
+
+		/// <summary>
+		/// Summarizes the run.
+		/// </summary>
+		/// <returns>A few lines giving the delivery counts, throughput and latency percentiles of the run.</returns>
+		public override string ToString() {
+			StringBuilder builder = new StringBuilder();
+
+			builder.AppendFormat( "{0} of {1} messages received, {2} duplicate, {3} out of order, {4} corrupt in {5:0.000} s\r\n",
+				_received, _sent, _duplicates, _outOfOrder, _corrupt, _elapsed.TotalSeconds );
+			builder.AppendFormat( "{0} retransmits ({1} fast), {2} timeouts, {3} abandoned\r\n",
+				_retransmits, _fastRetransmits, _timeouts, _abandoned );
+			builder.AppendFormat( "{0} chunks in {1} packets ({2:0.00} per packet)\r\n",
+				_chunks, _packets, (double) _chunks / Math.Max( _packets, 1L ) );
+			builder.AppendFormat( "{0:0.0} messages/s, {1:0.0} KB/s\r\n", MessagesPerSecond, BytesPerSecond / 1024.0 );
+			builder.AppendFormat( "delivery us: p50 {0} p99 {1} p99.9 {2} max {3} mean {4:0.0}",
+				_latency.P50, _latency.P99, _latency.P999, _latency.Max, _latency.Mean );
+
+			return builder.ToString();
+		}
+	}
+}
@@ -51,22 +51,25 @@ namespace Fluggo.Communications {
 		/*
 		 * How this side works
 		 * 
-		 * Here, we have one outstanding Receive request at a time. When the last bit of data has been read
-		 * from the current read buffer, the _readBuffer is set to null. On the next read request, a new receive
-		 * request is made, and the receive callback handles putting data into ReadAsyncResults correctly. If
-		 * the callback runs out of data and there are more queue requests waiting, it queues another request.
+		 * Receives are kept outstanding in _pendingReceives, up to _readAhead of them, and are ended strictly in order.
+		 * Each read request copies what's left of the current read buffer, then keeps pulling in completed receives
+		 * until the caller's buffer is full. It only waits on a receive if it hasn't copied anything yet; otherwise it
+		 * returns what it has. When the zero-length message arrives, no more receives are made.
 		 */
 
 		ProcessingQueue<ReadAsyncResult> _readQueue;
 		volatile bool _readClosed, _disposed;
 		IMessageBuffer _readBuffer = null;
 		int _readCount = 0;
-		IAsyncResult _lastRead = null;
+		Queue<IAsyncResult> _pendingReceives = new Queue<IAsyncResult>();
+		int _readAhead = 1;
+		Exception _readException;
 
 		class ReadAsyncResult : BaseAsyncResult
 		{
 			byte[] _buffer;
 			int _offset, _count;
+			int _filled;
 			int _readCount = -1;
 			bool willCompleteSync = true;
 
@@ -93,23 +96,45 @@ namespace Fluggo.Communications {
 			}
 
 			/// <summary>
-			/// Writes as much of <paramref name="count"/> as is possible into the read buffer.
+			/// Gets the number of bytes copied into the read buffer so far.
 			/// </summary>
-			/// <param name="sourceBuffer"></param>
-			/// <param name="offset"></param>
-			/// <param name="count"></param>
-			public void Write( IMessageBuffer sourceBuffer, int offset, int count ) {
+			public int Filled {
+				get { return _filled; }
+			}
+
+			/// <summary>
+			/// Gets the room left in the read buffer.
+			/// </summary>
+			public int Remaining {
+				get { return _count - _filled; }
+			}
+
+			/// <summary>
+			/// Copies as much of the given range as will fit into the read buffer.
+			/// </summary>
+			/// <param name="sourceBuffer">Buffer to copy from.</param>
+			/// <param name="offset">Offset in <paramref name="sourceBuffer"/> at which to start copying.</param>
+			/// <param name="count">Number of bytes available to copy.</param>
+			/// <returns>The number of bytes copied.</returns>
+			public int Append( IMessageBuffer sourceBuffer, int offset, int count ) {
 				if( count < 0 || _readCount != -1 )
 					throw new InvalidOperationException();
 
-				if( count != 0 ) {
-					_readCount = Math.Min( count, _count );
-					sourceBuffer.CopyTo( offset, _buffer, _offset, _readCount );
-				}
-				else {
-					_readCount = 0;
+				int length = Math.Min( count, _count - _filled );
+
+				if( length != 0 ) {
+					sourceBuffer.CopyTo( offset, _buffer, _offset + _filled, length );
+					_filled += length;
 				}
 
+				return length;
+			}
+
+			/// <summary>
+			/// Completes the read with whatever has been copied.
+			/// </summary>
+			public void Finish() {
+				_readCount = _filled;
 				Complete( willCompleteSync );
 			}
 
@@ -119,66 +144,100 @@ namespace Fluggo.Communications {
 			}
 		}
 
+		/// <summary>
+		/// Gets or sets the number of receives to keep outstanding on the channel.
+		/// </summary>
+		/// <value>The number of messages to receive ahead of the reader. The default is one.</value>
+		/// <remarks>With more than one receive outstanding, a large read can be filled from several messages without
+		///     waiting on the channel between them.
+		///   <para>Only set this above one if nothing else will receive from the channel after the stream ends. Receives
+		///     still outstanding when the zero-length message arrives will take messages meant for whoever uses the channel
+		///     next, which is exactly how <see cref="UnidirectionalStreamPool"/> reuses its channels.</para></remarks>
+		public int ReadAhead {
+			get {
+				return _readAhead;
+			}
+			set {
+				if( value < 1 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_readAhead = value;
+			}
+		}
+
 		private WaitHandle HandleReadRequest( ReadAsyncResult result, bool async ) {
-			for( int i = 0; i < 2; i++ ) {
-				if( _lastRead != null ) {
-					try {
-						IMessageBuffer message = _channel.EndReceive( _lastRead );
-						
-						if( message != null && message.Length != 0 ) {
-							_readBuffer = message;
-							_readCount = 0;
-						}
-						else {
-							// Complete with closure
-							result.Write( null, 0, 0 );
-							_readClosed = true;
-							return null;
-						}
-					}
-					catch( Exception ex ) {
-						result.CompleteError( ex );
-						return null;
+			if( async )
+				result.GoAsync();
+
+			for( ;; ) {
+				// Take what's left of the current message
+				if( _readBuffer != null ) {
+					_readCount += result.Append( _readBuffer, _readCount, _readBuffer.Length - _readCount );
+
+					if( _readCount == _readBuffer.Length )
+						_readBuffer = null;
+				}
+
+				if( result.Remaining == 0 || _readClosed ) {
+					result.Finish();
+					return null;
+				}
+
+				if( _readException != null ) {
+					if( result.Filled != 0 ) {
+						result.Finish();
 					}
-					finally {
-						_lastRead = null;
+					else {
+						result.CompleteError( _readException );
+						_readException = null;
 					}
+
+					return null;
 				}
 
-				if( async )
-					result.GoAsync();
+				try {
+					while( _pendingReceives.Count < _readAhead )
+						_pendingReceives.Enqueue( _channel.BeginReceive( null, null ) );
+				}
+				catch( Exception ex ) {
+					if( result.Filled != 0 )
+						result.Finish();
+					else
+						result.CompleteError( ex );
 
-				if( _readClosed ) {
-					result.Write( null, 0, 0 );
 					return null;
 				}
 
-				// Try to satisfy it with what's here
-				if( _readBuffer != null ) {
-					result.Write( _readBuffer, _readCount, _readBuffer.Length - _readCount );
-					_readCount += result.ReadCount;
+				IAsyncResult receive = _pendingReceives.Peek();
 
-					if( _readCount == _readBuffer.Length )
-						_readBuffer = null;
+				if( !receive.IsCompleted ) {
+					// Don't hold up a read that already has data
+					if( result.Filled != 0 ) {
+						result.Finish();
+						return null;
+					}
 
-					return null;
+					return receive.AsyncWaitHandle;
 				}
 
-				if( _lastRead == null ) {
-					try {
-						_lastRead = _channel.BeginReceive( null, null );
+				_pendingReceives.Dequeue();
 
-						if( !_lastRead.IsCompleted )
-							return _lastRead.AsyncWaitHandle;
+				try {
+					IMessageBuffer message = _channel.EndReceive( receive );
+
+					if( message != null && message.Length != 0 ) {
+						_readBuffer = message;
+						_readCount = 0;
 					}
-					catch( Exception ex ) {
-						result.CompleteError( ex );
-						return null;
+					else {
+						// Complete with closure
+						_readClosed = true;
 					}
 				}
+				catch( Exception ex ) {
+					_readException = ex;
+				}
 			}
-
-			throw new UnexpectedException();
 		}
 
 		/// <include file='Common.xml' path='/root/Stream/method[@name="BeginRead"]/*'/>
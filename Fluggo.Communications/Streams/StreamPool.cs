@@ -22,18 +22,61 @@ using System.Collections.Generic;
 using System.Text;
 using System.Threading;
 using System.IO;
+using System.Diagnostics;
 
 namespace Fluggo.Communications
 {
 	/// <summary>
 	/// Represents a pool of streams that communicate in one direction across a <see cref="ChannelMultiplexer"/>.
 	/// </summary>
+	/// <remarks>Write streams are built when they're handed out, on the lowest free channel, and their channel goes back
+	///     to the pool when the stream is closed. If every channel is in use, <see cref="GetStream"/> waits for one to be
+	///     closed; <see cref="WaitLatency"/> records how long each request waited.
+	///   <para>A pool created with an initial count is elastic. It uses its first channel to agree with the far end on
+	///     how many stream channels each side may use. The limit starts at the far end's initial count, doubles
+	///     whenever every channel is busy and a stream is requested, and halves once no more than a quarter of the
+	///     channels are in use, never dropping below the initial count or rising above the count given to the
+	///     constructor. The receiving side only watches the channels it has granted, so channels in a quiet pool cost
+	///     nothing on either end. Both ends must create their pools the same way.</para></remarks>
 	public sealed class UnidirectionalStreamPool : IDisposable {
+		static TraceSource _ts = new TraceSource( "UnidirectionalStreamPool", SourceLevels.Error );
+
+		enum InboundState {
+			Idle,
+			Monitored,
+			Reading
+		}
+
+		enum ControlMessageType : byte {
+			/// <summary>
+			/// The sender asks to use the given number of channels, and promises not to use any beyond it.
+			/// </summary>
+			Request = 1,
+
+			/// <summary>
+			/// The receiver is watching the given number of channels in answer to the request with the same serial number.
+			/// </summary>
+			Grant = 2
+		}
+
+		const int __controlMessageLength = 9;
+
 		ChannelMultiplexer _transport;
+		Channel _control;
+		int _baseIndex, _count, _minimumCount;
+		object _lock = new object();
+		bool _disposed;
 		EventHandler _firstMessageCallback;
-		int _baseIndex, _count;
 		EventHandler _readStreamBoundaryCallback, _writeStreamBoundaryCallback;
+		AsyncCallback _controlCallback;
+		byte[] _controlBuffer = new byte[__controlMessageLength];
 		
+		/// <summary>
+		/// Creates a new instance of the <see cref='UnidirectionalStreamPool'/> class with a fixed number of channels.
+		/// </summary>
+		/// <param name="transport"><see cref="ChannelMultiplexer"/> to carry the streams.</param>
+		/// <param name="baseIndex">Index of the first channel to use.</param>
+		/// <param name="count">Number of channels to use, starting at <paramref name="baseIndex"/>.</param>
 		public UnidirectionalStreamPool( ChannelMultiplexer transport, int baseIndex, int count ) {
 			if( transport == null )
 				throw new ArgumentNullException( "transport" );
@@ -47,6 +90,63 @@ namespace Fluggo.Communications
 			if( baseIndex + count > transport.ChannelCount )
 				throw new ArgumentException( "There are not enough queues in the transport to support the requested number of streams." );
 				
+			Initialize( transport, baseIndex, count );
+
+			_minimumCount = count;
+			_outboundLimit = count;
+			_inboundLimit = count;
+
+			for( int i = 0; i < _count; i++ ) {
+				_inboundStates[i] = InboundState.Monitored;
+				WatchChannel( i );
+			}
+		}
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='UnidirectionalStreamPool'/> class that grows and shrinks with demand.
+		/// </summary>
+		/// <param name="transport"><see cref="ChannelMultiplexer"/> to carry the streams.</param>
+		/// <param name="baseIndex">Index of the first channel to use. This channel carries the pool's control messages.</param>
+		/// <param name="count">Number of channels to use, starting at <paramref name="baseIndex"/>. At most one less than
+		///   this many streams can be open in each direction.</param>
+		/// <param name="initialCount">Number of stream channels to offer the far end at first, and the fewest the pool
+		///   will shrink to.</param>
+		public UnidirectionalStreamPool( ChannelMultiplexer transport, int baseIndex, int count, int initialCount ) {
+			if( transport == null )
+				throw new ArgumentNullException( "transport" );
+
+			if( baseIndex < 0 || baseIndex >= transport.ChannelCount )
+				throw new ArgumentOutOfRangeException( "baseIndex" );
+
+			if( count < 2 )
+				throw new ArgumentOutOfRangeException( "count" );
+
+			if( baseIndex + count > transport.ChannelCount )
+				throw new ArgumentException( "There are not enough queues in the transport to support the requested number of streams." );
+
+			if( initialCount < 0 || initialCount > count - 1 )
+				throw new ArgumentOutOfRangeException( "initialCount" );
+
+			Initialize( transport, baseIndex + 1, count - 1 );
+
+			_control = transport.GetChannel( baseIndex );
+			_controlCallback = HandleControlReceive;
+			_minimumCount = initialCount;
+
+			// The far end tells us how many channels we may use; until it does, we have none
+			_outboundLimit = 0;
+			_inboundLimit = initialCount;
+
+			for( int i = 0; i < initialCount; i++ ) {
+				_inboundStates[i] = InboundState.Monitored;
+				WatchChannel( i );
+			}
+
+			StartControlReceive();
+			SendControl( EncodeControl( ControlMessageType.Grant, 0, initialCount ) );
+		}
+
+		private void Initialize( ChannelMultiplexer transport, int baseIndex, int count ) {
 			_transport = transport;
 			_baseIndex = baseIndex;
 			_count = count;
@@ -54,31 +154,53 @@ namespace Fluggo.Communications
 			_firstMessageCallback = FirstMessageCallback;
 			_readStreamBoundaryCallback = LastReadCompleted;
 			_writeStreamBoundaryCallback = LastWriteCompleted;
-			
-			for( int i = _baseIndex; i < _baseIndex + _count; i++ ) {
-				HoldbackTransport readHoldback = new HoldbackTransport( transport.GetChannel( i ), i, _firstMessageCallback );
-				readHoldback.ReadClosed += _readStreamBoundaryCallback;
-				
-				HoldbackTransport writeHoldback = new HoldbackTransport( transport.GetChannel( i ), i, null );
-				writeHoldback.WriteClosed += _writeStreamBoundaryCallback;
-				
-				_writeOnlyQueue.Enqueue( new WriteStreamOverChannel( writeHoldback ) );
-			}
+
+			_inboundStates = new InboundState[count];
+			_outboundInUse = new bool[count];
+		}
+
+		/// <summary>
+		/// Gets the largest number of streams the pool can have open in each direction.
+		/// </summary>
+		/// <value>The number of stream channels in the pool.</value>
+		public int MaximumCount {
+			get { return _count; }
 		}
 
 	#region Receiving read-only streams
 		AsynchronousQueue<ReadStreamOverChannel> _readOnlyQueue = new AsynchronousQueue<ReadStreamOverChannel>();
+		InboundState[] _inboundStates;
+		int _inboundLimit, _lastRequestSerial;
 		
 		void FirstMessageCallback( object sender, EventArgs e ) {
-			_readOnlyQueue.Enqueue( new ReadStreamOverChannel( (HoldbackTransport) sender ) );
+			HoldbackTransport transport = (HoldbackTransport) sender;
+
+			lock( _lock ) {
+				_inboundStates[transport.SubStream - _baseIndex] = InboundState.Reading;
+			}
+
+			_readOnlyQueue.Enqueue( new ReadStreamOverChannel( transport ) );
 		}
 		
 		void LastReadCompleted( object sender, EventArgs e ) {
-			// Stream boundary was read on one of our read-only streams; take over and start monitoring it again
-			HoldbackTransport transport = (HoldbackTransport) sender;
-			int i = transport.SubStream;
-			
-			HoldbackTransport readHoldback = new HoldbackTransport( _transport.GetChannel( i ), i, _firstMessageCallback );
+			// Stream boundary was read on one of our read-only streams; take over and start monitoring it again,
+			// unless the far end has given the channel up
+			int index = ((HoldbackTransport) sender).SubStream - _baseIndex;
+
+			lock( _lock ) {
+				if( index >= _inboundLimit ) {
+					_inboundStates[index] = InboundState.Idle;
+					return;
+				}
+
+				_inboundStates[index] = InboundState.Monitored;
+			}
+
+			WatchChannel( index );
+		}
+
+		private void WatchChannel( int index ) {
+			HoldbackTransport readHoldback = new HoldbackTransport( _transport.GetChannel( _baseIndex + index ), _baseIndex + index, _firstMessageCallback );
 			readHoldback.ReadClosed += _readStreamBoundaryCallback;
 		}
 
@@ -102,23 +224,95 @@ namespace Fluggo.Communications
 	#endregion
 		
 	#region Getting write-only streams
-		AsynchronousQueue<WriteStreamOverChannel> _writeOnlyQueue = new AsynchronousQueue<WriteStreamOverChannel>();
+		sealed class GetStreamResult : BaseAsyncResult {
+			long _startTimestamp = Stopwatch.GetTimestamp();
+			Stream _stream;
+
+			public GetStreamResult( AsyncCallback callback, object state ) : base( callback, state ) {
+			}
+
+			public long StartTimestamp {
+				get { return _startTimestamp; }
+			}
+
+			public void Complete( Stream stream, bool sync ) {
+				_stream = stream;
+				Complete( sync );
+			}
+
+			public new Stream End() {
+				base.End();
+				return _stream;
+			}
+		}
+
+		Queue<GetStreamResult> _waiters = new Queue<GetStreamResult>();
+		bool[] _outboundInUse;
+		int _outboundLimit, _outboundActive;
+		int _requestSerial, _requestedCount;
+		bool _requestPending, _peerLimitReached, _grantReceived;
+		LatencyHistogram _waitLatency = new LatencyHistogram();
+		long _waitCount;
 		
 		void LastWriteCompleted( object sender, EventArgs e ) {
-			// Stream boundary was read on one of our read-only streams; take over and start monitoring it again
-			HoldbackTransport transport = (HoldbackTransport) sender;
-			transport = new HoldbackTransport( _transport.GetChannel( transport.SubStream ), transport.SubStream, null );
-			transport.WriteClosed += _writeStreamBoundaryCallback;
-			
-			_writeOnlyQueue.Enqueue( new WriteStreamOverChannel( transport ) );
+			// The stream was closed; hand its channel to the next waiter, or put it back
+			int index = ((HoldbackTransport) sender).SubStream - _baseIndex;
+			GetStreamResult waiter = null;
+			byte[] request = null;
+
+			lock( _lock ) {
+				if( _waiters.Count != 0 && index < _outboundLimit ) {
+					waiter = _waiters.Dequeue();
+				}
+				else {
+					_outboundInUse[index] = false;
+					_outboundActive--;
+					request = TryShrink();
+				}
+			}
+
+			if( waiter != null )
+				CompleteWaiter( waiter, index, false );
+
+			SendControl( request );
 		}
 
 		public IAsyncResult BeginGetStream( AsyncCallback callback, object state ) {
-			return _writeOnlyQueue.BeginDequeue( callback, state );
+			GetStreamResult result = new GetStreamResult( callback, state );
+			int index;
+			byte[] request = null;
+
+			lock( _lock ) {
+				if( _disposed )
+					throw new ObjectDisposedException( null );
+
+				index = TakeChannel();
+
+				if( index == -1 ) {
+					_waiters.Enqueue( result );
+					Interlocked.Increment( ref _waitCount );
+					request = RequestGrowth();
+				}
+			}
+
+			if( index != -1 )
+				CompleteWaiter( result, index, true );
+			else
+				SendControl( request );
+
+			return result;
 		}
 
 		public Stream EndGetStream( IAsyncResult result ) {
-			return _writeOnlyQueue.EndDequeue( result );
+			if( result == null )
+				throw new ArgumentNullException( "result" );
+
+			GetStreamResult getResult = result as GetStreamResult;
+
+			if( getResult == null )
+				throw new ArgumentException( "The given asynchronous result did not originate from a BeginGetStream call on this object.", "result" );
+
+			return getResult.End();
 		}
 
 		/// <summary>
@@ -128,13 +322,293 @@ namespace Fluggo.Communications
 		/// <remarks>This method blocks until a new write-only stream is available. You can write data to the stream until you call
 		///   <see cref="Stream.Close"/>, at which point the underlying transport will be returned to the list of available transports.</remarks>
 		public Stream GetStream() {
-			return _writeOnlyQueue.Dequeue();
+			return EndGetStream( BeginGetStream( null, null ) );
+		}
+
+		private void CompleteWaiter( GetStreamResult waiter, int index, bool sync ) {
+			HoldbackTransport writeHoldback = new HoldbackTransport( _transport.GetChannel( _baseIndex + index ), _baseIndex + index, null );
+			writeHoldback.WriteClosed += _writeStreamBoundaryCallback;
+
+			_waitLatency.RecordSince( waiter.StartTimestamp );
+			waiter.Complete( new WriteStreamOverChannel( writeHoldback ), sync );
+		}
+
+		/// <summary>
+		/// Claims the lowest free channel under the current limit. Call this under the lock.
+		/// </summary>
+		/// <returns>The index of the channel, or -1 if all of them are in use.</returns>
+		private int TakeChannel() {
+			for( int i = 0; i < _outboundLimit; i++ ) {
+				if( !_outboundInUse[i] ) {
+					_outboundInUse[i] = true;
+					_outboundActive++;
+					return i;
+				}
+			}
+
+			return -1;
+		}
+
+		/// <summary>
+		/// Gets the number of write streams currently open.
+		/// </summary>
+		/// <value>The number of outbound channels in use.</value>
+		public int ActiveCount {
+			get { return _outboundActive; }
+		}
+
+		/// <summary>
+		/// Gets the number of channels the pool may currently use for write streams.
+		/// </summary>
+		/// <value>The current limit on outbound channels. For a pool with a fixed number of channels, this is
+		///   <see cref="MaximumCount"/>.</value>
+		public int ChannelLimit {
+			get { return _outboundLimit; }
+		}
+
+		/// <summary>
+		/// Gets the distribution of times spent waiting for a write stream.
+		/// </summary>
+		/// <value>A <see cref="LatencyHistogram"/> with one entry for each stream handed out by <see cref="GetStream"/> or
+		///   <see cref="BeginGetStream"/>, including the ones that didn't have to wait.</value>
+		public LatencyHistogram WaitLatency {
+			get { return _waitLatency; }
+		}
+
+		/// <summary>
+		/// Gets the number of requests for a write stream that had to wait for one.
+		/// </summary>
+		/// <value>The number of requests that found every channel in use.</value>
+		public long WaitCount {
+			get { return Interlocked.Read( ref _waitCount ); }
+		}
+	#endregion
+
+	#region Control channel
+		/// <summary>
+		/// Asks the far end for more channels if every channel we have is in use. Call this under the lock.
+		/// </summary>
+		/// <returns>The request to send, or <see langword='null'/> if no request is needed.</returns>
+		private byte[] RequestGrowth() {
+			if( _control == null || !_grantReceived || _requestPending || _peerLimitReached || _outboundLimit >= _count )
+				return null;
+
+			_requestSerial++;
+			_requestPending = true;
+			_requestedCount = Math.Min( _count, Math.Max( 1, _outboundLimit * 2 ) );
+
+			return EncodeControl( ControlMessageType.Request, _requestSerial, _requestedCount );
+		}
+
+		/// <summary>
+		/// Gives back the upper half of the channels if no more than a quarter of them are in use. Call this under the lock.
+		/// </summary>
+		/// <returns>The request to send, or <see langword='null'/> if the pool shouldn't shrink.</returns>
+		private byte[] TryShrink() {
+			if( _control == null || _requestPending || _waiters.Count != 0 || _outboundLimit <= _minimumCount )
+				return null;
+
+			if( _outboundActive > _outboundLimit / 4 )
+				return null;
+
+			int newLimit = Math.Max( _minimumCount, _outboundLimit / 2 );
+
+			for( int i = newLimit; i < _outboundLimit; i++ ) {
+				if( _outboundInUse[i] )
+					return null;
+			}
+
+			// We stop using the channels right now; the far end can stop watching them when it sees the request
+			_outboundLimit = newLimit;
+			_peerLimitReached = false;
+			_requestSerial++;
+
+			return EncodeControl( ControlMessageType.Request, _requestSerial, newLimit );
+		}
+
+		private void HandleRequest( int serial, int count ) {
+			int granted;
+			List<int> monitor = null;
+
+			lock( _lock ) {
+				// Requests can pass each other on the way; only the newest counts
+				if( serial - _lastRequestSerial <= 0 )
+					return;
+
+				_lastRequestSerial = serial;
+				granted = Math.Max( 0, Math.Min( count, _count ) );
+				_inboundLimit = granted;
+
+				// Channels past the limit that are still being watched stay that way, since a receive
+				// can't be taken back, and channels still being read go idle when their streams end
+				for( int i = 0; i < granted; i++ ) {
+					if( _inboundStates[i] == InboundState.Idle ) {
+						_inboundStates[i] = InboundState.Monitored;
+
+						if( monitor == null )
+							monitor = new List<int>();
+
+						monitor.Add( i );
+					}
+				}
+			}
+
+			if( monitor != null ) {
+				foreach( int index in monitor )
+					WatchChannel( index );
+			}
+
+			SendControl( EncodeControl( ControlMessageType.Grant, serial, granted ) );
+		}
+
+		private void HandleGrant( int serial, int count ) {
+			List<GetStreamResult> waiters = null;
+			List<int> indexes = null;
+			byte[] request = null;
+
+			lock( _lock ) {
+				if( serial != _requestSerial || _disposed )
+					return;
+
+				if( _requestPending && count < _requestedCount )
+					_peerLimitReached = true;
+
+				_requestPending = false;
+				_grantReceived = true;
+				_outboundLimit = Math.Max( 0, Math.Min( count, _count ) );
+
+				while( _waiters.Count != 0 ) {
+					int index = TakeChannel();
+
+					if( index == -1 )
+						break;
+
+					if( waiters == null ) {
+						waiters = new List<GetStreamResult>();
+						indexes = new List<int>();
+					}
+
+					waiters.Add( _waiters.Dequeue() );
+					indexes.Add( index );
+				}
+
+				if( _waiters.Count != 0 )
+					request = RequestGrowth();
+			}
+
+			if( waiters != null ) {
+				for( int i = 0; i < waiters.Count; i++ )
+					CompleteWaiter( waiters[i], indexes[i], false );
+			}
+
+			SendControl( request );
+		}
+
+		private static byte[] EncodeControl( ControlMessageType type, int serial, int count ) {
+			byte[] message = new byte[__controlMessageLength];
+
+			message[0] = (byte) type;
+			NetworkBitConverter.Copy( serial, message, 1 );
+			NetworkBitConverter.Copy( count, message, 5 );
+
+			return message;
+		}
+
+		private void SendControl( byte[] message ) {
+			if( message == null )
+				return;
+
+			try {
+				_control.Send( message, 0, message.Length );
+			}
+			catch( Exception ex ) {
+				_ts.TraceEvent( TraceEventType.Error, 0, "Exception \"{0}\" occured while sending a pool control message", ex.Message );
+			}
+		}
+
+		private void StartControlReceive() {
+			for( ;; ) {
+				IAsyncResult result;
+
+				try {
+					result = _control.BeginReceive( _controlCallback, null );
+				}
+				catch( Exception ex ) {
+					_ts.TraceEvent( TraceEventType.Error, 0, "Exception \"{0}\" occured while receiving a pool control message", ex.Message );
+					return;
+				}
+
+				if( !result.CompletedSynchronously || !HandleControl( result ) )
+					return;
+			}
+		}
+
+		private void HandleControlReceive( IAsyncResult result ) {
+			if( result.CompletedSynchronously )
+				return;
+
+			if( HandleControl( result ) )
+				StartControlReceive();
+		}
+
+		/// <summary>
+		/// Processes a received control message.
+		/// </summary>
+		/// <returns>True if the pool should keep receiving control messages, false if the channel has closed.</returns>
+		private bool HandleControl( IAsyncResult result ) {
+			IMessageBuffer message;
+
+			try {
+				message = _control.EndReceive( result );
+			}
+			catch( Exception ex ) {
+				_ts.TraceEvent( TraceEventType.Error, 0, "Exception \"{0}\" occured while receiving a pool control message", ex.Message );
+				return false;
+			}
+
+			if( message == null || message.Length == 0 || _disposed )
+				return false;
+
+			if( message.Length != __controlMessageLength ) {
+				_ts.TraceEvent( TraceEventType.Error, 0, "Ignored a pool control message of length {0}", message.Length );
+				return true;
+			}
+
+			message.CopyTo( _controlBuffer, 0 );
+			int serial = NetworkBitConverter.ToInt32( _controlBuffer, 1 );
+			int count = NetworkBitConverter.ToInt32( _controlBuffer, 5 );
+
+			switch( (ControlMessageType) _controlBuffer[0] ) {
+				case ControlMessageType.Request:
+					HandleRequest( serial, count );
+					break;
+
+				case ControlMessageType.Grant:
+					HandleGrant( serial, count );
+					break;
+
+				default:
+					_ts.TraceEvent( TraceEventType.Error, 0, "Ignored a pool control message of type {0}", _controlBuffer[0] );
+					break;
+			}
+
+			return true;
 		}
 	#endregion
 
 		public void Dispose() {
+			GetStreamResult[] waiters;
+
+			lock( _lock ) {
+				_disposed = true;
+				waiters = _waiters.ToArray();
+				_waiters.Clear();
+			}
+
+			foreach( GetStreamResult waiter in waiters )
+				waiter.CompleteError( new ObjectDisposedException( null ) );
+
 			_readOnlyQueue.Dispose();
-			_writeOnlyQueue.Dispose();
 		}
 	}
 
@@ -8,9 +8,13 @@ namespace Fluggo.Communications {
 	/// </summary>
 	/// <remarks>The stream created by this class emulates the root stream specified in its constructor. When a class
 	///     reads from or writes to the tap, it is read from or written to the root and optionally copied to another stream.
-	///     Seek operations are not duplicated on the target streams, though.</remarks>
+	///     Seek operations are not duplicated on the target streams, though.
+	///   <para>A tap created with <see cref="TapSink"/> objects hands each copy to the sink and goes on without waiting,
+	///     so a slow capture target can't slow down the root stream; the sink drops data instead when it falls behind.
+	///     The same sink can take both directions.</para></remarks>
 	public sealed class Tap : Stream {
 		Stream _root, _writeTap, _readTap;
+		TapSink _readSink, _writeSink;
 
 		/// <summary>
 		/// Creates a new instance of the <see cref='Tap'/> class.
@@ -36,6 +40,49 @@ namespace Fluggo.Communications {
 			_writeTap = writeTap;
 		}
 
+		/// <summary>
+		/// Creates a new instance of the <see cref='Tap'/> class that copies data through background sinks.
+		/// </summary>
+		/// <param name="root">A reference to the stream to tap.</param>
+		/// <param name="readSink">Optional sink to receive data read from the root stream.</param>
+		/// <param name="writeSink">Optional sink to receive data written to the root stream. This can be the same sink
+		///   as <paramref name="readSink"/>.</param>
+		/// <exception cref="ArgumentNullException"><paramref name="root"/> is <see langword='null'/>.</exception>
+		public Tap( Stream root, TapSink readSink, TapSink writeSink ) {
+			if( root == null )
+				throw new ArgumentNullException( "root" );
+
+			_root = root;
+			_readSink = readSink;
+			_writeSink = writeSink;
+		}
+
+		private bool IsTappingReads {
+			get { return _readSink != null || (_readTap != null && _readTap.CanWrite); }
+		}
+
+		private void MirrorRead( byte[] buffer, int offset, int count ) {
+			if( _readSink != null ) {
+				_readSink.Post( TapRecordType.Read, buffer, offset, count );
+			}
+			else if( _readTap != null && _readTap.CanWrite ) {
+				_readTap.BeginWrite( buffer, offset, count, delegate( IAsyncResult ar ) {
+					_readTap.EndWrite( ar );
+				}, null );
+			}
+		}
+
+		private void MirrorWrite( byte[] buffer, int offset, int count ) {
+			if( _writeSink != null ) {
+				_writeSink.Post( TapRecordType.Write, buffer, offset, count );
+			}
+			else if( _writeTap != null && _writeTap.CanWrite ) {
+				_writeTap.BeginWrite( buffer, offset, count, delegate( IAsyncResult result ) {
+					_writeTap.EndWrite( result );
+				}, null );
+			}
+		}
+
 		public override bool CanRead {
 			get { return _root.CanRead; }
 		}
@@ -73,13 +120,7 @@ namespace Fluggo.Communications {
 
 		public override int Read( byte[] buffer, int offset, int count ) {
 			int result = _root.Read( buffer, offset, count );
-			
-			if( _readTap != null && _readTap.CanWrite ) {
-				_readTap.BeginWrite( buffer, offset, result, delegate( IAsyncResult ar ) {
-					_readTap.EndWrite( ar );
-				}, null );
-			}
-			
+			MirrorRead( buffer, offset, result );
 			return result;
 		}
 
@@ -99,14 +140,10 @@ namespace Fluggo.Communications {
 				}
 				catch( Exception ex ) {
 					Ex = ex;
-					return;
 				}
 				
-				if( Owner._readTap.CanWrite ) {
-					Owner._readTap.BeginWrite( Buffer, Offset, Count, delegate( IAsyncResult ar ) {
-						Owner._readTap.EndWrite( ar );
-					}, null );
-				}
+				if( Ex == null )
+					Owner.MirrorRead( Buffer, Offset, Count );
 				
 				if( Callback != null )
 					Callback( this );
@@ -130,7 +167,7 @@ namespace Fluggo.Communications {
 		}
 		
 		public override IAsyncResult BeginRead( byte[] buffer, int offset, int count, AsyncCallback callback, object state ) {
-			if( _readTap != null && _readTap.CanWrite ) {
+			if( IsTappingReads ) {
 				ReadOp op = new ReadOp();
 				op.Buffer = buffer;
 				op.Offset = offset;
@@ -150,6 +187,9 @@ namespace Fluggo.Communications {
 			ReadOp op = asyncResult as ReadOp;
 			
 			if( op != null ) {
+				if( op.Ex != null )
+					throw op.Ex;
+
 				return op.Count;
 			}
 			
@@ -165,22 +205,12 @@ namespace Fluggo.Communications {
 		}
 
 		public override void Write( byte[] buffer, int offset, int count ) {
-			if( _writeTap != null && _writeTap.CanWrite ) {
-				_writeTap.BeginWrite( buffer, offset, count, delegate( IAsyncResult result ) {
-					_writeTap.EndWrite( result );
-				}, null );
-			}
-			
+			MirrorWrite( buffer, offset, count );
 			_root.Write( buffer, offset, count );
 		}
 
 		public override IAsyncResult BeginWrite( byte[] buffer, int offset, int count, AsyncCallback callback, object state ) {
-			if( _writeTap != null && _writeTap.CanWrite ) {
-				_writeTap.BeginWrite( buffer, offset, count, delegate( IAsyncResult result ) {
-					_writeTap.EndWrite( result );
-				}, null );
-			}
-
+			MirrorWrite( buffer, offset, count );
 			return _root.BeginWrite( buffer, offset, count, callback, state );
 		}
 
@@ -0,0 +1,161 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.IO;
+
+namespace Fluggo.Communications {
+	/// <summary>
+	/// Reads the records of a capture written by a <see cref="TapSink"/>.
+	/// </summary>
+	public sealed class TapCaptureReader : IDisposable {
+		Stream _stream;
+		byte[] _header = new byte[TapSink.RecordHeaderLength];
+		TapRecordType _type;
+		DateTime _time;
+		int _length;
+		byte[] _data;
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='TapCaptureReader'/> class.
+		/// </summary>
+		/// <param name="stream">Stream positioned at the start of the capture.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='stream'/> is <see langword='null'/>.</exception>
+		/// <exception cref='IOException'>The stream does not begin with a capture header, or the capture is a later
+		///   version than this reader understands.</exception>
+		public TapCaptureReader( Stream stream ) {
+			if( stream == null )
+				throw new ArgumentNullException( "stream" );
+
+			_stream = stream;
+
+			byte[] header = new byte[8];
+
+			if( !ReadFully( header, header.Length ) || header[0] != 'F' || header[1] != 'T' || header[2] != 'A' || header[3] != 'P' )
+				throw new IOException( "The stream is not a tap capture." );
+
+			if( header[4] != 1 )
+				throw new IOException( "The tap capture is version " + header[4].ToString() + ", which is not supported." );
+		}
+
+		/// <summary>
+		/// Moves to the next record.
+		/// </summary>
+		/// <returns>True if a record was read, or false at the end of the capture.</returns>
+		/// <exception cref='EndOfStreamException'>The capture ends in the middle of a record.</exception>
+		/// <exception cref='IOException'>The record is malformed.</exception>
+		public bool ReadRecord() {
+			int read = _stream.Read( _header, 0, _header.Length );
+
+			if( read == 0 )
+				return false;
+
+			if( read < _header.Length && !ReadFully( _header, read, _header.Length - read ) )
+				throw new EndOfStreamException( "The capture ends in the middle of a record header." );
+
+			_type = (TapRecordType) _header[0];
+			_time = new DateTime( NetworkBitConverter.ToInt64( _header, 1 ), DateTimeKind.Utc );
+			_length = NetworkBitConverter.ToInt32( _header, 9 );
+
+			if( _length < 0 )
+				throw new IOException( "The capture record has a negative length." );
+
+			switch( _type ) {
+				case TapRecordType.Read:
+				case TapRecordType.Write:
+					if( _data == null || _data.Length < _length )
+						_data = new byte[Math.Max( _length, _data == null ? 0 : _data.Length * 2 )];
+
+					if( !ReadFully( _data, _length ) )
+						throw new EndOfStreamException( "The capture ends in the middle of a record." );
+
+					break;
+
+				case TapRecordType.Dropped:
+					break;
+
+				default:
+					throw new IOException( "The capture record type " + _header[0].ToString() + " is not recognized." );
+			}
+
+			return true;
+		}
+
+		/// <summary>
+		/// Gets the type of the current record.
+		/// </summary>
+		/// <value>The direction of the current record's data, or <see cref="TapRecordType.Dropped"/> if data was lost here.</value>
+		public TapRecordType RecordType {
+			get { return _type; }
+		}
+
+		/// <summary>
+		/// Gets the time of the current record.
+		/// </summary>
+		/// <value>The UTC time the data was posted to the sink.</value>
+		public DateTime Time {
+			get { return _time; }
+		}
+
+		/// <summary>
+		/// Gets the length of the current record.
+		/// </summary>
+		/// <value>The length of the record's data, or for a <see cref="TapRecordType.Dropped"/> record, the number of
+		///   bytes lost.</value>
+		public int Length {
+			get { return _length; }
+		}
+
+		/// <summary>
+		/// Copies the current record's data.
+		/// </summary>
+		/// <param name="buffer">Array to receive the data.</param>
+		/// <param name="index">Index in <paramref name="buffer"/> at which to start copying.</param>
+		/// <exception cref='InvalidOperationException'>The current record has no data.</exception>
+		/// <remarks>There must be room in <paramref name="buffer"/> for <see cref="Length"/> bytes.</remarks>
+		public void CopyData( byte[] buffer, int index ) {
+			if( _type != TapRecordType.Read && _type != TapRecordType.Write )
+				throw new InvalidOperationException( "The current record has no data." );
+
+			Buffer.BlockCopy( _data, 0, buffer, index, _length );
+		}
+
+		public void Dispose() {
+			_stream.Close();
+		}
+
+		private bool ReadFully( byte[] buffer, int count ) {
+			return ReadFully( buffer, 0, count );
+		}
+
+		private bool ReadFully( byte[] buffer, int offset, int count ) {
+			while( count != 0 ) {
+				int read = _stream.Read( buffer, offset, count );
+
+				if( read == 0 )
+					return false;
+
+				offset += read;
+				count -= read;
+			}
+
+			return true;
+		}
+	}
+}
@@ -0,0 +1,43 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+
+namespace Fluggo.Communications {
+	/// <summary>
+	/// Identifies a record in a tap capture.
+	/// </summary>
+	public enum TapRecordType : byte {
+		/// <summary>
+		/// Data read from the tapped stream.
+		/// </summary>
+		Read = 1,
+
+		/// <summary>
+		/// Data written to the tapped stream.
+		/// </summary>
+		Write = 2,
+
+		/// <summary>
+		/// Data was dropped because the sink fell behind. The record's length is the number of bytes lost, and it carries
+		/// no data.
+		/// </summary>
+		Dropped = 3,
+	}
+}
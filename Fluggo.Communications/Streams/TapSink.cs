@@ -0,0 +1,389 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Threading;
+
+namespace Fluggo.Communications {
+	/// <summary>
+	/// Writes tapped data to a stream in the background, dropping data rather than slowing down the tapped stream.
+	/// </summary>
+	/// <remarks><see cref="Post"/> copies the data into a fixed-size ring buffer and returns right away; a thread pool
+	///     thread writes the buffer out to the target stream. If the target can't keep up and the buffer fills, new data
+	///     is dropped and counted in <see cref="DroppedCount"/> and <see cref="DroppedBytes"/>.
+	///   <para>In capture mode, the target gets a header followed by one record for each post, with the time, the direction,
+	///     and the data, so the session can be replayed later with <see cref="TapCaptureReader"/>. Data that was dropped
+	///     shows up as a <see cref="TapRecordType.Dropped"/> record. Otherwise, the target gets only the raw data.</para>
+	///   <para>If writing to the target fails, the sink stops writing and drops everything posted after that. The
+	///     exception is available from <see cref="Error"/>.</para></remarks>
+	public sealed class TapSink : IDisposable {
+		static TraceSource _ts = new TraceSource( "TapSink", SourceLevels.Error );
+
+		/// <summary>
+		/// The bytes that begin a capture: "FTAP", then the format version and three reserved bytes.
+		/// </summary>
+		static readonly byte[] __captureHeader = new byte[] { (byte) 'F', (byte) 'T', (byte) 'A', (byte) 'P', 1, 0, 0, 0 };
+
+		/// <summary>
+		/// Length of the header on each capture record: the type, the time in UTC ticks, and the data length.
+		/// </summary>
+		internal const int RecordHeaderLength = 13;
+
+		/// <summary>
+		/// A post whose data is in the ring, by where it ends in the sequence of bytes copied into the ring.
+		/// </summary>
+		struct QueuedPost {
+			public long End;
+			public int Length;
+
+			public QueuedPost( long end, int length ) {
+				End = end;
+				Length = length;
+			}
+		}
+
+		Stream _target;
+		bool _capture, _closed, _writeQueued;
+		object _lock = new object();
+		byte[] _ring, _recordHeader = new byte[RecordHeaderLength];
+		int _head, _count;
+		long _copiedBytes;
+		Queue<QueuedPost> _queuedPosts = new Queue<QueuedPost>();
+		WaitCallback _writeCallback;
+		Exception _error;
+
+		long _startTicks, _startTimestamp;
+		long _postedCount, _postedBytes, _droppedCount, _droppedBytes, _writtenBytes, _unreportedDrop;
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='TapSink'/> class.
+		/// </summary>
+		/// <param name="target">Stream to write the tapped data to.</param>
+		/// <param name="bufferLength">Size of the buffer, in bytes, that holds data waiting to be written. Data that doesn't
+		///   fit is dropped.</param>
+		/// <param name="capture">True to write timestamped capture records, false to write only the data.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='target'/> is <see langword='null'/>.</exception>
+		/// <exception cref='ArgumentException'><paramref name='target'/> does not support writing.</exception>
+		/// <exception cref='ArgumentOutOfRangeException'><paramref name='bufferLength'/> is too small to hold a capture
+		///   record.</exception>
+		public TapSink( Stream target, int bufferLength, bool capture ) {
+			if( target == null )
+				throw new ArgumentNullException( "target" );
+
+			if( !target.CanWrite )
+				throw new ArgumentException( "The specified target stream does not support writing.", "target" );
+
+			if( bufferLength <= __captureHeader.Length + RecordHeaderLength )
+				throw new ArgumentOutOfRangeException( "bufferLength" );
+
+			_target = target;
+			_capture = capture;
+			_ring = new byte[bufferLength];
+			_writeCallback = HandleWrite;
+
+			// Record times come from the high-resolution timer, anchored to the wall clock once
+			_startTicks = DateTime.UtcNow.Ticks;
+			_startTimestamp = Stopwatch.GetTimestamp();
+
+			if( _capture ) {
+				lock( _lock ) {
+					CopyIn( __captureHeader, 0, __captureHeader.Length );
+					QueueWrite();
+				}
+			}
+		}
+
+		/// <summary>
+		/// Queues a copy of tapped data to be written.
+		/// </summary>
+		/// <param name="type">Direction of the data; either <see cref="TapRecordType.Read"/> or <see cref="TapRecordType.Write"/>.</param>
+		/// <param name="buffer">Array containing the data.</param>
+		/// <param name="offset">Offset in <paramref name="buffer"/> at which the data begins.</param>
+		/// <param name="count">Length of the data.</param>
+		/// <returns>True if the data was queued, false if it was dropped.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='buffer'/> is <see langword='null'/>.</exception>
+		/// <exception cref='ArgumentException'><paramref name='offset'/> and <paramref name='count'/> do not specify a valid
+		///   range in <paramref name="buffer"/>.</exception>
+		/// <exception cref='ArgumentOutOfRangeException'><paramref name='type'/> is not a direction.</exception>
+		/// <remarks>This method never blocks on the target stream. The data is copied, so the caller can reuse the buffer
+		///   as soon as it returns. Data posted after the sink is closed is dropped.</remarks>
+		public bool Post( TapRecordType type, byte[] buffer, int offset, int count ) {
+			new ArraySegment<byte>( buffer, offset, count );
+
+			if( type != TapRecordType.Read && type != TapRecordType.Write )
+				throw new ArgumentOutOfRangeException( "type" );
+
+			if( count == 0 )
+				return true;
+
+			long ticks = _capture ? GetTicks() : 0;
+
+			lock( _lock ) {
+				_postedCount++;
+				_postedBytes += count;
+
+				int needed = count;
+
+				if( _capture ) {
+					needed += RecordHeaderLength;
+
+					if( _unreportedDrop != 0 )
+						needed += RecordHeaderLength;
+				}
+
+				if( _closed || _error != null || needed > _ring.Length - _count ) {
+					_droppedCount++;
+					_droppedBytes += count;
+					_unreportedDrop += count;
+					return false;
+				}
+
+				if( _capture ) {
+					if( _unreportedDrop != 0 ) {
+						CopyRecordHeader( TapRecordType.Dropped, ticks, (int) Math.Min( _unreportedDrop, int.MaxValue ) );
+						_unreportedDrop = 0;
+					}
+
+					CopyRecordHeader( type, ticks, count );
+				}
+
+				CopyIn( buffer, offset, count );
+				_queuedPosts.Enqueue( new QueuedPost( _copiedBytes, count ) );
+				QueueWrite();
+			}
+
+			return true;
+		}
+
+		/// <summary>
+		/// Queues a <see cref="TapRecordType.Dropped"/> record for data dropped since the last record, if there is room.
+		/// Call this under the lock.
+		/// </summary>
+		private void ReportDrops() {
+			if( !_capture || _unreportedDrop == 0 || _error != null || RecordHeaderLength > _ring.Length - _count )
+				return;
+
+			CopyRecordHeader( TapRecordType.Dropped, GetTicks(), (int) Math.Min( _unreportedDrop, int.MaxValue ) );
+			_unreportedDrop = 0;
+			QueueWrite();
+		}
+
+		private long GetTicks() {
+			long elapsed = Stopwatch.GetTimestamp() - _startTimestamp;
+			return _startTicks + (long)((double) elapsed * TimeSpan.TicksPerSecond / Stopwatch.Frequency);
+		}
+
+		private void CopyRecordHeader( TapRecordType type, long ticks, int length ) {
+			_recordHeader[0] = (byte) type;
+			NetworkBitConverter.Copy( ticks, _recordHeader, 1 );
+			NetworkBitConverter.Copy( length, _recordHeader, 9 );
+			CopyIn( _recordHeader, 0, RecordHeaderLength );
+		}
+
+		/// <summary>
+		/// Copies data into the free space of the ring. Call this under the lock, after making sure it fits.
+		/// </summary>
+		private void CopyIn( byte[] buffer, int offset, int count ) {
+			int tail = (_head + _count) % _ring.Length;
+			int first = Math.Min( count, _ring.Length - tail );
+
+			Buffer.BlockCopy( buffer, offset, _ring, tail, first );
+			Buffer.BlockCopy( buffer, offset + first, _ring, 0, count - first );
+			_count += count;
+			_copiedBytes += count;
+		}
+
+		private void QueueWrite() {
+			if( !_writeQueued ) {
+				_writeQueued = true;
+				ThreadPool.QueueUserWorkItem( _writeCallback );
+			}
+		}
+
+		private void HandleWrite( object state ) {
+			for( ;; ) {
+				int start, length;
+
+				lock( _lock ) {
+					if( _count == 0 || _error != null ) {
+						_writeQueued = false;
+						Monitor.PulseAll( _lock );
+						return;
+					}
+
+					// Write the longest run that doesn't wrap; Post only ever adds data after it
+					start = _head;
+					length = Math.Min( _count, _ring.Length - _head );
+				}
+
+				try {
+					_target.Write( _ring, start, length );
+				}
+				catch( Exception ex ) {
+					_ts.TraceEvent( TraceEventType.Error, 0, "Exception \"{0}\" occured while writing tapped data; the sink is stopping", ex.Message );
+
+					lock( _lock ) {
+						// Posts that didn't make it out whole are lost; count their data, not the capture headers
+						_error = ex;
+						_droppedCount += _queuedPosts.Count;
+
+						foreach( QueuedPost post in _queuedPosts )
+							_droppedBytes += post.Length;
+
+						_queuedPosts.Clear();
+						_head = 0;
+						_count = 0;
+					}
+
+					continue;
+				}
+
+				lock( _lock ) {
+					_head = (_head + length) % _ring.Length;
+					_count -= length;
+					_writtenBytes += length;
+
+					while( _queuedPosts.Count != 0 && _queuedPosts.Peek().End <= _writtenBytes )
+						_queuedPosts.Dequeue();
+				}
+			}
+		}
+
+		/// <summary>
+		/// Waits for all queued data to be written, then flushes the target stream.
+		/// </summary>
+		/// <remarks>In capture mode, data dropped since the last record is written out as a <see cref="TapRecordType.Dropped"/>
+		///     record first, so a capture that is flushed or closed accounts for every drop.
+		///   <para>This method blocks, so don't call it from the tapped stream's I/O path.</para></remarks>
+		public void Flush() {
+			lock( _lock ) {
+				for( ;; ) {
+					// If the ring is too full for the record now, it will have room once the writer is done
+					ReportDrops();
+
+					if( !_writeQueued )
+						break;
+
+					Monitor.Wait( _lock );
+				}
+
+				if( _error != null )
+					return;
+			}
+
+			_target.Flush();
+		}
+
+		/// <summary>
+		/// Writes out all queued data and closes the target stream.
+		/// </summary>
+		/// <remarks>Like <see cref="Flush"/>, this writes a final <see cref="TapRecordType.Dropped"/> record in capture mode
+		///   if any drops haven't been reported yet.</remarks>
+		public void Close() {
+			Dispose();
+		}
+
+		public void Dispose() {
+			lock( _lock ) {
+				if( _closed )
+					return;
+
+				_closed = true;
+			}
+
+			try {
+				Flush();
+			}
+			finally {
+				_target.Close();
+			}
+		}
+
+	#region Statistics
+		/// <summary>
+		/// Gets a value that indicates whether the sink writes capture records.
+		/// </summary>
+		/// <value>True if the target gets timestamped capture records, false if it gets only the data.</value>
+		public bool IsCapture {
+			get { return _capture; }
+		}
+
+		/// <summary>
+		/// Gets the number of posts made to the sink.
+		/// </summary>
+		/// <value>The number of calls to <see cref="Post"/> with data, whether the data was written or dropped.</value>
+		public long PostedCount {
+			get { lock( _lock ) { return _postedCount; } }
+		}
+
+		/// <summary>
+		/// Gets the number of bytes posted to the sink.
+		/// </summary>
+		/// <value>The total length of the data passed to <see cref="Post"/>, whether it was written or dropped.</value>
+		public long PostedBytes {
+			get { lock( _lock ) { return _postedBytes; } }
+		}
+
+		/// <summary>
+		/// Gets the number of posts that were dropped.
+		/// </summary>
+		/// <value>The number of calls to <see cref="Post"/> whose data didn't fit in the buffer, or was still waiting to be
+		///   written when writing to the target failed.</value>
+		public long DroppedCount {
+			get { lock( _lock ) { return _droppedCount; } }
+		}
+
+		/// <summary>
+		/// Gets the number of bytes that were dropped.
+		/// </summary>
+		/// <value>The number of bytes that were posted but will never reach the target. This counts only the posted data,
+		///   never capture headers. If writing fails partway through a post, all of that post's data is counted.</value>
+		public long DroppedBytes {
+			get { lock( _lock ) { return _droppedBytes; } }
+		}
+
+		/// <summary>
+		/// Gets the number of bytes written to the target.
+		/// </summary>
+		/// <value>The number of bytes written to the target stream, including capture headers.</value>
+		public long WrittenBytes {
+			get { lock( _lock ) { return _writtenBytes; } }
+		}
+
+		/// <summary>
+		/// Gets the number of bytes waiting to be written.
+		/// </summary>
+		/// <value>The number of bytes in the buffer.</value>
+		public int QueuedBytes {
+			get { lock( _lock ) { return _count; } }
+		}
+
+		/// <summary>
+		/// Gets the exception that stopped the sink.
+		/// </summary>
+		/// <value>The exception thrown by the target stream, or <see langword='null'/> if writing hasn't failed.</value>
+		public Exception Error {
+			get { lock( _lock ) { return _error; } }
+		}
+	#endregion
+	}
+}
@@ -56,6 +56,7 @@ namespace Fluggo.Xml {
 		void PushText( string text );
 		void PushCharRef( int codePoint );
 		void PushEntityRef( string name );
+		void PushCloseStartTag();
 		void PushCloseEmptyElement();
 		void PushEndElement();
 		void PushComment( string text );
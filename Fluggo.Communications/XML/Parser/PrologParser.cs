@@ -76,10 +76,10 @@ namespace Fluggo.Xml {
 							return ParseAction.Continue;
 						}
 						
-						// Only thing left now is an element, which means we should quit
+						// Only thing left now is an element, which means the prolog is over; XmlTokenizer
+						// reads the element itself, starting from this character
 						_mode = Mode.End;
-						_state.PushParser( new ElementParser( _state ), '<', value );
-						return ParseAction.Continue;
+						return ParseAction.End;
 						
 					case Mode.XmlDeclOrPI:
 						// We've seen "<?", so if the next three characters are "xml", it's an xml decl
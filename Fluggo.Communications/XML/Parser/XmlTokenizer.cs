@@ -0,0 +1,1231 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Collections.Generic;
+using System.Text;
+using System.Xml;
+
+namespace Fluggo.Xml {
+	/// <summary>
+	/// Parses an XML document a block of characters at a time.
+	/// </summary>
+	/// <remarks>The tokenizer raises the same <see cref="IXmlParseListener"/> events as the <see cref="Parser"/> chain, but
+	///     scans each block in tight loops instead of making a virtual call per character. Runs of text, attribute values and
+	///     names are found by looking each character up in a small class table, and are turned into strings straight from
+	///     the block they arrived in. Only a token that is split across two blocks is copied into a holding buffer.
+	///   <para>The prolog (XML declaration, doctype, comments and processing instructions before the root element) is rare and
+	///     short, so it is still handed to a <see cref="PrologParser"/> one character at a time. The tokenizer takes over at
+	///     the root element. Inside it, a CDATA section is reported through <see cref="IXmlParseListener.PushText"/> like
+	///     any other text, and a processing instruction is reported as a parse error.</para>
+	///   <para>Blocks can be pushed as they arrive, split at any character. Blocks of UTF-8 bytes can be pushed too, split at
+	///     any byte; they are decoded straight into a reusable character buffer, so no intermediate string is created.
+	///     Don't mix byte and character blocks in the middle of a multibyte sequence. The tokenizer is not thread-safe.</para>
+	///   <para>Element, attribute and entity names are atomized in an <see cref="XmlNameTable"/> straight from the block,
+	///     so a name that has been seen before costs a hash lookup rather than a new string.</para></remarks>
+	sealed class XmlTokenizer {
+		IXmlParseListener _listener;
+		XmlNameTable _nameTable;
+		ParserState _prolog;
+		Mode _mode = Mode.Prolog;
+
+		// Part of a name, text run or comment left over from an earlier block
+		StringBuilder _token = new StringBuilder();
+		Stack<string> _openElements = new Stack<string>();
+		char[] _scratch;
+		const int __scratchLength = 4096;
+
+		// UTF-8 sequence left unfinished at the end of the last byte block
+		int _utf8Value, _utf8BytesLeft, _utf8MinValue;
+		bool _utf8Started;
+
+		string _attributeName, _refName;
+		char _quote;
+		bool _sawWhitespace, _refInAttribute, _refHex, _refDigitFound;
+		int _refCodePoint;
+
+		// How much of the "[CDATA[" that opens a CDATA section has been matched
+		const string __cdataOpen = "[CDATA[";
+		int _cdataOpenMatched;
+
+		// Position tracking for errors: the absolute offset of buffer[0] in the current block,
+		// the offset of the first character of the current line, and the offset of the last CR seen
+		long _base, _lineStart, _lastCR = -2;
+		int _row = 1;
+
+		enum Mode {
+			Prolog,
+			Content,
+			Text,
+			TextCR,
+			TextBracket1,
+			TextBracket2,
+			TagOpen,
+			StartTagNameStart,
+			StartTagName,
+			InTag,
+			EmptyTagClose,
+			AttributeNameStart,
+			AttributeName,
+			AttributePreEquals,
+			AttributePostEquals,
+			AttributeValue,
+			AttributeValueCR,
+			ReferenceStart,
+			ReferenceHash,
+			ReferenceDigits,
+			ReferenceName,
+			ReferenceSemicolon,
+			Bang,
+			CommentOpen,
+			CommentText,
+			CommentDash1,
+			CommentDash2,
+			CDataOpen,
+			CDataText,
+			CDataCR,
+			CDataBracket1,
+			CDataBracket2,
+			EndTagNameStart,
+			EndTagName,
+			EndTagWhitespace,
+			Done
+		}
+
+	#region Character classes
+		const byte __textStop = 1, __attributeStop = 2, __commentStop = 4, __nameStart = 8, __nameChar = 16, __cdataStop = 32;
+		static readonly byte[] __charClass = CreateCharClassTable();
+
+		private static byte[] CreateCharClassTable() {
+			byte[] table = new byte[0x80];
+
+			for( int i = 0; i < 0x20; i++ )
+				table[i] = __textStop | __attributeStop | __commentStop | __cdataStop;
+
+			table['<'] |= __textStop | __attributeStop;
+			table['&'] |= __textStop | __attributeStop;
+			table[']'] |= __textStop | __cdataStop;
+			table['"'] |= __attributeStop;
+			table['\''] |= __attributeStop;
+			table['-'] |= __commentStop | __nameChar;
+
+			for( int i = 'A'; i <= 'Z'; i++ )
+				table[i] |= __nameStart | __nameChar;
+
+			for( int i = 'a'; i <= 'z'; i++ )
+				table[i] |= __nameStart | __nameChar;
+
+			for( int i = '0'; i <= '9'; i++ )
+				table[i] |= __nameChar;
+
+			table['_'] |= __nameStart | __nameChar;
+			table[':'] |= __nameStart | __nameChar;
+			table['.'] |= __nameChar;
+
+			return table;
+		}
+
+		private static bool IsNameStart( char value ) {
+			if( value < 0x80 )
+				return (__charClass[value] & __nameStart) != 0;
+
+			return XmlHelp.IsNameStart( value );
+		}
+
+		private static bool IsNameChar( char value ) {
+			if( value < 0x80 )
+				return (__charClass[value] & __nameChar) != 0;
+
+			return XmlHelp.IsNameChar( value );
+		}
+
+		/// <summary>
+		/// Determines whether a character above the ASCII range is allowed in an XML document.
+		/// </summary>
+		/// <remarks>Surrogates are let through so that characters outside the Basic Multilingual Plane can be read.</remarks>
+		private static bool IsValidHighChar( char value ) {
+			return value != 0xFFFE && value != 0xFFFF;
+		}
+	#endregion
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='XmlTokenizer'/> class.
+		/// </summary>
+		/// <param name="listener"><see cref="IXmlParseListener"/> that receives the parsed document.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='listener'/> is <see langword='null'/>.</exception>
+		public XmlTokenizer( IXmlParseListener listener ) : this( listener, new NameTable() ) {
+		}
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='XmlTokenizer'/> class.
+		/// </summary>
+		/// <param name="listener"><see cref="IXmlParseListener"/> that receives the parsed document.</param>
+		/// <param name="nameTable"><see cref="XmlNameTable"/> in which to atomize element, attribute and entity names.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='listener'/> or <paramref name='nameTable'/> is <see langword='null'/>.</exception>
+		public XmlTokenizer( IXmlParseListener listener, XmlNameTable nameTable ) {
+			if( listener == null )
+				throw new ArgumentNullException( "listener" );
+
+			if( nameTable == null )
+				throw new ArgumentNullException( "nameTable" );
+
+			_listener = listener;
+			_nameTable = nameTable;
+			_prolog = new ParserState( listener );
+			_prolog.PushParser( new PrologParser( _prolog ) );
+		}
+
+		/// <summary>
+		/// Parses the next part of the document.
+		/// </summary>
+		/// <param name="value">Text to parse.</param>
+		/// <returns>True if more data is expected, or false if the root element has already been closed.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='value'/> is <see langword='null'/>.</exception>
+		public bool Parse( string value ) {
+			if( value == null )
+				throw new ArgumentNullException( "value" );
+
+			if( _scratch == null )
+				_scratch = new char[__scratchLength];
+
+			for( int offset = 0; offset < value.Length; ) {
+				int count = Math.Min( value.Length - offset, _scratch.Length );
+				value.CopyTo( offset, _scratch, 0, count );
+
+				if( !Parse( _scratch, 0, count ) )
+					return false;
+
+				offset += count;
+			}
+
+			return true;
+		}
+
+		/// <summary>
+		/// Parses the next part of a UTF-8 encoded document.
+		/// </summary>
+		/// <param name="buffer">Buffer containing the bytes to parse.</param>
+		/// <param name="offset">Offset in <paramref name="buffer"/> of the first byte to parse.</param>
+		/// <param name="count">Number of bytes to parse.</param>
+		/// <returns>True if more data is expected, or false if the root element has already been closed.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='buffer'/> is <see langword='null'/>.</exception>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="offset"/> or <paramref name="count"/> is out of range.</exception>
+		/// <remarks>A multibyte sequence can be split across calls; its first bytes are held until the rest arrive. A byte order
+		///     mark at the very start of the document is skipped. Malformed sequences, overlong forms, encoded surrogates and
+		///     values above U+10FFFF are reported as parse errors.
+		///   <para>ASCII bytes, which make up nearly all of the names, whitespace and markup in a typical stream, are widened
+		///     in a tight loop without going through the sequence decoder.</para></remarks>
+		public bool Parse( byte[] buffer, int offset, int count ) {
+			if( buffer == null )
+				throw new ArgumentNullException( "buffer" );
+
+			if( offset < 0 || offset > buffer.Length )
+				throw new ArgumentOutOfRangeException( "offset" );
+
+			if( count < 0 || count > buffer.Length - offset )
+				throw new ArgumentOutOfRangeException( "count" );
+
+			if( _scratch == null )
+				_scratch = new char[__scratchLength];
+
+			char[] chars = _scratch;
+			int end = offset + count, i = offset;
+
+			// Leave room for a surrogate pair at the end of the character buffer
+			int limit = chars.Length - 1;
+
+			while( i < end ) {
+				int n = 0;
+
+				while( i < end && n < limit ) {
+					if( _utf8BytesLeft != 0 ) {
+						byte trail = buffer[i];
+
+						if( (trail & 0xC0) != 0x80 )
+							ThrowEncodingError( n );
+
+						_utf8Value = (_utf8Value << 6) | (trail & 0x3F);
+						i++;
+
+						if( --_utf8BytesLeft != 0 )
+							continue;
+
+						if( _utf8Value < _utf8MinValue || _utf8Value > 0x10FFFF || (_utf8Value >= 0xD800 && _utf8Value <= 0xDFFF) )
+							ThrowEncodingError( n );
+
+						if( _utf8Value >= 0x10000 ) {
+							chars[n++] = (char)(0xD800 + ((_utf8Value - 0x10000) >> 10));
+							chars[n++] = (char)(0xDC00 + ((_utf8Value - 0x10000) & 0x3FF));
+						}
+						else if( _utf8Value != 0xFEFF || _utf8Started ) {
+							// A byte order mark is only skipped as the very first character
+							chars[n++] = (char) _utf8Value;
+						}
+
+						_utf8Started = true;
+						continue;
+					}
+
+					// ASCII fast path
+					int run = Math.Min( end - i, limit - n );
+
+					while( run != 0 && buffer[i] < 0x80 ) {
+						chars[n++] = (char) buffer[i++];
+						run--;
+					}
+
+					if( i == end || n >= limit )
+						break;
+
+					if( n != 0 )
+						_utf8Started = true;
+
+					byte lead = buffer[i];
+
+					if( lead < 0xC2 ) {
+						// A stray continuation byte or an overlong two-byte form
+						ThrowEncodingError( n );
+					}
+					else if( lead < 0xE0 ) {
+						_utf8Value = lead & 0x1F;
+						_utf8BytesLeft = 1;
+						_utf8MinValue = 0x80;
+					}
+					else if( lead < 0xF0 ) {
+						_utf8Value = lead & 0x0F;
+						_utf8BytesLeft = 2;
+						_utf8MinValue = 0x800;
+					}
+					else if( lead < 0xF5 ) {
+						_utf8Value = lead & 0x07;
+						_utf8BytesLeft = 3;
+						_utf8MinValue = 0x10000;
+					}
+					else {
+						ThrowEncodingError( n );
+					}
+
+					i++;
+				}
+
+				if( n != 0 ) {
+					_utf8Started = true;
+
+					if( !Parse( chars, 0, n ) )
+						return false;
+				}
+			}
+
+			return true;
+		}
+
+		private void ThrowEncodingError( int decodedCount ) {
+			// Parse what came before the bad sequence so the error is reported at the right place
+			if( decodedCount != 0 )
+				Parse( _scratch, 0, decodedCount );
+
+			ThrowParseException( 0, "Invalid UTF-8 sequence found in XML stream." );
+			throw new UnexpectedException();
+		}
+
+		/// <summary>
+		/// Parses the next part of the document.
+		/// </summary>
+		/// <param name="buffer">Buffer containing the text to parse.</param>
+		/// <param name="offset">Offset in <paramref name="buffer"/> of the first character to parse.</param>
+		/// <param name="count">Number of characters to parse.</param>
+		/// <returns>True if more data is expected, or false if the root element has already been closed.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='buffer'/> is <see langword='null'/>.</exception>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="offset"/> or <paramref name="count"/> is out of range.</exception>
+		/// <remarks>The buffer is not referenced after the call returns, so the caller can reuse it.</remarks>
+		public bool Parse( char[] buffer, int offset, int count ) {
+			if( buffer == null )
+				throw new ArgumentNullException( "buffer" );
+
+			if( offset < 0 || offset > buffer.Length )
+				throw new ArgumentOutOfRangeException( "offset" );
+
+			if( count < 0 || count > buffer.Length - offset )
+				throw new ArgumentOutOfRangeException( "count" );
+
+			int end = offset + count, i = offset, start;
+			char c = '\0';
+
+			_base -= offset;
+
+			while( i < end ) {
+				switch( _mode ) {
+					case Mode.Prolog:
+						c = buffer[i];
+
+						if( !_prolog.Parse( c ) ) {
+							// The prolog parser has eaten the '<' of the root element and left us its name
+							_prolog = null;
+							_mode = Mode.StartTagNameStart;
+							continue;
+						}
+
+						if( c == '\n' )
+							LineFeed( i );
+						else if( c == '\r' )
+							CarriageReturn( i );
+
+						i++;
+						continue;
+
+					case Mode.Content:
+						c = buffer[i];
+
+						if( c == '<' ) {
+							i++;
+							_mode = Mode.TagOpen;
+							continue;
+						}
+
+						if( c == '&' ) {
+							i++;
+							_refInAttribute = false;
+							_mode = Mode.ReferenceStart;
+							continue;
+						}
+
+						_mode = Mode.Text;
+						continue;
+
+				#region Text
+					case Mode.Text:
+						start = i;
+
+						for( ; i < end; i++ ) {
+							c = buffer[i];
+
+							if( c < 0x80 ) {
+								if( (__charClass[c] & __textStop) == 0 || c == '\t' )
+									continue;
+
+								if( c == '\n' ) {
+									LineFeed( i );
+									continue;
+								}
+							}
+							else if( c < 0xD800 || IsValidHighChar( c ) )
+								continue;
+
+							break;
+						}
+
+						if( i == end ) {
+							_token.Append( buffer, start, i - start );
+							continue;
+						}
+
+						switch( c ) {
+							case '<':
+							case '&':
+								string text = TakeToken( buffer, start, i );
+
+								if( text.Length != 0 )
+									_listener.PushText( text );
+
+								_mode = Mode.Content;
+								continue;
+
+							case ']':
+								// Might be the start of a "]]>", which isn't allowed in text
+								_token.Append( buffer, start, i - start );
+								i++;
+								_mode = Mode.TextBracket1;
+								continue;
+
+							case '\r':
+								// Line ends are normalized to a single LF
+								_token.Append( buffer, start, i - start );
+								_token.Append( '\n' );
+								CarriageReturn( i );
+								i++;
+								_mode = Mode.TextCR;
+								continue;
+
+							default:
+								ThrowInvalidCharacter( i );
+								throw new UnexpectedException();
+						}
+
+					case Mode.TextCR:
+						if( buffer[i] == '\n' ) {
+							LineFeed( i );
+							i++;
+						}
+
+						_mode = Mode.Text;
+						continue;
+
+					case Mode.TextBracket1:
+						if( buffer[i] == ']' ) {
+							i++;
+							_mode = Mode.TextBracket2;
+							continue;
+						}
+
+						_token.Append( ']' );
+						_mode = Mode.Text;
+						continue;
+
+					case Mode.TextBracket2:
+						c = buffer[i];
+
+						if( c == '>' ) {
+							ThrowParseException( i, "Found \"]]>\" sequence in text." );
+							throw new UnexpectedException();
+						}
+
+						if( c == ']' ) {
+							// "]]]" could still be followed by '>'
+							_token.Append( ']' );
+							i++;
+							continue;
+						}
+
+						_token.Append( "]]" );
+						_mode = Mode.Text;
+						continue;
+				#endregion
+
+				#region Start tags
+					case Mode.TagOpen:
+						c = buffer[i];
+
+						if( c == '/' ) {
+							i++;
+							_mode = Mode.EndTagNameStart;
+							continue;
+						}
+
+						if( c == '!' ) {
+							i++;
+							_mode = Mode.Bang;
+							continue;
+						}
+
+						if( c == '?' ) {
+							// The listener has no way to take a PI
+							ThrowParseException( i, "Processing instructions are not supported in element content." );
+							throw new UnexpectedException();
+						}
+
+						_mode = Mode.StartTagNameStart;
+						continue;
+
+					case Mode.StartTagNameStart:
+						if( !IsNameStart( buffer[i] ) ) {
+							ThrowUnexpectedCharacter( i, buffer[i], "name" );
+							throw new UnexpectedException();
+						}
+
+						_mode = Mode.StartTagName;
+						continue;
+
+					case Mode.StartTagName:
+						start = i;
+
+						while( i < end && IsNameChar( buffer[i] ) )
+							i++;
+
+						if( i == end ) {
+							_token.Append( buffer, start, i - start );
+							continue;
+						}
+
+						string elementName = TakeName( buffer, start, i );
+						_listener.PushElementName( elementName );
+						_openElements.Push( elementName );
+
+						_sawWhitespace = false;
+						_mode = Mode.InTag;
+						continue;
+
+					case Mode.InTag:
+						// We can expect whitespace, an attribute, or the end of the tag
+						c = buffer[i];
+
+						if( c == '/' ) {
+							// Empty tag!
+							_listener.PushCloseEmptyElement();
+							i++;
+							_mode = Mode.EmptyTagClose;
+							continue;
+						}
+
+						if( c == '>' ) {
+							_listener.PushCloseStartTag();
+							i++;
+							_mode = Mode.Content;
+							continue;
+						}
+
+						if( XmlHelp.IsWhitespace( c ) ) {
+							SkipWhitespace( buffer, ref i, end );
+							_sawWhitespace = true;
+							continue;
+						}
+
+						// We expect an attribute now, but first, did we see whitespace?
+						if( !_sawWhitespace ) {
+							ThrowParseException( i, string.Format( "Found the character \'{0}\' where whitespace was expected.", c ) );
+							throw new UnexpectedException();
+						}
+
+						_sawWhitespace = false;
+						_mode = Mode.AttributeNameStart;
+						continue;
+
+					case Mode.EmptyTagClose:
+						if( buffer[i] != '>' ) {
+							ThrowUnexpectedCharacter( i, '>', buffer[i] );
+							throw new UnexpectedException();
+						}
+
+						i++;
+						_openElements.Pop();
+						_mode = (_openElements.Count == 0) ? Mode.Done : Mode.Content;
+						continue;
+				#endregion
+
+				#region Attributes
+					case Mode.AttributeNameStart:
+						if( !IsNameStart( buffer[i] ) ) {
+							ThrowUnexpectedCharacter( i, buffer[i], "name" );
+							throw new UnexpectedException();
+						}
+
+						_mode = Mode.AttributeName;
+						continue;
+
+					case Mode.AttributeName:
+						start = i;
+
+						while( i < end && IsNameChar( buffer[i] ) )
+							i++;
+
+						if( i == end ) {
+							_token.Append( buffer, start, i - start );
+							continue;
+						}
+
+						_attributeName = TakeName( buffer, start, i );
+						_mode = Mode.AttributePreEquals;
+						continue;
+
+					case Mode.AttributePreEquals:
+						c = buffer[i];
+
+						if( c == '=' ) {
+							i++;
+							_mode = Mode.AttributePostEquals;
+							continue;
+						}
+
+						if( XmlHelp.IsWhitespace( c ) ) {
+							SkipWhitespace( buffer, ref i, end );
+							continue;
+						}
+
+						ThrowUnexpectedCharacter( i, '=', c );
+						throw new UnexpectedException();
+
+					case Mode.AttributePostEquals:
+						c = buffer[i];
+
+						if( XmlHelp.IsWhitespace( c ) ) {
+							SkipWhitespace( buffer, ref i, end );
+							continue;
+						}
+
+						if( c == '\'' || c == '"' ) {
+							_listener.PushAttributeName( _attributeName, c );
+							_attributeName = null;
+							_quote = c;
+							i++;
+							_mode = Mode.AttributeValue;
+							continue;
+						}
+
+						ThrowParseException( i, "Expected a quote character." );
+						throw new UnexpectedException();
+
+					case Mode.AttributeValue:
+						start = i;
+
+						for( ; i < end; i++ ) {
+							c = buffer[i];
+
+							if( c < 0x80 ) {
+								if( (__charClass[c] & __attributeStop) == 0 || c == '\t' )
+									continue;
+
+								if( c == '\n' ) {
+									LineFeed( i );
+									continue;
+								}
+
+								// The quote that didn't open the value is ordinary text
+								if( (c == '"' || c == '\'') && c != _quote )
+									continue;
+							}
+							else if( c < 0xD800 || IsValidHighChar( c ) )
+								continue;
+
+							break;
+						}
+
+						if( i == end ) {
+							_token.Append( buffer, start, i - start );
+							continue;
+						}
+
+						if( c == _quote || c == '&' ) {
+							string value = TakeToken( buffer, start, i );
+
+							if( value.Length != 0 )
+								_listener.PushAttributeText( value );
+
+							i++;
+
+							if( c == '&' ) {
+								_refInAttribute = true;
+								_mode = Mode.ReferenceStart;
+							}
+							else {
+								_mode = Mode.InTag;
+							}
+
+							continue;
+						}
+
+						if( c == '\r' ) {
+							_token.Append( buffer, start, i - start );
+							_token.Append( '\n' );
+							CarriageReturn( i );
+							i++;
+							_mode = Mode.AttributeValueCR;
+							continue;
+						}
+
+						if( c == '<' ) {
+							ThrowUnexpectedCharacter( i, c, "attribute text" );
+							throw new UnexpectedException();
+						}
+
+						ThrowInvalidCharacter( i );
+						throw new UnexpectedException();
+
+					case Mode.AttributeValueCR:
+						if( buffer[i] == '\n' ) {
+							LineFeed( i );
+							i++;
+						}
+
+						_mode = Mode.AttributeValue;
+						continue;
+				#endregion
+
+				#region References
+					case Mode.ReferenceStart:
+						c = buffer[i];
+
+						if( c == '#' ) {
+							i++;
+							_mode = Mode.ReferenceHash;
+							continue;
+						}
+
+						if( !IsNameStart( c ) ) {
+							ThrowUnexpectedCharacter( i, c, "name" );
+							throw new UnexpectedException();
+						}
+
+						_mode = Mode.ReferenceName;
+						continue;
+
+					case Mode.ReferenceHash:
+						_refHex = buffer[i] == 'x';
+						_refDigitFound = false;
+						_refCodePoint = 0;
+
+						if( _refHex )
+							i++;
+
+						_mode = Mode.ReferenceDigits;
+						continue;
+
+					case Mode.ReferenceDigits:
+						c = buffer[i];
+
+						if( c == ';' ) {
+							if( !_refDigitFound ) {
+								ThrowParseException( i, "Encountered an empty entity." );
+								throw new UnexpectedException();
+							}
+
+							if( _refInAttribute )
+								_listener.PushAttributeCharRef( _refCodePoint );
+							else
+								_listener.PushCharRef( _refCodePoint );
+
+							i++;
+							_mode = _refInAttribute ? Mode.AttributeValue : Mode.Content;
+							continue;
+						}
+
+						int digit;
+
+						if( c >= '0' && c <= '9' )
+							digit = c - '0';
+						else if( _refHex && c >= 'a' && c <= 'f' )
+							digit = c - 'a' + 10;
+						else if( _refHex && c >= 'A' && c <= 'F' )
+							digit = c - 'A' + 10;
+						else {
+							ThrowUnexpectedCharacter( i, c, "character reference" );
+							throw new UnexpectedException();
+						}
+
+						_refCodePoint = _refCodePoint * (_refHex ? 16 : 10) + digit;
+						_refDigitFound = true;
+
+						if( _refCodePoint > 0x10FFFF ) {
+							ThrowParseException( i, "The character reference is out of range." );
+							throw new UnexpectedException();
+						}
+
+						i++;
+						continue;
+
+					case Mode.ReferenceName:
+						start = i;
+
+						while( i < end && IsNameChar( buffer[i] ) )
+							i++;
+
+						if( i == end ) {
+							_token.Append( buffer, start, i - start );
+							continue;
+						}
+
+						_refName = TakeName( buffer, start, i );
+						_mode = Mode.ReferenceSemicolon;
+						continue;
+
+					case Mode.ReferenceSemicolon:
+						if( buffer[i] != ';' ) {
+							ThrowUnexpectedCharacter( i, ';', buffer[i] );
+							throw new UnexpectedException();
+						}
+
+						if( _refInAttribute )
+							_listener.PushAttributeEntityRef( _refName );
+						else
+							_listener.PushEntityRef( _refName );
+
+						_refName = null;
+						i++;
+						_mode = _refInAttribute ? Mode.AttributeValue : Mode.Content;
+						continue;
+				#endregion
+
+				#region Comments
+					case Mode.Bang:
+						// In content, "<!" starts either a comment or a CDATA section
+						c = buffer[i];
+
+						if( c == '-' ) {
+							i++;
+							_mode = Mode.CommentOpen;
+							continue;
+						}
+
+						if( c == '[' ) {
+							i++;
+							_cdataOpenMatched = 1;
+							_mode = Mode.CDataOpen;
+							continue;
+						}
+
+						ThrowParseException( i, "Expected a comment or CDATA section after \"<!\"." );
+						throw new UnexpectedException();
+
+					case Mode.CommentOpen:
+						if( buffer[i] != '-' ) {
+							ThrowUnexpectedCharacter( i, '-', buffer[i] );
+							throw new UnexpectedException();
+						}
+
+						i++;
+						_mode = Mode.CommentText;
+						continue;
+
+					case Mode.CommentText:
+						start = i;
+
+						for( ; i < end; i++ ) {
+							c = buffer[i];
+
+							if( c < 0x80 ) {
+								if( (__charClass[c] & __commentStop) == 0 || c == '\t' )
+									continue;
+
+								if( c == '\n' ) {
+									LineFeed( i );
+									continue;
+								}
+
+								if( c == '\r' ) {
+									CarriageReturn( i );
+									continue;
+								}
+							}
+							else if( c < 0xD800 || IsValidHighChar( c ) )
+								continue;
+
+							break;
+						}
+
+						_token.Append( buffer, start, i - start );
+
+						if( i == end )
+							continue;
+
+						if( c != '-' ) {
+							ThrowInvalidCharacter( i );
+							throw new UnexpectedException();
+						}
+
+						i++;
+						_mode = Mode.CommentDash1;
+						continue;
+
+					case Mode.CommentDash1:
+						// A dash means nothing if it isn't followed by another dash
+						if( buffer[i] == '-' ) {
+							_listener.PushComment( _token.ToString() );
+							_token.Length = 0;
+
+							i++;
+							_mode = Mode.CommentDash2;
+							continue;
+						}
+
+						_token.Append( '-' );
+						_mode = Mode.CommentText;
+						continue;
+
+					case Mode.CommentDash2:
+						// "--" is not allowed in the middle of a comment, so this must be the end
+						if( buffer[i] != '>' ) {
+							ThrowUnexpectedCharacter( i, '>', buffer[i] );
+							throw new UnexpectedException();
+						}
+
+						i++;
+						_mode = Mode.Content;
+						continue;
+				#endregion
+
+				#region CDATA sections
+					case Mode.CDataOpen:
+						if( buffer[i] != __cdataOpen[_cdataOpenMatched] ) {
+							ThrowUnexpectedCharacter( i, __cdataOpen[_cdataOpenMatched], buffer[i] );
+							throw new UnexpectedException();
+						}
+
+						i++;
+
+						if( ++_cdataOpenMatched == __cdataOpen.Length )
+							_mode = Mode.CDataText;
+
+						continue;
+
+					case Mode.CDataText:
+						start = i;
+
+						for( ; i < end; i++ ) {
+							c = buffer[i];
+
+							if( c < 0x80 ) {
+								if( (__charClass[c] & __cdataStop) == 0 || c == '\t' )
+									continue;
+
+								if( c == '\n' ) {
+									LineFeed( i );
+									continue;
+								}
+							}
+							else if( c < 0xD800 || IsValidHighChar( c ) )
+								continue;
+
+							break;
+						}
+
+						_token.Append( buffer, start, i - start );
+
+						if( i == end )
+							continue;
+
+						if( c == ']' ) {
+							i++;
+							_mode = Mode.CDataBracket1;
+							continue;
+						}
+
+						if( c == '\r' ) {
+							// Line ends are normalized here too
+							_token.Append( '\n' );
+							CarriageReturn( i );
+							i++;
+							_mode = Mode.CDataCR;
+							continue;
+						}
+
+						ThrowInvalidCharacter( i );
+						throw new UnexpectedException();
+
+					case Mode.CDataCR:
+						if( buffer[i] == '\n' ) {
+							LineFeed( i );
+							i++;
+						}
+
+						_mode = Mode.CDataText;
+						continue;
+
+					case Mode.CDataBracket1:
+						if( buffer[i] == ']' ) {
+							i++;
+							_mode = Mode.CDataBracket2;
+							continue;
+						}
+
+						_token.Append( ']' );
+						_mode = Mode.CDataText;
+						continue;
+
+					case Mode.CDataBracket2:
+						c = buffer[i];
+
+						if( c == '>' ) {
+							// The section is character data like any other text
+							if( _token.Length != 0 ) {
+								_listener.PushText( _token.ToString() );
+								_token.Length = 0;
+							}
+
+							i++;
+							_mode = Mode.Content;
+							continue;
+						}
+
+						if( c == ']' ) {
+							// "]]]" could still be followed by '>'
+							_token.Append( ']' );
+							i++;
+							continue;
+						}
+
+						_token.Append( "]]" );
+						_mode = Mode.CDataText;
+						continue;
+				#endregion
+
+				#region End tags
+					case Mode.EndTagNameStart:
+						if( !IsNameStart( buffer[i] ) ) {
+							ThrowUnexpectedCharacter( i, buffer[i], "name" );
+							throw new UnexpectedException();
+						}
+
+						_mode = Mode.EndTagName;
+						continue;
+
+					case Mode.EndTagName:
+						start = i;
+
+						while( i < end && IsNameChar( buffer[i] ) )
+							i++;
+
+						if( i == end ) {
+							_token.Append( buffer, start, i - start );
+							continue;
+						}
+
+						string startName = _openElements.Peek();
+
+						if( !TokenEquals( startName, buffer, start, i ) ) {
+							string endName = TakeToken( buffer, start, i );
+							ThrowParseException( i, string.Format( "The name of the end tag ({1}) did not match the name of the start tag ({0}).", startName, endName ) );
+							throw new UnexpectedException();
+						}
+
+						_token.Length = 0;
+						_listener.PushEndElement();
+						_mode = Mode.EndTagWhitespace;
+						continue;
+
+					case Mode.EndTagWhitespace:
+						c = buffer[i];
+
+						if( XmlHelp.IsWhitespace( c ) ) {
+							SkipWhitespace( buffer, ref i, end );
+							continue;
+						}
+
+						if( c != '>' ) {
+							ThrowUnexpectedCharacter( i, '>', c );
+							throw new UnexpectedException();
+						}
+
+						i++;
+						_openElements.Pop();
+						_mode = (_openElements.Count == 0) ? Mode.Done : Mode.Content;
+						continue;
+				#endregion
+
+					case Mode.Done:
+						_base += end;
+						return false;
+
+					default:
+						throw new UnexpectedException();
+				}
+			}
+
+			_base += end;
+
+			// The block may have ended exactly on the root element's closing '>'
+			return _mode != Mode.Done;
+		}
+
+	#region Helpers
+		/// <summary>
+		/// Returns the token that ends at the given position, including any part of it held over from earlier blocks.
+		/// </summary>
+		private string TakeToken( char[] buffer, int start, int end ) {
+			if( _token.Length == 0 )
+				return new string( buffer, start, end - start );
+
+			_token.Append( buffer, start, end - start );
+			string result = _token.ToString();
+			_token.Length = 0;
+
+			return result;
+		}
+
+		/// <summary>
+		/// Returns the atomized name that ends at the given position, including any part of it held over from earlier blocks.
+		/// </summary>
+		private string TakeName( char[] buffer, int start, int end ) {
+			if( _token.Length == 0 )
+				return _nameTable.Add( buffer, start, end - start );
+
+			_token.Append( buffer, start, end - start );
+			string result = _nameTable.Add( _token.ToString() );
+			_token.Length = 0;
+
+			return result;
+		}
+
+		/// <summary>
+		/// Compares a string to the token that ends at the given position without creating a string for the token.
+		/// </summary>
+		private bool TokenEquals( string value, char[] buffer, int start, int end ) {
+			int heldLength = _token.Length;
+
+			if( value.Length != heldLength + (end - start) )
+				return false;
+
+			for( int i = 0; i < heldLength; i++ ) {
+				if( value[i] != _token[i] )
+					return false;
+			}
+
+			for( int i = start; i < end; i++ ) {
+				if( value[heldLength + i - start] != buffer[i] )
+					return false;
+			}
+
+			return true;
+		}
+
+		private void SkipWhitespace( char[] buffer, ref int i, int end ) {
+			for( ; i < end; i++ ) {
+				char c = buffer[i];
+
+				if( c == ' ' || c == '\t' )
+					continue;
+
+				if( c == '\n' ) {
+					LineFeed( i );
+					continue;
+				}
+
+				if( c == '\r' ) {
+					CarriageReturn( i );
+					continue;
+				}
+
+				return;
+			}
+		}
+
+		private void LineFeed( int index ) {
+			long position = _base + index;
+
+			// The LF of a CR-LF pair doesn't start another line
+			if( position - 1 != _lastCR )
+				_row++;
+
+			_lineStart = position + 1;
+		}
+
+		private void CarriageReturn( int index ) {
+			_lastCR = _base + index;
+			_lineStart = _lastCR + 1;
+			_row++;
+		}
+
+		private void ThrowParseException( int index, string text ) {
+			int column = (int) Math.Min( _base + index - _lineStart + 1, int.MaxValue );
+
+			_listener.PushParseError( _row, column, text );
+			throw new Exception( string.Format( "Line {0}, column {1}: {2}", _row, column, text ) );
+		}
+
+		private void ThrowUnexpectedCharacter( int index, char value, string context ) {
+			ThrowParseException( index, string.Format( "Unexpected character \'{0}\' in {1}.", value, context ) );
+		}
+
+		private void ThrowUnexpectedCharacter( int index, char expectedValue, char actualValue ) {
+			ThrowParseException( index, string.Format( "Unexpected character in XML stream. Expected '{0}' but found '{1}'.", expectedValue, actualValue ) );
+		}
+
+		private void ThrowInvalidCharacter( int index ) {
+			ThrowParseException( index, "Invalid character found in XML stream." );
+		}
+	#endregion
+	}
+}
@@ -22,5 +22,13 @@ namespace Fluggo.Xml {
 		public new bool Parse( string xml ) {
 			return base.Parse( xml );
 		}
+
+		public new bool Parse( char[] buffer, int offset, int count ) {
+			return base.Parse( buffer, offset, count );
+		}
+
+		public new bool Parse( byte[] buffer, int offset, int count ) {
+			return base.Parse( buffer, offset, count );
+		}
 	}
 }
\ No newline at end of file
@@ -26,114 +26,273 @@ using System.Collections.Generic;
 using Fluggo.Communications;
 
 namespace Fluggo.Xml {
-	class ScopedDictionary<TKey,TValue> {
-		Stack<KeyValuePair<Dictionary<TKey,TValue>,int>> _stack = new Stack<KeyValuePair<Dictionary<TKey,TValue>,int>>();
-		Dictionary<TKey,TValue> _currentDictionary = null;
-		int _levelCount;
+	/// <summary>
+	/// Tracks the namespace prefixes in scope while an XML document is read.
+	/// </summary>
+	/// <remarks>Each prefix keeps its own stack of bindings, and each binding is stamped with the depth and the version of the
+	///     scope that declared it. Every scope that is entered gets a new version, so leaving a scope only has to drop the depth;
+	///     bindings left behind by closed scopes no longer match the version at their depth and are thrown away the next time their
+	///     prefix is used. Looking up a prefix is one hash lookup no matter how deeply the elements are nested.
+	///   <para>Prefixes are compared as ordinary strings, but they should be atomized in the reader's name table anyway, since
+	///     the bindings for each distinct prefix are kept for the life of the table.</para></remarks>
+	sealed class XmlNamespaceTable {
+		Dictionary<string, PrefixBindings> _prefixes = new Dictionary<string, PrefixBindings>();
+		int[] _scopeVersions = new int[16];
+		int _depth, _lastVersion;
+
+		sealed class PrefixBindings {
+			public string[] NamespaceUris = new string[4];
+			public int[] Depths = new int[4];
+			public int[] Versions = new int[4];
+			public int Count;
+		}
 
-		public void Add( TKey key, TValue value ) {
-			if( _currentDictionary == null )
-				_currentDictionary = new Dictionary<TKey,TValue>();
+		/// <summary>
+		/// Binds a prefix to a namespace in the current scope.
+		/// </summary>
+		/// <param name="prefix">Prefix to bind, or <see cref="String.Empty"/> to set the default namespace.</param>
+		/// <param name="namespaceUri">Namespace URI to bind the prefix to.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='prefix'/> or <paramref name='namespaceUri'/> is <see langword='null'/>.</exception>
+		/// <exception cref='XmlException'><paramref name='prefix'/> is already bound in the current scope.</exception>
+		public void Add( string prefix, string namespaceUri ) {
+			if( prefix == null )
+				throw new ArgumentNullException( "prefix" );
 
-			_currentDictionary.Add( key, value );
-		}
+			if( namespaceUri == null )
+				throw new ArgumentNullException( "namespaceUri" );
 
-		public bool ContainsKey( TKey key ) {
-			if( _currentDictionary != null && _currentDictionary.ContainsKey( key ) )
-				return true;
+			PrefixBindings bindings;
 
-			foreach( KeyValuePair<Dictionary<TKey, TValue>, int> pair in _stack ) {
-				if( pair.Key.ContainsKey( key ) )
-					return true;
+			if( !_prefixes.TryGetValue( prefix, out bindings ) ) {
+				bindings = new PrefixBindings();
+				_prefixes.Add( prefix, bindings );
 			}
-			
-			return false;
+
+			DropClosedBindings( bindings );
+			int count = bindings.Count;
+
+			if( count != 0 && bindings.Depths[count - 1] == _depth )
+				throw new XmlException( "The namespace prefix \"" + prefix + "\" was declared more than once on the same element.", null );
+
+			if( count == bindings.Depths.Length ) {
+				Array.Resize( ref bindings.NamespaceUris, count * 2 );
+				Array.Resize( ref bindings.Depths, count * 2 );
+				Array.Resize( ref bindings.Versions, count * 2 );
+			}
+
+			bindings.NamespaceUris[count] = namespaceUri;
+			bindings.Depths[count] = _depth;
+			bindings.Versions[count] = _scopeVersions[_depth];
+			bindings.Count = count + 1;
 		}
 
-/*		public bool Remove( TKey key ) {
-			if( _currentDictionary == null )
-				return false;
-				
-			return _currentDictionary.Remove( key );
-		}*/
+		/// <summary>
+		/// Finds the namespace a prefix is bound to in the current scope.
+		/// </summary>
+		/// <param name="prefix">Prefix to look up, or <see cref="String.Empty"/> to find the default namespace.</param>
+		/// <param name="namespaceUri">Reference to a variable that receives the namespace URI, or <see langword='null'/> if the prefix isn't bound.</param>
+		/// <returns>True if the prefix is bound, false otherwise.</returns>
+		public bool TryGetValue( string prefix, out string namespaceUri ) {
+			PrefixBindings bindings;
 
-		public bool TryGetValue( TKey key, out TValue value ) {
-			if( _currentDictionary != null && _currentDictionary.TryGetValue( key, out value ) )
-				return true;
+			if( _prefixes.TryGetValue( prefix, out bindings ) ) {
+				DropClosedBindings( bindings );
 
-			foreach( KeyValuePair<Dictionary<TKey, TValue>, int> pair in _stack ) {
-				if( pair.Key.TryGetValue( key, out value ) )
+				if( bindings.Count != 0 ) {
+					namespaceUri = bindings.NamespaceUris[bindings.Count - 1];
 					return true;
+				}
 			}
-			
-			value = default(TValue);
-			
+
+			namespaceUri = null;
 			return false;
 		}
 
-/*		public TValue this[TKey key] {
-			get {
-				throw new Exception( "The method or operation is not implemented." );
-			}
-			set {
-				throw new Exception( "The method or operation is not implemented." );
-			}
-		}*/
+		/// <summary>
+		/// Enters a new scope, such as when an element starts.
+		/// </summary>
+		public void PushScope() {
+			_depth++;
 
-/*		public void Clear() {
-			if( _currentDictionary != null )
-				_currentDictionary.Clear();
-		}*/
+			if( _depth == _scopeVersions.Length )
+				Array.Resize( ref _scopeVersions, _depth * 2 );
 
-		public void PushScope() {
-			if( _currentDictionary == null || _currentDictionary.Count == 0 ) {
-				// Don't push an empty dictionary on the stack; just remember that there was an empty dictionary here
-				_levelCount++;
-			}
-			else {
-				_stack.Push( new KeyValuePair<Dictionary<TKey,TValue>,int>( _currentDictionary, _levelCount ) );
-				_currentDictionary = null;
-				_levelCount = 0;
-			}
+			_scopeVersions[_depth] = ++_lastVersion;
 		}
-		
+
+		/// <summary>
+		/// Leaves the current scope, forgetting any prefixes bound in it.
+		/// </summary>
+		/// <exception cref='InvalidOperationException'>There is no scope to leave.</exception>
 		public void PopScope() {
-			if( _levelCount == 0 ) {
-				KeyValuePair<Dictionary<TKey,TValue>,int> pair = _stack.Pop();
-				_currentDictionary = pair.Key;
-				_levelCount = pair.Value;
-			}
-			else {
-				// There was an empty dictionary at the previous level, so make sure our current dictionary goes away
-				_levelCount--;
-				_currentDictionary = null;
+			if( _depth == 0 )
+				throw new InvalidOperationException( "There is no namespace scope to leave." );
+
+			_depth--;
+		}
+
+		/// <summary>
+		/// Removes bindings from the top of a prefix's stack that were declared in scopes that have since been left.
+		/// </summary>
+		/// <remarks>A binding is still in scope if the scope at its depth is the same one that declared it. Bindings below one
+		///     that is still in scope were declared by its ancestors, so the first live binding ends the search.</remarks>
+		private void DropClosedBindings( PrefixBindings bindings ) {
+			int count = bindings.Count;
+
+			while( count != 0 ) {
+				int depth = bindings.Depths[count - 1];
+
+				if( depth <= _depth && bindings.Versions[count - 1] == _scopeVersions[depth] )
+					break;
+
+				bindings.NamespaceUris[--count] = null;
 			}
-			
+
+			bindings.Count = count;
 		}
 	}
 	
 	public abstract class XmlAsyncTextReader : XmlAsyncReader {
-		ParserState _state;
+		const string XmlNamespace = "http://www.w3.org/XML/1998/namespace", XmlnsNamespace = "http://www.w3.org/2000/xmlns/";
+
+		XmlTokenizer _tokenizer;
+		XmlNameTable _nameTable = new NameTable();
+		NodePool _pool = new NodePool();
 		Node _currentNode = null;
 		AsynchronousQueue<Node> _nodeQueue = new AsynchronousQueue<Node>();
 		ReadState _readState = ReadState.Initial;
 		XmlException _error;
 		IAsyncResult _lastAsyncResult;
+		EmptyRead _completedRead;
 		object _readLock = new object();
-		bool _lastReadEmpty;
+		bool _lastReadEmpty, _lastReadFromBatch;
+
+		// Nodes parsed from the current buffer that haven't been queued yet
+		Node _batchHead, _batchTail;
+		bool _deliverInBatches;
 
 	#region Nodes
 		static string NodeToValue( Node node ) {
 			return node.ToString();
 		}
+
+		/// <summary>
+		/// Keeps nodes the reader has moved past so that the parser can use them again.
+		/// </summary>
+		/// <remarks>The parser takes nodes on whatever thread pushes data, and the reader gives them back on whatever thread
+		///     reads, so the pool takes a short lock for each. An element gives back its attributes along with it.</remarks>
+		sealed class NodePool {
+			const int __maxFreeCount = 256;
+
+			Stack<Node> _nodes = new Stack<Node>();
+			Stack<ElementNode> _elements = new Stack<ElementNode>();
+			Stack<Attribute> _attributes = new Stack<Attribute>();
+			object _lock = new object();
+
+			public Node GetNode( XmlNodeType type, string name, int depth, string value ) {
+				Node node = null;
+
+				lock( _lock ) {
+					if( _nodes.Count != 0 )
+						node = _nodes.Pop();
+				}
+
+				if( node == null )
+					node = new Node();
+
+				node.Initialize( type, name, depth, value );
+				return node;
+			}
+
+			public Node GetNode( XmlNodeType type, XmlNameCache.QualifiedName name, int depth, string value ) {
+				Node node = null;
+
+				lock( _lock ) {
+					if( _nodes.Count != 0 )
+						node = _nodes.Pop();
+				}
+
+				if( node == null )
+					node = new Node();
+
+				node.Initialize( type, name, depth, value );
+				return node;
+			}
+
+			public ElementNode GetElement( XmlNameCache.QualifiedName name, int depth ) {
+				ElementNode element = null;
+
+				lock( _lock ) {
+					if( _elements.Count != 0 )
+						element = _elements.Pop();
+				}
+
+				if( element == null )
+					element = new ElementNode();
+
+				element.Initialize( name, depth );
+				return element;
+			}
+
+			public Attribute GetAttribute( XmlNameCache.QualifiedName name, int depth, char quoteChar ) {
+				Attribute attribute = null;
+
+				lock( _lock ) {
+					if( _attributes.Count != 0 )
+						attribute = _attributes.Pop();
+				}
+
+				if( attribute == null )
+					attribute = new Attribute();
+
+				attribute.Initialize( name, depth, quoteChar );
+				return attribute;
+			}
+
+			/// <summary>
+			/// Returns a node, and any nodes it owns, to the pool.
+			/// </summary>
+			public void Release( Node node ) {
+				lock( _lock ) {
+					node.Recycle( this );
+				}
+			}
+
+			// These are called from Node.Recycle with the lock held
+			public void ReturnNode( Node node ) {
+				if( _nodes.Count < __maxFreeCount )
+					_nodes.Push( node );
+			}
+
+			public void ReturnElement( ElementNode element ) {
+				if( _elements.Count < __maxFreeCount )
+					_elements.Push( element );
+			}
+
+			public void ReturnAttribute( Attribute attribute ) {
+				if( _attributes.Count < __maxFreeCount )
+					_attributes.Push( attribute );
+			}
+		}
 		
 		sealed class Attribute : Node {
 			List<Node> _nodes = new List<Node>();
 			char _quoteChar;
 			int _currentNode = -1;
 			
-			public Attribute( string name, int depth, char quoteChar ) : base(XmlNodeType.Attribute, name, depth, null) {
+			public void Initialize( XmlNameCache.QualifiedName name, int depth, char quoteChar ) {
+				Initialize( XmlNodeType.Attribute, name, depth, null );
 				_quoteChar = quoteChar;
+				_currentNode = -1;
+			}
+
+			public override void Recycle( NodePool pool ) {
+				foreach( Node node in _nodes )
+					node.Recycle( pool );
+
+				_nodes.Clear();
+				Clear();
+				pool.ReturnAttribute( this );
 			}
 			
 			public void AddNode( Node node ) {
@@ -242,7 +401,22 @@ namespace Fluggo.Xml {
 			int _currentAttr = -1;
 			bool _isEmpty;
 
-			public ElementNode( string name, int depth ) : base( XmlNodeType.Element, name, depth, null ) {
+			public void Initialize( XmlNameCache.QualifiedName name, int depth ) {
+				Initialize( XmlNodeType.Element, name, depth, null );
+				_currentAttr = -1;
+				_isEmpty = false;
+			}
+
+			public override void Recycle( NodePool pool ) {
+				if( _attributes != null ) {
+					foreach( Attribute attr in _attributes )
+						attr.Recycle( pool );
+
+					_attributes.Clear();
+				}
+
+				Clear();
+				pool.ReturnElement( this );
 			}
 
 			public void AddAttribute( Attribute attribute ) {
@@ -255,9 +429,12 @@ namespace Fluggo.Xml {
 				_attributes.Add( attribute );
 			}
 			
-			public override void ResolveNamespaces( ScopedDictionary<string, string> namespaces ) {
+			public override void ResolveNamespaces( XmlNamespaceTable namespaces ) {
 				base.ResolveNamespaces( namespaces );
 				
+				if( _attributes == null )
+					return;
+
 				foreach( Attribute attr in _attributes )
 					attr.ResolveNamespaces( namespaces );
 			}
@@ -461,11 +638,15 @@ namespace Fluggo.Xml {
 			string _baseURI = string.Empty;
 			string _value;
 			XmlNodeType _type;
+			string _name;
 			string _localName;
 			string _prefix;
 			string _namespaceURI;
+
+			// Next node parsed from the same buffer, when nodes are delivered in batches
+			public Node NextInBatch;
 			
-			public Node( XmlNodeType type, string name, int depth, string value ) {
+			public void Initialize( XmlNodeType type, string name, int depth, string value ) {
 				_type = type;
 				_value = value;
 				
@@ -473,23 +654,23 @@ namespace Fluggo.Xml {
 					_value = string.Empty;
 				
 				if( name != null ) {
-					string[] nameParts = name.Split( new char[] { ':' }, 2 );
+					int colon = name.IndexOf( ':' );
+					_name = name;
 
-					if( nameParts.Length == 1 ) {
+					if( colon == -1 ) {
 						_prefix = null;
 						_namespaceURI = string.Empty;
-						_localName = nameParts[0];
+						_localName = name;
 					}
-					else if( nameParts.Length == 2 ) {
-						_prefix = nameParts[0];
+					else {
+						_prefix = name.Substring( 0, colon );
 						_namespaceURI = null;
 						
-						_localName = nameParts[1];
+						_localName = name.Substring( colon + 1 );
 					}
-					else
-						throw new UnexpectedException();
 				}
 				else {
+					_name = string.Empty;
 					_prefix = null;
 					_namespaceURI = string.Empty;
 					_localName = string.Empty;
@@ -497,14 +678,55 @@ namespace Fluggo.Xml {
 				
 				_depth = depth;
 			}
+
+			public void Initialize( XmlNodeType type, XmlNameCache.QualifiedName name, int depth, string value ) {
+				if( name == null )
+					throw new ArgumentNullException( "name" );
+
+				_type = type;
+				_value = value;
+				
+				if( _value == null )
+					_value = string.Empty;
+
+				_name = name.Name;
+				_prefix = name.Prefix;
+				_localName = name.LocalName;
+				_namespaceURI = (_prefix == null) ? string.Empty : null;
+				_depth = depth;
+			}
 			
 			public void AppendValue( string value ) {
 				_value += value;
 			}
 
-			public virtual void ResolveNamespaces( ScopedDictionary<string, string> namespaces ) {
+			/// <summary>
+			/// Clears the node and hands it back to the pool once the reader has moved past it.
+			/// </summary>
+			public virtual void Recycle( NodePool pool ) {
+				Clear();
+				pool.ReturnNode( this );
+			}
+
+			protected void Clear() {
+				_value = null;
+				_name = null;
+				_localName = null;
+				_prefix = null;
+				_namespaceURI = null;
+				NextInBatch = null;
+			}
+
+			public virtual void ResolveNamespaces( XmlNamespaceTable namespaces ) {
 				string uri;
 				
+				if( _prefix == null && _type == XmlNodeType.Attribute ) {
+					// Unprefixed attributes are never in the default namespace; a default namespace declaration
+					// belongs to the xmlns namespace like any other
+					_namespaceURI = (_localName == "xmlns") ? XmlnsNamespace : string.Empty;
+					return;
+				}
+
 				if( !namespaces.TryGetValue( (_prefix == null) ? string.Empty : _prefix, out uri ) ) {
 					if( _prefix == null )
 						_namespaceURI = null;
@@ -600,10 +822,7 @@ namespace Fluggo.Xml {
 			
 			public virtual string Name {
 				get {
-					if( _prefix != null )
-						return _prefix + ":" + _localName;
-					
-					return _localName;
+					return _name;
 				}
 			}
 			
@@ -643,19 +862,94 @@ namespace Fluggo.Xml {
 	#endregion
 
 		protected XmlAsyncTextReader() {
-			_state = new ParserState( new ParserListener( this ) );
-			_state.PushParser( new PrologParser( _state ) );
+			_tokenizer = new XmlTokenizer( new ParserListener( this ), _nameTable );
+
+			_completedRead = new EmptyRead( null, null );
+			_completedRead.CompleteRead();
+		}
+
+		/// <summary>
+		/// Gets or sets a value that represents whether parsed nodes are delivered a buffer at a time.
+		/// </summary>
+		/// <value>True if the nodes parsed from each buffer are queued together when the buffer has been parsed, or false if
+		///   each node is queued as soon as it is parsed. The default is false.</value>
+		/// <remarks>In batched mode, the <see cref="BeginRead"/> call that receives a batch is the only one that waits on the
+		///     queue. Reads for the rest of the nodes in the batch complete synchronously without taking anything from the queue,
+		///     and reads without a callback or state don't allocate at all. This suits streams where many small stanzas arrive
+		///     in each buffer.
+		///   <para>A change takes effect with the next buffer parsed.</para></remarks>
+		public bool DeliverInBatches {
+			get { return _deliverInBatches; }
+			set { _deliverInBatches = value; }
+		}
+
+		private void QueueNode( Node node ) {
+			if( !_deliverInBatches ) {
+				_nodeQueue.Enqueue( node );
+				return;
+			}
+
+			if( _batchHead == null )
+				_batchHead = node;
+			else
+				_batchTail.NextInBatch = node;
+
+			_batchTail = node;
+		}
+
+		private void FlushBatch() {
+			if( _batchHead == null )
+				return;
+
+			Node head = _batchHead;
+			_batchHead = null;
+			_batchTail = null;
+
+			_nodeQueue.Enqueue( head );
 		}
 
 		protected bool Parse( string text ) {
-			return _state.Parse( text );
+			try {
+				return _tokenizer.Parse( text );
+			}
+			finally {
+				FlushBatch();
+			}
+		}
+
+		protected bool Parse( char[] buffer, int offset, int count ) {
+			try {
+				return _tokenizer.Parse( buffer, offset, count );
+			}
+			finally {
+				FlushBatch();
+			}
+		}
+
+		/// <summary>
+		/// Parses the next part of a UTF-8 encoded document.
+		/// </summary>
+		/// <param name="buffer">Buffer containing the bytes to parse, as read from the network.</param>
+		/// <param name="offset">Offset in <paramref name="buffer"/> of the first byte to parse.</param>
+		/// <param name="count">Number of bytes to parse.</param>
+		/// <returns>True if more data is expected, or false if the root element has already been closed.</returns>
+		/// <remarks>Bytes are decoded directly into the parser, and a multibyte character can be split across calls.</remarks>
+		protected bool Parse( byte[] buffer, int offset, int count ) {
+			try {
+				return _tokenizer.Parse( buffer, offset, count );
+			}
+			finally {
+				FlushBatch();
+			}
 		}
 
 	#region Listener
 		class ParserListener : IXmlParseListener {
 			XmlAsyncTextReader _owner;
-			ScopedDictionary<string, string> _namespaces;
-			Stack<string> _elementNames = new Stack<string>();
+			XmlNamespaceTable _namespaces = new XmlNamespaceTable();
+			XmlNameCache _names;
+			Stack<XmlNameCache.QualifiedName> _elementNames = new Stack<XmlNameCache.QualifiedName>();
+			string _xmlnsPrefix;
 			ElementNode _element;
 			Attribute _attribute;
 			StringBuilder _text;
@@ -665,17 +959,20 @@ namespace Fluggo.Xml {
 					throw new ArgumentNullException( "owner" );
 
 				_owner = owner;
+				_names = new XmlNameCache( owner._nameTable );
+				_xmlnsPrefix = owner._nameTable.Add( "xmlns" );
 
-				_namespaces = new ScopedDictionary<string, string>();
-				_namespaces.Add( "xml", "http://www.w3.org/XML/1998/namespace" );
-				_namespaces.Add( "xmlns", "http://www.w3.org/2000/xmlns/" );
+				_namespaces.Add( owner._nameTable.Add( "xml" ), XmlNamespace );
+				_namespaces.Add( _xmlnsPrefix, XmlnsNamespace );
 			}
 		
 			public void PushElementName( string name ) {
 				ClearText();
 
-				_element = new ElementNode( name, _elementNames.Count );
-				_elementNames.Push( name );
+				XmlNameCache.QualifiedName qualifiedName = _names.Get( name );
+
+				_element = _owner._pool.GetElement( qualifiedName, _elementNames.Count );
+				_elementNames.Push( qualifiedName );
 				_namespaces.PushScope();
 			}
 
@@ -684,7 +981,7 @@ namespace Fluggo.Xml {
 					throw new InvalidOperationException( "Attribute name pushed with no active element." );
 					
 				ClearAttribute();
-				_attribute = new Attribute( name, _elementNames.Count, quoteChar );
+				_attribute = _owner._pool.GetAttribute( _names.Get( name ), _elementNames.Count, quoteChar );
 			}
 
 			public void PushAttributeText( string text ) {
@@ -737,11 +1034,11 @@ namespace Fluggo.Xml {
 				}
 				
 				if( _text != null ) {
-					_attribute.AddNode( new Node( XmlNodeType.Text, string.Empty, 0, _text.ToString() ) );
+					_attribute.AddNode( _owner._pool.GetNode( XmlNodeType.Text, string.Empty, 0, _text.ToString() ) );
 					_text = null;
 				}
 				
-				_attribute.AddNode( new Node( XmlNodeType.EntityReference, name, 0, null ) );
+				_attribute.AddNode( _owner._pool.GetNode( XmlNodeType.EntityReference, name, 0, null ) );
 			}
 
 			public void PushAttributeCharRef( int codePoint ) {
@@ -758,7 +1055,7 @@ namespace Fluggo.Xml {
 				if( _attribute != null ) {
 					// Close out the current text on the attribute
 					if( _text != null ) {
-						_attribute.AddNode( new Node( XmlNodeType.Text, string.Empty, 0, _text.ToString() ) );
+						_attribute.AddNode( _owner._pool.GetNode( XmlNodeType.Text, string.Empty, 0, _text.ToString() ) );
 						_text = null;
 					}
 //					else {
@@ -767,10 +1064,11 @@ namespace Fluggo.Xml {
 
 					_element.AddAttribute( _attribute );
 					
-					// Figure out if it's a new namespace
-					if( _attribute.Prefix == "xmlns" ) {
+					// Figure out if it's a new namespace; names come from the name table, so they can be compared by reference
+					if( (object) _attribute.Prefix == (object) _xmlnsPrefix )
 						_namespaces.Add( _attribute.LocalName, _attribute.Value );
-					}
+					else if( _attribute.Prefix.Length == 0 && (object) _attribute.LocalName == (object) _xmlnsPrefix )
+						_namespaces.Add( string.Empty, _attribute.Value );
 					
 					_attribute = null;
 				}
@@ -783,7 +1081,7 @@ namespace Fluggo.Xml {
 					// Resolve any and all namespace references
 					_element.ResolveNamespaces( _namespaces );
 					
-					_owner._nodeQueue.Enqueue( _element );
+					_owner.QueueNode( _element );
 					_element = null;
 				}
 			}
@@ -796,7 +1094,7 @@ namespace Fluggo.Xml {
 				
 				if( _text != null ) {
 					// Submit the text!
-					_owner._nodeQueue.Enqueue( new Node( XmlNodeType.Text, string.Empty, _elementNames.Count, _text.ToString() ) );
+					_owner.QueueNode( _owner._pool.GetNode( XmlNodeType.Text, string.Empty, _elementNames.Count, _text.ToString() ) );
 					_text = null;
 				}
 			}
@@ -858,11 +1156,17 @@ namespace Fluggo.Xml {
 				}
 
 				if( _text != null ) {
-					_owner._nodeQueue.Enqueue( new Node( XmlNodeType.Text, string.Empty, _elementNames.Count, _text.ToString() ) );
+					_owner.QueueNode( _owner._pool.GetNode( XmlNodeType.Text, string.Empty, _elementNames.Count, _text.ToString() ) );
 					_text = null;
 				}
 				
-				_owner._nodeQueue.Enqueue( new Node( XmlNodeType.EntityReference, name, _elementNames.Count, null ) );
+				_owner.QueueNode( _owner._pool.GetNode( XmlNodeType.EntityReference, name, _elementNames.Count, null ) );
+			}
+
+			public void PushCloseStartTag() {
+				// The element is complete; queue it now rather than waiting for whatever comes next,
+				// which might not arrive until the other side hears from us
+				ClearElement();
 			}
 
 			public void PushCloseEmptyElement() {
@@ -878,13 +1182,16 @@ namespace Fluggo.Xml {
 			public void PushEndElement() {
 				ClearText();
 				
+				Node endElement = _owner._pool.GetNode( XmlNodeType.EndElement, _elementNames.Pop(), _elementNames.Count, null );
+				endElement.ResolveNamespaces( _namespaces );
+
 				_namespaces.PopScope();
-				_owner._nodeQueue.Enqueue( new Node( XmlNodeType.EndElement, _elementNames.Pop(), _elementNames.Count, null ) );
+				_owner.QueueNode( endElement );
 			}
 
 			public void PushComment( string text ) {
 				ClearText();
-				_owner._nodeQueue.Enqueue( new Node( XmlNodeType.Comment, string.Empty, _elementNames.Count, text ) );
+				_owner.QueueNode( _owner._pool.GetNode( XmlNodeType.Comment, string.Empty, _elementNames.Count, text ) );
 			}
 
 			public void PushDoctype( string name, string publicID, string systemID ) {
@@ -903,7 +1210,7 @@ namespace Fluggo.Xml {
 					builder.Append( standalone.Value ? " standalone='yes'" : " standalone='no'" );
 				}
 				
-				_owner._nodeQueue.Enqueue( new Node( XmlNodeType.XmlDeclaration, "xml", 0, builder.ToString() ) );
+				_owner.QueueNode( _owner._pool.GetNode( XmlNodeType.XmlDeclaration, "xml", 0, builder.ToString() ) );
 			}
 
 			public void PushParseError( int line, int column, string error ) {
@@ -1096,11 +1403,14 @@ namespace Fluggo.Xml {
 		}
 
 		public override XmlNameTable NameTable {
-			get { throw new NotSupportedException(); }
+			get { return _nameTable; }
 		}
 
 		class EmptyRead : BaseAsyncResult {
 			public EmptyRead( AsyncCallback callback, object state ) : base( callback, state ) {
+			}
+
+			public void CompleteRead() {
 				Complete( true );
 			}
 		}
@@ -1108,6 +1418,8 @@ namespace Fluggo.Xml {
 		public override IAsyncResult BeginRead( AsyncCallback callback, object state ) {
 			if( _error != null )
 				throw _error;
+
+			EmptyRead read;
 				
 			lock( _readLock ) {
 				if( _lastAsyncResult != null ) {
@@ -1117,12 +1429,28 @@ namespace Fluggo.Xml {
 			
 				if( _readState == ReadState.EndOfFile || _readState == ReadState.Closed ) {
 					_lastReadEmpty = true;
-					return (_lastAsyncResult = new EmptyRead( callback, state ));
+					_lastReadFromBatch = false;
 				}
-				
-				_lastReadEmpty = false;
-				return (_lastAsyncResult = _nodeQueue.BeginDequeue( callback, state ));
+				else if( _currentNode != null && _currentNode.NextInBatch != null ) {
+					// The rest of the batch is already here
+					_lastReadEmpty = false;
+					_lastReadFromBatch = true;
+
+					if( callback == null && state == null )
+						return (_lastAsyncResult = _completedRead);
+				}
+				else {
+					_lastReadEmpty = false;
+					_lastReadFromBatch = false;
+					return (_lastAsyncResult = _nodeQueue.BeginDequeue( callback, state ));
+				}
+
+				// Publish the result before completing it so that the callback can end it
+				_lastAsyncResult = read = new EmptyRead( callback, state );
 			}
+
+			read.CompleteRead();
+			return read;
 		}
 
 		public override bool EndRead( IAsyncResult result ) {
@@ -1139,10 +1467,17 @@ namespace Fluggo.Xml {
 				throw _error;
 			}
 				
-			if( _lastReadEmpty )
+			if( _lastReadEmpty ) {
+				_lastAsyncResult = null;
 				return false;
+			}
 
-			Node node = _nodeQueue.EndDequeue( result );
+			Node node;
+
+			if( _lastReadFromBatch )
+				node = _currentNode.NextInBatch;
+			else
+				node = _nodeQueue.EndDequeue( result );
 
 			lock( _readLock ) {
 				if( _error != null ) {
@@ -1156,9 +1491,16 @@ namespace Fluggo.Xml {
 					return false;
 				}
 				else {
+					// Nothing can reach the old node once the reader has moved on, so it can be used again
+					Node previous = _currentNode;
+
 					_readState = ReadState.Interactive;
 					_currentNode = node;
 					_lastAsyncResult = null;
+
+					if( previous != null )
+						_pool.Release( previous );
+
 					return true;
 				}
 			}
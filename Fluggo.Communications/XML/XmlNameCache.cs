@@ -0,0 +1,112 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Collections.Generic;
+using System.Runtime.CompilerServices;
+using System.Xml;
+
+namespace Fluggo.Xml {
+	/// <summary>
+	/// Splits qualified names into their prefix and local name once, and remembers the result.
+	/// </summary>
+	/// <remarks>All of the strings the cache hands out are atomized in its <see cref="XmlNameTable"/>, so they can be
+	///     compared by reference. Names are looked up by reference too, which makes a lookup constant time no matter how
+	///     long the name is; a name that wasn't atomized in the same table is atomized first.
+	///   <para>A stream uses only a handful of distinct names, so after the first few elements every split is a single
+	///     hash lookup with no allocation.</para></remarks>
+	sealed class XmlNameCache {
+		XmlNameTable _nameTable;
+		Dictionary<string, QualifiedName> _names = new Dictionary<string, QualifiedName>( new ReferenceComparer() );
+
+		/// <summary>
+		/// A qualified name split into its parts.
+		/// </summary>
+		public sealed class QualifiedName {
+			public readonly string Name, Prefix, LocalName;
+
+			public QualifiedName( string name, string prefix, string localName ) {
+				Name = name;
+				Prefix = prefix;
+				LocalName = localName;
+			}
+		}
+
+		sealed class ReferenceComparer : IEqualityComparer<string> {
+			public bool Equals( string x, string y ) {
+				return object.ReferenceEquals( x, y );
+			}
+
+			public int GetHashCode( string obj ) {
+				return RuntimeHelpers.GetHashCode( obj );
+			}
+		}
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='XmlNameCache'/> class.
+		/// </summary>
+		/// <param name="nameTable"><see cref="XmlNameTable"/> in which to atomize names and their parts.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='nameTable'/> is <see langword='null'/>.</exception>
+		public XmlNameCache( XmlNameTable nameTable ) {
+			if( nameTable == null )
+				throw new ArgumentNullException( "nameTable" );
+
+			_nameTable = nameTable;
+		}
+
+		/// <summary>
+		/// Gets the name table used by the cache.
+		/// </summary>
+		/// <value>The <see cref="XmlNameTable"/> in which names are atomized.</value>
+		public XmlNameTable NameTable {
+			get { return _nameTable; }
+		}
+
+		/// <summary>
+		/// Gets the parts of a qualified name.
+		/// </summary>
+		/// <param name="name">Qualified name, such as "stream:features" or "message".</param>
+		/// <returns>The parts of the name. The prefix is <see langword='null'/> if the name has none.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='name'/> is <see langword='null'/>.</exception>
+		public QualifiedName Get( string name ) {
+			if( name == null )
+				throw new ArgumentNullException( "name" );
+
+			QualifiedName result;
+
+			if( _names.TryGetValue( name, out result ) )
+				return result;
+
+			string atom = _nameTable.Add( name );
+
+			if( !object.ReferenceEquals( atom, name ) && _names.TryGetValue( atom, out result ) )
+				return result;
+
+			int colon = atom.IndexOf( ':' );
+
+			if( colon == -1 )
+				result = new QualifiedName( atom, null, atom );
+			else
+				result = new QualifiedName( atom, _nameTable.Add( atom.Substring( 0, colon ) ), _nameTable.Add( atom.Substring( colon + 1 ) ) );
+
+			_names.Add( atom, result );
+			return result;
+		}
+	}
+}
@@ -0,0 +1,118 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Collections.Generic;
+using System.Threading;
+
+namespace Fluggo.Communications.Xmpp {
+	/// <summary>
+	/// Maps stream IDs to the connections that own them.
+	/// </summary>
+	/// <remarks>The table is split into stripes by the hash of the stream ID, and each stripe has its own lock. Connections
+	///     opening and closing on different threads rarely touch the same stripe, so they don't line up behind one lock the
+	///     way they would with a single dictionary.</remarks>
+	sealed class XmppConnectionTable {
+		const int __stripeCount = 32;
+		Dictionary<string, XmppServerConnection>[] _stripes = new Dictionary<string, XmppServerConnection>[__stripeCount];
+		int _count;
+
+		public XmppConnectionTable() {
+			for( int i = 0; i < _stripes.Length; i++ )
+				_stripes[i] = new Dictionary<string, XmppServerConnection>();
+		}
+
+		/// <summary>
+		/// Gets the number of connections in the table.
+		/// </summary>
+		/// <value>The number of connections in the table.</value>
+		public int Count {
+			get { return Thread.VolatileRead( ref _count ); }
+		}
+
+		/// <summary>
+		/// Adds a connection to the table if its stream ID is not already taken.
+		/// </summary>
+		/// <param name="streamId">Stream ID of the connection.</param>
+		/// <param name="connection">Connection to add.</param>
+		/// <returns>True if the connection was added, or false if another connection already has the stream ID.</returns>
+		public bool TryAdd( string streamId, XmppServerConnection connection ) {
+			if( streamId == null )
+				throw new ArgumentNullException( "streamId" );
+
+			if( connection == null )
+				throw new ArgumentNullException( "connection" );
+
+			Dictionary<string, XmppServerConnection> stripe = GetStripe( streamId );
+
+			lock( stripe ) {
+				if( stripe.ContainsKey( streamId ) )
+					return false;
+
+				stripe.Add( streamId, connection );
+			}
+
+			Interlocked.Increment( ref _count );
+			return true;
+		}
+
+		/// <summary>
+		/// Removes a connection from the table.
+		/// </summary>
+		/// <param name="streamId">Stream ID of the connection to remove.</param>
+		/// <returns>True if the connection was removed, or false if no connection has the stream ID.</returns>
+		public bool Remove( string streamId ) {
+			if( streamId == null )
+				throw new ArgumentNullException( "streamId" );
+
+			Dictionary<string, XmppServerConnection> stripe = GetStripe( streamId );
+
+			lock( stripe ) {
+				if( !stripe.Remove( streamId ) )
+					return false;
+			}
+
+			Interlocked.Decrement( ref _count );
+			return true;
+		}
+
+		/// <summary>
+		/// Finds the connection with the given stream ID.
+		/// </summary>
+		/// <param name="streamId">Stream ID of the connection to find.</param>
+		/// <returns>The connection with the given stream ID, or <see langword='null'/> if there isn't one.</returns>
+		public XmppServerConnection Find( string streamId ) {
+			if( streamId == null )
+				throw new ArgumentNullException( "streamId" );
+
+			Dictionary<string, XmppServerConnection> stripe = GetStripe( streamId );
+			XmppServerConnection connection;
+
+			lock( stripe ) {
+				stripe.TryGetValue( streamId, out connection );
+			}
+
+			return connection;
+		}
+
+		private Dictionary<string, XmppServerConnection> GetStripe( string streamId ) {
+			return _stripes[(streamId.GetHashCode() & 0x7FFFFFFF) % __stripeCount];
+		}
+	}
+}
@@ -5,35 +5,77 @@ using System.Globalization;
 using System.Xml;
 using System.IO;
 using System.Collections.ObjectModel;
+using System.Diagnostics;
 using System.Security.Cryptography;
+using Fluggo.Xml;
 
 namespace Fluggo.Communications.Xmpp {
 	/// <summary>
 	/// Represents a single XMPP server instance.
 	/// </summary>
 	public class XmppServer {
-		HostNameList _alternateHostNames, _expiredHostNames;
+		HostNameList _alternateHostNames = new HostNameList(), _expiredHostNames = new HostNameList();
 		RandomNumberGenerator _rng;
 		string _hostName;
 		bool _useAsync;
-		Dictionary<string,XmppServerConnection> _connectionsById = new Dictionary<string,XmppServerConnection>();
+		XmppConnectionTable _connectionsById = new XmppConnectionTable();
 
 		/// <summary>
 		/// Creates a new instance of the <see cref='XmppServer'/> class.
 		/// </summary>
 		/// <param name="hostName">The default host name to give to clients.</param>
 		/// <param name="useAsync">True to use asynchronous operations, false otherwise.</param>
+		/// <remarks>With asynchronous operations, <see cref="AcceptConnection"/> returns right away and each connection is
+		///     served from the thread pool as data arrives, so an idle connection doesn't hold a thread. Stanzas are handed to
+		///     the <see cref="StanzaReceived"/> event.
+		///   <para>Without them, <see cref="AcceptConnection"/> blocks until the client has opened its stream.</para></remarks>
 		public XmppServer( string hostName, bool useAsync ) {
-			if( useAsync )
-				throw new NotImplementedException( "Asynchronous operations are not implemented." );
-
 			if( Uri.CheckHostName( hostName ) == UriHostNameType.Unknown )
 				throw new ArgumentException( "Invalid host name.", "hostName" );
 
 			_hostName = hostName;
+			_useAsync = useAsync;
 			_rng = RandomNumberGenerator.Create();
 		}
 
+		/// <summary>
+		/// Occurs when an asynchronous connection receives a stanza.
+		/// </summary>
+		/// <remarks>The event is raised on a thread pool thread, one stanza at a time for each connection. The stanza's bytes
+		///   are only valid until the handler returns. Exceptions thrown by a handler close the connection with an
+		///   internal-server-error; throw an <see cref="XmppStreamException"/> to close it with a specific error.</remarks>
+		public event EventHandler<XmppStanzaEventArgs> StanzaReceived;
+
+		internal void OnStanzaReceived( XmppServerConnection connection, XmppStanzaSplitter splitter ) {
+			EventHandler<XmppStanzaEventArgs> handler = StanzaReceived;
+
+			if( handler != null )
+				handler( this, new XmppStanzaEventArgs( connection, splitter ) );
+		}
+
+		/// <summary>
+		/// Gets the number of open connections that have been assigned a stream ID.
+		/// </summary>
+		/// <value>The number of open connections that have been assigned a stream ID.</value>
+		public int ConnectionCount {
+			get {
+				return _connectionsById.Count;
+			}
+		}
+
+		/// <summary>
+		/// Finds an open connection by its stream ID.
+		/// </summary>
+		/// <param name="streamId">Stream ID of the connection.</param>
+		/// <returns>The connection with the given stream ID, or <see langword='null'/> if there is no such connection.</returns>
+		/// <exception cref='ArgumentNullException'><paramref name='streamId'/> is <see langword='null'/>.</exception>
+		public XmppServerConnection FindConnection( string streamId ) {
+			if( streamId == null )
+				throw new ArgumentNullException( "streamId" );
+
+			return _connectionsById.Find( streamId );
+		}
+
 		/// <summary>
 		/// Gets the default host name of this server.
 		/// </summary>
@@ -76,19 +118,22 @@ namespace Fluggo.Communications.Xmpp {
 		}
 		
 		internal string AssignStreamId( XmppServerConnection connection ) {
-			lock( _connectionsById ) {
-				for( int i = 0; i < 10; i++ ) {
-					string streamId = CreateStreamId();
-					
-					if( _connectionsById.ContainsKey( streamId ) )
-						continue;
-						
-					_connectionsById[streamId] = connection;
-					return streamId;
+			for( int i = 0; i < 10; i++ ) {
+				string streamId;
+
+				lock( _rng ) {
+					streamId = CreateStreamId();
 				}
 				
-				throw new ResourceConstraintException( "Server is too busy. Please try again later.\nThe specific error was: Unable to create a stream ID." );
+				if( _connectionsById.TryAdd( streamId, connection ) )
+					return streamId;
 			}
+			
+			throw new ResourceConstraintException( "Server is too busy. Please try again later.\nThe specific error was: Unable to create a stream ID." );
+		}
+
+		internal void ReleaseStreamId( string streamId ) {
+			_connectionsById.Remove( streamId );
 		}
 	}
 
@@ -250,17 +295,105 @@ namespace Fluggo.Communications.Xmpp {
 		}
 	}
 	
+	/// <summary>
+	/// Provides data for the <see cref="XmppServer.StanzaReceived"/> event.
+	/// </summary>
+	public class XmppStanzaEventArgs : EventArgs {
+		XmppServerConnection _connection;
+		string _name, _to, _from, _id, _type;
+		ArraySegment<byte> _data;
+
+		internal XmppStanzaEventArgs( XmppServerConnection connection, XmppStanzaSplitter splitter ) {
+			_connection = connection;
+			_name = splitter.Name;
+			_to = splitter.To;
+			_from = splitter.From;
+			_id = splitter.Id;
+			_type = splitter.Type;
+			_data = splitter.Data;
+		}
+
+		/// <summary>
+		/// Gets the connection that received the stanza.
+		/// </summary>
+		/// <value>The connection that received the stanza.</value>
+		public XmppServerConnection Connection {
+			get { return _connection; }
+		}
+
+		/// <summary>
+		/// Gets the qualified name of the stanza's element.
+		/// </summary>
+		/// <value>The qualified name of the stanza's element, such as "message" or "iq".</value>
+		public string Name {
+			get { return _name; }
+		}
+
+		/// <summary>
+		/// Gets the stanza's "to" attribute.
+		/// </summary>
+		/// <value>The value of the "to" attribute, or <see langword='null'/> if there isn't one.</value>
+		public string To {
+			get { return _to; }
+		}
+
+		/// <summary>
+		/// Gets the stanza's "from" attribute.
+		/// </summary>
+		/// <value>The value of the "from" attribute, or <see langword='null'/> if there isn't one.</value>
+		public string From {
+			get { return _from; }
+		}
+
+		/// <summary>
+		/// Gets the stanza's "id" attribute.
+		/// </summary>
+		/// <value>The value of the "id" attribute, or <see langword='null'/> if there isn't one.</value>
+		public string Id {
+			get { return _id; }
+		}
+
+		/// <summary>
+		/// Gets the stanza's "type" attribute.
+		/// </summary>
+		/// <value>The value of the "type" attribute, or <see langword='null'/> if there isn't one.</value>
+		public string Type {
+			get { return _type; }
+		}
+
+		/// <summary>
+		/// Gets the bytes of the stanza.
+		/// </summary>
+		/// <value>The bytes of the stanza exactly as they arrived.</value>
+		/// <remarks>The segment refers to the connection's receive buffer, and is only valid until the event handler returns.
+		///   Copy it if you need it later.</remarks>
+		public ArraySegment<byte> Data {
+			get { return _data; }
+		}
+	}
+
 	/// <summary>
 	/// Represents a single XMPP session from the server's viewpoint.
 	/// </summary>
 	public class XmppServerConnection {
+		static TraceSource _ts = new TraceSource( "XmppServerConnection", SourceLevels.Error );
+		const int __receiveBufferSize = 4096, __maxCoalescedSend = 16384;
+
 		XmppServer _server;
 		XmlReader _reader;
 		XmlWriter _writer;
 		Stream _stream;
-		bool _useAsync, _isOpen;
+		bool _useAsync, _isOpen, _endSent;
 		SessionTagInfo _sessionInfo;
 		string _streamId;
+		object _writerLock = new object();
+
+		// Asynchronous mode
+		XmppStanzaSplitter _splitter;
+		byte[] _receiveBuffer;
+		object _sendLock = new object();
+		Queue<byte[]> _sendQueue;
+		bool _sending, _closing, _closed;
 
 		struct SessionTagInfo {
 			public int ClientVersionMajor, ClientVersionMinor;
@@ -268,18 +401,106 @@ namespace Fluggo.Communications.Xmpp {
 			public string TargetHost;
 		}
 
+		/// <summary>
+		/// Stream that hands the writer's output to the connection's send queue.
+		/// </summary>
+		/// <remarks>Writes complete as soon as the bytes are queued, so flushing the writer never waits on the network.</remarks>
+		sealed class SendQueueStream : Stream {
+			XmppServerConnection _owner;
+
+			public SendQueueStream( XmppServerConnection owner ) {
+				_owner = owner;
+			}
+
+			public override bool CanRead {
+				get { return false; }
+			}
+
+			public override bool CanSeek {
+				get { return false; }
+			}
+
+			public override bool CanWrite {
+				get { return true; }
+			}
+
+			public override long Length {
+				get { throw new NotSupportedException(); }
+			}
+
+			public override long Position {
+				get { throw new NotSupportedException(); }
+				set { throw new NotSupportedException(); }
+			}
+
+			public override void Flush() {
+			}
+
+			public override int Read( byte[] buffer, int offset, int count ) {
+				throw new NotSupportedException();
+			}
+
+			public override long Seek( long offset, SeekOrigin origin ) {
+				throw new NotSupportedException();
+			}
+
+			public override void SetLength( long value ) {
+				throw new NotSupportedException();
+			}
+
+			public override void Write( byte[] buffer, int offset, int count ) {
+				_owner.Send( buffer, offset, count );
+			}
+
+			public override IAsyncResult BeginWrite( byte[] buffer, int offset, int count, AsyncCallback callback, object state ) {
+				EmptyAsyncResult<bool> result = new EmptyAsyncResult<bool>( callback, state );
+
+				try {
+					Write( buffer, offset, count );
+					result.Complete( true );
+				}
+				catch( Exception ex ) {
+					result.CompleteError( ex );
+				}
+
+				return result;
+			}
+
+			public override void EndWrite( IAsyncResult result ) {
+				if( result == null )
+					throw new ArgumentNullException( "result" );
+
+				EmptyAsyncResult<bool> write = result as EmptyAsyncResult<bool>;
+
+				if( write == null )
+					throw new ArgumentException( "The given asynchronous result did not originate from a BeginWrite call on this object.", "result" );
+
+				write.End();
+			}
+		}
+
 		internal XmppServerConnection( XmppServer server, Stream stream, bool useAsync ) {
 			if( stream == null )
 				throw new ArgumentNullException( "stream" );
 
-			if( useAsync )
-				throw new NotImplementedException( "Asynchronous operations are not implemented." );
-
 			if( server == null )
 				throw new ArgumentNullException( "server" );
 
 			_stream = stream;
 			_server = server;
+			_useAsync = useAsync;
+
+			if( useAsync ) {
+				// The stream header and everything after it are handled as they arrive; nothing here waits on the client.
+				// The reader is only used to check the header, and the writer queues its output for the send pump.
+				_splitter = new XmppStanzaSplitter();
+				_receiveBuffer = new byte[__receiveBufferSize];
+				_sendQueue = new Queue<byte[]>();
+				_writer = new XmlTextAsyncWriter( new SendQueueStream( this ), Encoding.UTF8 );
+
+				BeginReceive();
+				return;
+			}
 
 			XmlWriterSettings writerSettings = new XmlWriterSettings();
 			writerSettings.ConformanceLevel = ConformanceLevel.Document;
@@ -306,6 +527,16 @@ namespace Fluggo.Communications.Xmpp {
 			SendStreamOpen();
 		}
 
+		/// <summary>
+		/// Gets the stream ID assigned to the connection.
+		/// </summary>
+		/// <value>The stream ID assigned to the connection, or <see langword='null'/> if the client hasn't opened its stream yet.</value>
+		public string StreamId {
+			get {
+				return _streamId;
+			}
+		}
+
 		/// <summary>
 		/// Reads the opening &lt;stream&gt; tag.
 		/// </summary>
@@ -330,109 +561,486 @@ namespace Fluggo.Communications.Xmpp {
 					break;
 				}
 
-				if( _reader.NodeType != XmlNodeType.Element || _reader.LocalName != Xmpp.Streams.Tags.Stream )
-					throw new InvalidXmlException();
+				CheckStreamOpen( _reader );
+			}
+			catch( XmppStreamException ex ) {
+				SendFatalStreamError( ex.TagName, ex.Message );
+				throw;
+			}
+		}
+
+		/// <summary>
+		/// Checks the opening &lt;stream&gt; tag and records the session information in it.
+		/// </summary>
+		/// <param name="reader">Reader positioned on the opening tag.</param>
+		private void CheckStreamOpen( XmlReader reader ) {
+			if( reader.NodeType != XmlNodeType.Element || reader.LocalName != Xmpp.Streams.Tags.Stream )
+				throw new InvalidXmlException();
 
-				if( _reader.NamespaceURI != Xmpp.Streams.Namespace )
-					throw new InvalidNamespaceException();
+			if( reader.NamespaceURI != Xmpp.Streams.Namespace )
+				throw new InvalidNamespaceException();
 
-				// Check the "version" attribute, if any
-				string version = _reader[Xmpp.Streams.Attributes.Version];
+			// Check the "version" attribute, if any
+			string version = reader[Xmpp.Streams.Attributes.Version];
 
-				if( version != null ) {
-					string[] versionSplit = version.Split( new char[] { '.' }, 2 );
+			if( version != null ) {
+				string[] versionSplit = version.Split( new char[] { '.' }, 2 );
 
-					if( versionSplit.Length == 2 ) {
-						if( !int.TryParse( versionSplit[0], out _sessionInfo.ClientVersionMajor ) ||
-								!int.TryParse( versionSplit[1], out _sessionInfo.ClientVersionMinor ) ) {
-							_sessionInfo.ClientVersionMajor = 0;
-							_sessionInfo.ClientVersionMinor = 0;
-						}
+				if( versionSplit.Length == 2 ) {
+					if( !int.TryParse( versionSplit[0], out _sessionInfo.ClientVersionMajor ) ||
+							!int.TryParse( versionSplit[1], out _sessionInfo.ClientVersionMinor ) ) {
+						_sessionInfo.ClientVersionMajor = 0;
+						_sessionInfo.ClientVersionMinor = 0;
 					}
 				}
+			}
 
-				if( _sessionInfo.ClientVersionMajor < 1 )
-					throw new UnsupportedVersionException();
+			if( _sessionInfo.ClientVersionMajor < 1 )
+				throw new UnsupportedVersionException();
 
-				// Check the "to" attribute, if any
-				string to = _reader[Xmpp.Streams.Attributes.To];
+			// Check the "to" attribute, if any
+			string to = reader[Xmpp.Streams.Attributes.To];
 
-				if( to != null ) {
-					// Validate the hostname
-					if( to == _server.HostName || _server.AlternateHostNames.Contains( to ) ) {
-						// Avoid memory leaks by keeping only the existing string
-						_sessionInfo.TargetHost = string.Intern( to );
-					}
-					else {
-						// Is it one we moved away from?
-						if( _server.ExpiredHostNames.Contains( to ) )
-							throw new HostGoneException();
+			if( to != null ) {
+				// Validate the hostname
+				if( to == _server.HostName || _server.AlternateHostNames.Contains( to ) ) {
+					// Avoid memory leaks by keeping only the existing string
+					_sessionInfo.TargetHost = string.Intern( to );
+				}
+				else {
+					// Is it one we moved away from?
+					if( _server.ExpiredHostNames.Contains( to ) )
+						throw new HostGoneException();
 
-						// Bad hostname
-						throw new HostUnknownException();
-					}
+					// Bad hostname
+					throw new HostUnknownException();
 				}
+			}
 
-				// Check the language attribute, if any
-				string language = _reader[Xmpp.Xml.Attributes.Language, Xmpp.Xml.Namespace];
+			// Check the language attribute, if any
+			string language = reader[Xmpp.Xml.Attributes.Language, Xmpp.Xml.Namespace];
 
-				if( language != null ) {
-					try {
-						_sessionInfo.Language = CultureInfo.GetCultureInfoByIetfLanguageTag( language );
-					}
-					catch( ArgumentException ) {
-						throw new BadFormatException( "The client requested an unrecognized language: " + language );
-					}
+			if( language != null ) {
+				try {
+					_sessionInfo.Language = CultureInfo.GetCultureInfoByIetfLanguageTag( language );
+				}
+				catch( ArgumentException ) {
+					throw new BadFormatException( "The client requested an unrecognized language: " + language );
 				}
-			}
-			catch( XmppStreamException ex ) {
-				SendFatalStreamError( ex.TagName, ex.Message );
-				throw;
 			}
 		}
 		
 		private void SendStreamOpen() {
-			_writer.WriteStartElement( Xmpp.Streams.Prefix, Xmpp.Streams.Tags.Stream, Xmpp.Streams.Namespace );
-			_writer.WriteAttributeString( "xmlns", null, Xmpp.Jabber.ClientNamespace );
-			_writer.WriteAttributeString( "xmlns", Xmpp.Streams.Prefix, null, Xmpp.Streams.Namespace );
-			_writer.WriteAttributeString( Xmpp.Streams.Attributes.From, _sessionInfo.TargetHost );
-			_writer.WriteAttributeString( Xmpp.Streams.Attributes.Id, _streamId );
-			_writer.WriteAttributeString( Xmpp.Streams.Attributes.Version, "1.0" );
-			_writer.WriteStartElement( Xmpp.Streams.Prefix, Xmpp.Streams.Tags.Features, Xmpp.Streams.Namespace );
-			_writer.WriteEndElement();
-			_writer.Flush();
-		}
-
-		private void SendFatalStreamError( string errorElement, string errorMessage ) {
-			if( !_isOpen ) {
-				// Send the opening stream element so that we can send an error message
+			lock( _writerLock ) {
 				_writer.WriteStartElement( Xmpp.Streams.Prefix, Xmpp.Streams.Tags.Stream, Xmpp.Streams.Namespace );
 				_writer.WriteAttributeString( "xmlns", null, Xmpp.Jabber.ClientNamespace );
 				_writer.WriteAttributeString( "xmlns", Xmpp.Streams.Prefix, null, Xmpp.Streams.Namespace );
-				_writer.WriteAttributeString( Xmpp.Streams.Attributes.From, _server.HostName );
+				_writer.WriteAttributeString( Xmpp.Streams.Attributes.From, _sessionInfo.TargetHost );
+				_writer.WriteAttributeString( Xmpp.Streams.Attributes.Id, _streamId );
 				_writer.WriteAttributeString( Xmpp.Streams.Attributes.Version, "1.0" );
-			}
+				_writer.WriteStartElement( Xmpp.Streams.Prefix, Xmpp.Streams.Tags.Features, Xmpp.Streams.Namespace );
+				_writer.WriteEndElement();
+				FlushWriter();
 
-			_writer.WriteStartElement( Xmpp.Streams.Prefix, Xmpp.Streams.Tags.Error, Xmpp.Streams.Namespace );
+				_isOpen = true;
+			}
+		}
 
-			_writer.WriteStartElement( null, errorElement, Xmpp.StreamErrors.Namespace );
-			_writer.WriteAttributeString( "xmlns", null, Xmpp.StreamErrors.Namespace );
-			_writer.WriteEndElement();
+		private void SendStreamEnd() {
+			lock( _writerLock ) {
+				if( !_isOpen || _endSent )
+					return;
 
-			if( errorMessage != null ) {
-				_writer.WriteStartElement( null, Xmpp.StreamErrors.Tags.Text, Xmpp.StreamErrors.Namespace );
-				_writer.WriteAttributeString( "xmlns", null, Xmpp.StreamErrors.Namespace );
-				_writer.WriteString( errorMessage );
+				_endSent = true;
 				_writer.WriteEndElement();
+				FlushWriter();
+			}
+		}
+
+		private void SendFatalStreamError( string errorElement, string errorMessage ) {
+			lock( _writerLock ) {
+				if( !_endSent ) {
+					_endSent = true;
+
+					if( !_isOpen ) {
+						// Send the opening stream element so that we can send an error message
+						_writer.WriteStartElement( Xmpp.Streams.Prefix, Xmpp.Streams.Tags.Stream, Xmpp.Streams.Namespace );
+						_writer.WriteAttributeString( "xmlns", null, Xmpp.Jabber.ClientNamespace );
+						_writer.WriteAttributeString( "xmlns", Xmpp.Streams.Prefix, null, Xmpp.Streams.Namespace );
+						_writer.WriteAttributeString( Xmpp.Streams.Attributes.From, _server.HostName );
+						_writer.WriteAttributeString( Xmpp.Streams.Attributes.Version, "1.0" );
+					}
+
+					_writer.WriteStartElement( Xmpp.Streams.Prefix, Xmpp.Streams.Tags.Error, Xmpp.Streams.Namespace );
+
+					_writer.WriteStartElement( null, errorElement, Xmpp.StreamErrors.Namespace );
+					_writer.WriteAttributeString( "xmlns", null, Xmpp.StreamErrors.Namespace );
+					_writer.WriteEndElement();
+
+					if( errorMessage != null ) {
+						_writer.WriteStartElement( null, Xmpp.StreamErrors.Tags.Text, Xmpp.StreamErrors.Namespace );
+						_writer.WriteAttributeString( "xmlns", null, Xmpp.StreamErrors.Namespace );
+						_writer.WriteString( errorMessage );
+						_writer.WriteEndElement();
+					}
+
+					_writer.WriteEndElement();
+					_writer.WriteEndElement();
+					
+					FlushWriter();
+				}
+			}
+
+			if( _useAsync ) {
+				CloseAfterSend();
+				return;
 			}
 
-			_writer.WriteEndElement();
-			_writer.WriteEndElement();
-			
-			_writer.Flush();
 			_stream.Flush();
-			
-			_stream.Close();
+			CloseNow();
+		}
+
+		private void FlushWriter() {
+			if( !_useAsync ) {
+				_writer.Flush();
+				return;
+			}
+
+			// The send queue stream completes the write as soon as the bytes are queued
+			XmlAsyncWriter writer = (XmlAsyncWriter) _writer;
+			writer.EndFlush( writer.BeginFlush( null, null ) );
+		}
+
+		/// <summary>
+		/// Sends raw bytes to the client.
+		/// </summary>
+		/// <param name="buffer">Buffer containing the bytes to send.</param>
+		/// <param name="offset">Offset in <paramref name="buffer"/> of the first byte to send.</param>
+		/// <param name="count">Number of bytes to send.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='buffer'/> is <see langword='null'/>.</exception>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="offset"/> or <paramref name="count"/> is out of range.</exception>
+		/// <exception cref="InvalidOperationException">The connection is not using asynchronous operations.</exception>
+		/// <remarks>The bytes are copied and queued, and the call returns without waiting for the network. They should be one
+		///     or more complete stanzas, such as the <see cref="XmppStanzaEventArgs.Data"/> of a stanza being routed to this
+		///     client.
+		///   <para>Bytes sent after the connection has started closing are discarded.</para></remarks>
+		public void Send( byte[] buffer, int offset, int count ) {
+			if( buffer == null )
+				throw new ArgumentNullException( "buffer" );
+
+			if( offset < 0 || offset > buffer.Length )
+				throw new ArgumentOutOfRangeException( "offset" );
+
+			if( count < 0 || count > buffer.Length - offset )
+				throw new ArgumentOutOfRangeException( "count" );
+
+			if( !_useAsync )
+				throw new InvalidOperationException( "Raw sends are only available on asynchronous connections." );
+
+			if( count == 0 )
+				return;
+
+			byte[] copy = new byte[count];
+			Buffer.BlockCopy( buffer, offset, copy, 0, count );
+
+			lock( _sendLock ) {
+				if( _closing || _closed )
+					return;
+
+				_sendQueue.Enqueue( copy );
+
+				if( _sending )
+					return;
+
+				_sending = true;
+			}
+
+			PumpSend();
+		}
+
+		/// <summary>
+		/// Closes the client's stream and then the connection.
+		/// </summary>
+		/// <remarks>On an asynchronous connection, the connection closes once everything queued before the call has been sent.</remarks>
+		public void Close() {
+			SendStreamEnd();
+
+			if( _useAsync )
+				CloseAfterSend();
+			else
+				CloseNow();
+		}
+
+	#region Asynchronous receive
+		private void BeginReceive() {
+			for( ;; ) {
+				IAsyncResult result;
+
+				try {
+					result = _stream.BeginRead( _receiveBuffer, 0, _receiveBuffer.Length, HandleReceive, null );
+
+					if( !result.CompletedSynchronously )
+						return;
+
+					if( !EndReceive( result ) )
+						return;
+				}
+				catch( Exception ex ) {
+					HandleReceiveError( ex );
+					return;
+				}
+			}
+		}
+
+		private void HandleReceive( IAsyncResult result ) {
+			if( result.CompletedSynchronously )
+				return;
+
+			try {
+				if( !EndReceive( result ) )
+					return;
+			}
+			catch( Exception ex ) {
+				HandleReceiveError( ex );
+				return;
+			}
+
+			BeginReceive();
+		}
+
+		/// <summary>
+		/// Finishes a read from the client and handles everything in it.
+		/// </summary>
+		/// <returns>True if the connection should keep reading, or false if it is closing.</returns>
+		private bool EndReceive( IAsyncResult result ) {
+			int count = _stream.EndRead( result );
+
+			if( count == 0 ) {
+				// The client went away without closing its stream
+				CloseNow();
+				return false;
+			}
+
+			_splitter.Push( _receiveBuffer, 0, count );
+
+			while( _splitter.Read() ) {
+				switch( _splitter.Kind ) {
+					case XmppStanzaKind.StreamStart:
+						OpenStream();
+						break;
+
+					case XmppStanzaKind.Stanza:
+						_server.OnStanzaReceived( this, _splitter );
+						break;
+
+					case XmppStanzaKind.StreamEnd:
+						Close();
+						return false;
+				}
+
+				if( _closing || _closed )
+					return false;
+			}
+
+			return !(_closing || _closed);
+		}
+
+		/// <summary>
+		/// Checks the client's stream header and opens the server's stream in reply.
+		/// </summary>
+		/// <remarks>The splitter has already found the whole start tag, so the push reader has the element node ready as soon
+		///   as the tag is parsed, and the read below completes without waiting.</remarks>
+		private void OpenStream() {
+			ArraySegment<byte> header = _splitter.Data;
+			XmlAsyncPushTextReader reader = new XmlAsyncPushTextReader();
+			reader.Parse( header.Array, header.Offset, header.Count );
+
+			IAsyncResult result = reader.BeginRead( null, null );
+
+			if( !result.IsCompleted || !reader.EndRead( result ) )
+				throw new InvalidXmlException();
+
+			CheckStreamOpen( reader );
+			_streamId = _server.AssignStreamId( this );
+			SendStreamOpen();
+		}
+
+		private void HandleReceiveError( Exception ex ) {
+			if( ex is IOException || ex is ObjectDisposedException ) {
+				// The transport is gone; there's no one left to tell
+				CloseNow();
+				return;
+			}
+
+			XmppStreamException streamEx = ex as XmppStreamException;
+
+			if( streamEx == null ) {
+				if( ex is XmlException ) {
+					streamEx = new XmlNotWellFormedException( ex.Message );
+				}
+				else {
+					_ts.TraceEvent( TraceEventType.Error, 0, "Closing stream {0} after an unexpected error: {1}", _streamId, ex );
+					streamEx = new InternalServerErrorException();
+				}
+			}
+
+			try {
+				SendFatalStreamError( streamEx.TagName, streamEx.Message );
+			}
+			catch( Exception sendEx ) {
+				_ts.TraceEvent( TraceEventType.Information, 0, "Could not send a stream error to stream {0}: {1}", _streamId, sendEx.Message );
+				CloseNow();
+			}
+		}
+	#endregion
+
+	#region Asynchronous send
+		/// <summary>
+		/// Writes the send queue to the stream until it is empty.
+		/// </summary>
+		/// <remarks>Only one pump runs at a time, guarded by <see cref="_sending"/>. Queued buffers are coalesced so that
+		///   a burst of small stanzas goes out in a few large writes.</remarks>
+		private void PumpSend() {
+			for( ;; ) {
+				byte[] buffer = null;
+				bool close = false;
+
+				lock( _sendLock ) {
+					if( !_closed && _sendQueue.Count != 0 ) {
+						buffer = TakeSendBuffer();
+					}
+					else {
+						_sending = false;
+						close = _closing && !_closed;
+					}
+				}
+
+				if( buffer == null ) {
+					// Everything queued before the close has gone out
+					if( close )
+						CloseNow();
+
+					return;
+				}
+
+				IAsyncResult result;
+
+				try {
+					result = _stream.BeginWrite( buffer, 0, buffer.Length, HandleSend, null );
+
+					if( !result.CompletedSynchronously )
+						return;
+
+					_stream.EndWrite( result );
+				}
+				catch( Exception ex ) {
+					HandleSendError( ex );
+					return;
+				}
+			}
+		}
+
+		private void HandleSend( IAsyncResult result ) {
+			if( result.CompletedSynchronously )
+				return;
+
+			try {
+				_stream.EndWrite( result );
+			}
+			catch( Exception ex ) {
+				HandleSendError( ex );
+				return;
+			}
+
+			PumpSend();
+		}
+
+		private void HandleSendError( Exception ex ) {
+			if( !(ex is IOException || ex is ObjectDisposedException) )
+				_ts.TraceEvent( TraceEventType.Error, 0, "Unexpected error sending to stream {0}: {1}", _streamId, ex );
+
+			lock( _sendLock ) {
+				_sending = false;
+			}
+
+			CloseNow();
+		}
+
+		/// <summary>
+		/// Takes the next buffer to send off the queue, joining small buffers together.
+		/// </summary>
+		/// <remarks>Call this with <see cref="_sendLock"/> held and at least one buffer queued.</remarks>
+		private byte[] TakeSendBuffer() {
+			byte[] first = _sendQueue.Dequeue();
+
+			if( _sendQueue.Count == 0 || first.Length >= __maxCoalescedSend )
+				return first;
+
+			int length = first.Length;
+
+			foreach( byte[] next in _sendQueue ) {
+				if( length + next.Length > __maxCoalescedSend )
+					break;
+
+				length += next.Length;
+			}
+
+			if( length == first.Length )
+				return first;
+
+			byte[] result = new byte[length];
+			Buffer.BlockCopy( first, 0, result, 0, first.Length );
+
+			for( int offset = first.Length; offset < length; ) {
+				byte[] next = _sendQueue.Dequeue();
+				Buffer.BlockCopy( next, 0, result, offset, next.Length );
+				offset += next.Length;
+			}
+
+			return result;
+		}
+
+		/// <summary>
+		/// Closes the connection once the send queue is empty.
+		/// </summary>
+		private void CloseAfterSend() {
+			lock( _sendLock ) {
+				if( _closing || _closed )
+					return;
+
+				_closing = true;
+
+				// The running pump closes the connection when it empties the queue
+				if( _sending )
+					return;
+			}
+
+			CloseNow();
+		}
+	#endregion
+
+		/// <summary>
+		/// Closes the connection without waiting for anything still queued.
+		/// </summary>
+		private void CloseNow() {
+			lock( _sendLock ) {
+				if( _closed )
+					return;
+
+				_closed = true;
+
+				if( _sendQueue != null )
+					_sendQueue.Clear();
+			}
+
+			if( _streamId != null )
+				_server.ReleaseStreamId( _streamId );
+
+			try {
+				_stream.Close();
+			}
+			catch( IOException ) {
+			}
 		}
 
 		/// <summary>
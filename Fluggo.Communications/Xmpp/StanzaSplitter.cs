@@ -0,0 +1,937 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Collections.Generic;
+using System.Text;
+using System.Xml;
+
+namespace Fluggo.Communications.Xmpp {
+	/// <summary>
+	/// Identifies the kind of item read by an <see cref="XmppStanzaSplitter"/>.
+	/// </summary>
+	public enum XmppStanzaKind {
+		/// <summary>
+		/// No item has been read.
+		/// </summary>
+		None,
+
+		/// <summary>
+		/// The start tag of the stream's root element.
+		/// </summary>
+		StreamStart,
+
+		/// <summary>
+		/// A complete child of the stream's root element, such as a message, presence or iq stanza.
+		/// </summary>
+		Stanza,
+
+		/// <summary>
+		/// The end tag of the stream's root element.
+		/// </summary>
+		StreamEnd
+	}
+
+	/// <summary>
+	/// Splits a UTF-8 XMPP stream into its top-level stanzas without building a node-by-node view of them.
+	/// </summary>
+	/// <remarks>Push each block of bytes as it arrives with <see cref="Push"/>, then call <see cref="Read"/> until it returns
+	///     false. Each successful read produces the stream header, one complete stanza or the end of the stream. It gives the raw
+	///     bytes of the item along with its name and its to, from, id and type attributes, so a router can forward the
+	///     stanza exactly as it arrived.
+	///   <para>When an item lies entirely within the last pushed block, <see cref="Data"/> is a slice of that block and nothing
+	///     is copied. An item that spans blocks is gathered into an internal buffer, which is reused after the next read. Copy
+	///     the data if you need it for longer.</para>
+	///   <para>The splitter works on bytes directly. This is safe because the bytes of markup in UTF-8 never appear inside a
+	///     multibyte character. It checks enough to find stanza boundaries reliably: tags nest and their names match, attribute
+	///     values are quoted, and the comments, processing instructions and document type declarations that XMPP forbids are
+	///     rejected. It does not check that names and text are made of legal characters. Pass the <see cref="Data"/> of a stanza
+	///     to an <see cref="Fluggo.Xml.XmlAsyncPushTextReader"/> when it must be fully checked or read.</para>
+	///   <para>Errors are reported as an <see cref="XmlException"/>, after which the splitter can't be used again.
+	///     The splitter is not thread-safe.</para></remarks>
+	public sealed class XmppStanzaSplitter {
+		enum Mode {
+			Content,
+			TagOpen,
+			StartTagName,
+			InTag,
+			EmptyTagClose,
+			AttributeName,
+			AttributePreEquals,
+			AttributePostEquals,
+			AttributeValue,
+			EndTagName,
+			EndTagWhitespace,
+			Bang,
+			CData,
+			CDataBrackets,
+			ProcessingInstruction,
+			ProcessingInstructionQuestion,
+			Done
+		}
+
+		enum RoutingAttribute {
+			None,
+			To,
+			From,
+			Id,
+			Type
+		}
+
+		const byte __whitespace = 1, __nameStop = 2;
+		static readonly byte[] __byteClass = CreateByteClassTable();
+		const string __cdataOpen = "[CDATA[";
+
+		XmlNameTable _nameTable;
+		int _maxStanzaLength = 65536;
+		XmlException _error;
+
+		// Current block
+		byte[] _buffer;
+		int _position, _end;
+
+		Mode _mode = Mode.Content;
+		int _depth, _matchCount;
+		byte _quote;
+		bool _rootSeen, _endPending, _collect;
+		RoutingAttribute _attribute;
+		string _rootName;
+
+		// Item being scanned; the start is the offset of its '<' in the current block. If the item began in an earlier
+		// block, its first part is in _pending and the start is moved to the beginning of each new block.
+		int _itemStart = -1;
+		byte[] _pending = new byte[1024];
+		int _pendingLength;
+		bool _pendingPublished;
+		string _nextName, _nextTo, _nextFrom, _nextId, _nextType;
+
+		// Name or attribute value being scanned, kept the same way as the item
+		int _captureStart = -1;
+		byte[] _capture = new byte[64];
+		int _captureLength;
+		char[] _nameChars = new char[64];
+
+		// Names of the open elements, for matching end tags
+		byte[] _names = new byte[256];
+		int[] _nameStarts = new int[16];
+		int _nameCount, _namesLength;
+
+		// Last item read
+		XmppStanzaKind _kind;
+		string _name, _to, _from, _id, _type;
+		ArraySegment<byte> _data;
+
+	#region Byte classes
+		private static byte[] CreateByteClassTable() {
+			byte[] table = new byte[256];
+
+			table[' '] = table['\t'] = table['\r'] = table['\n'] = __whitespace | __nameStop;
+			table['/'] = table['>'] = table['='] = table['<'] = __nameStop;
+
+			return table;
+		}
+
+		private static bool IsWhitespace( byte value ) {
+			return (__byteClass[value] & __whitespace) != 0;
+		}
+	#endregion
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='XmppStanzaSplitter'/> class.
+		/// </summary>
+		public XmppStanzaSplitter() : this( new NameTable() ) {
+		}
+
+		/// <summary>
+		/// Creates a new instance of the <see cref='XmppStanzaSplitter'/> class.
+		/// </summary>
+		/// <param name="nameTable"><see cref="XmlNameTable"/> in which to atomize element names.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='nameTable'/> is <see langword='null'/>.</exception>
+		public XmppStanzaSplitter( XmlNameTable nameTable ) {
+			if( nameTable == null )
+				throw new ArgumentNullException( "nameTable" );
+
+			_nameTable = nameTable;
+		}
+
+	#region Properties
+		/// <summary>
+		/// Gets the name table used by the splitter.
+		/// </summary>
+		/// <value>The <see cref="XmlNameTable"/> in which element names are atomized.</value>
+		public XmlNameTable NameTable {
+			get { return _nameTable; }
+		}
+
+		/// <summary>
+		/// Gets or sets the largest stanza the splitter will accept.
+		/// </summary>
+		/// <value>The largest number of bytes allowed in one stanza or stream header. The default is 65536.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than one.</exception>
+		/// <remarks>A stanza that grows past this size causes an <see cref="XmlException"/>, which keeps a peer from making the
+		///   splitter buffer an unbounded amount of data.</remarks>
+		public int MaximumStanzaLength {
+			get { return _maxStanzaLength; }
+			set {
+				if( value < 1 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_maxStanzaLength = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets the kind of item last read.
+		/// </summary>
+		/// <value>The kind of item last read, or <see cref="XmppStanzaKind.None"/> if <see cref="Read"/> has not returned true yet.</value>
+		public XmppStanzaKind Kind {
+			get { return _kind; }
+		}
+
+		/// <summary>
+		/// Gets the qualified name of the element last read.
+		/// </summary>
+		/// <value>The qualified name of the element, such as "message" or "stream:features", atomized in <see cref="NameTable"/>.
+		///   For <see cref="XmppStanzaKind.StreamStart"/> and <see cref="XmppStanzaKind.StreamEnd"/>, this is the name of the root element.</value>
+		public string Name {
+			get { return _name; }
+		}
+
+		/// <summary>
+		/// Gets the value of the "to" attribute of the element last read.
+		/// </summary>
+		/// <value>The value of the attribute with references expanded, or <see langword='null'/> if the element doesn't have one.</value>
+		public string To {
+			get { return _to; }
+		}
+
+		/// <summary>
+		/// Gets the value of the "from" attribute of the element last read.
+		/// </summary>
+		/// <value>The value of the attribute with references expanded, or <see langword='null'/> if the element doesn't have one.</value>
+		public string From {
+			get { return _from; }
+		}
+
+		/// <summary>
+		/// Gets the value of the "id" attribute of the element last read.
+		/// </summary>
+		/// <value>The value of the attribute with references expanded, or <see langword='null'/> if the element doesn't have one.</value>
+		public string Id {
+			get { return _id; }
+		}
+
+		/// <summary>
+		/// Gets the value of the "type" attribute of the element last read.
+		/// </summary>
+		/// <value>The value of the attribute with references expanded, or <see langword='null'/> if the element doesn't have one.</value>
+		public string Type {
+			get { return _type; }
+		}
+
+		/// <summary>
+		/// Gets the raw bytes of the item last read.
+		/// </summary>
+		/// <value>The bytes of the item exactly as they arrived, from its opening '&lt;' to its closing '&gt;'. For
+		///   <see cref="XmppStanzaKind.StreamStart"/>, this is only the root element's start tag.</value>
+		/// <remarks>The segment refers either to the last pushed block or to a buffer inside the splitter, and is only valid
+		///   until the next call to <see cref="Push"/> or <see cref="Read"/>.</remarks>
+		public ArraySegment<byte> Data {
+			get { return _data; }
+		}
+	#endregion
+
+		/// <summary>
+		/// Supplies the next block of the stream.
+		/// </summary>
+		/// <param name="buffer">Buffer containing the next bytes of the stream.</param>
+		/// <param name="offset">Offset in <paramref name="buffer"/> of the first byte of the block.</param>
+		/// <param name="count">Number of bytes in the block.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='buffer'/> is <see langword='null'/>.</exception>
+		/// <exception cref="ArgumentOutOfRangeException"><paramref name="offset"/> or <paramref name="count"/> is out of range.</exception>
+		/// <exception cref="InvalidOperationException"><see cref="Read"/> has not returned false for the last block yet.</exception>
+		/// <remarks>The splitter refers to the block until <see cref="Read"/> returns false, so don't change it before then.</remarks>
+		public void Push( byte[] buffer, int offset, int count ) {
+			if( buffer == null )
+				throw new ArgumentNullException( "buffer" );
+
+			if( offset < 0 || offset > buffer.Length )
+				throw new ArgumentOutOfRangeException( "offset" );
+
+			if( count < 0 || count > buffer.Length - offset )
+				throw new ArgumentOutOfRangeException( "count" );
+
+			if( _position != _end )
+				throw new InvalidOperationException( "The last block has not been read completely." );
+
+			_buffer = buffer;
+			_position = offset;
+			_end = offset + count;
+
+			// Anything left unfinished in the last block continues from the start of this one
+			if( _itemStart != -1 )
+				_itemStart = offset;
+
+			if( _captureStart != -1 )
+				_captureStart = offset;
+		}
+
+		/// <summary>
+		/// Reads the next item from the stream.
+		/// </summary>
+		/// <returns>True if an item was read, or false if more data must be pushed first.</returns>
+		/// <exception cref="XmlException">The stream is not well-formed enough to split, contains markup that XMPP forbids,
+		///   or contains a stanza larger than <see cref="MaximumStanzaLength"/>.</exception>
+		public bool Read() {
+			if( _error != null )
+				throw _error;
+
+			_kind = XmppStanzaKind.None;
+			_name = null;
+			_to = null;
+			_from = null;
+			_id = null;
+			_type = null;
+			_data = new ArraySegment<byte>();
+
+			if( _pendingPublished ) {
+				_pendingLength = 0;
+				_pendingPublished = false;
+			}
+
+			if( _endPending ) {
+				// The root element was empty, so the stream ends right after it starts
+				_endPending = false;
+				_kind = XmppStanzaKind.StreamEnd;
+				_name = _rootName;
+				_data = new ArraySegment<byte>( _pending, 0, 0 );
+				return true;
+			}
+
+			if( _position == _end )
+				return false;
+
+			try {
+				return Scan();
+			}
+			catch( XmlException ex ) {
+				_error = ex;
+				throw;
+			}
+		}
+
+		private bool Scan() {
+			byte[] buffer = _buffer;
+			int end = _end;
+			int i = _position;
+
+			byte[] array;
+			int offset, count;
+			byte b;
+
+			while( i < end ) {
+				switch( _mode ) {
+					case Mode.Content:
+						while( i < end && buffer[i] != (byte) '<' )
+							i++;
+
+						if( i == end )
+							continue;
+
+						// Only tags at the top two levels start an item; everything deeper is part of a stanza
+						if( _depth <= 1 )
+							_itemStart = i;
+
+						i++;
+						_mode = Mode.TagOpen;
+						continue;
+
+					case Mode.TagOpen:
+						b = buffer[i];
+
+						if( b == (byte) '/' ) {
+							i++;
+							_captureStart = i;
+							_mode = Mode.EndTagName;
+						}
+						else if( b == (byte) '!' ) {
+							i++;
+							_matchCount = 0;
+							_mode = Mode.Bang;
+						}
+						else if( b == (byte) '?' ) {
+							if( _rootSeen )
+								Throw( "Processing instructions are not allowed in an XMPP stream." );
+
+							i++;
+							_mode = Mode.ProcessingInstruction;
+						}
+						else {
+							_captureStart = i;
+							_mode = Mode.StartTagName;
+						}
+						continue;
+
+					case Mode.StartTagName:
+						while( i < end && (__byteClass[buffer[i]] & __nameStop) == 0 )
+							i++;
+
+						if( i == end )
+							continue;
+
+						EndCapture( i, out array, out offset, out count );
+
+						if( count == 0 )
+							Throw( "Expected an element name." );
+
+						PushName( array, offset, count );
+						_collect = _depth <= 1;
+
+						if( _collect ) {
+							_nextName = GetName( array, offset, count );
+							_nextTo = _nextFrom = _nextId = _nextType = null;
+						}
+
+						_mode = Mode.InTag;
+						continue;
+
+					case Mode.InTag:
+						b = buffer[i];
+
+						if( IsWhitespace( b ) ) {
+							i++;
+						}
+						else if( b == (byte) '>' ) {
+							i++;
+							_mode = Mode.Content;
+
+							if( _depth++ == 0 ) {
+								// The stream header
+								_rootSeen = true;
+								_rootName = _nextName;
+								CompleteItem( XmppStanzaKind.StreamStart, i );
+								return true;
+							}
+						}
+						else if( b == (byte) '/' ) {
+							i++;
+							_mode = Mode.EmptyTagClose;
+						}
+						else if( (__byteClass[b] & __nameStop) != 0 ) {
+							Throw( "Expected an attribute name or the end of the tag." );
+						}
+						else {
+							_captureStart = i;
+							_mode = Mode.AttributeName;
+						}
+						continue;
+
+					case Mode.EmptyTagClose:
+						if( buffer[i] != (byte) '>' )
+							Throw( "Expected '>' after '/' in a tag." );
+
+						i++;
+						PopName();
+						_mode = Mode.Content;
+
+						if( _depth == 1 ) {
+							CompleteItem( XmppStanzaKind.Stanza, i );
+							return true;
+						}
+
+						if( _depth == 0 ) {
+							_rootSeen = true;
+							_rootName = _nextName;
+							_endPending = true;
+							_mode = Mode.Done;
+							CompleteItem( XmppStanzaKind.StreamStart, i );
+							return true;
+						}
+						continue;
+
+					case Mode.AttributeName:
+						while( i < end && (__byteClass[buffer[i]] & __nameStop) == 0 )
+							i++;
+
+						if( i == end )
+							continue;
+
+						b = buffer[i];
+
+						if( b != (byte) '=' && !IsWhitespace( b ) )
+							Throw( "Expected '=' after an attribute name." );
+
+						EndCapture( i, out array, out offset, out count );
+						_attribute = _collect ? ClassifyAttribute( array, offset, count ) : RoutingAttribute.None;
+						_mode = Mode.AttributePreEquals;
+						continue;
+
+					case Mode.AttributePreEquals:
+						b = buffer[i];
+
+						if( IsWhitespace( b ) ) {
+							i++;
+							continue;
+						}
+
+						if( b != (byte) '=' )
+							Throw( "Expected '=' after an attribute name." );
+
+						i++;
+						_mode = Mode.AttributePostEquals;
+						continue;
+
+					case Mode.AttributePostEquals:
+						b = buffer[i];
+
+						if( IsWhitespace( b ) ) {
+							i++;
+							continue;
+						}
+
+						if( b != (byte) '"' && b != (byte) '\'' )
+							Throw( "Expected a quoted attribute value." );
+
+						i++;
+						_quote = b;
+
+						if( _attribute != RoutingAttribute.None )
+							_captureStart = i;
+
+						_mode = Mode.AttributeValue;
+						continue;
+
+					case Mode.AttributeValue: {
+						byte quote = _quote;
+
+						while( i < end && buffer[i] != quote ) {
+							if( buffer[i] == (byte) '<' )
+								Throw( "The character '<' is not allowed in an attribute value." );
+
+							i++;
+						}
+
+						if( i == end )
+							continue;
+
+						if( _attribute != RoutingAttribute.None ) {
+							EndCapture( i, out array, out offset, out count );
+							string value = DecodeAttributeValue( array, offset, count );
+
+							switch( _attribute ) {
+								case RoutingAttribute.To:
+									_nextTo = value;
+									break;
+
+								case RoutingAttribute.From:
+									_nextFrom = value;
+									break;
+
+								case RoutingAttribute.Id:
+									_nextId = value;
+									break;
+
+								case RoutingAttribute.Type:
+									_nextType = value;
+									break;
+							}
+						}
+
+						i++;
+						_mode = Mode.InTag;
+						continue;
+					}
+
+					case Mode.EndTagName:
+						while( i < end && (__byteClass[buffer[i]] & __nameStop) == 0 )
+							i++;
+
+						if( i == end )
+							continue;
+
+						EndCapture( i, out array, out offset, out count );
+
+						if( _nameCount == 0 || !TopNameEquals( array, offset, count ) )
+							Throw( "The name of an end tag did not match the name of its start tag." );
+
+						PopName();
+						_mode = Mode.EndTagWhitespace;
+						continue;
+
+					case Mode.EndTagWhitespace:
+						b = buffer[i];
+
+						if( IsWhitespace( b ) ) {
+							i++;
+							continue;
+						}
+
+						if( b != (byte) '>' )
+							Throw( "Expected '>' at the end of an end tag." );
+
+						i++;
+						_mode = Mode.Content;
+
+						switch( --_depth ) {
+							case 1:
+								CompleteItem( XmppStanzaKind.Stanza, i );
+								return true;
+
+							case 0:
+								_mode = Mode.Done;
+								_nextName = _rootName;
+								CompleteItem( XmppStanzaKind.StreamEnd, i );
+								return true;
+						}
+						continue;
+
+					case Mode.Bang:
+						b = buffer[i];
+
+						if( _matchCount == 0 && b == (byte) '-' )
+							Throw( "Comments are not allowed in an XMPP stream." );
+
+						if( _depth == 0 || b != (byte) __cdataOpen[_matchCount] )
+							Throw( "Document type declarations are not allowed in an XMPP stream, and only CDATA sections may start with \"<!\"." );
+
+						i++;
+
+						if( ++_matchCount == __cdataOpen.Length )
+							_mode = Mode.CData;
+						continue;
+
+					case Mode.CData:
+						while( i < end && buffer[i] != (byte) ']' )
+							i++;
+
+						if( i == end )
+							continue;
+
+						i++;
+						_matchCount = 1;
+						_mode = Mode.CDataBrackets;
+						continue;
+
+					case Mode.CDataBrackets:
+						b = buffer[i];
+
+						if( b == (byte) ']' ) {
+							i++;
+							_matchCount++;
+						}
+						else if( b == (byte) '>' && _matchCount >= 2 ) {
+							i++;
+							_mode = Mode.Content;
+
+							// A CDATA section directly inside the root is not a stanza; drop any of it held over from
+							// earlier blocks so it isn't put in front of the next item
+							if( _depth == 1 ) {
+								_itemStart = -1;
+								_pendingLength = 0;
+							}
+						}
+						else {
+							_mode = Mode.CData;
+						}
+						continue;
+
+					case Mode.ProcessingInstruction:
+						while( i < end && buffer[i] != (byte) '?' )
+							i++;
+
+						if( i == end )
+							continue;
+
+						i++;
+						_mode = Mode.ProcessingInstructionQuestion;
+						continue;
+
+					case Mode.ProcessingInstructionQuestion:
+						b = buffer[i];
+
+						if( b == (byte) '>' ) {
+							// The XML declaration; not an item
+							i++;
+							_itemStart = -1;
+							_pendingLength = 0;
+							_mode = Mode.Content;
+						}
+						else if( b == (byte) '?' ) {
+							i++;
+						}
+						else {
+							_mode = Mode.ProcessingInstruction;
+						}
+						continue;
+
+					case Mode.Done:
+						if( !IsWhitespace( buffer[i] ) )
+							Throw( "Data was found after the end of the stream." );
+
+						i++;
+						continue;
+
+					default:
+						throw new UnexpectedException();
+				}
+			}
+
+			// Keep whatever is unfinished until the next block arrives
+			if( _itemStart != -1 ) {
+				AppendPending( buffer, _itemStart, end - _itemStart );
+				_itemStart = 0;
+			}
+
+			if( _captureStart != -1 ) {
+				AppendCapture( buffer, _captureStart, end - _captureStart );
+				_captureStart = 0;
+			}
+
+			_position = end;
+			return false;
+		}
+
+	#region Helpers
+		/// <summary>
+		/// Publishes the item that ends just before the given position in the current block.
+		/// </summary>
+		private void CompleteItem( XmppStanzaKind kind, int position ) {
+			int length = position - _itemStart;
+
+			if( _pendingLength == 0 ) {
+				if( length > _maxStanzaLength )
+					ThrowTooLarge();
+
+				_data = new ArraySegment<byte>( _buffer, _itemStart, length );
+			}
+			else {
+				AppendPending( _buffer, _itemStart, length );
+				_data = new ArraySegment<byte>( _pending, 0, _pendingLength );
+				_pendingPublished = true;
+			}
+
+			_kind = kind;
+			_name = _nextName;
+			_to = _nextTo;
+			_from = _nextFrom;
+			_id = _nextId;
+			_type = _nextType;
+
+			_nextName = _nextTo = _nextFrom = _nextId = _nextType = null;
+			_itemStart = -1;
+			_position = position;
+		}
+
+		private void AppendPending( byte[] buffer, int offset, int count ) {
+			if( _pendingLength + count > _maxStanzaLength )
+				ThrowTooLarge();
+
+			if( _pendingLength + count > _pending.Length ) {
+				byte[] newPending = new byte[Math.Max( _pending.Length * 2, _pendingLength + count )];
+				Buffer.BlockCopy( _pending, 0, newPending, 0, _pendingLength );
+				_pending = newPending;
+			}
+
+			Buffer.BlockCopy( buffer, offset, _pending, _pendingLength, count );
+			_pendingLength += count;
+		}
+
+		private void AppendCapture( byte[] buffer, int offset, int count ) {
+			if( _captureLength + count > _capture.Length ) {
+				byte[] newCapture = new byte[Math.Max( _capture.Length * 2, _captureLength + count )];
+				Buffer.BlockCopy( _capture, 0, newCapture, 0, _captureLength );
+				_capture = newCapture;
+			}
+
+			Buffer.BlockCopy( buffer, offset, _capture, _captureLength, count );
+			_captureLength += count;
+		}
+
+		/// <summary>
+		/// Finishes the name or value being captured, which ends just before the given position in the current block.
+		/// </summary>
+		/// <remarks>The result refers to the current block when the capture lies entirely within it, and is only valid until
+		///   the next capture begins.</remarks>
+		private void EndCapture( int position, out byte[] array, out int offset, out int count ) {
+			if( _captureLength == 0 ) {
+				array = _buffer;
+				offset = _captureStart;
+				count = position - _captureStart;
+			}
+			else {
+				AppendCapture( _buffer, _captureStart, position - _captureStart );
+				array = _capture;
+				offset = 0;
+				count = _captureLength;
+				_captureLength = 0;
+			}
+
+			_captureStart = -1;
+		}
+
+		private void PushName( byte[] array, int offset, int count ) {
+			if( _nameCount == _nameStarts.Length )
+				Array.Resize( ref _nameStarts, _nameCount * 2 );
+
+			if( _namesLength + count > _names.Length )
+				Array.Resize( ref _names, Math.Max( _names.Length * 2, _namesLength + count ) );
+
+			Buffer.BlockCopy( array, offset, _names, _namesLength, count );
+			_nameStarts[_nameCount++] = _namesLength;
+			_namesLength += count;
+		}
+
+		private void PopName() {
+			_namesLength = _nameStarts[--_nameCount];
+		}
+
+		private bool TopNameEquals( byte[] array, int offset, int count ) {
+			int start = _nameStarts[_nameCount - 1];
+
+			if( _namesLength - start != count )
+				return false;
+
+			for( int i = 0; i < count; i++ ) {
+				if( _names[start + i] != array[offset + i] )
+					return false;
+			}
+
+			return true;
+		}
+
+		private string GetName( byte[] array, int offset, int count ) {
+			if( _nameChars.Length < count )
+				_nameChars = new char[count];
+
+			int length = Encoding.UTF8.GetChars( array, offset, count, _nameChars, 0 );
+			return _nameTable.Add( _nameChars, 0, length );
+		}
+
+		private static RoutingAttribute ClassifyAttribute( byte[] array, int offset, int count ) {
+			switch( count ) {
+				case 2:
+					if( array[offset] == (byte) 't' && array[offset + 1] == (byte) 'o' )
+						return RoutingAttribute.To;
+
+					if( array[offset] == (byte) 'i' && array[offset + 1] == (byte) 'd' )
+						return RoutingAttribute.Id;
+
+					break;
+
+				case 4:
+					if( BytesEqual( array, offset, "from" ) )
+						return RoutingAttribute.From;
+
+					if( BytesEqual( array, offset, "type" ) )
+						return RoutingAttribute.Type;
+
+					break;
+			}
+
+			return RoutingAttribute.None;
+		}
+
+		private static bool BytesEqual( byte[] array, int offset, string value ) {
+			for( int i = 0; i < value.Length; i++ ) {
+				if( array[offset + i] != (byte) value[i] )
+					return false;
+			}
+
+			return true;
+		}
+
+		/// <summary>
+		/// Decodes an attribute value, expanding the predefined entity references and character references.
+		/// </summary>
+		private static string DecodeAttributeValue( byte[] array, int offset, int count ) {
+			string value = Encoding.UTF8.GetString( array, offset, count );
+			int amp = value.IndexOf( '&' );
+
+			if( amp == -1 )
+				return value;
+
+			StringBuilder builder = new StringBuilder( value.Length );
+			int start = 0;
+
+			while( amp != -1 ) {
+				builder.Append( value, start, amp - start );
+
+				int semicolon = value.IndexOf( ';', amp + 1 );
+
+				if( semicolon == -1 )
+					Throw( "A reference in an attribute value was not terminated." );
+
+				string name = value.Substring( amp + 1, semicolon - amp - 1 );
+
+				switch( name ) {
+					case "lt":
+						builder.Append( '<' );
+						break;
+
+					case "gt":
+						builder.Append( '>' );
+						break;
+
+					case "amp":
+						builder.Append( '&' );
+						break;
+
+					case "apos":
+						builder.Append( '\'' );
+						break;
+
+					case "quot":
+						builder.Append( '"' );
+						break;
+
+					default:
+						int codePoint;
+
+						if( name.Length < 2 || name[0] != '#' )
+							Throw( "Only the predefined entities may be referenced in an XMPP stream." );
+
+						bool parsed = (name[1] == 'x') ?
+							int.TryParse( name.Substring( 2 ), System.Globalization.NumberStyles.AllowHexSpecifier, null, out codePoint ) :
+							int.TryParse( name.Substring( 1 ), System.Globalization.NumberStyles.None, null, out codePoint );
+
+						if( !parsed || codePoint < 0 || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF) )
+							Throw( "An attribute value contained an invalid character reference." );
+
+						builder.Append( char.ConvertFromUtf32( codePoint ) );
+						break;
+				}
+
+				start = semicolon + 1;
+				amp = value.IndexOf( '&', start );
+			}
+
+			builder.Append( value, start, value.Length - start );
+			return builder.ToString();
+		}
+
+		private void ThrowTooLarge() {
+			Throw( "A stanza was larger than the maximum of " + _maxStanzaLength.ToString( System.Globalization.CultureInfo.InvariantCulture ) + " bytes." );
+		}
+
+		private static void Throw( string message ) {
+			throw new XmlException( message, null );
+		}
+	#endregion
+	}
+}
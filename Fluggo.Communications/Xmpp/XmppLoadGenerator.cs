@@ -0,0 +1,571 @@
+/*
+	Fluggo Communications Library
+	Copyright (C) 2005-6  Brian J. Crowell
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Globalization;
+using System.IO;
+using System.Text;
+using System.Threading;
+
+namespace Fluggo.Communications.Xmpp {
+	/// <summary>
+	/// Opens many loopback connections to an asynchronous <see cref="XmppServer"/> and measures how it holds up.
+	/// </summary>
+	/// <remarks>The generator starts a server in asynchronous mode that echoes every stanza back to its sender, and connects
+	///     <see cref="IdleConnections"/> plus <see cref="ActiveConnections"/> clients to it over
+	///     <see cref="Pipe.CreateLoopback">loopback pipes</see>. Every client opens its stream; the idle ones then say
+	///     nothing more, while each active one sends <see cref="MessagesPerConnection"/> messages, one at a time, waiting
+	///     for each echo before sending the next.
+	///   <para>Neither the server nor the pipes keep a thread per connection, so the idle connections cost only memory. A
+	///     run shows whether they slow down the active ones, and how long the server takes to open all of the streams.</para>
+	///   <para>Each message carries the <see cref="Stopwatch"/> timestamp at which it was sent in its id attribute, and the
+	///     client records the round trip when the echo arrives.</para></remarks>
+	public sealed class XmppLoadGenerator {
+		const int __timestampDigits = 20;
+
+		string _hostName = "localhost";
+		int _idleConnections = 10000, _activeConnections = 1000, _messagesPerConnection = 100, _payloadLength = 64,
+			_bufferSize = 4096;
+		TimeSpan _duration = TimeSpan.MaxValue, _timeout = TimeSpan.FromSeconds( 60.0 );
+
+	#region Settings
+		/// <summary>
+		/// Gets or sets the number of connections that open their streams and then stay quiet.
+		/// </summary>
+		/// <value>The number of idle connections. The default is 10000.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is negative.</exception>
+		public int IdleConnections {
+			get { return _idleConnections; }
+			set {
+				if( value < 0 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_idleConnections = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the number of connections that send messages.
+		/// </summary>
+		/// <value>The number of active connections. The default is 1000.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is negative.</exception>
+		public int ActiveConnections {
+			get { return _activeConnections; }
+			set {
+				if( value < 0 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_activeConnections = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the number of messages each active connection sends.
+		/// </summary>
+		/// <value>The number of messages each active connection sends. The default is 100.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than one.</exception>
+		public int MessagesPerConnection {
+			get { return _messagesPerConnection; }
+			set {
+				if( value < 1 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_messagesPerConnection = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the length of each message body.
+		/// </summary>
+		/// <value>The number of characters in the body of each message. The default is 64.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is negative.</exception>
+		public int PayloadLength {
+			get { return _payloadLength; }
+			set {
+				if( value < 0 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_payloadLength = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the size of each loopback pipe.
+		/// </summary>
+		/// <value>The number of bytes each direction of a connection can hold. The default is 4096.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is less than 512.</exception>
+		/// <remarks>The pipes are allocated for every connection, idle or not, so this sets most of the memory a run uses.</remarks>
+		public int BufferSize {
+			get { return _bufferSize; }
+			set {
+				if( value < 512 )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_bufferSize = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets the longest time to send messages for.
+		/// </summary>
+		/// <value>The time after which active connections stop sending, even if they haven't sent
+		///   <see cref="MessagesPerConnection"/> messages. The default is <see cref="TimeSpan.MaxValue"/>, which runs until
+		///   every message has been sent.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is not positive.</exception>
+		public TimeSpan Duration {
+			get { return _duration; }
+			set {
+				if( value <= TimeSpan.Zero )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_duration = value;
+			}
+		}
+
+		/// <summary>
+		/// Gets or sets how long to wait for the server.
+		/// </summary>
+		/// <value>The longest time to wait for all of the streams to open, and again for the last echoes to arrive once sending
+		///   stops. The default is 60 seconds.</value>
+		/// <exception cref="ArgumentOutOfRangeException">The value is negative.</exception>
+		public TimeSpan Timeout {
+			get { return _timeout; }
+			set {
+				if( value < TimeSpan.Zero )
+					throw new ArgumentOutOfRangeException( "value" );
+
+				_timeout = value;
+			}
+		}
+	#endregion
+
+	#region Run
+		/// <summary>
+		/// Holds everything the active clients share during a run.
+		/// </summary>
+		sealed class RunState {
+			public long Deadline;
+			public long Messages, Errors;
+			public int ClientsLeft;
+			public LatencyHistogram Latency = new LatencyHistogram();
+			public ManualResetEvent Done = new ManualResetEvent( false );
+		}
+
+		/// <summary>
+		/// Client end of one active connection.
+		/// </summary>
+		sealed class ActiveClient {
+			public RunState State;
+			public Stream Stream;
+			public XmppStanzaSplitter Splitter = new XmppStanzaSplitter();
+			public byte[] ReceiveBuffer = new byte[1024], Message;
+			public int TimestampOffset, MessagesLeft;
+			public bool Finished;
+		}
+
+		/// <summary>
+		/// Makes one run with the current settings.
+		/// </summary>
+		/// <returns>An <see cref="XmppLoadResult"/> describing the run.</returns>
+		/// <remarks>New connections are created for each run and closed when the run ends. A connection that fails is
+		///   counted in <see cref="XmppLoadResult.Errors"/> and doesn't stop the run.</remarks>
+		public XmppLoadResult Run() {
+			XmppServer server = new XmppServer( _hostName, true );
+			server.StanzaReceived += HandleStanza;
+
+			int total = _idleConnections + _activeConnections;
+			Stream[] clients = new Stream[total];
+			byte[] header = Encoding.UTF8.GetBytes( string.Format( CultureInfo.InvariantCulture,
+				"<stream:stream xmlns='{0}' xmlns:stream='{1}' to='{2}' version='1.0'>",
+				Xmpp.Jabber.ClientNamespace, Xmpp.Streams.Namespace, _hostName ) );
+
+			RunState state = new RunState();
+
+			try {
+				// Open every stream, then wait for the server to catch up
+				long setupStart = Stopwatch.GetTimestamp();
+
+				for( int i = 0; i < total; i++ ) {
+					Stream serverStream;
+					Pipe.CreateLoopback( _bufferSize, out clients[i], out serverStream );
+					server.AcceptConnection( serverStream );
+					clients[i].Write( header, 0, header.Length );
+				}
+
+				long setupDeadline = Stopwatch.GetTimestamp() + ToTimestamp( _timeout );
+
+				while( server.ConnectionCount < total && Stopwatch.GetTimestamp() < setupDeadline )
+					Thread.Sleep( 1 );
+
+				int opened = server.ConnectionCount;
+				TimeSpan setupTime = ToTimeSpan( Stopwatch.GetTimestamp() - setupStart );
+
+				// Start the active clients; the idle ones are left alone from here on
+				long start = Stopwatch.GetTimestamp();
+				state.Deadline = (_duration == TimeSpan.MaxValue) ? long.MaxValue : start + ToTimestamp( _duration );
+				state.ClientsLeft = _activeConnections;
+
+				if( _activeConnections == 0 )
+					state.Done.Set();
+
+				for( int i = _idleConnections; i < total; i++ ) {
+					ActiveClient client = new ActiveClient();
+					client.State = state;
+					client.Stream = clients[i];
+					client.MessagesLeft = _messagesPerConnection;
+					client.Message = CreateMessage( i, out client.TimestampOffset );
+
+					BeginReceive( client );
+					SendNext( client );
+				}
+
+				long drain = (_duration == TimeSpan.MaxValue) ? _timeout.Ticks : _duration.Ticks + _timeout.Ticks;
+				state.Done.WaitOne( TimeSpan.FromTicks( Math.Min( drain, int.MaxValue * TimeSpan.TicksPerMillisecond ) ), false );
+
+				TimeSpan elapsed = ToTimeSpan( Stopwatch.GetTimestamp() - start );
+
+				return new XmppLoadResult( total, opened, setupTime, elapsed, Interlocked.Read( ref state.Messages ),
+					Interlocked.Read( ref state.Errors ), state.Latency.CreateSnapshot() );
+			}
+			finally {
+				for( int i = 0; i < clients.Length; i++ ) {
+					if( clients[i] != null )
+						clients[i].Close();
+				}
+
+				state.Done.Close();
+			}
+		}
+
+		private static void HandleStanza( object sender, XmppStanzaEventArgs e ) {
+			ArraySegment<byte> data = e.Data;
+			e.Connection.Send( data.Array, data.Offset, data.Count );
+		}
+
+		/// <summary>
+		/// Builds the message an active client sends, with room for the timestamp in its id.
+		/// </summary>
+		private byte[] CreateMessage( int index, out int timestampOffset ) {
+			string prefix = string.Format( CultureInfo.InvariantCulture, "<message to='client{0}@{1}' id='", index, _hostName );
+			string message = prefix + new string( '0', __timestampDigits ) + "' type='chat'><body>" +
+				new string( 'x', _payloadLength ) + "</body></message>";
+
+			timestampOffset = prefix.Length;
+			return Encoding.UTF8.GetBytes( message );
+		}
+
+		private static void SendNext( ActiveClient client ) {
+			long now = Stopwatch.GetTimestamp();
+
+			if( client.MessagesLeft == 0 || now >= client.State.Deadline ) {
+				Finish( client );
+				return;
+			}
+
+			client.MessagesLeft--;
+
+			// Write the timestamp into the id, right-aligned and zero-padded
+			for( int i = client.TimestampOffset + __timestampDigits - 1; i >= client.TimestampOffset; i-- ) {
+				client.Message[i] = (byte)('0' + (int)(now % 10L));
+				now /= 10L;
+			}
+
+			client.Stream.Write( client.Message, 0, client.Message.Length );
+		}
+
+		private static void Finish( ActiveClient client ) {
+			if( client.Finished )
+				return;
+
+			client.Finished = true;
+
+			if( Interlocked.Decrement( ref client.State.ClientsLeft ) == 0 )
+				client.State.Done.Set();
+		}
+
+		private static void BeginReceive( ActiveClient client ) {
+			for( ;; ) {
+				try {
+					IAsyncResult result = client.Stream.BeginRead( client.ReceiveBuffer, 0, client.ReceiveBuffer.Length, HandleReceive, client );
+
+					if( !result.CompletedSynchronously )
+						return;
+
+					if( !EndReceive( client, result ) )
+						return;
+				}
+				catch( Exception ex ) {
+					Fail( client, ex );
+					return;
+				}
+			}
+		}
+
+		private static void HandleReceive( IAsyncResult result ) {
+			if( result.CompletedSynchronously )
+				return;
+
+			ActiveClient client = (ActiveClient) result.AsyncState;
+
+			try {
+				if( !EndReceive( client, result ) )
+					return;
+			}
+			catch( Exception ex ) {
+				Fail( client, ex );
+				return;
+			}
+
+			BeginReceive( client );
+		}
+
+		/// <summary>
+		/// Handles a read on an active client.
+		/// </summary>
+		/// <returns>True if the client should keep reading, or false if it's done.</returns>
+		private static bool EndReceive( ActiveClient client, IAsyncResult result ) {
+			int count = client.Stream.EndRead( result );
+
+			if( count == 0 ) {
+				if( !client.Finished )
+					throw new EndOfStreamException( "The server closed the connection." );
+
+				return false;
+			}
+
+			client.Splitter.Push( client.ReceiveBuffer, 0, count );
+
+			while( client.Splitter.Read() ) {
+				if( client.Splitter.Kind == XmppStanzaKind.StreamEnd )
+					throw new EndOfStreamException( "The server closed its stream." );
+
+				// Skip the stream header and features
+				if( client.Splitter.Kind != XmppStanzaKind.Stanza || client.Splitter.Name != Xmpp.Jabber.Tags.Message )
+					continue;
+
+				client.State.Latency.RecordSince( long.Parse( client.Splitter.Id, CultureInfo.InvariantCulture ) );
+				Interlocked.Increment( ref client.State.Messages );
+
+				SendNext( client );
+			}
+
+			return true;
+		}
+
+		private static void Fail( ActiveClient client, Exception ex ) {
+			if( client.Finished )
+				return;
+
+			Interlocked.Increment( ref client.State.Errors );
+			_ts.TraceEvent( TraceEventType.Warning, 0, "Load test connection failed: {0}", ex );
+			Finish( client );
+		}
+
+		private static long ToTimestamp( TimeSpan time ) {
+			return (long)(time.TotalSeconds * (double) Stopwatch.Frequency);
+		}
+
+		private static TimeSpan ToTimeSpan( long timestampDelta ) {
+			return TimeSpan.FromTicks( LatencyHistogram.TimestampToMicroseconds( timestampDelta ) * 10L );
+		}
+
+		static TraceSource _ts = new TraceSource( "XmppLoadGenerator", SourceLevels.Error );
+	#endregion
+
+	#region Splitter check
+		const string __splitterSample = "<?xml version='1.0'?>" +
+			"<stream:stream xmlns='jabber:client' xmlns:stream='http://etherx.jabber.org/streams' to='example.com' version='1.0'>" +
+			"<![CDATA[ ]]>" +
+			"<message to='juliet@example.com' from='romeo@example.net' id='m1' type='chat'><body>a &amp; b</body></message>" +
+			"<presence/>" +
+			"</stream:stream>";
+
+		/// <summary>
+		/// Checks that an <see cref="XmppStanzaSplitter"/> reads a sample stream the same way wherever it is split.
+		/// </summary>
+		/// <exception cref="InvalidOperationException">Splitting the sample at some offset changed the items read.</exception>
+		/// <remarks>The sample opens with an XML declaration and has a CDATA section directly inside the root, the two
+		///   kinds of markup the splitter skips rather than returning as items.</remarks>
+		public static void VerifySplitter() {
+			VerifySplitter( Encoding.UTF8.GetBytes( __splitterSample ) );
+		}
+
+		/// <summary>
+		/// Checks that an <see cref="XmppStanzaSplitter"/> reads a stream the same way wherever it is split.
+		/// </summary>
+		/// <param name="stream">The complete stream, from its header to its end tag.</param>
+		/// <exception cref='ArgumentNullException'><paramref name='stream'/> is <see langword='null'/>.</exception>
+		/// <exception cref="InvalidOperationException">Splitting <paramref name="stream"/> at some offset changed the
+		///   items read.</exception>
+		/// <exception cref="System.Xml.XmlException"><paramref name="stream"/> can't be split even in one block.</exception>
+		/// <remarks>The stream is first read in one block. It is then pushed in two blocks, split at every offset in turn,
+		///   and each time the kind, name, routing attributes and data of every item must match the first read.</remarks>
+		public static void VerifySplitter( byte[] stream ) {
+			if( stream == null )
+				throw new ArgumentNullException( "stream" );
+
+			List<string> expected = SplitAt( stream, stream.Length );
+
+			for( int split = 0; split < stream.Length; split++ ) {
+				List<string> actual = SplitAt( stream, split );
+
+				for( int i = 0; i < Math.Max( expected.Count, actual.Count ); i++ ) {
+					string expectedItem = (i < expected.Count) ? expected[i] : "(none)";
+					string actualItem = (i < actual.Count) ? actual[i] : "(none)";
+
+					if( expectedItem != actualItem )
+						throw new InvalidOperationException( string.Format( CultureInfo.InvariantCulture,
+							"Splitting the stream at byte {0} read item {1} as \"{2}\" instead of \"{3}\".",
+							split, i, actualItem, expectedItem ) );
+				}
+			}
+		}
+
+		/// <summary>
+		/// Reads a stream pushed in two blocks, and describes each item read.
+		/// </summary>
+		private static List<string> SplitAt( byte[] stream, int split ) {
+			XmppStanzaSplitter splitter = new XmppStanzaSplitter();
+			List<string> items = new List<string>();
+
+			splitter.Push( stream, 0, split );
+			ReadItems( splitter, items );
+			splitter.Push( stream, split, stream.Length - split );
+			ReadItems( splitter, items );
+
+			return items;
+		}
+
+		private static void ReadItems( XmppStanzaSplitter splitter, List<string> items ) {
+			while( splitter.Read() ) {
+				ArraySegment<byte> data = splitter.Data;
+
+				items.Add( string.Format( CultureInfo.InvariantCulture, "{0} {1} to={2} from={3} id={4} type={5} {6}",
+					splitter.Kind, splitter.Name, splitter.To, splitter.From, splitter.Id, splitter.Type,
+					Encoding.UTF8.GetString( data.Array, data.Offset, data.Count ) ) );
+			}
+		}
+	#endregion
+	}
+
+	/// <summary>
+	/// Describes one run of an <see cref="XmppLoadGenerator"/>.
+	/// </summary>
+	public sealed class XmppLoadResult {
+		int _connections, _connectionsOpened;
+		TimeSpan _setupTime, _elapsed;
+		long _messages, _errors;
+		LatencyHistogram _latency;
+
+		internal XmppLoadResult( int connections, int connectionsOpened, TimeSpan setupTime, TimeSpan elapsed, long messages,
+				long errors, LatencyHistogram latency ) {
+			_connections = connections;
+			_connectionsOpened = connectionsOpened;
+			_setupTime = setupTime;
+			_elapsed = elapsed;
+			_messages = messages;
+			_errors = errors;
+			_latency = latency;
+		}
+
+		/// <summary>
+		/// Gets the number of connections the run made.
+		/// </summary>
+		/// <value>The number of idle and active connections together.</value>
+		public int Connections {
+			get { return _connections; }
+		}
+
+		/// <summary>
+		/// Gets the number of connections whose streams the server opened.
+		/// </summary>
+		/// <value>The number of connections the server had assigned a stream ID when setup ended.</value>
+		public int ConnectionsOpened {
+			get { return _connectionsOpened; }
+		}
+
+		/// <summary>
+		/// Gets the time it took to open the connections.
+		/// </summary>
+		/// <value>The time from creating the first connection until the server had opened every stream, or until the
+		///   generator gave up waiting.</value>
+		public TimeSpan SetupTime {
+			get { return _setupTime; }
+		}
+
+		/// <summary>
+		/// Gets the length of the messaging part of the run.
+		/// </summary>
+		/// <value>The time from the first message to the last echo.</value>
+		public TimeSpan Elapsed {
+			get { return _elapsed; }
+		}
+
+		/// <summary>
+		/// Gets the number of messages that made the round trip.
+		/// </summary>
+		/// <value>The number of echoes the active connections received.</value>
+		public long Messages {
+			get { return _messages; }
+		}
+
+		/// <summary>
+		/// Gets the number of active connections that failed.
+		/// </summary>
+		/// <value>The number of active connections that were closed or threw an exception before they finished.</value>
+		public long Errors {
+			get { return _errors; }
+		}
+
+		/// <summary>
+		/// Gets the rate at which messages made the round trip.
+		/// </summary>
+		/// <value>The number of echoes received per second.</value>
+		public double MessagesPerSecond {
+			get { return (double) _messages / Math.Max( _elapsed.TotalSeconds, 1e-9 ); }
+		}
+
+		/// <summary>
+		/// Gets the round-trip times of the messages.
+		/// </summary>
+		/// <value>A <see cref="LatencyHistogram"/> of the time from sending each message to receiving its echo.</value>
+		public LatencyHistogram Latency {
+			get { return _latency; }
+		}
+
+		/// <summary>
+		/// Summarizes the run.
+		/// </summary>
+		/// <returns>A few lines giving the setup time, throughput and latency percentiles of the run.</returns>
+		public override string ToString() {
+			StringBuilder builder = new StringBuilder();
+
+			builder.AppendFormat( "{0} of {1} streams opened in {2:0.000} s\r\n",
+				_connectionsOpened, _connections, _setupTime.TotalSeconds );
+			builder.AppendFormat( "{0} messages, {1} errors in {2:0.000} s, {3:0.0} messages/s\r\n",
+				_messages, _errors, _elapsed.TotalSeconds, MessagesPerSecond );
+			builder.AppendFormat( "round trip us: p50 {0} p99 {1} p99.9 {2} max {3} mean {4:0.0}",
+				_latency.P50, _latency.P99, _latency.P999, _latency.Max, _latency.Mean );
+
+			return builder.ToString();
+		}
+	}
+}